@@ -0,0 +1,125 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         atomic.hpp
+ * Description  Atomic operations on integers
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_ATOMIC_HPP
+#define _UNREALIRCD_ATOMIC_HPP
+
+#include <platform.hpp>
+
+/**
+ * Minimal set of atomic operations on integers, for the few places
+ * where threads exchange data without a lock. All of them imply a full
+ * memory barrier.
+ */
+namespace UnrealAtomic
+{
+	/**
+	 * Add a value and return the previous one.
+	 *
+	 * @param ptr Pointer to the integer
+	 * @param value Value to add
+	 * @return Previous value
+	 */
+	inline uint32_t add(volatile uint32_t* ptr, uint32_t value)
+	{
+#if defined(COMPILER_MSVC)
+		return static_cast<uint32_t>(InterlockedExchangeAdd(
+			reinterpret_cast<volatile LONG*>(ptr),
+			static_cast<LONG>(value)));
+#else
+		return __sync_fetch_and_add(ptr, value);
+#endif
+	}
+
+	/**
+	 * Add a value to a 64 bit integer and return the previous one.
+	 *
+	 * @param ptr Pointer to the integer
+	 * @param value Value to add
+	 * @return Previous value
+	 */
+	inline uint64_t add64(volatile uint64_t* ptr, uint64_t value)
+	{
+#if defined(COMPILER_MSVC)
+		return static_cast<uint64_t>(InterlockedExchangeAdd64(
+			reinterpret_cast<volatile LONGLONG*>(ptr),
+			static_cast<LONGLONG>(value)));
+#else
+		return __sync_fetch_and_add(ptr, value);
+#endif
+	}
+
+	/**
+	 * Replace the value if it's equal to `expected'.
+	 *
+	 * @param ptr Pointer to the integer
+	 * @param expected Expected current value
+	 * @param desired New value
+	 * @return true if the value has been replaced
+	 */
+	inline bool cas(volatile uint32_t* ptr, uint32_t expected,
+		uint32_t desired)
+	{
+#if defined(COMPILER_MSVC)
+		return static_cast<uint32_t>(InterlockedCompareExchange(
+			reinterpret_cast<volatile LONG*>(ptr),
+			static_cast<LONG>(desired),
+			static_cast<LONG>(expected))) == expected;
+#else
+		return __sync_bool_compare_and_swap(ptr, expected, desired);
+#endif
+	}
+
+	/**
+	 * Read a value.
+	 *
+	 * @param ptr Pointer to the integer
+	 * @return Current value
+	 */
+	inline uint32_t load(volatile uint32_t* ptr)
+	{
+		return add(ptr, 0);
+	}
+
+	/**
+	 * Write a value.
+	 *
+	 * @param ptr Pointer to the integer
+	 * @param value New value
+	 */
+	inline void store(volatile uint32_t* ptr, uint32_t value)
+	{
+#if defined(COMPILER_MSVC)
+		InterlockedExchange(reinterpret_cast<volatile LONG*>(ptr),
+			static_cast<LONG>(value));
+#else
+		__sync_synchronize();
+		*ptr = value;
+		__sync_synchronize();
+#endif
+	}
+}
+
+#endif /* _UNREALIRCD_ATOMIC_HPP */
@@ -0,0 +1,169 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         banlist.hpp
+ * Description  Server bans (K-, G- and Z-lines)
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_BANLIST_HPP
+#define _UNREALIRCD_BANLIST_HPP
+
+#include <hashmap.hpp>
+#include <list.hpp>
+#include <radixtree.hpp>
+#include <string.hpp>
+#include <timer.hpp>
+
+#include <ctime>
+#include <map>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * Server-wide ban store.
+ *
+ * Z-lines ban IP addresses or CIDR blocks and are checked right after
+ * accepting a connection, through a radix tree. K-lines and G-lines ban
+ * user@host masks and are checked once DNS and ident lookups are done.
+ * Their masks are sorted by the shape of the host part: exact hosts and
+ * "*.domain" suffixes are found through hash lookups, CIDR hosts through a
+ * radix tree, and only the remaining masks are matched one by one.
+ *
+ * Temporary bans are removed by a timer once they expire. All bans are
+ * kept in Bans::File, which is written shortly after changes.
+ */
+class UnrealBanList
+{
+public:
+	/** ban types; the values are used in the ban file */
+	enum Type
+	{
+		/** user@host ban on this server */
+		KLine = 'K',
+
+		/** user@host ban on the whole network */
+		GLine = 'G',
+
+		/** IP address ban, checked before registration starts */
+		ZLine = 'Z'
+	};
+
+	/** ban entry */
+	struct Ban
+	{
+		/** ban type */
+		Type type;
+
+		/** normalized mask */
+		String mask;
+
+		/** user part of K/G-line masks */
+		String user;
+
+		/** host part of K/G-line masks; the address for Z-lines */
+		String host;
+
+		/** prefix for Z-lines and CIDR hosts */
+		UnrealRadixTree<int>::Key prefix;
+
+		/** prefix length; 0 if the host is no address */
+		size_t bits;
+
+		/** reason */
+		String reason;
+
+		/** who set the ban */
+		String setter;
+
+		/** time the ban was set */
+		std::time_t set_at;
+
+		/** expiry time; 0 for permanent bans */
+		std::time_t expires;
+	};
+
+	/** alias the shared pointer type for bans */
+	typedef boost::shared_ptr<Ban> BanPtr;
+
+	/** alias the list type for bans */
+	typedef List<BanPtr> BanList;
+
+public:
+	UnrealBanList();
+	~UnrealBanList();
+	BanPtr add(Type type, const String& mask, const String& reason,
+		const String& setter, std::time_t duration);
+	BanPtr checkAddress(const String& ip);
+	BanPtr checkUser(const String& ident, const String& host,
+		const String& ip);
+	void clear();
+	void close();
+	BanList entries();
+	BanPtr find(Type type, const String& mask);
+	bool load();
+	static bool matches(const Ban& ban, const String& ident,
+		const String& host, const String& ip);
+	static bool normalize(Type type, const String& mask, String& result);
+	bool remove(Type type, const String& mask);
+	size_t size();
+	static const char* typeName(Type type);
+
+private:
+	BanPtr create(Type type, const String& mask);
+	void expire();
+	void handleTimer(const UnrealTimer::ErrorCode& ec);
+	void index(BanPtr ban);
+	bool save();
+	void schedule();
+	void unindex(BanPtr ban);
+
+private:
+	/** all bans, by type and mask */
+	HashMap<String, BanPtr> bans_;
+
+	/** temporary bans by expiry time */
+	std::multimap<std::time_t, BanPtr> expiry_;
+
+	/** Z-lines */
+	UnrealRadixTree<BanPtr> zlines_;
+
+	/** K/G-lines with a plain host, by host */
+	HashMap<String, BanList> by_host_;
+
+	/** K/G-lines with a "*.domain" host, by ".domain" */
+	HashMap<String, BanList> by_suffix_;
+
+	/** K/G-lines with an address or CIDR host */
+	UnrealRadixTree<BanList> by_cidr_;
+
+	/** K/G-lines with any other host pattern */
+	BanList generic_;
+
+	/** expiry and save timer; allocated on first use */
+	UnrealTimer* timer_;
+
+	/** whether there are changes not written to the file yet */
+	bool dirty_;
+
+	/** time the changes should be written */
+	std::time_t save_at_;
+};
+
+#endif /* _UNREALIRCD_BANLIST_HPP */
@@ -26,24 +26,34 @@
 #ifndef _UNREALIRCD_BASE_H
 #define _UNREALIRCD_BASE_H
 
+#include <banlist.hpp>
+#include <capture.hpp>
 #include <channel.hpp>
 #include <command.hpp>
 #include <config.hpp>
+#include <ident.hpp>
 #include <isupport.hpp>
 #include <list.hpp>
 #include <listener.hpp>
 #include <log.hpp>
+#include <loopmonitor.hpp>
 #include <map.hpp>
+#include <metrics.hpp>
 #include <module.hpp>
+#include <operindex.hpp>
+#include <prototrace.hpp>
 #include <reactor.hpp>
 #include <server.hpp>
 #include <stats.hpp>
 #include <string.hpp>
 #include <stringlist.hpp>
+#include <throttle.hpp>
 #include <time.hpp>
 #include <timer.hpp>
 #include <user.hpp>
+#include <userindex.hpp>
 #include <version.hpp>
+#include <workerpool.hpp>
 
 /** generic foreach */
 #define foreach(x, y, z) \
@@ -82,6 +92,18 @@ public:
 	/** log system */
 	UnrealLog log;
 
+	/** event loop health monitor */
+	UnrealLoopMonitor monitor;
+
+	/** protocol trace */
+	UnrealProtocolTrace trace;
+
+	/** traffic capture for replays */
+	UnrealTrafficCapture capture;
+
+	/** metrics registry and exporter */
+	UnrealMetrics metrics;
+
 	/** list with modules */
 	List<UnrealModule*> modules;
 
@@ -97,6 +119,24 @@ public:
 	/** nick mapping */
 	Map<String, UnrealUser*> nicks;
 
+	/** user search index */
+	UnrealUserIndex userindex;
+
+	/** local IRC operators and their server notice masks */
+	UnrealOperIndex opers;
+
+	/** ident client */
+	UnrealIdentClient ident;
+
+	/** K-, G- and Z-lines */
+	UnrealBanList bans;
+
+	/** per-host connection throttle */
+	UnrealThrottle throttle;
+
+	/** worker threads for blocking operations */
+	UnrealWorkerPool workers;
+
 	/** channel mapping */
 	Map<String, UnrealChannel*> channels;
 
@@ -121,6 +161,7 @@ public:
 private:
 	void checkConfig();
 	void checkPermissions();
+	void collectMetrics(UnrealMetricWriter& out);
 	void finish();
 	void init();
 	void initLog();
@@ -128,11 +169,13 @@ private:
 	void initModules();
 	void parseArgv();
 	void printConfig();
+	void printPassword(const String& password);
 	void printUsage();
 	void printVersion();
 	void run(const UnrealReactor::ErrorCode& ec);
 	void setupISupport();
 	void setupListener();
+	void setupMetrics();
 	void setupRlimit();
 	void setupServer();
 
@@ -0,0 +1,162 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         capture.hpp
+ * Description  Capture of client traffic for replays
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_CAPTURE_HPP
+#define _UNREALIRCD_CAPTURE_HPP
+
+#include <map.hpp>
+#include <platform.hpp>
+#include <string.hpp>
+#include <cstdio>
+
+class UnrealSocket;
+
+/**
+ * Capture of the lines received from clients, written into a binary file
+ * which unreal-replay drives against a test server.
+ *
+ * Only connections accepted after the capture has been started are
+ * recorded, so every connection in the file starts with its registration.
+ * Lines are anonymized before they are written: nicknames, user names and
+ * channel names are replaced by keyed hashes, which stay the same within a
+ * capture, message texts are replaced by 'x' characters of the same length
+ * and OPER and PASS arguments are dropped.
+ *
+ * The file starts with a FileHeader, followed by records, each a Record
+ * header and `length' bytes of text. All fields are in host byte order.
+ */
+class UnrealTrafficCapture
+{
+public:
+	/** record types */
+	enum RecordType
+	{
+		/** a connection has been accepted */
+		Open = 'O',
+
+		/** a line has been received, without CRLF */
+		Line = 'L',
+
+		/** a connection has been closed */
+		Close = 'C'
+	};
+
+	/** file format version */
+	static const uint32_t Version = 1;
+
+	/** file header */
+	struct FileHeader
+	{
+		/** "UCAP" */
+		char magic[4];
+
+		/** file format version */
+		uint32_t version;
+
+		/** wall clock time the capture was started, in microseconds */
+		uint64_t started;
+	};
+
+	/** record header, followed by `length' bytes of text */
+	struct Record
+	{
+		/** time since the capture was started, in microseconds */
+		uint64_t time;
+
+		/** connection number, counted from 1 */
+		uint32_t connection;
+
+		/** text length */
+		uint16_t length;
+
+		/** record type */
+		uint8_t type;
+
+		/** padding */
+		uint8_t reserved;
+	};
+
+public:
+	UnrealTrafficCapture();
+	~UnrealTrafficCapture();
+	String anonymize(const String& line);
+	uint64_t bytes();
+	void close(UnrealSocket* sptr);
+	size_t connections();
+	bool enabled();
+	const String& fileName();
+	void open(UnrealSocket* sptr);
+	uint64_t records();
+	bool start();
+	void stop();
+
+	/**
+	 * Record a line received from a client.
+	 *
+	 * @param sptr Socket the line was received on
+	 * @param line Line without CRLF
+	 */
+	inline void record(UnrealSocket* sptr, const String& line)
+	{
+		if (file_)
+			append(sptr, line);
+	}
+
+private:
+	String anonymizeParam(const String& param);
+	void append(UnrealSocket* sptr, const String& line);
+	String pseudonym(const String& token);
+	bool write(RecordType type, uint32_t connection, const String& text);
+
+private:
+	/** capture file; zero if not capturing */
+	std::FILE* file_;
+
+	/** capture file name */
+	String file_name_;
+
+	/** key for the hashed names, random per capture */
+	String key_;
+
+	/** connection numbers of the recorded connections */
+	Map<UnrealSocket*, uint32_t> connections_;
+
+	/** last connection number assigned */
+	uint32_t last_connection_;
+
+	/** monotonic time the capture was started */
+	uint64_t started_;
+
+	/** bytes written */
+	uint64_t bytes_;
+
+	/** records written */
+	uint64_t records_;
+
+	/** capture size limit in bytes; 0 means no limit */
+	uint64_t max_size_;
+};
+
+#endif /* _UNREALIRCD_CAPTURE_HPP */
@@ -32,11 +32,42 @@
 #include <mode.hpp>
 #include <modebuf.hpp>
 #include <numeric.hpp>
+#include <replystream.hpp>
 #include <string.hpp>
 #include <time.hpp>
 #include <user.hpp>
 
+/** maximum size of the nick list in a single NAMES reply line */
+#define NAMES_CHUNK_SIZE	420
+
 class UnrealUser;
+struct UnrealChannelMember;
+
+/**
+ * A pre-rendered part of the channel's NAMES reply. Each chunk holds the
+ * members of one RPL_NAMREPLY line; the line is rendered again only after
+ * a member of this chunk has changed.
+ */
+struct UnrealChannelNamesChunk
+{
+	/** chunk number, never reused; chunks are kept in ascending order */
+	uint64_t id;
+
+	/** members in this chunk */
+	List<UnrealChannelMember*> members;
+
+	/** sum of the entry sizes, with room for all prefixes */
+	size_t length;
+
+	/** whether the rendered lines are outdated */
+	bool dirty;
+
+	/** nick list with the highest prefix only */
+	String single_prefix;
+
+	/** nick list with all prefixes (NAMESX) */
+	String multi_prefix;
+};
 
 /**
  * Channel ban representation.
@@ -106,6 +137,12 @@ struct UnrealChannelMember
 
 	/** the time the user entered the channel */
 	UnrealTime joined;
+
+	/** NAMES chunk the member is listed in */
+	UnrealChannelNamesChunk* chunk;
+
+	/** size of the member's NAMES entry when it was added to the chunk */
+	size_t names_size;
 };
 
 /**
@@ -123,6 +160,9 @@ public:
 	/** alias the channel member type */
 	typedef UnrealChannelMember Member;
 
+	/** alias the NAMES chunk type */
+	typedef UnrealChannelNamesChunk NamesChunk;
+
 	/** alias iterator for the member map */
 	typedef Map<UnrealUser*, Member*>::Iterator MemberIterator;
 
@@ -157,6 +197,8 @@ public:
 	Bitmask<uint32_t>& modes();
 	String modestr();
 	const String& name();
+	const String& namesChunk(NamesChunk* chunk, bool multi_prefix);
+	NamesChunk* namesChunkAfter(uint64_t id);
 	void parseModeChange(UnrealUser* uptr, StringList* argv);
 	void removeBan(const String& mask);
 	void removeMember(UnrealUser* uptr);
@@ -178,12 +220,19 @@ public:
 	const String& topic();
 	const String& topicMask();
 	UnrealTime topicTime();
+	void updateNames(UnrealUser* uptr);
 
 public:
 	List<Ban*> banlist;
 	List<UnrealUser*> invites;
 	Map<UnrealUser*, Member*> members;
 
+private:
+	void addNamesEntry(Member* cmptr);
+	void mergeNamesChunk(NamesChunk* chunk);
+	bool mergeNamesChunks(size_t index);
+	void removeNamesEntry(Member* cmptr);
+
 private:
 	/** channel name */
 	String name_;
@@ -211,6 +260,32 @@ private:
 
 	/** channel limit */
 	uint32_t limit_;
+
+	/** pre-rendered NAMES reply */
+	List<NamesChunk*> names_chunks_;
+
+	/** number of the last NAMES chunk created */
+	static uint64_t last_names_chunk_;
+};
+
+/**
+ * Reply stream for channel ban lists. The channel is looked up by its name
+ * on every chunk, so the stream ends quietly if the channel goes away.
+ */
+class UnrealBanListStream
+	: public UnrealReplyStream
+{
+public:
+	UnrealBanListStream(const String& chname);
+
+	Result produce(UnrealUser* uptr, size_t max_lines);
+
+private:
+	/** channel name */
+	String chname_;
+
+	/** index of the next ban to send */
+	size_t pos_;
 };
 
 namespace UnrealChannelProperties
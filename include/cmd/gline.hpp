@@ -0,0 +1,67 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         gline.hpp
+ * Description  GLINE, KLINE and ZLINE command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_CMD_GLINE_HPP
+#define _UNREALIRCD_CMD_GLINE_HPP
+
+#include <banlist.hpp>
+#include <module.hpp>
+
+#define CMD_GLINE	"GLINE"
+#define TOK_GLINE	"}"
+
+#define CMD_KLINE	"KLINE"
+#define TOK_KLINE	"KLINE"
+
+#define CMD_ZLINE	"ZLINE"
+#define TOK_ZLINE	"ZLINE"
+
+/**
+ * Unreal Command Handler for "GLINE", "KLINE" and "ZLINE"
+ */
+class UnrealCH_gline
+{
+public:
+	UnrealCH_gline(UnrealModule* mptr);
+	~UnrealCH_gline();
+
+	static void exec(UnrealUser* uptr, StringList* argv);
+	static void execKline(UnrealUser* uptr, StringList* argv);
+	static void execZline(UnrealUser* uptr, StringList* argv);
+	void setInfo(UnrealModuleInf* inf);
+
+private:
+	static void applyBan(UnrealBanList::BanPtr ban);
+	static void handle(UnrealUser* uptr, StringList* argv,
+		UnrealBanList::Type type, const char* cmd);
+	static long parseDuration(const String& str);
+
+private:
+	UnrealUserCommand* command_;
+	UnrealUserCommand* kline_command_;
+	UnrealUserCommand* zline_command_;
+};
+
+#endif /* _UNREALIRCD_CMD_GLINE_HPP */
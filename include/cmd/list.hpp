@@ -27,6 +27,7 @@
 #define _UNREALIRCD_CMD_LIST_HPP
 
 #include <module.hpp>
+#include <replystream.hpp>
 
 #define CMD_LIST	"LIST"
 #define TOK_LIST	"LIST"
@@ -47,4 +48,24 @@ private:
 	UnrealUserCommand* command_;
 };
 
+/**
+ * Reply stream for the channel list. The position is kept as the name of
+ * the last channel sent, so channels may come and go between two chunks.
+ */
+class UnrealListStream
+	: public UnrealReplyStream
+{
+public:
+	UnrealListStream(uint32_t min_users, uint32_t max_users);
+
+	Result produce(UnrealUser* uptr, size_t max_lines);
+
+private:
+	/** user count filters */
+	uint32_t min_users_, max_users_;
+
+	/** lowercase name of the last channel examined */
+	String cursor_;
+};
+
 #endif /* _UNREALIRCD_CMD_LIST_HPP */
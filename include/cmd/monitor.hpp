@@ -0,0 +1,104 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         monitor.hpp
+ * Description  MONITOR and WATCH command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_CMD_MONITOR_HPP
+#define _UNREALIRCD_CMD_MONITOR_HPP
+
+#include <hashmap.hpp>
+#include <map.hpp>
+#include <module.hpp>
+#include <numeric.hpp>
+
+#define CMD_MONITOR	"MONITOR"
+#define TOK_MONITOR	"MONITOR"
+
+#define CMD_WATCH	"WATCH"
+#define TOK_WATCH	"WATCH"
+
+/**
+ * Notify lists of all users, together with a reverse index from the
+ * (lowercase) nick to the users watching it. Status changes of a nick are
+ * thus delivered to its watchers without looking at anybody else.
+ */
+class UnrealNotifyIndex
+{
+public:
+	/** watched nicks of a user; lowercase nick to nick as given */
+	typedef Map<String, String> TargetMap;
+
+	/** users watching a nick */
+	typedef List<UnrealUser*> WatcherList;
+
+public:
+	bool add(UnrealUser* uptr, const String& nick);
+	void clear(UnrealUser* uptr);
+	size_t count(UnrealUser* uptr);
+	bool remove(UnrealUser* uptr, const String& nick);
+	TargetMap* targets(UnrealUser* uptr);
+	WatcherList* watchers(const String& nick);
+
+private:
+	/** lowercase nick to watching users */
+	HashMap<String, WatcherList> watchers_;
+
+	/** user to watched nicks */
+	Map<UnrealUser*, TargetMap> targets_;
+};
+
+/**
+ * Unreal Command Handler for "MONITOR" and "WATCH"
+ */
+class UnrealCH_monitor
+{
+public:
+	UnrealCH_monitor(UnrealModule* mptr);
+	~UnrealCH_monitor();
+
+	static void exec(UnrealUser* uptr, StringList* argv);
+	static void execWatch(UnrealUser* uptr, StringList* argv);
+	static void handleLeavingUser(UnrealUser* uptr);
+	static void handleNickChange(UnrealUser* uptr, const String& oldnick);
+	static void handleRegister(UnrealUser* uptr);
+	void setInfo(UnrealModuleInf* inf);
+
+	/** MONITOR lists */
+	static UnrealNotifyIndex monitors;
+
+	/** WATCH lists */
+	static UnrealNotifyIndex watches;
+
+private:
+	static void notifyOffline(UnrealUser* uptr, const String& nick);
+	static void notifyOnline(UnrealUser* uptr);
+	static void sendList(UnrealUser* uptr, IRCNumeric numeric,
+		const StringList& items, char separator);
+	static void sendMonitorStatus(UnrealUser* uptr, const StringList& nicks);
+
+private:
+	UnrealUserCommand* command_;
+	UnrealUserCommand* watch_command_;
+};
+
+#endif /* _UNREALIRCD_CMD_MONITOR_HPP */
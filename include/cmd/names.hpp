@@ -27,6 +27,8 @@
 #define _UNREALIRCD_CMD_NAMES_HPP
 
 #include <module.hpp>
+#include <replystream.hpp>
+#include <stringlist.hpp>
 
 #define CMD_NAMES	"NAMES"
 #define TOK_NAMES	"NAMES"
@@ -47,4 +49,28 @@ private:
 	UnrealUserCommand* command_;
 };
 
+/**
+ * Reply stream for NAMES. The lines are copied from the NAMES cache of the
+ * channels; channels are looked up by name for every chunk, so they may go
+ * away while the reply is being sent.
+ */
+class UnrealNamesStream
+	: public UnrealReplyStream
+{
+public:
+	UnrealNamesStream(const StringList& chlist);
+
+	Result produce(UnrealUser* uptr, size_t max_lines);
+
+private:
+	/** channels to list */
+	StringList channels_;
+
+	/** index of the current channel */
+	size_t pos_;
+
+	/** number of the last NAMES chunk sent of the current channel */
+	uint64_t chunk_;
+};
+
 #endif /* _UNREALIRCD_CMD_NAMES_HPP */
@@ -27,6 +27,7 @@
 #define _UNREALIRCD_CMD_OPER_HPP
 
 #include <module.hpp>
+#include <boost/shared_ptr.hpp>
 
 #define CMD_OPER	"OPER"
 #define TOK_OPER	"OPER"
@@ -41,6 +42,8 @@ public:
 	~UnrealCH_oper();
 
 	static void exec(UnrealUser* uptr, StringList* argv);
+	static void handlePasswordCheck(UnrealUser* uptr, const String& snomask,
+		boost::shared_ptr<bool> valid);
 	void setInfo(UnrealModuleInf* inf);
 
 private:
@@ -0,0 +1,87 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         stats.hpp
+ * Description  STATS command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_CMD_STATS_HPP
+#define _UNREALIRCD_CMD_STATS_HPP
+
+#include <module.hpp>
+#include <regtrace.hpp>
+
+#define CMD_STATS	"STATS"
+#define TOK_STATS	"2"
+
+/**
+ * Unreal Command Handler for "STATS"
+ */
+class UnrealCH_stats
+{
+public:
+	/** report handler type */
+	typedef void (*ReportHandler)(UnrealUser* uptr);
+
+	/** STATS report description */
+	struct Report
+	{
+		/** query letter */
+		char letter;
+
+		/** long query name */
+		const char* name;
+
+		/** short description, shown in the report list */
+		const char* description;
+
+		/** whether the report is available to IRC operators only */
+		bool oper_only;
+
+		/** report handler */
+		ReportHandler handler;
+	};
+
+public:
+	UnrealCH_stats(UnrealModule* mptr);
+	~UnrealCH_stats();
+
+	static void exec(UnrealUser* uptr, StringList* argv);
+	static void sendBans(UnrealUser* uptr);
+	static void sendCommands(UnrealUser* uptr);
+	static void sendDNS(UnrealUser* uptr);
+	static void sendIdent(UnrealUser* uptr);
+	static void sendLoop(UnrealUser* uptr);
+	static void sendMemory(UnrealUser* uptr);
+	static void sendRegistration(UnrealUser* uptr);
+	static void sendThrottle(UnrealUser* uptr);
+	void setInfo(UnrealModuleInf* inf);
+
+private:
+	static void sendRegistrationStats(UnrealUser* uptr, const String& label,
+		const UnrealRegistrationStats& stats);
+	static void sendReportList(UnrealUser* uptr);
+
+private:
+	UnrealUserCommand* command_;
+};
+
+#endif /* _UNREALIRCD_CMD_STATS_HPP */
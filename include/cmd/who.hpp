@@ -26,7 +26,10 @@
 #ifndef _UNREALIRCD_CMD_WHO_HPP
 #define _UNREALIRCD_CMD_WHO_HPP
 
+#include <list.hpp>
 #include <module.hpp>
+#include <replystream.hpp>
+#include <stringlist.hpp>
 
 #define CMD_WHO		"WHO"
 #define TOK_WHO		"WH"
@@ -38,6 +41,48 @@ class UnrealChannel;
  */
 class UnrealCH_who
 {
+public:
+	/** fields to match the mask against (WHOX flags) */
+	enum MatchField
+	{
+		/** nickname (n) */
+		MFNick		= 0x01,
+
+		/** username (u) */
+		MFUser		= 0x02,
+
+		/** hostname (h) */
+		MFHost		= 0x04,
+
+		/** IP address (i); IRC operators only */
+		MFIP		= 0x08,
+
+		/** real name (r) */
+		MFRealname	= 0x10
+	};
+
+	/** parsed WHO request */
+	struct Query
+	{
+		/** search mask */
+		String mask;
+
+		/** list IRC operators only */
+		bool opers_only;
+
+		/** MatchField flags; 0 means nick, host and the full mask */
+		uint8_t match_fields;
+
+		/** whether a WHOX field selection was given */
+		bool whox;
+
+		/** selected WHOX fields */
+		String fields;
+
+		/** WHOX query type token */
+		String querytype;
+	};
+
 public:
 	UnrealCH_who(UnrealModule* mptr);
 	~UnrealCH_who();
@@ -46,8 +91,78 @@ public:
 	static void exec(UnrealUser* uptr, StringList* argv);
 	void setInfo(UnrealModuleInf* inf);
 
+private:
+	static bool collect(Query& q, List<UnrealUser*>& result);
+	static bool lookup(uint8_t field, const String& prefix,
+		const String& suffix, List<UnrealUser*>& result);
+	static bool matches(Query& q, UnrealUser* tuptr);
+	static bool parseQuery(UnrealUser* uptr, StringList* argv, Query& q);
+	static void sendEntry(UnrealUser* uptr, UnrealUser* tuptr,
+		UnrealChannel* chptr, Query& q);
+
 private:
 	UnrealUserCommand* command_;
+
+	friend class UnrealWhoStream;
+};
+
+/**
+ * Reply stream for WHO. Channels are looked up by name and users by nick
+ * on every chunk, so they may go away while the reply is being sent.
+ */
+class UnrealWhoStream
+	: public UnrealReplyStream
+{
+public:
+	/** where the users are taken from */
+	enum Source
+	{
+		/** members of the channel named by the mask */
+		Channel,
+
+		/** users found in the user index */
+		Candidates,
+
+		/** all users */
+		All
+	};
+
+public:
+	UnrealWhoStream(const UnrealCH_who::Query& q, Source source);
+
+	Result produce(UnrealUser* uptr, size_t max_lines);
+	void setCandidates(List<UnrealUser*>& candidates);
+
+private:
+	UnrealUser* next(UnrealChannel*& chptr);
+
+private:
+	/** parsed request */
+	UnrealCH_who::Query query_;
+
+	/** user source */
+	Source source_;
+
+	/** last channel member examined; only used as a key */
+	UnrealUser* member_cursor_;
+
+	/** last nick examined for All streams */
+	String nick_cursor_;
+
+	/** lowercase nicks of the candidates, sorted */
+	StringList candidates_;
+
+	/** index of the next candidate */
+	size_t pos_;
+
+	/** number of replies sent so far, and the limit */
+	size_t replies_, max_replies_;
+
+	/** whether all users have been examined */
+	bool done_;
+
+	/** whether the reply limit has been hit */
+	bool truncated_;
 };
 
 #endif /* _UNREALIRCD_CMD_WHO_HPP */
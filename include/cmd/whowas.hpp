@@ -22,12 +22,13 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  * GNU General Public License for more details.
  ******************************************************************/
- 
+
 #ifndef _UNREALIRCD_CMD_WHOWAS_HPP
 #define _UNREALIRCD_CMD_WHOWAS_HPP
 
-#include <map.hpp>
+#include <hashmap.hpp>
 #include <module.hpp>
+#include <vector>
 
 #define CMD_WHOWAS	"WHOWAS"
 #define TOK_WHOWAS	"WHOWAS"
@@ -48,10 +49,91 @@ struct WhowasEntry_t
 
 	/** real name */
 	String realname;
+
+	/** lowercase nickname, used as index key */
+	String lnick;
+
+	/** whether this ring slot is occupied */
+	bool used;
+
+	/** estimated memory usage of this entry in bytes */
+	size_t bytes;
+
+	/** ring slot of the next newer entry with the same nick */
+	size_t newer;
+
+	/** ring slot of the next older entry with the same nick */
+	size_t older;
 };
 
 /**
- * Unreal Command Handler for "ADMIN"
+ * Bounded WHOWAS history.
+ *
+ * Entries are kept in a fixed-size ring which is overwritten in
+ * insertion order, so adding a new entry always takes constant time.
+ * Entries with the same nickname are chained together and the chain is
+ * reachable through a hash index on the lowercase nickname.
+ * Besides the entry count, the history can be limited by its estimated
+ * memory usage and by the number of entries per nickname.
+ */
+class UnrealWhowasHistory
+{
+public:
+	/** Marks an invalid ring slot */
+	static const size_t npos = static_cast<size_t>(-1);
+
+	UnrealWhowasHistory(size_t max_entries, size_t max_bytes,
+		size_t max_per_nick);
+	~UnrealWhowasHistory();
+
+	void add(const String& nick, const String& user,
+		const String& hostname, const String& realname);
+	size_t bytes() const;
+	const WhowasEntry_t* newest(const String& nick);
+	const WhowasEntry_t* older(const WhowasEntry_t* entry) const;
+	size_t size() const;
+
+private:
+	/** Per-nick chain of history entries */
+	struct Chain
+	{
+		/** ring slot of the newest entry */
+		size_t newest;
+
+		/** ring slot of the oldest entry */
+		size_t oldest;
+
+		/** number of entries in the chain */
+		size_t count;
+	};
+
+	void remove(size_t pos);
+
+private:
+	/** ring storage */
+	std::vector<WhowasEntry_t> ring_;
+
+	/** next ring slot to be written */
+	size_t head_;
+
+	/** number of occupied ring slots */
+	size_t count_;
+
+	/** estimated memory usage of all entries */
+	size_t bytes_;
+
+	/** memory limit in bytes, 0 = unlimited */
+	size_t max_bytes_;
+
+	/** entries per nick limit, 0 = unlimited */
+	size_t max_per_nick_;
+
+	/** lowercase nick to chain index */
+	HashMap<String, Chain> index_;
+};
+
+/**
+ * Unreal Command Handler for "WHOWAS"
  */
 class UnrealCH_whowas
 {
@@ -63,11 +145,10 @@ public:
 	static void handleLeavingUser(UnrealUser* uptr);
 	void setInfo(UnrealModuleInf* inf);
 
-	static std::multimap<String, WhowasEntry_t> entries;
+	static UnrealWhowasHistory* history;
 
 private:
 	UnrealUserCommand* command_;
 };
- 
+
 #endif /* _UNREALIRCD_CMD_WHOWAS_HPP */
- 
\ No newline at end of file
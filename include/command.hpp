@@ -27,6 +27,8 @@
 #define _UNREALIRCD_COMMAND_HPP
 
 #include <bitmask.hpp>
+#include <histogram.hpp>
+#include <metrics.hpp>
 #include <platform.hpp>
 #include <user.hpp>
 #include <string.hpp>
@@ -58,17 +60,37 @@ public:
 	UnrealUserCommand(const String& name, Function cfn,
 		bool oper_only = false, bool reg_only = true);
 	~UnrealUserCommand();
+	void account(uint64_t usec, uint64_t cpu_usec, uint64_t bytes);
+	static bool cpuAccounting();
 	static UnrealUserCommand* find(const String& name);
 	String name();
 	Function fn();
 	bool isActive();
 	bool isOperOnly();
 	bool isRegistered();
+	static void loadSettings();
 	void setActive(bool state);
 	void setFn(const Function& fn);
 	void setName(const String& name);
 	void setOperOnly(bool state);
 	void setRegistered(bool state);
+	static uint64_t slowThreshold();
+
+public:
+	/** number of times the command has been called */
+	UnrealMetricCounter calls;
+
+	/** execution time per call */
+	UnrealHistogram latency;
+
+	/** CPU time used, in microseconds */
+	uint64_t cpu_time;
+
+	/** bytes queued for sending while the command ran */
+	uint64_t bytes_sent;
+
+	/** calls that took Commands::SlowThreshold or longer */
+	uint64_t slow_calls;
 
 private:
 	/** command name */
@@ -79,6 +101,12 @@ private:
 	
 	/** command flags */
 	Bitmask<uint8_t> flags_;
+
+	/** whether the CPU time of commands is measured */
+	static bool cpu_accounting_;
+
+	/** time from which on calls are logged, in microseconds; 0 if never */
+	static uint64_t slow_threshold_;
 };
 
 #endif /* _UNREALIRCD_COMMAND_HPP */
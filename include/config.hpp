@@ -60,6 +60,9 @@ public:
 	void startRead();
 	uint32_t warnings();
 
+private:
+	void accountMemory();
+
 private:
 	/** config table entries */
 	Map<String, String> entries_;
@@ -78,6 +81,9 @@ private:
 
 	/** number of warnings encountered on parsing */
 	uint32_t warnings_;
+
+	/** memory accounted for the configuration */
+	size_t memory_;
 };
 
 #endif /* _UNREALIRCD_CONFIG_HPP */
@@ -26,20 +26,35 @@
 #ifndef _UNREALIRCD_HASH_HPP
 #define _UNREALIRCD_HASH_HPP
 
+#include <platform.hpp>
 #include <string.hpp>
 
 /**
  * Secure Hash Algorithm (SHA) digest calculator wrapper.
+ *
+ * Stored passwords have the form "$TYPE$digest" for plain digests, or
+ * "$PBKDF2-SHA256$iterations$salt$key" for keys derived with PBKDF2; salt,
+ * digest and key are hexadecimal. Anything else is a plain text password.
  */
 class UnrealHash
 {
 public:
-	enum Type { Invalid, Plain, SHA1, SHA224, SHA256, SHA384, SHA512 };
+	enum Type { Invalid, Plain, SHA1, SHA224, SHA256, SHA384, SHA512,
+		PBKDF2_SHA256 };
 
 public:
 	static String calculate(const String& message, Type type = Plain);
+	static String derive(const String& password, const String& salt,
+		uint32_t iterations);
 	static size_t digest_size(Type type);
+	static String encode(const String& password, uint32_t iterations = 0);
+	static String randomSalt(size_t length = 16);
 	static Type strtotype(const String& str);
+	static bool verify(const String& password, const String& stored);
+
+private:
+	static bool equals(const String& a, const String& b,
+		bool nocase = false);
 };
 
 #endif /* _UNREALIRCD_HASH_HPP */
\ No newline at end of file
@@ -0,0 +1,129 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         hashmap.hpp
+ * Description  Hashed key/value container
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_HASHMAP_HPP
+#define _UNREALIRCD_HASHMAP_HPP
+
+#include <string.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
+/**
+ * Hash function for String keys; found by boost::hash through ADL.
+ *
+ * @param str String to hash
+ * @return Hash value
+ */
+inline std::size_t hash_value(const String& str)
+{
+	return boost::hash_range(str.begin(), str.end());
+}
+
+/**
+ * Provides an unordered container for storing key/value pairs with
+ * constant lookup time. The interface follows the one of `Map', so both
+ * can be exchanged where the ordering of the keys doesn't matter.
+ *
+ * This class is header-only.
+ */
+template<typename _KeyType, typename _ElementType,
+	class _Hash = boost::hash<_KeyType> >
+class HashMap
+	: public boost::unordered_map<_KeyType, _ElementType, _Hash>
+{
+public:
+	/** Alias the original iterator */
+	typedef typename boost::unordered_map<_KeyType, _ElementType,
+		_Hash>::iterator Iterator;
+
+public:
+	/**
+	 * Add key/value to the map.
+	 */
+	void add(const _KeyType& key, const _ElementType& el)
+	{
+		this->insert(std::pair<_KeyType, _ElementType>(key, el));
+	}
+
+	/**
+	 * Returns whether the map contains an Element with the specified Key.
+	 *
+	 * @param key Key to find
+	 * @return true when found, otherwise false
+	 */
+	bool contains(const _KeyType& key) const
+	{
+		return this->find(key) != this->end();
+	}
+
+	/**
+	 * Remove the Element with the specified Key from the map
+	 * and free it's allocated memory.
+	 * Just use this for pointer elements!
+	 *
+	 * @param key Key of Element to be removed
+	 */
+	void free(const _KeyType& key)
+	{
+		Iterator i = this->find(key);
+
+		if (i != this->end())
+		{
+			delete i->second;
+			this->erase(i);
+		}
+	}
+
+	/**
+	 * Remove the Element with the specified Key from the map.
+	 *
+	 * @param key Key of Element to be removed
+	 */
+	void remove(const _KeyType& key)
+	{
+		Iterator i = this->find(key);
+
+		if (i != this->end())
+			this->erase(i);
+	}
+
+	/**
+	 * Returns the Element that is associated with the specified Key.
+	 *
+	 * @param key Key of Element
+	 * @return Element, or _ElementType(0) when not found
+	 */
+	_ElementType value(const _KeyType& key)
+	{
+		Iterator i = this->find(key);
+
+		if (i != this->end())
+			return i->second;
+		else
+			return _ElementType(0);
+	}
+};
+
+#endif /* _UNREALIRCD_HASHMAP_HPP */
@@ -0,0 +1,69 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         histogram.hpp
+ * Description  Log-scale latency histogram
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_HISTOGRAM_HPP
+#define _UNREALIRCD_HISTOGRAM_HPP
+
+#include <platform.hpp>
+#include <cstddef>
+
+/**
+ * Histogram for latency samples in microseconds. Samples are counted in
+ * power-of-two buckets, so adding a sample is cheap and the memory usage
+ * is fixed; percentiles are accurate to the bucket bounds.
+ */
+class UnrealHistogram
+{
+public:
+	/** number of buckets; the last one collects everything above */
+	static const size_t BucketCount = 32;
+
+public:
+	UnrealHistogram();
+	void add(uint64_t usec);
+	uint64_t bucket(size_t index) const;
+	static uint64_t bucketBound(size_t index);
+	uint64_t count() const;
+	uint64_t max() const;
+	void merge(const UnrealHistogram& other);
+	uint64_t percentile(double q) const;
+	void reset();
+	uint64_t sum() const;
+
+private:
+	/** sample count per bucket */
+	uint64_t buckets_[BucketCount];
+
+	/** total number of samples */
+	uint64_t count_;
+
+	/** sum of all samples */
+	uint64_t sum_;
+
+	/** largest sample seen */
+	uint64_t max_;
+};
+
+#endif /* _UNREALIRCD_HISTOGRAM_HPP */
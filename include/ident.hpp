@@ -0,0 +1,170 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         ident.hpp
+ * Description  Ident (RFC 1413) client
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_IDENT_HPP
+#define _UNREALIRCD_IDENT_HPP
+
+#include <hashmap.hpp>
+#include <string.hpp>
+#include <timer.hpp>
+
+#include <ctime>
+#include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
+
+using namespace boost::asio::ip;
+
+class UnrealUser;
+
+/**
+ * Ident client shared by all connecting users.
+ *
+ * The number of ident queries at the same time is limited by
+ * Ident::MaxQueries; users connecting while all slots are taken skip the
+ * ident check instead of waiting. Each query has its own hard timeout
+ * (Ident::Timeout), independent of the auth timeout.
+ * Usernames belong to a single connection and are never cached. Hosts
+ * whose ident server answers without a username are remembered per IP
+ * for Ident::CacheTTL, and hosts which refuse or don't answer connections
+ * on port 113 for Ident::UnreachableTTL, so following connections from
+ * there skip the check right away.
+ */
+class UnrealIdentClient
+{
+public:
+	/** error code type */
+	typedef boost::system::error_code ErrorCode;
+
+	/** lookup results */
+	enum Result
+	{
+		/** the query is running; the user is notified later */
+		Pending,
+
+		/** got a username */
+		Found,
+
+		/** the ident server answered without a username */
+		NoReply,
+
+		/** port 113 refused the connection or didn't answer in time */
+		Unreachable,
+
+		/** all query slots are taken */
+		Busy
+	};
+
+	/** counters */
+	struct Counters
+	{
+		/** queries sent */
+		size_t queries;
+
+		/** lookups answered from the reply cache */
+		size_t cache_hits;
+
+		/** lookups skipped for unreachable hosts */
+		size_t unreachable_skips;
+
+		/** lookups skipped because all slots were taken */
+		size_t busy_skips;
+
+		/** queries that timed out */
+		size_t timeouts;
+	};
+
+public:
+	UnrealIdentClient();
+	~UnrealIdentClient();
+	size_t active();
+	void cancel(UnrealUser* uptr);
+	const Counters& counters();
+	Result lookup(UnrealUser* uptr, const tcp::endpoint& remote,
+		const tcp::endpoint& local, String& username);
+
+private:
+	/** running query */
+	struct Query
+	{
+		Query();
+
+		/** user waiting for the result; 0 if gone */
+		UnrealUser* owner;
+
+		/** IP address of the user */
+		String ip;
+
+		/** port pair to ask for */
+		uint16_t remote_port, local_port;
+
+		/** connection to the ident server */
+		tcp::socket socket;
+
+		/** hard timeout */
+		UnrealTimer timer;
+
+		/** request and reply buffer */
+		boost::asio::streambuf buffer;
+
+		/** whether the query has completed */
+		bool done;
+	};
+
+	/** cached reply */
+	struct CacheEntry
+	{
+		/** result */
+		Result result;
+
+		/** expiry time */
+		std::time_t expires;
+	};
+
+	/** alias the shared pointer type for queries */
+	typedef boost::shared_ptr<Query> QueryPtr;
+
+	void expire();
+	void finish(QueryPtr q, Result result, const String& username);
+	void handleConnect(QueryPtr q, const ErrorCode& ec);
+	void handleRead(QueryPtr q, const ErrorCode& ec);
+	void handleTimeout(QueryPtr q, const ErrorCode& ec);
+	void handleWrite(QueryPtr q, const ErrorCode& ec);
+	Result parseReply(QueryPtr q, String& username);
+
+private:
+	/** running queries by user */
+	HashMap<UnrealUser*, QueryPtr> queries_;
+
+	/** cached replies by IP */
+	HashMap<String, CacheEntry> cache_;
+
+	/** time of the last cache expiry run */
+	std::time_t last_expire_;
+
+	/** counters */
+	Counters counters_;
+};
+
+#endif /* _UNREALIRCD_IDENT_HPP */
@@ -28,9 +28,12 @@
 
 #include <list.hpp>
 #include <reactor.hpp>
+#include <regtrace.hpp>
 #include <socket.hpp>
 #include <string.hpp>
 #include <stringlist.hpp>
+#include <throttle.hpp>
+#include <timer.hpp>
 
 #include <boost/asio.hpp>
 #include <boost/signal.hpp>
@@ -55,6 +58,8 @@ public:
 	~UnrealListener();
 
 	void addConnection(UnrealSocket* sptr);
+	UnrealSocket* attachLoopback(const String& address,
+		const uint16_t& port);
 	String bindAddress();
 	uint16_t bindPort();
 	uint32_t maxConnections();
@@ -68,7 +73,7 @@ public:
 	void setMaxConnections(const uint32_t& max_conn);
 	void setPingFrequency(const uint32_t& ping_freq);
 	void setType(ListenerType lty);
-	StringList splitLine(String& data);
+	static StringList splitLine(String& data);
 	ListenerType type();
 	void waitForAccept();
 
@@ -76,14 +81,24 @@ public:
 	/** connections attached to this listener */
 	List<UnrealSocket*> connections;
 
+	/** registration latency of the clients accepted here */
+	UnrealRegistrationStats registrations;
+
+	/** traffic of the connections closed already */
+	UnrealSocketTrafficType closed_traffic;
+
 public:
 	/** signal which is triggered on a new connection ready */
 	boost::signal<void(UnrealListener*, UnrealSocket*)> onNewConnection;
 
 private:
+	bool admitConnection(UnrealSocket* sptr);
 	void handleAccept(const ErrorCode& ec, UnrealSocket* sptr);
+	void handleAcceptRetry(const UnrealTimer::ErrorCode& ec);
 	void handleDataResponse(UnrealSocket* sptr, String& data);
 	void handleNewConnection();
+	void handleWriteCompletion(UnrealSocket* sptr);
+	void rejectConnection(UnrealSocket* sptr, const String& reason);
 
 private:
 	/** listener type */
@@ -100,6 +115,18 @@ private:
 
 	/** max amount of connections allowed for this listener */
 	uint32_t max_connections_;
+
+	/** timer to retry accepting after an error */
+	UnrealTimer accept_timer_;
+
+	/** current accept retry delay in milliseconds, 0 if none */
+	uint32_t accept_delay_;
+
+	/** time an accept error was logged last */
+	std::time_t accept_logged_;
+
+	/** accept errors not logged since then */
+	uint32_t accept_suppressed_;
 };
 
 #endif /* _UNREALIRCD_LISTENER_HPP */
@@ -26,9 +26,30 @@
 #ifndef _UNREALIRCD_LOG_HPP
 #define _UNREALIRCD_LOG_HPP
 
+#include <atomic.hpp>
+#include <platform.hpp>
 #include <string.hpp>
+
+#include <ctime>
+#include <cstdarg>
 #include <fstream>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
+/**
+ * Log system.
+ *
+ * Once start() has been called, write() only formats the message into a
+ * slot of a lock-free ring and returns; a background thread collects the
+ * messages, prefixes them with a timestamp that is formatted once per
+ * second, and writes them in batches. A batch is written when it reaches
+ * Log::BatchSize bytes or Log::FlushInterval milliseconds have passed.
+ * If the ring (Log::QueueSize messages) is full, messages are dropped and
+ * counted; the writer notes the number of dropped messages in the log.
+ *
+ * Before start() and after close(), messages are written synchronously.
+ */
 class UnrealLog
 {
 public:
@@ -39,17 +60,44 @@ public:
 	~UnrealLog();
 
 	void close();
+	size_t dropped();
 	const String& fileName();
 	bool open();
 	void setFileName(const String& filename);
 	void setLevel(LogLevel ll);
+	void start();
 	void write(LogLevel level, const char* fmt, ...);
 
 	UnrealLog& operator<<(const String& str);
 	UnrealLog& operator<<(LogLevel ll);
 
 private:
+	/** maximum length of a message, including the terminating zero */
+	enum { TextSize = 1024 };
+
+	/** ring slot */
+	struct Slot
+	{
+		/** slot sequence number, see push() and pop() */
+		volatile uint32_t sequence;
+
+		/** log level */
+		LogLevel level;
+
+		/** time the message was written */
+		std::time_t ts;
+
+		/** message text */
+		char text[TextSize];
+	};
+
+	void flush(std::string& batch);
+	void format(std::string& batch, LogLevel level, std::time_t ts,
+		const char* text);
 	String levelToStr(LogLevel ll);
+	bool pop(std::string& batch);
+	bool push(LogLevel level, const char* fmt, va_list vl);
+	void run();
 
 private:
 	/** log file name */
@@ -63,6 +111,48 @@ private:
 
 	/** last level flag */
 	LogLevel last_level_flag_;
+
+	/** guards the streams and the timestamp cache */
+	boost::mutex mutex_;
+
+	/** message ring; its size is a power of two */
+	Slot* slots_;
+
+	/** ring size - 1 */
+	uint32_t mask_;
+
+	/** next slot to be written by a producer */
+	volatile uint32_t enqueue_pos_;
+
+	/** next slot to be read by the writer thread */
+	uint32_t dequeue_pos_;
+
+	/** number of messages dropped as the ring was full */
+	volatile uint32_t dropped_;
+
+	/** number of dropped messages already noted in the log */
+	uint32_t reported_drops_;
+
+	/** whether the writer thread is running */
+	volatile uint32_t running_;
+
+	/** set to make the writer thread drain the ring and exit */
+	volatile uint32_t stopping_;
+
+	/** writer thread */
+	boost::thread* thread_;
+
+	/** flush interval of the writer thread, in microseconds */
+	uint64_t flush_interval_;
+
+	/** size of a batch in bytes before it's written */
+	size_t batch_size_;
+
+	/** second of the cached timestamp */
+	std::time_t cached_second_;
+
+	/** cached timestamp */
+	String cached_time_;
 };
 
 #endif /* _UNREALIRCD_LOG_HPP */
@@ -0,0 +1,111 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         loopmonitor.hpp
+ * Description  Event loop health monitor
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_LOOPMONITOR_HPP
+#define _UNREALIRCD_LOOPMONITOR_HPP
+
+#include <histogram.hpp>
+#include <platform.hpp>
+#include <reactor.hpp>
+#include <string.hpp>
+
+#include <ctime>
+
+/**
+ * Monitor for the health of the event loop.
+ *
+ * run() replaces io_service::run(): it runs the ready handlers one by one
+ * and measures each of them, and counts how many handlers were ready per
+ * wakeup. The first handler after an idle wait is measured by the thread
+ * CPU time, as the wall time would include the wait.
+ *
+ * Code running in handlers may tag itself (a command name, "accept",
+ * ...), so the longest handler can be attributed. The main loop timer
+ * reports its drift through schedule() and tick(); if it fires
+ * Monitor::LagThreshold milliseconds late or more, IRC operators get a
+ * notice, at most once per Monitor::NoticeInterval seconds.
+ */
+class UnrealLoopMonitor
+{
+public:
+	/** maximum tag length */
+	enum { TagSize = 32 };
+
+public:
+	UnrealLoopMonitor();
+	const UnrealHistogram& depth();
+	const UnrealHistogram& handlers();
+	const UnrealHistogram& lag();
+	size_t lagEvents();
+	uint64_t lastLag();
+	uint64_t longest();
+	const char* longestTag();
+	void run(UnrealReactor& reactor);
+	void schedule(uint64_t usec);
+	void tag(const char* name);
+	void tick();
+
+private:
+	void account(uint64_t usec);
+
+private:
+	/** handler execution time */
+	UnrealHistogram handlers_;
+
+	/** handlers run per wakeup; the values are counts, not microseconds */
+	UnrealHistogram depth_;
+
+	/** main loop timer drift */
+	UnrealHistogram lag_;
+
+	/** monotonic time the main loop timer is due */
+	uint64_t due_;
+
+	/** last timer drift measured */
+	uint64_t last_lag_;
+
+	/** number of times the drift exceeded the threshold */
+	size_t lag_events_;
+
+	/** time of the last lag notice */
+	std::time_t last_notice_;
+
+	/** tag of the handler running right now */
+	char tag_[TagSize];
+
+	/** longest handler so far */
+	uint64_t longest_;
+
+	/** tag of the longest handler so far */
+	char longest_tag_[TagSize];
+
+	/** longest handler since the last tick */
+	uint64_t window_longest_;
+
+	/** tag of the longest handler since the last tick */
+	char window_tag_[TagSize];
+};
+
+#endif /* _UNREALIRCD_LOOPMONITOR_HPP */
@@ -0,0 +1,87 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         manualclock.hpp
+ * Description  Manually advanced clock for deterministic tests
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_MANUALCLOCK_HPP
+#define _UNREALIRCD_MANUALCLOCK_HPP
+
+#include <platform.hpp>
+#include <ctime>
+#include <cstddef>
+#include <map>
+#include <utility>
+
+class UnrealTimer;
+
+/**
+ * Clock which only moves when told to. Once installed with
+ * UnrealTime::setClock(), UnrealTime::now() and UnrealTime::monotonic()
+ * read from it and UnrealTimer waits are queued here instead of on the
+ * reactor, so tests can step through timeouts without sleeping.
+ *
+ * Due timers run synchronously from advance(), in order of their due time,
+ * with the clock set to that time. The clock is not thread safe and must
+ * only be used from the thread running the reactor.
+ */
+class UnrealManualClock
+{
+public:
+	UnrealManualClock(std::time_t epoch, uint64_t start = 0);
+	~UnrealManualClock();
+	void advance(uint64_t usec);
+	void advanceSeconds(std::time_t sec);
+	uint64_t monotonic();
+	size_t pending();
+	std::time_t wallclock();
+
+private:
+	friend class UnrealTimer;
+
+	/** queue key: due time and insertion order for timers due at once */
+	typedef std::pair<uint64_t, uint64_t> Key;
+
+	/** queue of waiting timers */
+	typedef std::map<Key, UnrealTimer*> Queue;
+
+	uint64_t schedule(UnrealTimer* timer, uint64_t due);
+	void unschedule(uint64_t due, uint64_t seq);
+
+private:
+	/** wall clock time at the start, in seconds */
+	std::time_t epoch_;
+
+	/** monotonic time at the start, in microseconds */
+	uint64_t start_;
+
+	/** current monotonic time, in microseconds */
+	uint64_t now_;
+
+	/** insertion counter for the queue keys */
+	uint64_t seq_;
+
+	/** waiting timers */
+	Queue queue_;
+};
+
+#endif /* _UNREALIRCD_MANUALCLOCK_HPP */
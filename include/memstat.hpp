@@ -0,0 +1,109 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         memstat.hpp
+ * Description  Memory accounting per subsystem
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_MEMSTAT_HPP
+#define _UNREALIRCD_MEMSTAT_HPP
+
+#include <platform.hpp>
+#include <string.hpp>
+#include <cstddef>
+
+/**
+ * Memory accounting per subsystem.
+ *
+ * Objects report the memory they hold when they're created, resized and
+ * destroyed, so the current and peak usage can be shown without walking
+ * any data structure. The figures are estimates: they count object sizes
+ * and string capacities, not allocator overhead. The counters are only
+ * updated from the reactor thread.
+ */
+class UnrealMemoryStats
+{
+public:
+	/** accounted subsystems */
+	enum Subsystem
+	{
+		/** user objects and their strings */
+		Users,
+
+		/** channel objects and their member entries */
+		Channels,
+
+		/** K-, G- and Z-lines */
+		Bans,
+
+		/** receive queues of users */
+		RecvQ,
+
+		/** send queues of sockets */
+		SendQ,
+
+		/** WHOWAS history entries */
+		Whowas,
+
+		/** configuration entries */
+		Config,
+
+		/** protocol trace buffer */
+		Trace,
+
+		/** queue of the log writer thread */
+		Log,
+
+		/** number of subsystems */
+		SubsystemCount
+	};
+
+	/** usage of a single subsystem */
+	struct Usage
+	{
+		/** bytes in use */
+		uint64_t bytes;
+
+		/** objects in use */
+		uint64_t objects;
+
+		/** highest byte count seen */
+		uint64_t peak_bytes;
+
+		/** highest object count seen */
+		uint64_t peak_objects;
+	};
+
+public:
+	static void allocate(Subsystem sub, size_t bytes, size_t objects = 1);
+	static size_t bytes(const String& str);
+	static const char* name(Subsystem sub);
+	static void release(Subsystem sub, size_t bytes, size_t objects = 1);
+	static void resize(Subsystem sub, size_t& accounted, size_t bytes);
+	static uint64_t totalBytes();
+	static const Usage& usage(Subsystem sub);
+
+private:
+	/** usage per subsystem */
+	static Usage usage_[SubsystemCount];
+};
+
+#endif /* _UNREALIRCD_MEMSTAT_HPP */
@@ -0,0 +1,244 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         metrics.hpp
+ * Description  Metrics registry and exporter
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_METRICS_HPP
+#define _UNREALIRCD_METRICS_HPP
+
+#include <atomic.hpp>
+#include <hashmap.hpp>
+#include <histogram.hpp>
+#include <list.hpp>
+#include <platform.hpp>
+#include <string.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * Counter for hot paths. Each thread adds to a shard of its own without
+ * any locking; the shards are summed up when the value is read.
+ */
+class UnrealMetricCounter
+{
+public:
+	/** number of shards; threads beyond share the last one atomically */
+	static const size_t ShardCount = 8;
+
+public:
+	UnrealMetricCounter();
+
+	/**
+	 * Add to the counter.
+	 *
+	 * @param n Amount to add
+	 */
+	inline void add(uint64_t n = 1)
+	{
+		size_t index = shard();
+
+		if (index < ShardCount - 1)
+			shards_[index].value += n;
+		else
+			UnrealAtomic::add64(&shards_[ShardCount - 1].value, n);
+	}
+
+	/**
+	 * Returns the shard of the calling thread.
+	 *
+	 * @return Shard index
+	 */
+	static inline size_t shard()
+	{
+		if (thread_shard_ < 0)
+			assignShard();
+
+		return static_cast<size_t>(thread_shard_);
+	}
+
+	uint64_t value() const;
+
+private:
+	static void assignShard();
+
+private:
+	/** shard, padded to a cache line of its own */
+	struct Shard
+	{
+		/** value */
+		volatile uint64_t value;
+
+		/** padding */
+		char reserved[64 - sizeof(uint64_t)];
+	};
+
+	/** shards */
+	Shard shards_[ShardCount];
+
+	/** shard of the current thread; -1 if not assigned yet */
+	static THREAD_LOCAL int thread_shard_;
+
+	/** number of shards assigned so far */
+	static volatile uint32_t next_shard_;
+};
+
+/**
+ * Collects samples and renders them in the Prometheus text format.
+ * Samples of the same metric are grouped, so collectors may add them in
+ * any order.
+ */
+class UnrealMetricWriter
+{
+public:
+	void counter(const String& name, const String& help, double value,
+		const String& labels = String());
+	void gauge(const String& name, const String& help, double value,
+		const String& labels = String());
+	void histogram(const String& name, const String& help,
+		const UnrealHistogram& hist, const String& labels = String());
+	static String label(const String& key, const String& value);
+	String str();
+
+private:
+	/** samples of one metric */
+	struct Family
+	{
+		/** metric name */
+		String name;
+
+		/** help text */
+		String help;
+
+		/** metric type */
+		const char* type;
+
+		/** sample lines */
+		String samples;
+	};
+
+	Family& family(const String& name, const String& help,
+		const char* type);
+	static void sample(Family& fam, const String& name,
+		const String& labels, double value);
+
+private:
+	/** metrics in order of appearance */
+	List<Family> families_;
+
+	/** index into families_ by name */
+	HashMap<String, size_t> index_;
+};
+
+/**
+ * Metrics registry. Subsystems register collectors, which are called to
+ * write their current counters, gauges and histograms whenever metrics
+ * are requested.
+ *
+ * The metrics are served in the Prometheus text format on
+ * http://<Metrics::Address>:<Metrics::Port>/metrics, using the event
+ * reactor. Only loopback addresses are accepted; a port of 0 disables the
+ * listener.
+ */
+class UnrealMetrics
+{
+public:
+	/** callback writing samples */
+	typedef boost::function<void(UnrealMetricWriter&)> Collector;
+
+	/** callback returning a gauge value */
+	typedef boost::function<double()> Function;
+
+public:
+	UnrealMetrics();
+	~UnrealMetrics();
+	void addCollector(const void* owner, const Collector& fn);
+	void addCounter(const void* owner, const String& name,
+		const String& help, const UnrealMetricCounter* counter,
+		const String& labels = String());
+	void addGauge(const void* owner, const String& name,
+		const String& help, const Function& fn,
+		const String& labels = String());
+	void addHistogram(const void* owner, const String& name,
+		const String& help, const UnrealHistogram* hist,
+		const String& labels = String());
+	void removeCollectors(const void* owner);
+	String render();
+	void start();
+	void stop();
+
+private:
+	/** HTTP connection */
+	struct Connection
+	{
+		Connection(boost::asio::io_service& ios);
+
+		/** client socket */
+		boost::asio::ip::tcp::socket socket;
+
+		/** request data */
+		boost::asio::streambuf request;
+
+		/** response data */
+		String response;
+
+		/** closes the connection if the client is too slow */
+		boost::asio::deadline_timer timer;
+	};
+
+	/** registered collector */
+	struct Entry
+	{
+		/** owner, for removal */
+		const void* owner;
+
+		/** collector */
+		Collector fn;
+	};
+
+	/** alias the shared pointer type for connections */
+	typedef boost::shared_ptr<Connection> ConnectionPtr;
+
+	/** alias the error code type */
+	typedef boost::system::error_code ErrorCode;
+
+	void accept();
+	static void close(ConnectionPtr conn);
+	void handleAccept(ConnectionPtr conn, const ErrorCode& ec);
+	void handleRequest(ConnectionPtr conn, const ErrorCode& ec);
+	static void handleTimeout(ConnectionPtr conn, const ErrorCode& ec);
+	static void handleWritten(ConnectionPtr conn, const ErrorCode& ec);
+
+private:
+	/** collectors in order of registration */
+	List<Entry> collectors_;
+
+	/** HTTP acceptor; 0 if not listening */
+	boost::asio::ip::tcp::acceptor* acceptor_;
+
+	/** number of requests served */
+	UnrealMetricCounter requests_;
+};
+
+#endif /* _UNREALIRCD_METRICS_HPP */
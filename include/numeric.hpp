@@ -36,8 +36,11 @@ enum IRCNumeric
 	RPL_CREATED 				= 003,
 	RPL_MYINFO					= 004,
 	RPL_ISUPPORT				= 005,
+	RPL_SNOMASK					= 8,
 
+	RPL_ENDOFSTATS				= 219,
 	RPL_UMODEIS					= 221,
+	RPL_STATSDEBUG				= 249,
 	RPL_LUSERS					= 251,
 	RPL_LUSEROPS				= 252,
 	RPL_LUSERUNKNOWN			= 253,
@@ -47,6 +50,7 @@ enum IRCNumeric
 	RPL_ADMINLOC1				= 257,
 	RPL_ADMINLOC2				= 258,
 	RPL_ADMINEMAIL				= 259,
+	RPL_TRYAGAIN				= 263,
 
 	RPL_AWAY					= 301,
 	RPL_USERHOST				= 302,
@@ -73,6 +77,7 @@ enum IRCNumeric
 	RPL_VERSION					= 351,
 	RPL_WHOREPLY				= 352,
 	RPL_NAMREPLY				= 353,
+	RPL_WHOSPCRPL				= 354,
 	RPL_ENDOFNAMES				= 366,
 	RPL_BANLIST					= 367,
 	RPL_ENDOFBANLIST			= 368,
@@ -91,6 +96,7 @@ enum IRCNumeric
 	ERR_CANNOTSENDTOCHAN		= 404,
 	ERR_TOOMANYCHANNELS			= 405,
 	ERR_NOTEXTTOSEND			= 412,
+	ERR_TOOMANYMATCHES			= 416,
 	ERR_UNKNOWNCOMMAND			= 421,
 	ERR_NOMOTD					= 422,
 	ERR_NOADMININFO				= 423,
@@ -103,6 +109,7 @@ enum IRCNumeric
 	ERR_NEEDMOREPARAMS 			= 461,
 	ERR_ALREADYREGISTERED		= 462,
 	ERR_PASSWDMISMATCH			= 464,
+	ERR_YOUREBANNEDCREEP		= 465,
 	ERR_CHANNELISFULL			= 471,
 	ERR_UNKNOWNMODE				= 472,
 	ERR_INVITEONLYCHAN			= 473,
@@ -113,7 +120,23 @@ enum IRCNumeric
 	ERR_NOOPERHOST				= 491,
 
 	ERR_UMODEUNKNOWNFLAG		= 501,
-	ERR_USERSDONTMATCH			= 502
+	ERR_USERSDONTMATCH			= 502,
+	ERR_TOOMANYWATCH			= 512,
+
+	RPL_LOGON					= 600,
+	RPL_LOGOFF					= 601,
+	RPL_WATCHOFF				= 602,
+	RPL_WATCHSTAT				= 603,
+	RPL_NOWON					= 604,
+	RPL_NOWOFF					= 605,
+	RPL_WATCHLIST				= 606,
+	RPL_ENDOFWATCHLIST			= 607,
+
+	RPL_MONONLINE				= 730,
+	RPL_MONOFFLINE				= 731,
+	RPL_MONLIST					= 732,
+	RPL_ENDOFMONLIST			= 733,
+	ERR_MONLISTFULL				= 734
 };
 
 /** numeric messages */
@@ -122,10 +145,13 @@ enum IRCNumeric
 #define MSG_CREATED				":This server was created %s"
 #define MSG_MYINFO				"%s %s %s %s"
 #define MSG_ISUPPORT			"%s :are supported by this server"
+#define MSG_SNOMASK				"+%s :Server notice mask"
 #define MSG_LUSERS				":There are %d users and %d invisible on %d "\
 								"servers"
 
+#define MSG_ENDOFSTATS			"%s :End of /STATS report"
 #define MSG_UMODEIS				"+%s"
+#define MSG_STATSDEBUG			":%s"
 #define MSG_LUSEROPS			"%d :operator(s) online"
 #define MSG_LUSERUNKNOWN		"%d :unknown connection(s)"
 #define MSG_LUSERCHANNELS		"%d :channels formed"
@@ -133,6 +159,7 @@ enum IRCNumeric
 #define MSG_ADMINME				":Administrative information about \"%s\""
 #define MSG_LUSERHIGHEST		":Highest connection count: %d (%d clients, %d"\
 								" total connections since server was started)"
+#define MSG_TRYAGAIN			"%s :Please wait a while and try again."
 #define MSG_AWAY				"%s :%s"
 #define MSG_USERHOST			":%s%s=%s%s@%s"
 #define MSG_ISON				":%s"
@@ -157,6 +184,7 @@ enum IRCNumeric
 #define MSG_VERSION				"%s.%d %s :%s"
 #define MSG_WHOREPLY			"%s %s %s %s %s %s :%d %s"
 #define MSG_NAMREPLY			"%c %s :%s"
+#define MSG_WHOSPCRPL			"%s"
 #define MSG_ENDOFNAMES			"%s :End of /NAMES list."
 #define MSG_BANLIST				"%s %s %d"
 #define MSG_ENDOFBANLIST		":End of channel ban list"
@@ -175,6 +203,8 @@ enum IRCNumeric
 #define MSG_CANNOTSENDTOCHAN	"%s :Cannot send to channel"
 #define MSG_TOOMANYCHANNELS		"%s :You have joined too many channels"
 #define MSG_NOTEXTTOSEND		":No text to send"
+#define MSG_TOOMANYMATCHES		"%s :Too many lines in the output, restrict "\
+								"your query"
 #define MSG_UNKNOWNCOMMAND		"%s :Unknown command"
 #define MSG_NOMOTD				":No MOTD available"
 #define MSG_NOADMININFO			"%s :No administrative info available"
@@ -187,6 +217,7 @@ enum IRCNumeric
 #define MSG_NEEDMOREPARAMS		"%s :Not enough parameters"
 #define MSG_ALREADYREGISTERED	":You may not reregister"
 #define MSG_PASSWDMISMATCH		":Password incorrect"
+#define MSG_YOUREBANNEDCREEP	":You are banned from this server (%s)"
 #define MSG_CHANNELISFULL		"%s :Cannot join channel (+l); Full."
 #define MSG_UNKNOWNMODE			"%c :Unknown channel mode flag"
 #define MSG_INVITEONLYCHAN		"%s :Cannot join channel (+i); Invite only."
@@ -200,6 +231,23 @@ enum IRCNumeric
 
 #define MSG_UMODEUNKNOWNFLAG	"%c :Unknown user mode flag"
 #define MSG_USERSDONTMATCH		":Can't change MODE for other users"
+#define MSG_TOOMANYWATCH		"%s :Maximum size for WATCH-list is %d "\
+								"entries"
+
+#define MSG_LOGON				"%s %s %s %d :logged online"
+#define MSG_LOGOFF				"%s %s %s %d :logged offline"
+#define MSG_WATCHOFF			"%s %s %s %d :stopped watching"
+#define MSG_WATCHSTAT			":You have %d and are on %d WATCH entries"
+#define MSG_NOWON				"%s %s %s %d :is online"
+#define MSG_NOWOFF				"%s * * 0 :is offline"
+#define MSG_WATCHLIST			":%s"
+#define MSG_ENDOFWATCHLIST		":End of WATCH %c"
+
+#define MSG_MONONLINE			":%s"
+#define MSG_MONOFFLINE			":%s"
+#define MSG_MONLIST				":%s"
+#define MSG_ENDOFMONLIST		":End of MONITOR list"
+#define MSG_MONLISTFULL			"%d %s :Monitor list is full."
 
 #define MSG_INSMODFAILED		":Loading module failed: %s"
 #define MSG_INSMODOK			":Module \"%s\", Version \"%s\" loaded"
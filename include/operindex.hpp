@@ -0,0 +1,93 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         operindex.hpp
+ * Description  Index of local IRC operators and server notice masks
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_OPERINDEX_HPP
+#define _UNREALIRCD_OPERINDEX_HPP
+
+#include <list.hpp>
+#include <map.hpp>
+#include <string.hpp>
+
+class UnrealUser;
+
+/**
+ * Keeps track of the local IRC operators and the server notice categories
+ * (snomasks) each of them has subscribed to.
+ *
+ * Every category has its own subscriber list, so a server notice is only
+ * delivered to the operators interested in it, without walking the whole
+ * user list.
+ */
+class UnrealOperIndex
+{
+public:
+	/** server notice categories */
+	enum Snomask
+	{
+		/** general notices ('s') */
+		SNGeneral	= 0x01,
+
+		/** local client connects and exits ('c') */
+		SNConnect	= 0x02,
+
+		/** KILLs ('k') */
+		SNKill		= 0x04,
+
+		/** flooding clients ('f') */
+		SNFlood		= 0x08,
+
+		/** users becoming IRC operators ('o') */
+		SNOper		= 0x10
+	};
+
+	/** number of server notice categories */
+	static const size_t SnomaskCount = 5;
+
+public:
+	void add(UnrealUser* uptr, uint8_t snomask);
+	bool contains(UnrealUser* uptr);
+	uint8_t mask(UnrealUser* uptr);
+	static String maskString(uint8_t snomask);
+	void notice(Snomask category, const String& msg);
+	const List<UnrealUser*>& opers();
+	static uint8_t parseMask(const String& changes, uint8_t snomask);
+	void remove(UnrealUser* uptr);
+	void setMask(UnrealUser* uptr, uint8_t snomask);
+
+private:
+	static size_t slot(uint8_t category);
+
+private:
+	/** local IRC operators */
+	List<UnrealUser*> opers_;
+
+	/** subscribed categories per operator */
+	Map<UnrealUser*, uint8_t> masks_;
+
+	/** subscribers per category */
+	List<UnrealUser*> subscribers_[SnomaskCount];
+};
+
+#endif /* _UNREALIRCD_OPERINDEX_HPP */
@@ -69,6 +69,7 @@
 // compiler
 #if defined(_MSC_VER)
 #define COMPILER_MSVC
+#define THREAD_LOCAL __declspec(thread)
 typedef __int8 int8_t;
 typedef __int16 int16_t;
 typedef __int32 int32_t;
@@ -79,6 +80,7 @@ typedef unsigned __int32 uint32_t;
 typedef unsigned __int64 uint64_t;
 #elif defined(__GNUC__)
 #define COMPILER_GCC
+#define THREAD_LOCAL __thread
 #include <inttypes.h>
 #endif
 
@@ -0,0 +1,59 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         probes.hpp
+ * Description  USDT probe points
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_PROBES_HPP
+#define _UNREALIRCD_PROBES_HPP
+
+extern "C"
+{
+#include <config.h>
+}
+
+/**
+ * Static tracing probes of the "unrealircd" provider.
+ * With --enable-usdt, every probe compiles into a single nop and a note in
+ * the binary which tracers like bpftrace or perf attach to at run time.
+ * Otherwise the macros expand to nothing. Probe arguments are evaluated
+ * even if no tracer is attached, so only pass values which are at hand
+ * anyway. See docs/probes.txt for the list of probes.
+ */
+#if defined(HAVE_USDT)
+#  include <sys/sdt.h>
+#  define UNREAL_PROBE1(name, a) \
+	DTRACE_PROBE1(unrealircd, name, a)
+#  define UNREAL_PROBE2(name, a, b) \
+	DTRACE_PROBE2(unrealircd, name, a, b)
+#  define UNREAL_PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(unrealircd, name, a, b, c)
+#  define UNREAL_PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(unrealircd, name, a, b, c, d)
+#else
+#  define UNREAL_PROBE1(name, a) do { } while (0)
+#  define UNREAL_PROBE2(name, a, b) do { } while (0)
+#  define UNREAL_PROBE3(name, a, b, c) do { } while (0)
+#  define UNREAL_PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* _UNREALIRCD_PROBES_HPP */
@@ -0,0 +1,162 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         prototrace.hpp
+ * Description  Protocol trace ring
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_PROTOTRACE_HPP
+#define _UNREALIRCD_PROTOTRACE_HPP
+
+#include <list.hpp>
+#include <platform.hpp>
+#include <string.hpp>
+
+class UnrealSocket;
+
+/**
+ * In-memory trace of the protocol lines sent and received on client
+ * connections.
+ *
+ * Lines are copied into a fixed-size byte ring together with a binary
+ * header (time, connection, direction, length); nothing is formatted
+ * until the trace is dumped, and the oldest lines are overwritten once the
+ * ring is full. With tracing disabled, record() costs a single test.
+ *
+ * The trace is dumped into Trace::File on request (PTRACE DUMP, or the
+ * SIGUSR2 signal), and into Trace::File with ".crash" appended if the
+ * server crashes. Recording can be limited to a set of watched
+ * connections; once limited, it stays so until watchAll() is called, even
+ * if no watched connection is left. Arguments of OPER and PASS lines are
+ * not recorded.
+ */
+class UnrealProtocolTrace
+{
+public:
+	/** line direction */
+	enum Direction
+	{
+		/** line received from the client */
+		In = '>',
+
+		/** line sent to the client */
+		Out = '<'
+	};
+
+public:
+	UnrealProtocolTrace();
+	~UnrealProtocolTrace();
+	size_t bytes();
+	void clear();
+	bool dump(const String& file, uint64_t connection, size_t& count);
+	bool enabled();
+	const String& fileName();
+	void init();
+	bool isWatched(UnrealSocket* sptr);
+	void poll();
+	size_t records();
+	void setEnabled(bool enable);
+	size_t size();
+	void unwatch(UnrealSocket* sptr);
+	void watch(UnrealSocket* sptr);
+	void watchAll();
+	const List<UnrealSocket*>& watched();
+	bool watchingAll();
+
+	/**
+	 * Record a protocol line.
+	 *
+	 * @param sptr Socket the line was sent or received on
+	 * @param dir Direction
+	 * @param line Line without CRLF
+	 */
+	inline void record(UnrealSocket* sptr, Direction dir, const String& line)
+	{
+		if (enabled_)
+			append(sptr, dir, line);
+	}
+
+private:
+	/** record header, followed by `length' bytes of text */
+	struct Header
+	{
+		/** monotonic time in microseconds */
+		uint64_t time;
+
+		/** connection number, see UnrealSocket::id() */
+		uint64_t connection;
+
+		/** file descriptor */
+		int32_t fd;
+
+		/** text length */
+		uint16_t length;
+
+		/** direction */
+		uint8_t direction;
+
+		/** padding */
+		uint8_t reserved;
+	};
+
+	void append(UnrealSocket* sptr, Direction dir, const String& line);
+	void copyIn(uint64_t pos, const void* src, size_t len);
+	void copyOut(uint64_t pos, void* dst, size_t len);
+	bool dumpTo(int out, uint64_t connection, size_t& count);
+	static void handleCrash(int sig);
+	static void handleDumpSignal(int sig);
+
+private:
+	/** byte ring */
+	char* buffer_;
+
+	/** ring size in bytes */
+	size_t size_;
+
+	/** total number of bytes written to the ring */
+	uint64_t head_;
+
+	/** position of the oldest record */
+	uint64_t tail_;
+
+	/** number of records in the ring */
+	size_t records_;
+
+	/** whether lines are recorded */
+	bool enabled_;
+
+	/** whether all connections are recorded, rather than watched_ */
+	bool watch_all_;
+
+	/** connections to record unless watch_all_ is set */
+	List<UnrealSocket*> watched_;
+
+	/** wall clock minus monotonic time, in microseconds */
+	int64_t wall_offset_;
+
+	/** dump file name */
+	String file_;
+
+	/** crash dump file name, prepared for the signal handler */
+	char crash_file_[256];
+};
+
+#endif /* _UNREALIRCD_PROTOTRACE_HPP */
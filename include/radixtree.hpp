@@ -0,0 +1,434 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         radixtree.hpp
+ * Description  Radix tree for IP address prefixes
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_RADIXTREE_HPP
+#define _UNREALIRCD_RADIXTREE_HPP
+
+#include <platform.hpp>
+#include <string.hpp>
+
+#include <cstddef>
+#include <vector>
+#include <boost/asio.hpp>
+
+/**
+ * Path-compressed binary radix tree, mapping IP address prefixes (CIDR
+ * blocks) to values. IPv4 addresses are stored as IPv4-mapped IPv6
+ * addresses, so both families share one tree; a lookup visits at most one
+ * node per distinct prefix length on the way to the address.
+ *
+ * This class is header-only.
+ */
+template<typename _ValueType>
+class UnrealRadixTree
+{
+public:
+	/** address key, 128 bits */
+	typedef boost::asio::ip::address_v6::bytes_type Key;
+
+public:
+	UnrealRadixTree()
+		: root_(0), size_(0)
+	{ }
+
+	~UnrealRadixTree()
+	{
+		clear();
+	}
+
+	/**
+	 * Remove all entries.
+	 */
+	void clear()
+	{
+		destroy(root_);
+		root_ = 0;
+		size_ = 0;
+	}
+
+	/**
+	 * Returns the value stored for a prefix, adding a default constructed
+	 * one if there is none yet.
+	 *
+	 * @param key Prefix address
+	 * @param bits Prefix length, 0 to 128
+	 * @return Stored value
+	 */
+	_ValueType& insert(const Key& key, size_t bits)
+	{
+		Node** slot = &root_;
+
+		while (*slot)
+		{
+			Node* n = *slot;
+			size_t common = commonBits(key, n->key,
+				bits < n->bits ? bits : n->bits);
+
+			if (common < n->bits)
+			{
+				Node* fresh = new Node(key, bits);
+
+				if (common == bits)
+				{
+					/* the new prefix covers the existing node */
+					fresh->child[bit(n->key, bits)] = n;
+					*slot = fresh;
+				}
+				else
+				{
+					/* branch where both prefixes part */
+					Node* branch = new Node(key, common);
+
+					branch->child[bit(n->key, common)] = n;
+					branch->child[bit(key, common)] = fresh;
+					*slot = branch;
+				}
+
+				return claim(fresh);
+			}
+
+			if (n->bits == bits)
+				return claim(n);
+
+			slot = &n->child[bit(key, n->bits)];
+		}
+
+		*slot = new Node(key, bits);
+		return claim(*slot);
+	}
+
+	/**
+	 * Returns the value of the shortest stored prefix containing an
+	 * address.
+	 *
+	 * @param key Address
+	 * @return Value, or 0 if no prefix contains the address
+	 */
+	_ValueType* match(const Key& key)
+	{
+		Node* n = root_;
+
+		while (n && commonBits(key, n->key, n->bits) == n->bits)
+		{
+			if (n->used)
+				return &n->value;
+
+			if (n->bits >= 128)
+				break;
+
+			n = n->child[bit(key, n->bits)];
+		}
+
+		return 0;
+	}
+
+	/**
+	 * Collect the values of all stored prefixes containing an address,
+	 * shortest prefix first.
+	 *
+	 * @param key Address
+	 * @param out Receives pointers to the values
+	 * @return Number of values found
+	 */
+	size_t matchAll(const Key& key, std::vector<_ValueType*>& out)
+	{
+		Node* n = root_;
+		size_t found = 0;
+
+		while (n && commonBits(key, n->key, n->bits) == n->bits)
+		{
+			if (n->used)
+			{
+				out.push_back(&n->value);
+				found++;
+			}
+
+			if (n->bits >= 128)
+				break;
+
+			n = n->child[bit(key, n->bits)];
+		}
+
+		return found;
+	}
+
+	/**
+	 * Returns whether a prefix contains an address.
+	 *
+	 * @param prefix Prefix address
+	 * @param bits Prefix length
+	 * @param key Address
+	 * @return True if contained, otherwise false
+	 */
+	static bool contains(const Key& prefix, size_t bits, const Key& key)
+	{
+		return (commonBits(prefix, key, bits) == bits);
+	}
+
+	/**
+	 * Returns the value stored for exactly this prefix.
+	 *
+	 * @param key Prefix address
+	 * @param bits Prefix length
+	 * @return Value, or 0 if not stored
+	 */
+	_ValueType* find(const Key& key, size_t bits)
+	{
+		Node* n = root_;
+
+		while (n && n->bits <= bits
+				&& commonBits(key, n->key, n->bits) == n->bits)
+		{
+			if (n->bits == bits)
+				return (n->used ? &n->value : 0);
+
+			n = n->child[bit(key, n->bits)];
+		}
+
+		return 0;
+	}
+
+	/**
+	 * Remove the value stored for a prefix.
+	 *
+	 * @param key Prefix address
+	 * @param bits Prefix length
+	 * @return True if removed, false if there was none
+	 */
+	bool remove(const Key& key, size_t bits)
+	{
+		return remove(&root_, key, bits);
+	}
+
+	/**
+	 * Returns the number of stored prefixes.
+	 *
+	 * @return Prefix count
+	 */
+	size_t size() const
+	{
+		return size_;
+	}
+
+	/**
+	 * Build the key for an address.
+	 *
+	 * @param addr IPv4 or IPv6 address
+	 * @return Key
+	 */
+	static Key key(const boost::asio::ip::address& addr)
+	{
+		if (addr.is_v4())
+		{
+			return boost::asio::ip::address_v6::v4_mapped(addr.to_v4())
+				.to_bytes();
+		}
+
+		return addr.to_v6().to_bytes();
+	}
+
+	/**
+	 * Parse an address or CIDR block like "192.0.2.0/24" or
+	 * "2001:db8::/32". Host bits below the prefix are cleared.
+	 *
+	 * @param str Text to parse
+	 * @param key Receives the prefix address
+	 * @param bits Receives the prefix length, counted on the 128 bit key
+	 * @return True on success, otherwise false
+	 */
+	static bool parse(const String& str, Key& key, size_t& bits)
+	{
+		String text = str;
+		String addr_str = text;
+		long prefix = -1;
+		size_t slash = text.find('/');
+		boost::system::error_code ec;
+
+		if (slash != String::npos)
+		{
+			String len_str = text.mid(slash + 1);
+
+			addr_str = text.left(slash);
+
+			if (len_str.empty()
+					|| len_str.find_first_not_of("0123456789") != String::npos)
+				return false;
+
+			prefix = len_str.toInt();
+		}
+
+		boost::asio::ip::address addr =
+			boost::asio::ip::address::from_string(addr_str, ec);
+
+		if (ec)
+			return false;
+
+		size_t max = addr.is_v4() ? 32 : 128;
+
+		if (prefix < 0)
+			prefix = max;
+		else if (static_cast<size_t>(prefix) > max)
+			return false;
+
+		key = UnrealRadixTree::key(addr);
+		bits = prefix + (addr.is_v4() ? 96 : 0);
+
+		for (size_t i = bits; i < 128; ++i)
+			key[i / 8] &= ~(0x80 >> (i % 8));
+
+		return true;
+	}
+
+private:
+	/** tree node; nodes without value only exist as branch points */
+	struct Node
+	{
+		Node(const Key& k, size_t b)
+			: key(k), bits(b), used(false), value()
+		{
+			child[0] = child[1] = 0;
+		}
+
+		/** prefix address */
+		Key key;
+
+		/** prefix length */
+		size_t bits;
+
+		/** whether a value is stored here */
+		bool used;
+
+		/** stored value */
+		_ValueType value;
+
+		/** subtrees, by the bit following the prefix */
+		Node* child[2];
+	};
+
+	/**
+	 * Returns the bit at a position of a key.
+	 */
+	static int bit(const Key& key, size_t pos)
+	{
+		return (key[pos / 8] >> (7 - pos % 8)) & 1;
+	}
+
+	/**
+	 * Mark a node as holding a value and return it.
+	 */
+	_ValueType& claim(Node* n)
+	{
+		if (!n->used)
+		{
+			n->used = true;
+			size_++;
+		}
+
+		return n->value;
+	}
+
+	/**
+	 * Returns the number of leading bits two keys have in common, up to
+	 * a limit.
+	 */
+	static size_t commonBits(const Key& a, const Key& b, size_t limit)
+	{
+		size_t pos = 0;
+
+		/* compare whole bytes first */
+		while (pos + 8 <= limit && a[pos / 8] == b[pos / 8])
+			pos += 8;
+
+		while (pos < limit && bit(a, pos) == bit(b, pos))
+			++pos;
+
+		return pos;
+	}
+
+	/**
+	 * Free a subtree.
+	 */
+	static void destroy(Node* n)
+	{
+		if (!n)
+			return;
+
+		destroy(n->child[0]);
+		destroy(n->child[1]);
+		delete n;
+	}
+
+	/**
+	 * Remove a prefix below a slot and drop branch nodes which aren't
+	 * needed anymore.
+	 */
+	bool remove(Node** slot, const Key& key, size_t bits)
+	{
+		Node* n = *slot;
+
+		if (!n || n->bits > bits || commonBits(key, n->key, n->bits) != n->bits)
+			return false;
+
+		bool removed = false;
+
+		if (n->bits == bits)
+		{
+			if (!n->used)
+				return false;
+
+			n->used = false;
+			n->value = _ValueType();
+			size_--;
+			removed = true;
+		}
+		else
+			removed = remove(&n->child[bit(key, n->bits)], key, bits);
+
+		if (removed && !n->used)
+		{
+			/* collapse nodes with less than two subtrees */
+			if (!n->child[0] || !n->child[1])
+			{
+				*slot = (n->child[0] ? n->child[0] : n->child[1]);
+				delete n;
+			}
+		}
+
+		return removed;
+	}
+
+private:
+	/** root node */
+	Node* root_;
+
+	/** number of stored prefixes */
+	size_t size_;
+
+	/* not copyable */
+	UnrealRadixTree(const UnrealRadixTree&);
+	UnrealRadixTree& operator=(const UnrealRadixTree&);
+};
+
+#endif /* _UNREALIRCD_RADIXTREE_HPP */
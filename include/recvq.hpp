@@ -42,6 +42,7 @@ public:
 
 public:
 	UnrealRecvQueue();
+	~UnrealRecvQueue();
 	void add(const String& str);
 	String getline();
 	size_t length();
@@ -49,6 +50,9 @@ public:
 	void setLimit(Type type, const uint16_t& lim);
 	size_t size();
 
+private:
+	void accountMemory();
+
 private:
 	/** actual queue contents */
 	String queue_str_;
@@ -58,6 +62,9 @@ private:
 
 	/** soft limit, bytes */
 	uint16_t soft_limit_;
+
+	/** memory accounted for the queue */
+	size_t memory_;
 };
 
 #endif /* _UNREALIRCD_RECVQ_HPP */
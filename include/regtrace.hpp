@@ -0,0 +1,99 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         regtrace.hpp
+ * Description  Registration latency tracing
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_REGTRACE_HPP
+#define _UNREALIRCD_REGTRACE_HPP
+
+#include <histogram.hpp>
+#include <platform.hpp>
+
+/**
+ * Timestamps of the steps a client connection passes until it's registered.
+ */
+class UnrealRegistrationTrace
+{
+public:
+	/** registration phases, in their usual order */
+	enum Phase
+	{
+		/** connection accepted; all other phases are relative to it */
+		Accept,
+
+		/** first data received from the client */
+		FirstByte,
+
+		/** hostname lookup finished */
+		DNS,
+
+		/** ident check finished */
+		Ident,
+
+		/** NICK received */
+		Nick,
+
+		/** USER received */
+		User,
+
+		/** registration PING sent */
+		Ping,
+
+		/** PONG for the registration PING received */
+		Pong,
+
+		/** welcome burst sent */
+		Welcome,
+
+		/** number of phases */
+		PhaseCount
+	};
+
+public:
+	UnrealRegistrationTrace();
+	uint64_t elapsed(Phase phase) const;
+	void mark(Phase phase);
+	static const char* phaseName(Phase phase);
+	bool reached(Phase phase) const;
+
+private:
+	/** monotonic timestamps per phase; zero if not reached */
+	uint64_t marks_[PhaseCount];
+};
+
+/**
+ * Registration latency histograms, one per phase.
+ */
+class UnrealRegistrationStats
+{
+public:
+	void add(const UnrealRegistrationTrace& trace);
+	void merge(const UnrealRegistrationStats& other);
+	const UnrealHistogram& phase(UnrealRegistrationTrace::Phase phase) const;
+
+private:
+	/** time from accept until the phase was reached */
+	UnrealHistogram phases_[UnrealRegistrationTrace::PhaseCount];
+};
+
+#endif /* _UNREALIRCD_REGTRACE_HPP */
@@ -0,0 +1,67 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         replystream.hpp
+ * Description  Resumable reply streams
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_REPLYSTREAM_HPP
+#define _UNREALIRCD_REPLYSTREAM_HPP
+
+#include <platform.hpp>
+
+class UnrealUser;
+
+/**
+ * Base class for large replies (like LIST or WHO) that are produced in
+ * chunks. The user object calls produce() only while the send queue of the
+ * user is below the watermark, and resumes the stream once the send queue
+ * has drained. Streams must not keep pointers to objects that may go away
+ * between two calls; they should keep a key (like a channel name) and look
+ * the object up again instead.
+ */
+class UnrealReplyStream
+{
+public:
+	/** stream state after producing a chunk */
+	enum Result
+	{
+		/** there are more lines to send */
+		More,
+
+		/** the reply is complete; the stream will be deleted */
+		Done
+	};
+
+public:
+	virtual ~UnrealReplyStream() { }
+
+	/**
+	 * Send the next chunk of the reply.
+	 *
+	 * @param uptr User receiving the reply
+	 * @param max_lines Maximum number of lines to send
+	 * @return More or Done
+	 */
+	virtual Result produce(UnrealUser* uptr, size_t max_lines) = 0;
+};
+
+#endif /* _UNREALIRCD_REPLYSTREAM_HPP */
@@ -26,44 +26,346 @@
 #ifndef _UNREALIRCD_RESOLVER_HPP
 #define _UNREALIRCD_RESOLVER_HPP
 
+#include <hashmap.hpp>
+#include <histogram.hpp>
+#include <list.hpp>
 #include <map.hpp>
 #include <reactor.hpp>
 #include <string.hpp>
+#include <timer.hpp>
 
+#include <ares.h>
+#include <ctime>
+#include <list>
+#include <vector>
 #include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signal.hpp>
 
 using namespace boost::asio::ip;
 
+class UnrealResolver;
+
+/**
+ * Result of a DNS query: the hostname and the addresses found.
+ */
+struct UnrealResolverResult
+{
+	/** hostname */
+	String hostname;
+
+	/** addresses, with the port of the query */
+	std::vector<tcp::endpoint> endpoints;
+};
+
+/**
+ * A single entry of a resolver result, modelled after boost's resolver
+ * entries.
+ */
+class UnrealResolverEntry
+{
+public:
+	UnrealResolverEntry(const tcp::endpoint& ep, const String& hostname);
+	const tcp::endpoint& endpoint() const;
+	const String& host_name() const;
+	operator tcp::endpoint() const;
+
+private:
+	/** address */
+	tcp::endpoint endpoint_;
+
+	/** hostname */
+	String hostname_;
+};
+
+/**
+ * Forward iterator over the entries of a resolver result. A default
+ * constructed iterator marks the end.
+ */
+class UnrealResolverIterator
+{
+public:
+	UnrealResolverIterator();
+	UnrealResolverIterator(const boost::shared_ptr<UnrealResolverResult>& r);
+	UnrealResolverEntry operator*() const;
+	UnrealResolverIterator& operator++();
+	UnrealResolverIterator operator++(int);
+	bool operator==(const UnrealResolverIterator& other) const;
+	bool operator!=(const UnrealResolverIterator& other) const;
+
+private:
+	/** shared result; 0 at the end */
+	boost::shared_ptr<UnrealResolverResult> result_;
+
+	/** current entry */
+	size_t pos_;
+};
+
+/**
+ * DNS channel on top of c-ares. The sockets of c-ares are watched by the
+ * event reactor and its timeouts are driven by a reactor timer, so any
+ * number of queries can be in flight without blocking the reactor or
+ * occupying a thread.
+ *
+ * Results are kept in a bounded LRU cache for the TTL of the records
+ * (capped by DNS::CacheMaxTTL); failures are cached for DNS::NegativeTTL.
+ * Identical queries in flight at the same time share one lookup.
+ * The number of lookups sent at the same time is limited by
+ * DNS::MaxQueries; additional lookups wait in order.
+ */
+class UnrealResolverChannel
+{
+public:
+	/** error code type */
+	typedef boost::system::error_code ErrorCode;
+
+	struct Lookup;
+
+	/** query of a single resolver */
+	struct Request
+	{
+		/** query types */
+		enum Type
+		{
+			/** address to hostname */
+			Reverse,
+
+			/** hostname to addresses */
+			Forward
+		};
+
+		/** resolver waiting for the result; 0 if gone */
+		UnrealResolver* owner;
+
+		/** query type */
+		Type type;
+
+		/** address to look up (Reverse) */
+		tcp::endpoint endpoint;
+
+		/** hostname to look up (Forward) */
+		String hostname;
+
+		/** port for the resulting endpoints */
+		uint16_t port;
+
+		/** address family requested by the owner (Forward) */
+		int family;
+
+		/** shared lookup; 0 once the result has been posted */
+		Lookup* lookup;
+	};
+
+	/** DNS lookup, shared by all requests for the same record */
+	struct Lookup
+	{
+		/** cache key */
+		String key;
+
+		/** name to query */
+		String name;
+
+		/** query type */
+		Request::Type type;
+
+		/** address to look up (Reverse) */
+		address addr;
+
+		/** address family requested (Forward) */
+		int family;
+
+		/** address family currently queried (Forward) */
+		int current_family;
+
+		/** whether the lookup has been handed to c-ares */
+		bool started;
+
+		/** monotonic time the lookup was handed to c-ares */
+		uint64_t started_at;
+
+		/** requests waiting for the result */
+		List<Request*> waiters;
+	};
+
+	/** cache and query counters */
+	struct Counters
+	{
+		/** requests answered from the cache */
+		size_t hits;
+
+		/** requests that needed a lookup */
+		size_t misses;
+
+		/** requests that joined a lookup in flight */
+		size_t shared;
+
+		/** lookups that failed */
+		size_t failures;
+	};
+
+public:
+	UnrealResolverChannel();
+	~UnrealResolverChannel();
+	size_t cacheSize();
+	void cancel(Request* req);
+	const Counters& counters();
+	const UnrealHistogram& latency();
+	size_t pending();
+	void submit(Request* req);
+
+private:
+	/** watched c-ares socket */
+	struct Watch
+	{
+		Watch(UnrealReactor& reactor, ares_socket_t sock);
+
+		/** c-ares socket */
+		ares_socket_t fd;
+
+		/** duplicate of the socket, registered with the reactor */
+		boost::asio::posix::stream_descriptor descriptor;
+
+		/** whether c-ares waits for the socket to become readable */
+		bool want_read;
+
+		/** whether c-ares waits for the socket to become writable */
+		bool want_write;
+
+		/** whether a read wait is outstanding */
+		bool reading;
+
+		/** whether a write wait is outstanding */
+		bool writing;
+	};
+
+	/** cached lookup result */
+	struct CacheEntry
+	{
+		/** cache key */
+		String key;
+
+		/** expiry time */
+		time_t expires;
+
+		/** error code of the lookup */
+		ErrorCode ec;
+
+		/** hostname and addresses, without port */
+		UnrealResolverResult result;
+	};
+
+	/** alias the shared pointer type for watches */
+	typedef boost::shared_ptr<Watch> WatchPtr;
+
+	/** alias the LRU list type; most recently used entries first */
+	typedef std::list<CacheEntry> CacheList;
+
+	static uint32_t answerTTL(const unsigned char* abuf, int alen);
+	void complete(Lookup* lookup, const ErrorCode& ec,
+		const UnrealResolverResult& result, uint32_t ttl);
+	void deliver(Request* req, const ErrorCode& ec,
+		UnrealResolverIterator result);
+	static ErrorCode errorFromStatus(int status);
+	void finish();
+	static void handleAnswer(void* arg, int status, int timeouts,
+		unsigned char* abuf, int alen);
+	void handleReadable(WatchPtr watch, const ErrorCode& ec);
+	static void handleSocketState(void* data, ares_socket_t fd,
+		int readable, int writable);
+	void handleTimeout(const ErrorCode& ec);
+	void handleWritable(WatchPtr watch, const ErrorCode& ec);
+	bool isCurrent(WatchPtr watch);
+	void post(Request* req, const ErrorCode& ec,
+		const UnrealResolverResult& result);
+	void scheduleTimeout();
+	void send(Lookup* lookup);
+	void start(Lookup* lookup);
+	void startWait(WatchPtr watch);
+	void store(const String& key, const ErrorCode& ec,
+		const UnrealResolverResult& result, uint32_t ttl);
+
+private:
+	/** c-ares channel */
+	ares_channel channel_;
+
+	/** whether channel_ is valid */
+	bool initialized_;
+
+	/** watched sockets */
+	Map<ares_socket_t, WatchPtr> watches_;
+
+	/** timer for c-ares timeouts */
+	UnrealTimer timer_;
+
+	/** lookups waiting for a free slot */
+	List<Lookup*> waiting_;
+
+	/** lookups in flight or waiting, by cache key */
+	HashMap<String, Lookup*> inflight_;
+
+	/** lookups handed to c-ares */
+	size_t active_;
+
+	/** concurrency limit */
+	size_t max_active_;
+
+	/** cached results in LRU order */
+	CacheList cache_;
+
+	/** cache index */
+	HashMap<String, CacheList::iterator> cache_index_;
+
+	/** cache size limit */
+	size_t cache_max_;
+
+	/** upper TTL limit for positive results, in seconds */
+	uint32_t max_ttl_;
+
+	/** TTL for failed lookups, in seconds */
+	uint32_t negative_ttl_;
+
+	/** counters */
+	Counters counters_;
+
+	/** time from handing a lookup to c-ares until its completion */
+	UnrealHistogram latency_;
+};
+
 /**
- * Resolver class.
+ * Resolver class. Each object handles one query at a time and reports
+ * the result through the onResolve signal.
  */
 class UnrealResolver
-	: public tcp::resolver
 {
 public:
 	/** error code type */
 	typedef boost::system::error_code ErrorCode;
 	
 	/** result iterator */
-	typedef tcp::resolver::iterator Iterator;
+	typedef UnrealResolverIterator Iterator;
 	
 	/** endpoint type */
-	typedef tcp::resolver::endpoint_type Endpoint;
-	
-	/** query type */
-	typedef tcp::resolver::query Query;
+	typedef tcp::endpoint Endpoint;
 
 public:
 	UnrealResolver();
+	~UnrealResolver();
+	static UnrealResolverChannel& channel();
 	void query(Endpoint& ep);
-	void query(const String& hostname, const uint16_t& port);
+	void query(const String& hostname, const uint16_t& port,
+		int family = AF_UNSPEC);
 
 public:
 	boost::signal<void(const ErrorCode&, Iterator)> onResolve;
 
 private:
-	void handleResult(const ErrorCode& ec, Iterator ep_iter);
+	friend class UnrealResolverChannel;
+
+	void cancel();
+
+private:
+	/** pending query, if any */
+	UnrealResolverChannel::Request* request_;
 };
 
 #endif /* _UNREALIRCD_RESOLVER_HPP */
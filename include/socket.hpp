@@ -34,6 +34,7 @@
 #include <string.hpp>
 
 #include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signal.hpp>
 
 using namespace boost::asio::ip;
@@ -66,6 +67,18 @@ public:
 	void connectTo(UnrealResolver::Endpoint& ep);
 	void connectTo(const String& hostname, const uint16_t& portnum);
 	void destroyResolverQuery();
+	void disconnect(ErrorCode& ec);
+	void hangup();
+	uint64_t id();
+	void inject(const String& data);
+	bool isLoopback();
+	bool isOpen();
+	tcp::endpoint localEndpoint(ErrorCode& ec);
+	static uint64_t queuedTotal();
+	tcp::endpoint remoteEndpoint(ErrorCode& ec);
+	size_t sendqSize();
+	void setLoopback(const tcp::endpoint& remote, const tcp::endpoint& local);
+	String takeOutput();
 	UnrealSocketTrafficType traffic();
 	void waitForLine();
 	void write(const String& data);
@@ -75,14 +88,23 @@ public:
 	boost::signal<void(UnrealSocket*, const ErrorCode&)> onDisconnected;
 	boost::signal<void(UnrealSocket*, const ErrorCode&)> onError;
 	boost::signal<void(UnrealSocket*, String&)> onRead;
+	boost::signal<void(UnrealSocket*)> onWrite;
 
 private:
+	void accountMemory();
+	void deliverLine(String& buffer, size_t bytes_read);
 	void handleConnect(const ErrorCode& ec,
 		UnrealResolver::Iterator ep_iter);
+	void handleLoopbackRead(boost::shared_ptr<bool> alive,
+		const ErrorCode& ec);
+	void handleLoopbackWrite(boost::shared_ptr<bool> alive,
+		size_t bytes_written);
 	void handleRead(const ErrorCode& ec, size_t bytes_read);
 	void handleResolveResponse(const ErrorCode& ec,
 		UnrealResolver::Iterator ep_iter);
 	void handleWrite(const ErrorCode& ec, size_t bytes_written);
+	void pollLoopback();
+	void startWrite();
 
 private:
 	/** stream buffer */
@@ -90,6 +112,52 @@ private:
 
 	/** traffic on the socket */
 	UnrealSocketTrafficType traffic_;
+
+	/** data queued for writing */
+	String sendq_;
+
+	/** data currently being written */
+	String write_buffer_;
+
+	/** whether a write operation is in progress */
+	bool writing_;
+
+	/** memory accounted for the send queue buffers */
+	size_t memory_;
+
+	/** whether this is an in-memory connection, see setLoopback() */
+	bool loopback_;
+
+	/** whether the in-memory connection has not been closed yet */
+	bool loopback_open_;
+
+	/** whether the peer of the in-memory connection has hung up */
+	bool loopback_eof_;
+
+	/** whether a line is waited for on the in-memory connection */
+	bool loopback_reading_;
+
+	/** endpoints reported for the in-memory connection */
+	tcp::endpoint loopback_remote_;
+	tcp::endpoint loopback_local_;
+
+	/** data injected but not read yet */
+	String loopback_input_;
+
+	/** data written but not taken yet */
+	String loopback_output_;
+
+	/** cleared on destruction; guards handlers posted for loopback I/O */
+	boost::shared_ptr<bool> alive_;
+
+	/** connection number, unlike the descriptor never reused */
+	uint64_t id_;
+
+	/** last connection number handed out */
+	static uint64_t last_id_;
+
+	/** bytes queued for sending on all sockets */
+	static uint64_t queued_total_;
 };
 
 extern Map<UnrealSocket*, UnrealResolver*> resolver_queries;
@@ -0,0 +1,122 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         throttle.hpp
+ * Description  Per-host connection throttling
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_THROTTLE_HPP
+#define _UNREALIRCD_THROTTLE_HPP
+
+#include <hashmap.hpp>
+#include <string.hpp>
+
+#include <ctime>
+#include <boost/asio.hpp>
+
+class UnrealSocket;
+
+/**
+ * Connection throttle, consulted for every accepted connection before
+ * anything else is done with it.
+ *
+ * Connections are accounted per host, which is the IP address for IPv4
+ * and the /64 prefix for IPv6. A host may hold at most
+ * Throttle::MaxPerHost connections at the same time, and may open
+ * Throttle::Burst connections at once; the allowance refills at that
+ * rate over Throttle::Period seconds. Addresses listed in
+ * Throttle::Exempt are not limited.
+ */
+class UnrealThrottle
+{
+public:
+	/** verdicts for new connections */
+	enum Result
+	{
+		/** the connection may proceed */
+		Accepted,
+
+		/** the host holds too many connections already */
+		TooMany,
+
+		/** the host connects too fast */
+		TooFast
+	};
+
+	/** counters */
+	struct Counters
+	{
+		/** connections accepted */
+		size_t accepted;
+
+		/** connections rejected by the concurrency limit */
+		size_t too_many;
+
+		/** connections rejected by the rate limit */
+		size_t too_fast;
+	};
+
+public:
+	UnrealThrottle();
+	Result admit(UnrealSocket* sptr, const boost::asio::ip::address& addr);
+	const Counters& counters();
+	static String hostKey(const boost::asio::ip::address& addr);
+	void release(UnrealSocket* sptr);
+	size_t size();
+
+private:
+	/** per-host state */
+	struct Entry
+	{
+		Entry();
+
+		/** connections held right now */
+		uint32_t current;
+
+		/** connection allowance used up; decays over time */
+		double score;
+
+		/** time the score was last updated */
+		std::time_t updated;
+
+		/** whether the operators have been told about this host */
+		bool reported;
+	};
+
+	void decay(Entry& entry, std::time_t now);
+	void expire();
+	bool isExempt(const String& ip);
+
+private:
+	/** state by host */
+	HashMap<String, Entry> hosts_;
+
+	/** host of each admitted socket */
+	HashMap<UnrealSocket*, String> sockets_;
+
+	/** time of the last expiry run */
+	std::time_t last_expire_;
+
+	/** counters */
+	Counters counters_;
+};
+
+#endif /* _UNREALIRCD_THROTTLE_HPP */
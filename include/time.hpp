@@ -26,9 +26,12 @@
 #ifndef _UNREALIRCD_TIME_HPP
 #define _UNREALIRCD_TIME_HPP
 
+#include <platform.hpp>
 #include <string.hpp>
 #include <ctime>
 
+class UnrealManualClock;
+
 /**
  * UnrealTime class.
  */
@@ -38,10 +41,14 @@ public:
 	UnrealTime(const std::time_t& ts = 0);
 
 	UnrealTime& addSeconds(const std::time_t& sec);
+	static UnrealManualClock* clock();
+	static uint64_t monotonic();
 	static UnrealTime nettime();
 	static UnrealTime now();
+	static void setClock(UnrealManualClock* clock);
 	void setTS(const std::time_t& ts);
 	void sync();
+	static uint64_t threadCPU();
 	std::time_t toTS();
 	String toString(const String& fmt);
 
@@ -65,6 +72,9 @@ public:
 
 private:
 	std::time_t timestamp_;
+
+	/** clock used instead of the system clock, if any */
+	static UnrealManualClock* clock_;
 };
 
 #endif /* _UNREALIRCD_TIME_HPP */
@@ -26,19 +26,56 @@
 #ifndef _UNREALIRCD_TIMER_HPP
 #define _UNREALIRCD_TIMER_HPP
 
+#include <platform.hpp>
 #include <boost/asio.hpp>
+#include <boost/function.hpp>
+
+class UnrealManualClock;
 
 /**
  * UnrealTimer class.
+ * Wraps a deadline_timer with the same method names. While a manual clock
+ * is installed (see UnrealTime::setClock()), waits are queued on that
+ * clock instead and complete when it is advanced to their due time.
+ * Only one wait may be pending at a time. A wait whose expiry time has
+ * passed, e.g. one without a new expires_from_now(), completes right away.
  */
 class UnrealTimer
-	: public boost::asio::deadline_timer
 {
 public:
 	typedef boost::system::error_code ErrorCode;
+	typedef boost::asio::deadline_timer::duration_type Duration;
+	typedef boost::function<void(const ErrorCode&)> Handler;
 
 public:
 	UnrealTimer();
+	~UnrealTimer();
+	void async_wait(const Handler& handler);
+	size_t cancel();
+	size_t cancel(ErrorCode& ec);
+	size_t expires_from_now(const Duration& duration);
+
+private:
+	friend class UnrealManualClock;
+
+	size_t abort();
+	void fire();
+
+private:
+	/** reactor timer, used without a manual clock */
+	boost::asio::deadline_timer timer_;
+
+	/** manual clock the pending wait is queued on, if any */
+	UnrealManualClock* clock_;
+
+	/** handler of the pending wait on the manual clock */
+	Handler handler_;
+
+	/** monotonic time the timer is due on the manual clock */
+	uint64_t due_;
+
+	/** queue sequence number of the pending wait */
+	uint64_t seq_;
 };
 
 #endif /* _UNREALIRCD_TIMER_HPP */
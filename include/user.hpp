@@ -28,19 +28,24 @@
 
 #include <bitmask.hpp>
 #include <channel.hpp>
+#include <ident.hpp>
 #include <list.hpp>
 #include <listener.hpp>
 #include <mode.hpp>
 #include <modebuf.hpp>
 #include <numeric.hpp>
+#include <operindex.hpp>
 #include <platform.hpp>
 #include <recvq.hpp>
+#include <regtrace.hpp>
+#include <replystream.hpp>
 #include <resolver.hpp>
 #include <string.hpp>
 #include <stringlist.hpp>
 #include <time.hpp>
 #include <timer.hpp>
 #include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
 
 /**
  * Representation of an user entry.
@@ -70,12 +75,23 @@ public:
 		AFIdent = 0x10
 	};
 
+	/**
+	 * Enumeration of protocol extensions enabled by the client through
+	 * PROTOCTL.
+	 */
+	enum ProtoFlagType
+	{
+		/** show all member prefixes in NAMES replies */
+		PFNamesX = 0x01
+	};
+
 	/** alias the mode buffer type for user modes */
 	typedef UnrealModeBufferType<UnrealUserMode> ModeBuf;
 
 public:
 	UnrealUser(UnrealSocket* sptr = 0);
 	~UnrealUser();
+	void addReplyStream(UnrealReplyStream* stream, bool first = false);
 	void auth();
 	Bitmask<uint8_t>& authflags();
 	const String& awayMessage();
@@ -89,11 +105,13 @@ public:
 	bool havePendingRequests();
 	const String& hostname();
 	const String& ident();
+	const String& ip();
 	bool isAway();
 	bool isDeaf();
 	bool isIntroduced();
 	bool isInvisible();
 	bool isOper();
+	bool isRegistered();
 	void joinChannel(const String& chname, const String& key);
 	UnrealTime lastActionTime();
 	UnrealTime lastPongTime();
@@ -106,18 +124,23 @@ public:
 	Bitmask<uint16_t>& modes();
 	String modestr();
 	const String& nick();
-	void notifyOpers(const String& msg);
+	void notifyOpers(const String& msg, UnrealOperIndex::Snomask category
+			= UnrealOperIndex::SNGeneral);
 	void parseModeChange(StringList* argv);
+	Bitmask<uint8_t>& protoflags();
+	void pumpReplyStreams();
 	const String& realHostname();
 	const String& realname();
 	void recvqAdd(const String& str);
 	String recvqGetLine();
 	size_t recvqSize();
 	void registerUser();
+	UnrealRegistrationTrace& registrationTrace();
 	void send(const String& data);
 	void send(const char* fmt, ...);
 	void sendISupport();
 	void sendlocalreply(const String& cmd, const String& data);
+	void sendNeighbors(const String& data, bool include_self = false);
 	void sendreply(IRCNumeric numeric, const String& data);
 	void sendreply(const String& cmd, const String& data);
 	void sendreply(UnrealUser* uptr, const String& cmd,
@@ -148,17 +171,25 @@ public:
 	static boost::signal<void(UnrealUser*)>
 			onDestroy;
 
+	/** signal emitted when a registered user has changed the nick */
+	static boost::signal<void(UnrealUser*, const String&)>
+			onNickChange;
+
+	/** signal emitted when a user has completed the registration */
+	static boost::signal<void(UnrealUser*)>
+			onRegister;
+
 private:
+	friend class UnrealIdentClient;
+
+	void accountMemory();
 	void checkAuthTimeout(const UnrealTimer::ErrorCode& ec);
 	void checkPingTimeout(const UnrealTimer::ErrorCode& ec);
 	void checkRemoteIdent();
+	void continueReplyStreams(boost::shared_ptr<bool> alive);
 	void destroyIdentRequest();
-	void handleIdentCheckConnected(UnrealSocket* sptr);
-	void handleIdentCheckDisconnected(UnrealSocket* sptr,
-		const UnrealSocket::ErrorCode& ec);
-	void handleIdentCheckError(UnrealSocket* sptr,
-		const UnrealSocket::ErrorCode& ec);
-	void handleIdentCheckRead(UnrealSocket* sptr, String& data);
+	void handleIdentResult(UnrealIdentClient::Result result,
+		const String& username);
 	void handleResolveResponse(const UnrealResolver::ErrorCode& ec,
 		UnrealResolver::Iterator response);
 	void resolveHostname();
@@ -172,6 +203,9 @@ private:
 	/** user mode flags */
 	Bitmask<uint16_t> modes_;
 
+	/** protocol extension flags */
+	Bitmask<uint8_t> proto_flags_;
+
 	/** socket of this user; this is set to zero if it's not a real user */
 	UnrealSocket* socket_;
 
@@ -199,6 +233,9 @@ private:
 	/** real host name */
 	String real_hostname_;
 
+	/** IP address */
+	String ip_;
+
 	/** real name */
 	String realname_;
 
@@ -207,6 +244,39 @@ private:
 
 	/** timer */
 	UnrealTimer timer_;
+
+	/** pending large replies, served in order */
+	List<UnrealReplyStream*> reply_streams_;
+
+	/** number of streams at the front served before the others */
+	size_t first_streams_;
+
+	/** whether the reply streams are being served right now */
+	bool pumping_;
+
+	/** whether a continuation of the reply streams has been posted */
+	bool pump_posted_;
+
+	/** cleared on destruction; guards posted reply stream continuations */
+	boost::shared_ptr<bool> alive_;
+
+	/** whether the registration has been completed */
+	bool registered_;
+
+	/** whether the exit has been announced already */
+	bool exited_;
+
+	/** memory accounted for this user, see accountMemory() */
+	size_t memory_;
+
+	/** registration phase timestamps */
+	UnrealRegistrationTrace reg_trace_;
+
+	/** neighbor walk this user was last visited by */
+	uint32_t neighbor_mark_;
+
+	/** current neighbor walk, see sendNeighbors() */
+	static uint32_t neighbor_epoch_;
 };
 
 namespace UnrealUserProperties
@@ -214,6 +284,7 @@ namespace UnrealUserProperties
 	extern UnrealUserMode Deaf;
 	extern UnrealUserMode Invisible;
 	extern UnrealUserMode Operator;
+	extern UnrealUserMode ServerNotice;
 	extern UnrealUserMode Wallops;
 	extern UnrealUserModeTable ModeTable;
 }
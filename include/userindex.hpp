@@ -0,0 +1,134 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         userindex.hpp
+ * Description  User search index
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_USERINDEX_HPP
+#define _UNREALIRCD_USERINDEX_HPP
+
+#include <list.hpp>
+#include <map.hpp>
+#include <string.hpp>
+
+class UnrealUser;
+
+/**
+ * Sorted indexes on user properties, used to answer prefix and suffix
+ * searches (like "*.example.com" or "192.168.*") without walking the
+ * whole user list.
+ *
+ * Every indexed property is kept twice: once as-is for prefix searches
+ * and once reversed for suffix searches. All keys are lowercase.
+ * Only registered users are indexed.
+ */
+class UnrealUserIndex
+{
+public:
+	/** searchable user properties */
+	enum Field
+	{
+		/** nickname */
+		Nick,
+
+		/** visible hostname */
+		Host,
+
+		/** IP address */
+		IP,
+
+		/** real name; only when enabled via setIndexRealname() */
+		Realname
+	};
+
+public:
+	UnrealUserIndex();
+
+	void add(UnrealUser* uptr);
+	bool contains(UnrealUser* uptr) const;
+	bool findPrefix(Field field, const String& prefix,
+		List<UnrealUser*>& result);
+	bool findSuffix(Field field, const String& suffix,
+		List<UnrealUser*>& result);
+	void remove(UnrealUser* uptr);
+	void setIndexRealname(bool enabled);
+	void update(UnrealUser* uptr);
+
+private:
+	/** tree type; duplicate keys are allowed */
+	typedef std::multimap<String, UnrealUser*> Tree;
+
+	/** keys a user has been indexed with */
+	struct Keys
+	{
+		/** lowercase nickname */
+		String nick;
+
+		/** lowercase hostname */
+		String host;
+
+		/** IP address */
+		String ip;
+
+		/** lowercase real name */
+		String realname;
+	};
+
+	static void erase(Tree& tree, const String& key, UnrealUser* uptr);
+	static void insert(Tree& tree, const String& key, UnrealUser* uptr);
+	static void lookup(Tree& tree, const String& prefix,
+		List<UnrealUser*>& result);
+	static String reversed(const String& str);
+
+private:
+	/** nickname index */
+	Tree nick_;
+
+	/** reversed nickname index */
+	Tree rnick_;
+
+	/** hostname index */
+	Tree host_;
+
+	/** reversed hostname index */
+	Tree rhost_;
+
+	/** IP address index */
+	Tree ip_;
+
+	/** reversed IP address index */
+	Tree rip_;
+
+	/** real name index */
+	Tree realname_;
+
+	/** reversed real name index */
+	Tree rrealname_;
+
+	/** indexed users and their keys */
+	Map<UnrealUser*, Keys> keys_;
+
+	/** whether real names are indexed */
+	bool index_realname_;
+};
+
+#endif /* _UNREALIRCD_USERINDEX_HPP */
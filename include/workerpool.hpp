@@ -0,0 +1,146 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         workerpool.hpp
+ * Description  Worker threads for blocking operations
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#ifndef _UNREALIRCD_WORKERPOOL_HPP
+#define _UNREALIRCD_WORKERPOOL_HPP
+
+#include <hashmap.hpp>
+#include <list.hpp>
+#include <platform.hpp>
+
+#include <deque>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+class UnrealUser;
+
+/**
+ * Pool of worker threads for CPU-heavy or blocking operations like
+ * password hashing, so they don't stall the event reactor.
+ *
+ * A job runs on one of the worker threads and must not touch any server
+ * state; it should only work on data bound to it. Once it returns, its
+ * completion handler is posted back to the reactor, where it's safe to
+ * use the server state again. Jobs may be owned by a user: if the user is
+ * destroyed before the job completes, the completion handler is not called
+ * at all.
+ *
+ * The pool is started with the first job and uses Workers::Threads
+ * threads; with no threads, jobs run on the reactor itself. At most
+ * Workers::MaxQueue jobs may wait for a thread at the same time.
+ */
+class UnrealWorkerPool
+{
+public:
+	/** job run on a worker thread */
+	typedef boost::function<void()> Job;
+
+	/** completion handler run on the reactor */
+	typedef boost::function<void()> Completion;
+
+	/** counters */
+	struct Counters
+	{
+		/** jobs submitted */
+		size_t submitted;
+
+		/** jobs rejected as the queue was full */
+		size_t rejected;
+
+		/** completions dropped because the owner has gone */
+		size_t orphaned;
+	};
+
+public:
+	UnrealWorkerPool();
+	~UnrealWorkerPool();
+	void cancel(UnrealUser* uptr);
+	const Counters& counters();
+	size_t pending();
+	void stop();
+	bool submit(UnrealUser* owner, const Job& job,
+		const Completion& done = Completion());
+	size_t threads();
+
+private:
+	/** job entry */
+	struct Task
+	{
+		/** user waiting for the completion; 0 if none */
+		UnrealUser* owner;
+
+		/** whether the owner has been destroyed meanwhile */
+		bool orphaned;
+
+		/** work to be done on a worker thread */
+		Job job;
+
+		/** completion handler */
+		Completion done;
+
+		/** pool generation the task was submitted in */
+		uint32_t generation;
+	};
+
+	/** alias the shared pointer type for tasks */
+	typedef boost::shared_ptr<Task> TaskPtr;
+
+	void complete(TaskPtr task);
+	void start();
+	void work();
+
+private:
+	/** worker threads */
+	List<boost::thread*> threads_;
+
+	/** guards queue_ and stopping_ */
+	boost::mutex mutex_;
+
+	/** signalled when a job is queued or the pool stops */
+	boost::condition_variable wakeup_;
+
+	/** jobs waiting for a thread */
+	std::deque<TaskPtr> queue_;
+
+	/** whether the worker threads should exit */
+	bool stopping_;
+
+	/** jobs not completed yet, by owner; reactor thread only */
+	HashMap<UnrealUser*, List<TaskPtr> > owned_;
+
+	/** number of jobs not completed yet */
+	size_t pending_;
+
+	/** increased on stop(), so completions of earlier jobs are dropped */
+	uint32_t generation_;
+
+	/** counters */
+	Counters counters_;
+};
+
+#endif /* _UNREALIRCD_WORKERPOOL_HPP */
@@ -0,0 +1,840 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         banlist.cpp
+ * Description  Server bans (K-, G- and Z-lines)
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <banlist.hpp>
+#include <base.hpp>
+#include <memstat.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <boost/bind.hpp>
+
+/** delay between a change and writing the ban file, in seconds */
+static const std::time_t save_delay = 5;
+
+/** alias the address key type */
+typedef UnrealRadixTree<int>::Key AddressKey;
+
+/**
+ * Returns the memory used by a ban entry, including its index entries.
+ *
+ * @param ban Ban entry
+ * @return Number of bytes
+ */
+static size_t banBytes(const UnrealBanList::Ban& ban)
+{
+	return sizeof(UnrealBanList::Ban) + 8 * sizeof(void*)
+		+ 2 * UnrealMemoryStats::bytes(ban.mask)
+		+ UnrealMemoryStats::bytes(ban.user)
+		+ UnrealMemoryStats::bytes(ban.host)
+		+ UnrealMemoryStats::bytes(ban.reason)
+		+ UnrealMemoryStats::bytes(ban.setter);
+}
+
+/**
+ * Returns the key a ban is stored under.
+ *
+ * @param type Ban type
+ * @param mask Normalized mask
+ * @return Key
+ */
+static String banKey(UnrealBanList::Type type, const String& mask)
+{
+	return String::format("%c %s", static_cast<char>(type), mask.c_str());
+}
+
+/**
+ * Returns whether a string contains wildcard characters.
+ *
+ * @param str String to check
+ * @return True if it contains '*' or '?', otherwise false
+ */
+static bool hasWildcards(const String& str)
+{
+	return (str.find_first_of("*?") != String::npos);
+}
+
+/**
+ * Returns whether an address prefix covers all IPv6 or all IPv4
+ * addresses, like ::/0 or 0.0.0.0/0.
+ *
+ * @param key Prefix address
+ * @param bits Prefix length, counted on the 128 bit key
+ * @return True if so, otherwise false
+ */
+static bool isMatchAll(const AddressKey& key, size_t bits)
+{
+	/* IPv4 addresses are keyed as ::ffff:0:0/96 */
+	AddressKey v4 = UnrealRadixTree<int>::key(
+		boost::asio::ip::address(boost::asio::ip::address_v4::any()));
+
+	return (bits == 0
+		|| (bits <= 96 && UnrealRadixTree<int>::contains(key, bits, v4)));
+}
+
+/**
+ * Returns whether a host pattern has the form "*.domain", without further
+ * wildcards.
+ *
+ * @param host Host pattern
+ * @return True if so, otherwise false
+ */
+static bool isSuffixMask(const String& host)
+{
+	return (host.length() > 2 && host[0] == '*' && host[1] == '.'
+		&& host.find_first_of("*?", 1) == String::npos);
+}
+
+/**
+ * Returns the text form of an address prefix, omitting the length for
+ * single addresses.
+ *
+ * @param key Prefix address
+ * @param bits Prefix length, counted on the 128 bit key
+ * @return Prefix text
+ */
+static String prefixString(const AddressKey& key, size_t bits)
+{
+	boost::asio::ip::address_v6 v6(key);
+	String result;
+
+	if (v6.is_v4_mapped() && bits >= 96)
+	{
+		result = v6.to_v4().to_string();
+		bits -= 96;
+
+		if (bits < 32)
+			result.append(String::format("/%d", static_cast<int>(bits)));
+	}
+	else
+	{
+		result = v6.to_string();
+
+		if (bits < 128)
+			result.append(String::format("/%d", static_cast<int>(bits)));
+	}
+
+	return result;
+}
+
+/**
+ * Returns the first ban of a list matching a user.
+ *
+ * @param list Ban list
+ * @param ident Username
+ * @param host Hostname
+ * @param ip IP address
+ * @return Matching ban, or an empty pointer
+ */
+static UnrealBanList::BanPtr firstMatch(const UnrealBanList::BanList& list,
+	const String& ident, const String& host, const String& ip)
+{
+	for (UnrealBanList::BanList::const_iterator bi = list.begin();
+			bi != list.end(); ++bi)
+	{
+		if (UnrealBanList::matches(**bi, ident, host, ip))
+			return *bi;
+	}
+
+	return UnrealBanList::BanPtr();
+}
+
+/**
+ * Remove a ban from a hashed index, dropping the key once its list is
+ * empty.
+ *
+ * @param index Index
+ * @param key Key the ban is filed under
+ * @param ban Ban entry
+ */
+static void removeFromIndex(HashMap<String, UnrealBanList::BanList>& index,
+	const String& key, UnrealBanList::BanPtr ban)
+{
+	HashMap<String, UnrealBanList::BanList>::Iterator li = index.find(key);
+
+	if (li != index.end())
+	{
+		li->second.remove(ban);
+
+		if (li->second.empty())
+			index.erase(li);
+	}
+}
+
+/**
+ * UnrealBanList constructor.
+ */
+UnrealBanList::UnrealBanList()
+	: timer_(0), dirty_(false), save_at_(0)
+{ }
+
+/**
+ * UnrealBanList destructor.
+ */
+UnrealBanList::~UnrealBanList()
+{
+	delete timer_;
+}
+
+/**
+ * Add a ban, replacing an existing one with the same mask.
+ *
+ * @param type Ban type
+ * @param mask Mask; user@host for K/G-lines, address or CIDR for Z-lines
+ * @param reason Reason
+ * @param setter Who sets the ban
+ * @param duration Duration in seconds; 0 for a permanent ban
+ * @return The ban, or an empty pointer if the mask is invalid
+ */
+UnrealBanList::BanPtr UnrealBanList::add(Type type, const String& mask,
+	const String& reason, const String& setter, std::time_t duration)
+{
+	String normalized;
+
+	if (!normalize(type, mask, normalized))
+		return BanPtr();
+
+	remove(type, normalized);
+
+	BanPtr ban = create(type, normalized);
+	std::time_t now = UnrealTime::now().toTS();
+
+	ban->reason = reason;
+	ban->setter = setter.empty() ? String("*") : setter;
+	ban->set_at = now;
+	ban->expires = (duration > 0 ? now + duration : 0);
+
+	index(ban);
+
+	if (!dirty_)
+		save_at_ = now + save_delay;
+
+	dirty_ = true;
+	schedule();
+
+	return ban;
+}
+
+/**
+ * Returns the Z-line matching an address.
+ *
+ * @param ip IP address
+ * @return Matching ban, or an empty pointer
+ */
+UnrealBanList::BanPtr UnrealBanList::checkAddress(const String& ip)
+{
+	AddressKey key;
+	size_t bits;
+
+	if (zlines_.size() == 0 || !UnrealRadixTree<int>::parse(ip, key, bits))
+		return BanPtr();
+
+	BanPtr* ban = zlines_.match(key);
+
+	return (ban ? *ban : BanPtr());
+}
+
+/**
+ * Returns the K-line or G-line matching a user.
+ *
+ * @param ident Username
+ * @param host Hostname
+ * @param ip IP address
+ * @return Matching ban, or an empty pointer
+ */
+UnrealBanList::BanPtr UnrealBanList::checkUser(const String& ident,
+	const String& host, const String& ip)
+{
+	String lhost = String(host).toLower();
+	HashMap<String, BanList>::Iterator li;
+	BanPtr ban;
+
+	/* exact hosts */
+	if ((li = by_host_.find(lhost)) != by_host_.end()
+			&& (ban = firstMatch(li->second, ident, host, ip)))
+		return ban;
+
+	if ((li = by_host_.find(ip)) != by_host_.end()
+			&& (ban = firstMatch(li->second, ident, host, ip)))
+		return ban;
+
+	/* domain suffixes */
+	for (size_t pos = lhost.find('.'); pos != String::npos;
+			pos = lhost.find('.', pos + 1))
+	{
+		if ((li = by_suffix_.find(lhost.mid(pos))) != by_suffix_.end()
+				&& (ban = firstMatch(li->second, ident, host, ip)))
+			return ban;
+	}
+
+	/* address blocks */
+	AddressKey key;
+	size_t bits;
+
+	if (by_cidr_.size() > 0 && UnrealRadixTree<int>::parse(ip, key, bits))
+	{
+		std::vector<BanList*> lists;
+
+		by_cidr_.matchAll(key, lists);
+
+		for (size_t i = 0; i < lists.size(); ++i)
+		{
+			if ((ban = firstMatch(*lists[i], ident, host, ip)))
+				return ban;
+		}
+	}
+
+	/* everything else */
+	return firstMatch(generic_, ident, host, ip);
+}
+
+/**
+ * Remove all bans. The ban file is not touched.
+ */
+void UnrealBanList::clear()
+{
+	for (HashMap<String, BanPtr>::Iterator bi = bans_.begin();
+			bi != bans_.end(); ++bi)
+		UnrealMemoryStats::release(UnrealMemoryStats::Bans,
+			banBytes(*bi->second));
+
+	bans_.clear();
+	expiry_.clear();
+	zlines_.clear();
+	by_host_.clear();
+	by_suffix_.clear();
+	by_cidr_.clear();
+	generic_.clear();
+}
+
+/**
+ * Write pending changes and stop the timer; called on shutdown.
+ */
+void UnrealBanList::close()
+{
+	if (dirty_)
+		save();
+
+	delete timer_;
+	timer_ = 0;
+}
+
+/**
+ * Allocate a ban entry for a normalized mask.
+ *
+ * @param type Ban type
+ * @param mask Normalized mask
+ * @return Ban entry
+ */
+UnrealBanList::BanPtr UnrealBanList::create(Type type, const String& mask)
+{
+	BanPtr ban(new Ban);
+	String m = mask;
+
+	ban->type = type;
+	ban->mask = mask;
+	ban->bits = 0;
+	ban->set_at = 0;
+	ban->expires = 0;
+
+	if (type == ZLine)
+	{
+		ban->user = "*";
+		ban->host = mask;
+		UnrealRadixTree<int>::parse(mask, ban->prefix, ban->bits);
+	}
+	else
+	{
+		size_t at = m.find('@');
+
+		ban->user = m.left(at);
+		ban->host = m.mid(at + 1);
+
+		if (!UnrealRadixTree<int>::parse(ban->host, ban->prefix, ban->bits))
+			ban->bits = 0;
+	}
+
+	return ban;
+}
+
+/**
+ * Returns all bans.
+ *
+ * @return Ban list
+ */
+UnrealBanList::BanList UnrealBanList::entries()
+{
+	BanList result;
+
+	for (HashMap<String, BanPtr>::Iterator bi = bans_.begin();
+			bi != bans_.end(); ++bi)
+		result << bi->second;
+
+	return result;
+}
+
+/**
+ * Remove the bans that have expired.
+ */
+void UnrealBanList::expire()
+{
+	std::time_t now = UnrealTime::now().toTS();
+
+	while (!expiry_.empty() && expiry_.begin()->first <= now)
+	{
+		BanPtr ban = expiry_.begin()->second;
+
+		unreal->opers.notice(UnrealOperIndex::SNGeneral,
+			String::format("Expiring %s for %s (set by %s): %s",
+				typeName(ban->type),
+				ban->mask.c_str(),
+				ban->setter.c_str(),
+				ban->reason.c_str()));
+
+		unindex(ban);
+
+		if (!dirty_)
+			save_at_ = now + save_delay;
+
+		dirty_ = true;
+	}
+}
+
+/**
+ * Returns the ban with exactly this mask.
+ *
+ * @param type Ban type
+ * @param mask Mask
+ * @return Ban, or an empty pointer
+ */
+UnrealBanList::BanPtr UnrealBanList::find(Type type, const String& mask)
+{
+	String normalized;
+
+	if (!normalize(type, mask, normalized))
+		return BanPtr();
+
+	HashMap<String, BanPtr>::Iterator bi =
+		bans_.find(banKey(type, normalized));
+
+	return (bi != bans_.end() ? bi->second : BanPtr());
+}
+
+/**
+ * Timer callback; removes expired bans and writes pending changes.
+ *
+ * @param ec Error code
+ */
+void UnrealBanList::handleTimer(const UnrealTimer::ErrorCode& ec)
+{
+	if (ec)
+		return;
+
+	expire();
+
+	if (dirty_ && save_at_ <= UnrealTime::now().toTS())
+		save();
+
+	schedule();
+}
+
+/**
+ * Add a ban to the lookup structures.
+ *
+ * @param ban Ban entry
+ */
+void UnrealBanList::index(BanPtr ban)
+{
+	bans_[banKey(ban->type, ban->mask)] = ban;
+	UnrealMemoryStats::allocate(UnrealMemoryStats::Bans, banBytes(*ban));
+
+	if (ban->expires != 0)
+		expiry_.insert(std::make_pair(ban->expires, ban));
+
+	if (ban->type == ZLine)
+		zlines_.insert(ban->prefix, ban->bits) = ban;
+	else if (ban->bits != 0)
+		by_cidr_.insert(ban->prefix, ban->bits) << ban;
+	else if (!hasWildcards(ban->host))
+		by_host_[ban->host] << ban;
+	else if (isSuffixMask(ban->host))
+		by_suffix_[ban->host.mid(1)] << ban;
+	else
+		generic_ << ban;
+}
+
+/**
+ * Read the bans from Bans::File, replacing the current ones. Expired
+ * entries are skipped.
+ *
+ * @return False if the file couldn't be read, otherwise true
+ */
+bool UnrealBanList::load()
+{
+	String file = unreal->config.get("Bans::File", "bans.db");
+	std::ifstream in(file.c_str());
+	std::time_t now = UnrealTime::now().toTS();
+	std::string line;
+	size_t loaded = 0, invalid = 0;
+
+	if (!in)
+		return false;
+
+	clear();
+
+	while (std::getline(in, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		/* <type> <set time> <expiry time> <setter> <mask> :<reason> */
+		std::istringstream fields(line);
+		std::string setter, mask, reason;
+		char type = 0;
+		long set_at = 0, expires = 0;
+
+		fields >> type >> set_at >> expires >> setter >> mask;
+		std::getline(fields, reason);
+
+		if (mask.empty() || (type != KLine && type != GLine && type != ZLine))
+		{
+			invalid++;
+			continue;
+		}
+
+		if (expires != 0 && expires <= now)
+			continue;
+
+		String normalized;
+
+		if (!normalize(static_cast<Type>(type), mask, normalized))
+		{
+			invalid++;
+			continue;
+		}
+
+		BanPtr ban = create(static_cast<Type>(type), normalized);
+
+		if (reason.compare(0, 2, " :") == 0)
+			reason.erase(0, 2);
+
+		ban->reason = reason;
+		ban->setter = setter;
+		ban->set_at = set_at;
+		ban->expires = expires;
+
+		/* a later line for the same mask replaces the earlier one */
+		BanPtr old = find(ban->type, ban->mask);
+
+		if (old)
+			unindex(old);
+
+		index(ban);
+		loaded++;
+	}
+
+	unreal->log.write(UnrealLog::Normal, "Loaded %d bans from %s",
+		static_cast<int>(loaded), file.c_str());
+
+	if (invalid > 0)
+	{
+		unreal->log.write(UnrealLog::Error, "Skipped %d invalid entries in %s",
+			static_cast<int>(invalid), file.c_str());
+	}
+
+	dirty_ = false;
+	schedule();
+
+	return true;
+}
+
+/**
+ * Returns whether a ban matches a user.
+ *
+ * @param ban Ban entry
+ * @param ident Username
+ * @param host Hostname
+ * @param ip IP address
+ * @return True if matching, otherwise false
+ */
+bool UnrealBanList::matches(const Ban& ban, const String& ident,
+	const String& host, const String& ip)
+{
+	if (ban.user != "*" && !String(ident).match(ban.user))
+		return false;
+
+	if (ban.bits != 0)
+	{
+		AddressKey key;
+		size_t bits;
+
+		return (UnrealRadixTree<int>::parse(ip, key, bits)
+			&& UnrealRadixTree<int>::contains(ban.prefix, ban.bits, key));
+	}
+
+	return (String(host).match(ban.host) || String(ip).match(ban.host));
+}
+
+/**
+ * Check a mask and bring it into its canonical form: lowercase user@host
+ * for K/G-lines, an address or CIDR block for Z-lines.
+ *
+ * @param type Ban type
+ * @param mask Mask to check
+ * @param result Receives the canonical mask
+ * @return False if the mask is invalid or too broad, otherwise true
+ */
+bool UnrealBanList::normalize(Type type, const String& mask,
+	String& result)
+{
+	String m = String(mask).trimmed().toLower();
+	AddressKey key;
+	size_t bits;
+
+	if (m.empty() || m.find_first_of(" !,") != String::npos)
+		return false;
+
+	if (type == ZLine)
+	{
+		if (m.left(2) == "*@")
+			m = m.mid(2);
+
+		/* refuse to ban everyone */
+		if (!UnrealRadixTree<int>::parse(m, key, bits)
+				|| isMatchAll(key, bits))
+			return false;
+
+		result = prefixString(key, bits);
+		return true;
+	}
+
+	size_t at = m.find('@');
+
+	if (at == String::npos)
+		m = "*@" + m;
+	else if (at == 0)
+		m = "*" + m;
+
+	at = m.find('@');
+
+	String user = m.left(at);
+	String host = m.mid(at + 1);
+
+	/* refuse to ban everyone */
+	if (host.empty() || host.find_first_not_of("*?.") == String::npos
+			|| user.find('@') != String::npos || host.find('@') != String::npos)
+		return false;
+
+	if (UnrealRadixTree<int>::parse(host, key, bits))
+	{
+		if (isMatchAll(key, bits))
+			return false;
+
+		host = prefixString(key, bits);
+	}
+
+	result = user + "@" + host;
+	return true;
+}
+
+/**
+ * Remove a ban.
+ *
+ * @param type Ban type
+ * @param mask Mask
+ * @return True if removed, false if there was no such ban
+ */
+bool UnrealBanList::remove(Type type, const String& mask)
+{
+	BanPtr ban = find(type, mask);
+
+	if (!ban)
+		return false;
+
+	unindex(ban);
+
+	if (!dirty_)
+		save_at_ = UnrealTime::now().toTS() + save_delay;
+
+	dirty_ = true;
+	schedule();
+
+	return true;
+}
+
+/**
+ * Write all bans to Bans::File. A temporary file is written first and
+ * renamed, so the file is never left half written.
+ *
+ * @return True on success, otherwise false
+ */
+bool UnrealBanList::save()
+{
+	String file = unreal->config.get("Bans::File", "bans.db");
+	String temp = file + ".tmp";
+	std::ofstream out(temp.c_str(), std::ios::out | std::ios::trunc);
+
+	if (!out)
+	{
+		unreal->log.write(UnrealLog::Error, "Can't write bans to %s",
+			temp.c_str());
+		return false;
+	}
+
+	out << "# <type> <set time> <expiry time> <setter> <mask> :<reason>\n";
+
+	for (HashMap<String, BanPtr>::Iterator bi = bans_.begin();
+			bi != bans_.end(); ++bi)
+	{
+		const Ban& ban = *bi->second;
+
+		out << static_cast<char>(ban.type) << ' '
+			<< static_cast<long>(ban.set_at) << ' '
+			<< static_cast<long>(ban.expires) << ' '
+			<< ban.setter << ' '
+			<< ban.mask << " :"
+			<< ban.reason << '\n';
+	}
+
+	out.close();
+
+	if (!out || std::rename(temp.c_str(), file.c_str()) != 0)
+	{
+		unreal->log.write(UnrealLog::Error, "Can't write bans to %s",
+			file.c_str());
+		return false;
+	}
+
+	dirty_ = false;
+	return true;
+}
+
+/**
+ * Arm the timer for the next expiry or pending write.
+ */
+void UnrealBanList::schedule()
+{
+	std::time_t next = 0;
+	std::time_t now = UnrealTime::now().toTS();
+
+	if (!expiry_.empty())
+		next = expiry_.begin()->first;
+
+	if (dirty_ && (next == 0 || save_at_ < next))
+		next = save_at_;
+
+	if (next == 0)
+		return;
+
+	if (!timer_)
+		timer_ = new UnrealTimer();
+
+	timer_->expires_from_now(boost::posix_time::seconds(
+		next > now ? next - now : 0));
+	timer_->async_wait(
+		boost::bind(&UnrealBanList::handleTimer,
+			this,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * Returns the number of bans.
+ *
+ * @return Ban count
+ */
+size_t UnrealBanList::size()
+{
+	return bans_.size();
+}
+
+/**
+ * Returns the name of a ban type.
+ *
+ * @param type Ban type
+ * @return Name, like "G-line"
+ */
+const char* UnrealBanList::typeName(Type type)
+{
+	switch (type)
+	{
+		case KLine:
+			return "K-line";
+		case GLine:
+			return "G-line";
+		case ZLine:
+			return "Z-line";
+		default:
+			return "ban";
+	}
+}
+
+/**
+ * Remove a ban from the lookup structures.
+ *
+ * @param ban Ban entry
+ */
+void UnrealBanList::unindex(BanPtr ban)
+{
+	bans_.erase(banKey(ban->type, ban->mask));
+	UnrealMemoryStats::release(UnrealMemoryStats::Bans, banBytes(*ban));
+
+	if (ban->expires != 0)
+	{
+		typedef std::multimap<std::time_t, BanPtr>::iterator ExpiryIterator;
+		std::pair<ExpiryIterator, ExpiryIterator> range =
+			expiry_.equal_range(ban->expires);
+
+		for (ExpiryIterator ei = range.first; ei != range.second; ++ei)
+		{
+			if (ei->second == ban)
+			{
+				expiry_.erase(ei);
+				break;
+			}
+		}
+	}
+
+	if (ban->type == ZLine)
+		zlines_.remove(ban->prefix, ban->bits);
+	else if (ban->bits != 0)
+	{
+		BanList* list = by_cidr_.find(ban->prefix, ban->bits);
+
+		if (list)
+		{
+			list->remove(ban);
+
+			if (list->empty())
+				by_cidr_.remove(ban->prefix, ban->bits);
+		}
+	}
+	else if (!hasWildcards(ban->host))
+		removeFromIndex(by_host_, ban->host, ban);
+	else if (isSuffixMask(ban->host))
+		removeFromIndex(by_suffix_, ban->host.mid(1), ban);
+	else
+		generic_.remove(ban);
+}
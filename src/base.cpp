@@ -25,7 +25,9 @@
 
 #include "base.hpp"
 #include "exception.hpp"
+#include "hash.hpp"
 #include "limits.hpp"
+#include "memstat.hpp"
 #include "reactor.hpp"
 
 #include <cstdlib>
@@ -137,6 +139,210 @@ void UnrealBase::checkPermissions()
 	}
 }
 
+/**
+ * Metrics collector for the core subsystems.
+ *
+ * @param out Metrics writer
+ */
+void UnrealBase::collectMetrics(UnrealMetricWriter& out)
+{
+	/* connections and users */
+	out.gauge("unrealircd_connections", "Open client connections",
+		stats.connections_cur);
+	out.gauge("unrealircd_connections_unknown",
+		"Connections which haven't registered yet", stats.connections_unk);
+	out.counter("unrealircd_connections_accepted_total",
+		"Connections accepted", stats.connections_total);
+	out.gauge("unrealircd_users", "Users on the network", users.size());
+	out.gauge("unrealircd_users_local", "Local users",
+		stats.users_local_cur);
+	out.gauge("unrealircd_operators", "IRC operators", stats.operators);
+	out.gauge("unrealircd_channels", "Channels", channels.size());
+
+	/* queues */
+	uint64_t recvq = 0, sendq = 0;
+
+	for (Map<UnrealSocket*, UnrealUser*>::Iterator ui = local_users.begin();
+			ui != local_users.end(); ++ui)
+	{
+		recvq += ui->second->recvQ.length();
+		sendq += ui->first->sendqSize();
+	}
+
+	out.gauge("unrealircd_recvq_bytes", "Bytes waiting in receive queues",
+		static_cast<double>(recvq));
+	out.gauge("unrealircd_sendq_bytes", "Bytes waiting in send queues",
+		static_cast<double>(sendq));
+
+	/* memory */
+	for (int i = 0; i < UnrealMemoryStats::SubsystemCount; ++i)
+	{
+		UnrealMemoryStats::Subsystem sub =
+			static_cast<UnrealMemoryStats::Subsystem>(i);
+		const UnrealMemoryStats::Usage& u = UnrealMemoryStats::usage(sub);
+		String labels = UnrealMetricWriter::label("subsystem",
+			UnrealMemoryStats::name(sub));
+
+		out.gauge("unrealircd_memory_bytes", "Accounted memory usage",
+			static_cast<double>(u.bytes), labels);
+		out.gauge("unrealircd_memory_peak_bytes",
+			"Highest accounted memory usage",
+			static_cast<double>(u.peak_bytes), labels);
+		out.gauge("unrealircd_memory_objects", "Accounted objects",
+			static_cast<double>(u.objects), labels);
+	}
+
+	/* commands */
+	for (Map<String, UnrealUserCommand*>::Iterator ci =
+			user_commands.begin(); ci != user_commands.end(); ++ci)
+	{
+		UnrealUserCommand* ucptr = ci->second;
+		String labels = UnrealMetricWriter::label("command", ci->first);
+
+		out.counter("unrealircd_commands_total", "Commands called by users",
+			static_cast<double>(ucptr->calls.value()), labels);
+		out.histogram("unrealircd_command_seconds",
+			"Command execution time", ucptr->latency, labels);
+		out.counter("unrealircd_command_cpu_seconds_total",
+			"CPU time used by commands", ucptr->cpu_time / 1000000.0,
+			labels);
+		out.counter("unrealircd_command_sent_bytes_total",
+			"Bytes queued for sending by commands",
+			static_cast<double>(ucptr->bytes_sent), labels);
+		out.counter("unrealircd_command_slow_total",
+			"Command calls above Commands::SlowThreshold",
+			static_cast<double>(ucptr->slow_calls), labels);
+	}
+
+	/* listeners */
+	foreach (List<UnrealListener*>::Iterator, lit, listeners)
+	{
+		UnrealListener* lptr = *lit;
+		UnrealSocketTrafficType traffic = lptr->closed_traffic;
+		String labels = UnrealMetricWriter::label("listener",
+			String::format("%s/%d",
+				lptr->bindAddress().c_str(),
+				static_cast<int>(lptr->bindPort())));
+
+		foreach (List<UnrealSocket*>::Iterator, si, lptr->connections)
+		{
+			UnrealSocketTrafficType current = (*si)->traffic();
+
+			traffic.in += current.in;
+			traffic.out += current.out;
+		}
+
+		out.gauge("unrealircd_listener_connections",
+			"Open connections per listener", lptr->connections.size(),
+			labels);
+		out.counter("unrealircd_listener_received_bytes_total",
+			"Bytes received per listener", static_cast<double>(traffic.in),
+			labels);
+		out.counter("unrealircd_listener_sent_bytes_total",
+			"Bytes sent per listener", static_cast<double>(traffic.out),
+			labels);
+
+		if (lptr->type() != UnrealListener::LClient)
+			continue;
+
+		for (int i = UnrealRegistrationTrace::FirstByte;
+				i < UnrealRegistrationTrace::PhaseCount; ++i)
+		{
+			UnrealRegistrationTrace::Phase ph =
+				static_cast<UnrealRegistrationTrace::Phase>(i);
+
+			out.histogram("unrealircd_registration_seconds",
+				"Time from accepting a client until a registration phase "
+				"was reached", lptr->registrations.phase(ph),
+				labels + "," + UnrealMetricWriter::label("phase",
+					UnrealRegistrationTrace::phaseName(ph)));
+		}
+	}
+
+	/* DNS */
+	UnrealResolverChannel& chan = UnrealResolver::channel();
+	const UnrealResolverChannel::Counters& dns = chan.counters();
+
+	out.counter("unrealircd_dns_requests_total", "DNS requests by result",
+		dns.hits, UnrealMetricWriter::label("result", "cached"));
+	out.counter("unrealircd_dns_requests_total", "DNS requests by result",
+		dns.misses, UnrealMetricWriter::label("result", "lookup"));
+	out.counter("unrealircd_dns_requests_total", "DNS requests by result",
+		dns.shared, UnrealMetricWriter::label("result", "shared"));
+	out.counter("unrealircd_dns_failures_total", "Failed DNS lookups",
+		dns.failures);
+	out.gauge("unrealircd_dns_cache_entries", "Cached DNS results",
+		chan.cacheSize());
+	out.gauge("unrealircd_dns_pending", "DNS lookups in flight",
+		chan.pending());
+	out.histogram("unrealircd_dns_lookup_seconds", "DNS lookup latency",
+		chan.latency());
+
+	/* ident */
+	const UnrealIdentClient::Counters& idc = ident.counters();
+
+	out.counter("unrealircd_ident_queries_total", "Ident queries sent",
+		idc.queries);
+	out.counter("unrealircd_ident_timeouts_total", "Ident queries timed out",
+		idc.timeouts);
+	out.counter("unrealircd_ident_skipped_total", "Ident queries skipped",
+		idc.cache_hits, UnrealMetricWriter::label("reason", "cached"));
+	out.counter("unrealircd_ident_skipped_total", "Ident queries skipped",
+		idc.unreachable_skips,
+		UnrealMetricWriter::label("reason", "unreachable"));
+	out.counter("unrealircd_ident_skipped_total", "Ident queries skipped",
+		idc.busy_skips, UnrealMetricWriter::label("reason", "busy"));
+
+	/* throttle and bans */
+	const UnrealThrottle::Counters& thr = throttle.counters();
+
+	out.counter("unrealircd_throttle_rejected_total",
+		"Connections rejected by the throttle", thr.too_many,
+		UnrealMetricWriter::label("reason", "too_many"));
+	out.counter("unrealircd_throttle_rejected_total",
+		"Connections rejected by the throttle", thr.too_fast,
+		UnrealMetricWriter::label("reason", "too_fast"));
+	out.gauge("unrealircd_bans", "K-, G- and Z-lines", bans.size());
+
+	/* worker threads */
+	const UnrealWorkerPool::Counters& wrk = workers.counters();
+
+	out.counter("unrealircd_worker_jobs_total", "Jobs submitted to the "
+		"worker threads", wrk.submitted);
+	out.counter("unrealircd_worker_rejected_total", "Jobs rejected as the "
+		"worker queue was full", wrk.rejected);
+	out.gauge("unrealircd_worker_pending", "Jobs not completed yet",
+		workers.pending());
+
+	/* event loop */
+	out.histogram("unrealircd_reactor_handler_seconds",
+		"Execution time of event handlers", monitor.handlers());
+	out.histogram("unrealircd_reactor_lag_seconds",
+		"Delay of the main loop timer", monitor.lag());
+	out.gauge("unrealircd_reactor_lag_last_seconds",
+		"Last delay of the main loop timer", monitor.lastLag() / 1000000.0);
+	out.counter("unrealircd_reactor_lag_events_total",
+		"Times the main loop timer delay exceeded Monitor::LagThreshold",
+		monitor.lagEvents());
+	out.gauge("unrealircd_reactor_longest_handler_seconds",
+		"Longest event handler so far", monitor.longest() / 1000000.0,
+		UnrealMetricWriter::label("tag", monitor.longestTag()));
+	out.gauge("unrealircd_reactor_ready_handlers_p99",
+		"Handlers ready per wakeup, 99th percentile",
+		static_cast<double>(monitor.depth().percentile(0.99)));
+	out.gauge("unrealircd_reactor_ready_handlers_max",
+		"Most handlers ready at a wakeup",
+		static_cast<double>(monitor.depth().max()));
+
+	/* logging and tracing */
+	out.counter("unrealircd_log_dropped_total", "Log lines dropped",
+		log.dropped());
+	out.gauge("unrealircd_trace_records", "Lines in the protocol trace",
+		trace.records());
+	out.counter("unrealircd_capture_records_total",
+		"Records written to the traffic capture", capture.records());
+}
+
 /**
  * Terminate program execution.
  *
@@ -156,6 +362,15 @@ void UnrealBase::finish()
 	/* close log file */
 	log.close();
 
+	/* stop serving metrics */
+	metrics.stop();
+
+	/* stop the worker threads; their completions may live in modules */
+	workers.stop();
+
+	/* write pending ban changes */
+	bans.close();
+
 	/* destroy modules */
 	foreach (List<UnrealModule*>::Iterator, mod, modules)
 		delete *mod;
@@ -210,6 +425,22 @@ void UnrealBase::init()
 	/* open log file */
 	initLog();
 
+	/* build ISupport map; modules may add their own tokens */
+	setupISupport();
+
+	/* user search index options */
+	userindex.setIndexRealname(
+		config.get("Features::WhoRealnameIndex", "false").toBool());
+
+	/* allocate the protocol trace */
+	trace.init();
+
+	/* command accounting settings */
+	UnrealUserCommand::loadSettings();
+
+	/* load server bans */
+	bans.load();
+
 	/* load modules */
 	initModules();
 
@@ -222,8 +453,8 @@ void UnrealBase::init()
 	/* setup Listeners */
 	setupListener();
 
-	/* build ISupport map */
-	setupISupport();
+	/* register core metrics and start their listener */
+	setupMetrics();
 
 	/* setup local server entry */
 	setupServer();
@@ -270,6 +501,7 @@ void UnrealBase::initModes()
 		ModeTable.registerMode(Deaf);
 		ModeTable.registerMode(Invisible);
 		ModeTable.registerMode(Operator);
+		ModeTable.registerMode(ServerNotice);
 		ModeTable.registerMode(Wallops);
 	}
 
@@ -375,6 +607,18 @@ void UnrealBase::parseArgv()
 		{
 			printConfig();
 		}
+		else if (*sli == "-p" || *sli == "--mkpasswd")
+		{
+			if ((sli + 1) == argv.end())
+			{
+				std::cerr << *sli
+						  << ": missing argument"
+						  << std::endl;
+				continue;
+			}
+			else
+				printPassword(*++sli);
+		}
 		else if (*sli == "-v" || *sli == "--version")
 		{
 			printVersion();
@@ -394,7 +638,7 @@ void UnrealBase::printUsage()
 {
 	std::cout << "Usage: "
 			  << argv.at(0)
-			  << " [ -CchiPv [ arguments ] ]"
+			  << " [ -CchiPpv [ arguments ] ]"
 			  << std::endl
 			  << std::endl;
 	std::cout << "Available arguments:"
@@ -412,6 +656,9 @@ void UnrealBase::printUsage()
 			  << std::endl;
 	std::cout << "  -P, --print-config       Print config map contents"
 			  << std::endl;
+	std::cout << "  -p, --mkpasswd PASSWORD  Print a hashed password for the "
+			  << "config file"
+			  << std::endl;
 	std::cout << "  -v, --version            Print the program version"
 			  << std::endl;
 
@@ -437,6 +684,19 @@ void UnrealBase::printConfig()
 	exit();
 }
 
+/**
+ * Print the stored form of a password, to be used in the config file.
+ *
+ * @param password Plain password
+ */
+void UnrealBase::printPassword(const String& password)
+{
+	std::cout << UnrealHash::encode(password)
+			  << std::endl;
+
+	exit();
+}
+
 /**
  * Print the program version.
  */
@@ -498,18 +758,22 @@ void UnrealBase::restart()
  */
 void UnrealBase::run()
 {
+	/* hand logging over to the writer thread, now that we have forked */
+	log.start();
+
 	timer_ = new UnrealTimer();
 
 	/* launch timer */
 	timer_->expires_from_now(boost::posix_time::seconds(1));
+	monitor.schedule(1000000);
 	timer_->async_wait(
 		boost::bind(
 			&UnrealBase::run,
 			this,
 			boost::asio::placeholders::error));
 
-	/* run main loop */
-	reactor_.run();
+	/* run main loop, measuring its handlers */
+	monitor.run(reactor_);
 
 	/* once all necessary operations done, deallocate the timer */
 	delete timer_;
@@ -530,6 +794,9 @@ void UnrealBase::run(const UnrealReactor::ErrorCode& ec)
 	}
 	else
 	{
+		/* measure how late we are */
+		monitor.tick();
+
 		/* flood protection; check for local user connections only */
 		for (Map<UnrealSocket*, UnrealUser*>::Iterator ui = local_users.begin();
 				ui != local_users.end(); ++ui)
@@ -548,8 +815,12 @@ void UnrealBase::run(const UnrealReactor::ErrorCode& ec)
 				uptr->listener()->processRecvQueue(uptr, false);
 		}
 
+		/* dump the protocol trace if requested by signal */
+		trace.poll();
+
 		/* reset the timer */
 		timer_->expires_from_now(boost::posix_time::seconds(1));
+		monitor.schedule(1000000);
 		timer_->async_wait(
 			boost::bind(
 				&UnrealBase::run,
@@ -666,6 +937,18 @@ void UnrealBase::setupListener()
 	}
 }
 
+/**
+ * Register the metrics of the core subsystems and start the metrics
+ * listener.
+ */
+void UnrealBase::setupMetrics()
+{
+	metrics.addCollector(this,
+		boost::bind(&UnrealBase::collectMetrics, this, _1));
+
+	metrics.start();
+}
+
 /**
  * Check and fix resource limits as provided by the operating system.
  * That includes increasing the number of permitted open file descriptors
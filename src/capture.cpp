@@ -0,0 +1,421 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         capture.cpp
+ * Description  Capture of client traffic for replays
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <capture.hpp>
+#include <hash.hpp>
+#include <socket.hpp>
+#include <time.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <sys/time.h>
+
+/** commands whose last argument is free text */
+static const char* text_commands[] = {
+	"AWAY", "GLINE", "KICK", "KILL", "NOTICE", "PART", "PRIVMSG", "QUIT",
+	"TOPIC", "USER", "WALLOPS", 0
+};
+
+/** commands whose arguments are keywords, recorded as they are */
+static const char* keyword_commands[] = {
+	"ADMIN", "CAP", "HELP", "INFO", "LUSERS", "MOTD", "PROTOCTL", "STATS",
+	"VERSION", 0
+};
+
+/**
+ * Returns whether a command is in a list.
+ *
+ * @param list Zero terminated list of command names
+ * @param cmd Command name in upper case
+ * @return true if listed
+ */
+static bool listed(const char** list, const String& cmd)
+{
+	for (; *list; ++list)
+		if (cmd == *list)
+			return true;
+
+	return false;
+}
+
+/**
+ * UnrealTrafficCapture constructor.
+ */
+UnrealTrafficCapture::UnrealTrafficCapture()
+	: file_(0), last_connection_(0), started_(0), bytes_(0), records_(0),
+	  max_size_(0)
+{ }
+
+/**
+ * UnrealTrafficCapture destructor.
+ */
+UnrealTrafficCapture::~UnrealTrafficCapture()
+{
+	stop();
+}
+
+/**
+ * Anonymize a line received from a client. The command and the shape of
+ * the line are kept, so the server does the same work on a replay.
+ *
+ * @param line Line without CRLF
+ * @return Anonymized line
+ */
+String UnrealTrafficCapture::anonymize(const String& line)
+{
+	size_t pos = 0;
+
+	/* a prefix sent by a client is ignored by the server anyway */
+	if (!line.empty() && line[0] == ':')
+	{
+		pos = line.find(' ');
+
+		if (pos == String::npos)
+			return String();
+
+		++pos;
+	}
+
+	size_t end = line.find(' ', pos);
+	String cmd = String(line.substr(pos, end == String::npos
+		? String::npos : end - pos)).toUpper();
+	String result = cmd;
+
+	/* keep passwords out of the capture */
+	if (end == String::npos || cmd == "OPER" || cmd == "PASS")
+		return result;
+
+	bool text = listed(text_commands, cmd);
+	bool keywords = listed(keyword_commands, cmd);
+
+	for (pos = end; pos < line.length(); )
+	{
+		if (line[pos] == ' ')
+		{
+			result += ' ';
+			++pos;
+			continue;
+		}
+
+		if (line[pos] == ':')
+		{
+			String trailing = line.substr(pos + 1);
+
+			result += ':';
+
+			if (text)
+			{
+				/* keep the length, spaces and CTCP delimiters only */
+				for (String::Iterator ch = trailing.begin();
+						ch != trailing.end(); ++ch)
+					if (*ch != ' ' && *ch != '\001')
+						*ch = 'x';
+
+				result += trailing;
+			}
+			else
+				result += keywords ? trailing : anonymizeParam(trailing);
+
+			break;
+		}
+
+		end = line.find(' ', pos);
+
+		String param = line.substr(pos, end == String::npos
+			? String::npos : end - pos);
+
+		result += keywords ? param : anonymizeParam(param);
+		pos = end == String::npos ? line.length() : end;
+	}
+
+	return result;
+}
+
+/**
+ * Anonymize an argument; lists are separated by commas or spaces.
+ *
+ * @param param Argument
+ * @return Anonymized argument
+ */
+String UnrealTrafficCapture::anonymizeParam(const String& param)
+{
+	String result;
+	size_t pos = 0;
+
+	while (pos <= param.length())
+	{
+		size_t end = param.find_first_of(", ", pos);
+
+		if (end == String::npos)
+			end = param.length();
+
+		result += pseudonym(param.substr(pos, end - pos));
+
+		if (end < param.length())
+			result += param[end];
+
+		pos = end + 1;
+	}
+
+	return result;
+}
+
+/**
+ * Write a line record, if the connection is recorded.
+ *
+ * @param sptr Socket
+ * @param line Line without CRLF
+ */
+void UnrealTrafficCapture::append(UnrealSocket* sptr, const String& line)
+{
+	Map<UnrealSocket*, uint32_t>::Iterator ci = connections_.find(sptr);
+
+	if (ci != connections_.end())
+		write(Line, ci->second, anonymize(line));
+}
+
+/**
+ * Returns the number of bytes written.
+ *
+ * @return Bytes
+ */
+uint64_t UnrealTrafficCapture::bytes()
+{
+	return bytes_;
+}
+
+/**
+ * Record that a connection has been closed.
+ *
+ * @param sptr Socket
+ */
+void UnrealTrafficCapture::close(UnrealSocket* sptr)
+{
+	if (!file_)
+		return;
+
+	Map<UnrealSocket*, uint32_t>::Iterator ci = connections_.find(sptr);
+
+	if (ci == connections_.end())
+		return;
+
+	uint32_t connection = ci->second;
+
+	connections_.erase(ci);
+	write(Close, connection, String());
+}
+
+/**
+ * Returns the number of connections being recorded.
+ *
+ * @return Connections
+ */
+size_t UnrealTrafficCapture::connections()
+{
+	return connections_.size();
+}
+
+/**
+ * Returns whether traffic is captured.
+ *
+ * @return true if capturing
+ */
+bool UnrealTrafficCapture::enabled()
+{
+	return file_ != 0;
+}
+
+/**
+ * Returns the name of the capture file.
+ *
+ * @return File name
+ */
+const String& UnrealTrafficCapture::fileName()
+{
+	return file_name_;
+}
+
+/**
+ * Start recording a connection which has just been accepted.
+ *
+ * @param sptr Socket
+ */
+void UnrealTrafficCapture::open(UnrealSocket* sptr)
+{
+	if (!file_)
+		return;
+
+	uint32_t connection = ++last_connection_;
+
+	connections_.add(sptr, connection);
+	write(Open, connection, String());
+}
+
+/**
+ * Returns the replacement of a nickname, user name or channel name.
+ * Numbers, mode changes and single characters are kept.
+ *
+ * @param token Name
+ * @return Replacement
+ */
+String UnrealTrafficCapture::pseudonym(const String& token)
+{
+	if (token.length() <= 1 || token[0] == '+' || token[0] == '-'
+			|| token.find_first_not_of("0123456789") == String::npos)
+		return token;
+
+	String hash = UnrealHash::calculate(key_ + String(token).toLower(),
+		UnrealHash::SHA1).substr(0, 8);
+	String result;
+
+	if (token[0] == '#' || token[0] == '&')
+	{
+		result += token[0];
+		result += 'c';
+	}
+	else
+		result += 'u';
+
+	return result + hash.toLower();
+}
+
+/**
+ * Returns the number of records written.
+ *
+ * @return Records
+ */
+uint64_t UnrealTrafficCapture::records()
+{
+	return records_;
+}
+
+/**
+ * Start capturing into Capture::File, replacing an earlier capture.
+ *
+ * @return false if the file couldn't be created; errno is set then
+ */
+bool UnrealTrafficCapture::start()
+{
+	stop();
+
+	file_name_ = unreal->config.get("Capture::File", "capture.bin");
+	max_size_ = unreal->config.get("Capture::MaxSize", "104857600")
+		.toUInt64();
+
+	std::FILE* file = std::fopen(file_name_.c_str(), "wb");
+
+	if (!file)
+		return false;
+
+	FileHeader hdr;
+	struct timeval tv;
+
+	gettimeofday(&tv, 0);
+	std::memcpy(hdr.magic, "UCAP", 4);
+	hdr.version = Version;
+	hdr.started = static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+
+	if (std::fwrite(&hdr, sizeof(hdr), 1, file) != 1)
+	{
+		int err = errno;
+
+		std::fclose(file);
+		errno = err;
+
+		return false;
+	}
+
+	file_ = file;
+	key_ = UnrealHash::randomSalt();
+	last_connection_ = 0;
+	started_ = UnrealTime::monotonic();
+	bytes_ = sizeof(hdr);
+	records_ = 0;
+
+	return true;
+}
+
+/**
+ * Stop capturing and close the file.
+ */
+void UnrealTrafficCapture::stop()
+{
+	if (!file_)
+		return;
+
+	if (std::fclose(file_) != 0)
+		unreal->log.write(UnrealLog::Error, "Traffic capture: couldn't "
+			"write %s: %s", file_name_.c_str(), std::strerror(errno));
+
+	file_ = 0;
+	connections_.clear();
+}
+
+/**
+ * Write a record. The capture is stopped when Capture::MaxSize is
+ * reached or the file can't be written.
+ *
+ * @param type Record type
+ * @param connection Connection number
+ * @param text Record text
+ * @return true if the record has been written
+ */
+bool UnrealTrafficCapture::write(RecordType type, uint32_t connection,
+	const String& text)
+{
+	Record rec;
+	size_t len = text.length() > 0xffff ? 0xffff : text.length();
+
+	if (max_size_ > 0 && bytes_ + sizeof(rec) + len > max_size_)
+	{
+		unreal->log.write(UnrealLog::Normal, "Traffic capture: %s reached "
+			"Capture::MaxSize, stopped", file_name_.c_str());
+
+		stop();
+		return false;
+	}
+
+	rec.time = UnrealTime::monotonic() - started_;
+	rec.connection = connection;
+	rec.length = static_cast<uint16_t>(len);
+	rec.type = static_cast<uint8_t>(type);
+	rec.reserved = 0;
+
+	if (std::fwrite(&rec, sizeof(rec), 1, file_) != 1
+			|| (len > 0 && std::fwrite(text.data(), len, 1, file_) != 1))
+	{
+		unreal->log.write(UnrealLog::Error, "Traffic capture: couldn't "
+			"write %s: %s", file_name_.c_str(), std::strerror(errno));
+
+		stop();
+		return false;
+	}
+
+	bytes_ += sizeof(rec) + len;
+	records_++;
+
+	return true;
+}
@@ -25,6 +25,8 @@
 
 #include <base.hpp>
 #include <channel.hpp>
+#include <memstat.hpp>
+#include <probes.hpp>
 #include <cmd/mode.hpp>
 #include <iostream>
 
@@ -32,6 +34,12 @@
 #define FLAG_TO_UINT(x) \
 	static_cast<uint16_t>(x)
 
+/** memory used by a member entry, including the map node and the pointer
+ * in the user's channel list
+ */
+static const size_t member_bytes = sizeof(UnrealChannelMember)
+	+ 4 * sizeof(void*) + sizeof(UnrealChannel*);
+
 /** channel mode definitions */
 namespace UnrealChannelProperties
 {
@@ -75,6 +83,8 @@ namespace UnrealChannelProperties
 	UnrealChannelModeTable ModeTable;
 }
 
+uint64_t UnrealChannel::last_names_chunk_ = 0;
+
 /**
  * UnrealChannel constructor.
  *
@@ -83,6 +93,9 @@ namespace UnrealChannelProperties
 UnrealChannel::UnrealChannel(const String& name)
 	: creation_time_(UnrealTime::now()), limit_(0)
 {
+	UnrealMemoryStats::allocate(UnrealMemoryStats::Channels,
+		sizeof(UnrealChannel));
+
 	setName(name);
 }
 
@@ -91,6 +104,9 @@ UnrealChannel::UnrealChannel(const String& name)
  */
 UnrealChannel::~UnrealChannel()
 {
+	UnrealMemoryStats::release(UnrealMemoryStats::Channels,
+		sizeof(UnrealChannel) + members.size() * member_bytes);
+
 	foreach(MemberIterator, cmi, members)
 	{
 		/* free all member entries */
@@ -98,6 +114,9 @@ UnrealChannel::~UnrealChannel()
 		delete cmptr;
 	}
 
+	foreach(List<NamesChunk*>::Iterator, nci, names_chunks_)
+		delete *nci;
+
 	/* remove channel from channel list */
 	if (!name_.empty())
 	{
@@ -157,6 +176,10 @@ UnrealChannel::Member* UnrealChannel::addMember(UnrealUser* uptr,
 
 		/* add member to channel */
 		members.add(uptr, cmptr);
+		addNamesEntry(cmptr);
+
+		UnrealMemoryStats::allocate(UnrealMemoryStats::Channels,
+			member_bytes, 0);
 
 		/* add channel into user's channel list so we can access the channels
 		 * a bit faster
@@ -167,6 +190,34 @@ UnrealChannel::Member* UnrealChannel::addMember(UnrealUser* uptr,
 	return cmptr;
 }
 
+/**
+ * Add a member to the NAMES cache. The member is appended to the last
+ * chunk, or to a new chunk if it doesn't fit anymore.
+ *
+ * @param cmptr Member
+ */
+void UnrealChannel::addNamesEntry(Member* cmptr)
+{
+	/* reserve room for all prefixes, so prefix changes never overflow
+	 * a chunk */
+	cmptr->names_size = cmptr->user->nick().length() + 4;
+
+	NamesChunk* chunk = (names_chunks_.empty() ? 0 : names_chunks_.back());
+
+	if (!chunk || chunk->length + cmptr->names_size > NAMES_CHUNK_SIZE)
+	{
+		chunk = new NamesChunk();
+		chunk->id = ++last_names_chunk_;
+		chunk->length = 0;
+		names_chunks_ << chunk;
+	}
+
+	chunk->members << cmptr;
+	chunk->length += cmptr->names_size;
+	chunk->dirty = true;
+	cmptr->chunk = chunk;
+}
+
 /**
  * Returns whether the specified user can send to the channel.
  *
@@ -456,6 +507,55 @@ String UnrealChannel::lowerName()
 	return name_.toLower();
 }
 
+/**
+ * Merge an underfull NAMES chunk with its neighbors where they fit into a
+ * single line.
+ *
+ * @param chunk Chunk that has become smaller
+ */
+void UnrealChannel::mergeNamesChunk(NamesChunk* chunk)
+{
+	size_t index = names_chunks_.indexOf(chunk);
+
+	if (index > 0 && mergeNamesChunks(index - 1))
+		index--;
+
+	mergeNamesChunks(index);
+}
+
+/**
+ * Merge a NAMES chunk into the following one if both fit into a single
+ * line. The earlier chunk is folded into the later one, so a NAMES reply
+ * in progress may list a moved member twice, but never skips one.
+ *
+ * @param index Index of the earlier chunk
+ * @return Whether the chunks have been merged
+ */
+bool UnrealChannel::mergeNamesChunks(size_t index)
+{
+	if (index + 1 >= names_chunks_.size())
+		return false;
+
+	NamesChunk* chunk = names_chunks_.at(index);
+	NamesChunk* next = names_chunks_.at(index + 1);
+
+	if (chunk->length + next->length > NAMES_CHUNK_SIZE)
+		return false;
+
+	foreach (List<Member*>::Iterator, cmi, chunk->members)
+		(*cmi)->chunk = next;
+
+	next->members.insert(next->members.begin(), chunk->members.begin(),
+		chunk->members.end());
+	next->length += chunk->length;
+	next->dirty = true;
+
+	names_chunks_.removeAt(index);
+	delete chunk;
+
+	return true;
+}
+
 /**
  * Send modes.
  *
@@ -571,6 +671,76 @@ const String& UnrealChannel::name()
 	return name_;
 }
 
+/**
+ * Returns a part of the NAMES reply. The part is rendered again if one of
+ * its members has changed since it has been rendered last.
+ *
+ * @param chunk Chunk, see namesChunkAfter()
+ * @param multi_prefix Whether to show all prefixes of a member (NAMESX)
+ * @return Space separated nick list
+ */
+const String& UnrealChannel::namesChunk(NamesChunk* chunk, bool multi_prefix)
+{
+	if (chunk->dirty)
+	{
+		chunk->single_prefix.clear();
+		chunk->multi_prefix.clear();
+
+		foreach (List<Member*>::Iterator, cmi, chunk->members)
+		{
+			Member* cmptr = *cmi;
+			String multi;
+
+			if (cmptr->isChanOp())
+				multi.append(1, '@');
+			if (cmptr->isHalfOp())
+				multi.append(1, '%');
+			if (cmptr->isVoiced())
+				multi.append(1, '+');
+
+			if (!chunk->single_prefix.empty())
+			{
+				chunk->single_prefix.append(1, ' ');
+				chunk->multi_prefix.append(1, ' ');
+			}
+
+			if (!multi.empty())
+				chunk->single_prefix.append(1, multi.at(0));
+
+			chunk->single_prefix += cmptr->user->nick();
+			chunk->multi_prefix += multi + cmptr->user->nick();
+		}
+
+		chunk->dirty = false;
+	}
+
+	return (multi_prefix ? chunk->multi_prefix : chunk->single_prefix);
+}
+
+/**
+ * Returns the next part of the NAMES reply. Chunk numbers stay valid while
+ * chunks are freed or merged, so a reply in progress keeps its place.
+ *
+ * @param id Number of the last chunk sent, or 0 to start
+ * @return First chunk with a higher number, or 0 if there is none
+ */
+UnrealChannel::NamesChunk* UnrealChannel::namesChunkAfter(uint64_t id)
+{
+	size_t low = 0, high = names_chunks_.size();
+
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+
+		if (names_chunks_.at(mid)->id <= id)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return (low < names_chunks_.size() ? names_chunks_.at(low) : 0);
+}
+
 /**
  * Parse channel mode changes.
  *
@@ -732,6 +902,8 @@ void UnrealChannel::parseModeChange(UnrealUser* uptr, StringList* argv)
 							tumptr->flags << Member::ChanOp;
 						else
 							tumptr->flags << Member::Voice;
+
+						updateNames(tuptr);
 					}
 				}
 			}
@@ -847,6 +1019,8 @@ void UnrealChannel::parseModeChange(UnrealUser* uptr, StringList* argv)
 							tumptr->flags.revoke(Member::ChanOp);
 						else
 							tumptr->flags.revoke(Member::Voice);
+
+						updateNames(tuptr);
 					}
 				}
 			}
@@ -886,30 +1060,48 @@ void UnrealChannel::removeMember(UnrealUser* uptr)
 	if (cmptr)
 	{
 		uptr->channels.remove(this);
+		removeNamesEntry(cmptr);
 		members.remove(uptr);
 		delete cmptr;
+
+		UnrealMemoryStats::release(UnrealMemoryStats::Channels,
+			member_bytes, 0);
 	}
 }
 
 /**
- * Send the channel banlist to the specified user.
+ * Remove a member from the NAMES cache. A chunk that has become empty is
+ * freed, an underfull one merged with a neighbor if they fit into a single
+ * line.
  *
- * @param uptr User entry pointer
+ * @param cmptr Member
  */
-void UnrealChannel::sendBanList(UnrealUser* uptr)
+void UnrealChannel::removeNamesEntry(Member* cmptr)
 {
-	for (BanIterator cbi = banlist.begin(); cbi != banlist.end(); cbi++)
-	{
-		Ban* cbptr = *cbi;
+	NamesChunk* chunk = cmptr->chunk;
 
-		sendreply(uptr, RPL_BANLIST,
-			String::format(MSG_BANLIST,
-				cbptr->mask.c_str(),
-				cbptr->originator.c_str(),
-				cbptr->lastmod.toTS()));
+	chunk->members.remove(cmptr);
+	chunk->length -= cmptr->names_size;
+	chunk->dirty = true;
+	cmptr->chunk = 0;
+
+	if (chunk->members.empty())
+	{
+		names_chunks_.free(chunk);
+		return;
 	}
 
-	sendreply(uptr, RPL_ENDOFBANLIST, MSG_ENDOFBANLIST);
+	mergeNamesChunk(chunk);
+}
+
+/**
+ * Send the channel banlist to the specified user.
+ *
+ * @param uptr User entry pointer
+ */
+void UnrealChannel::sendBanList(UnrealUser* uptr)
+{
+	uptr->addReplyStream(new UnrealBanListStream(name_));
 }
 
 /**
@@ -935,6 +1127,8 @@ void UnrealChannel::sendlocalreply(UnrealUser* uptr, const String& cmd,
 		name_.c_str(),
 		data.c_str());
 
+	UNREAL_PROBE3(fanout, name_.c_str(), cmd.c_str(), members.size());
+
 	/* send the message to all users on the channel */
 	foreach (MemberIterator, cmi, members)
 	{
@@ -1119,3 +1313,81 @@ UnrealTime UnrealChannel::topicTime()
 {
 	return topic_time_;
 }
+
+/**
+ * Update the NAMES cache after the nick or the prefixes of a member have
+ * changed.
+ *
+ * @param uptr User entry pointer
+ */
+void UnrealChannel::updateNames(UnrealUser* uptr)
+{
+	Member* cmptr = findMember(uptr);
+
+	if (!cmptr)
+		return;
+
+	size_t names_size = uptr->nick().length() + 4;
+	NamesChunk* chunk = cmptr->chunk;
+
+	if (chunk->length - cmptr->names_size + names_size > NAMES_CHUNK_SIZE)
+	{
+		/* a longer nick doesn't fit anymore, so move the member */
+		removeNamesEntry(cmptr);
+		addNamesEntry(cmptr);
+	}
+	else
+	{
+		bool shrunk = (names_size < cmptr->names_size);
+
+		chunk->length = chunk->length - cmptr->names_size + names_size;
+		cmptr->names_size = names_size;
+		chunk->dirty = true;
+
+		if (shrunk)
+			mergeNamesChunk(chunk);
+	}
+}
+
+/**
+ * UnrealBanListStream constructor.
+ *
+ * @param chname Channel name
+ */
+UnrealBanListStream::UnrealBanListStream(const String& chname)
+	: chname_(chname), pos_(0)
+{ }
+
+/**
+ * Send the next chunk of the ban list.
+ *
+ * @param uptr User receiving the list
+ * @param max_lines Maximum number of lines to send
+ * @return More or Done
+ */
+UnrealReplyStream::Result UnrealBanListStream::produce(UnrealUser* uptr,
+	size_t max_lines)
+{
+	UnrealChannel* chptr = UnrealChannel::find(chname_);
+
+	if (!chptr)
+		return Done;
+
+	for (size_t lines = 0; pos_ < chptr->banlist.size(); ++pos_, ++lines)
+	{
+		if (lines >= max_lines)
+			return More;
+
+		UnrealChannel::Ban* cbptr = chptr->banlist.at(pos_);
+
+		chptr->sendreply(uptr, RPL_BANLIST,
+			String::format(MSG_BANLIST,
+				cbptr->mask.c_str(),
+				cbptr->originator.c_str(),
+				cbptr->lastmod.toTS()));
+	}
+
+	chptr->sendreply(uptr, RPL_ENDOFBANLIST, MSG_ENDOFBANLIST);
+
+	return Done;
+}
@@ -0,0 +1,338 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         gline.cpp
+ * Description  GLINE, KLINE and ZLINE command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <command.hpp>
+#include <module.hpp>
+#include <stringlist.hpp>
+
+#include <cmd/gline.hpp>
+#include <cmd/notice.hpp>
+
+/** class instance */
+static UnrealCH_gline* handler = NULL;
+
+/**
+ * Unreal Command Handler for "GLINE" - Constructor.
+ *
+ * @param mptr Module pointer
+ */
+UnrealCH_gline::UnrealCH_gline(UnrealModule* mptr)
+{
+	setInfo(&mptr->inf);
+	
+	/* allocate additional contents */
+	command_ = new UnrealUserCommand(CMD_GLINE, &UnrealCH_gline::exec, true);
+	kline_command_ = new UnrealUserCommand(CMD_KLINE,
+		&UnrealCH_gline::execKline, true);
+	zline_command_ = new UnrealUserCommand(CMD_ZLINE,
+		&UnrealCH_gline::execZline, true);
+}
+
+/**
+ * Unreal Command Handler for "GLINE" - Destructor.
+ */
+UnrealCH_gline::~UnrealCH_gline()
+{
+	delete command_;
+	delete kline_command_;
+	delete zline_command_;
+}
+
+/**
+ * Disconnect the local users matching a new ban. Z-lines also hit
+ * connections which haven't registered yet, as their address is known
+ * from the start.
+ *
+ * @param ban Ban entry
+ */
+void UnrealCH_gline::applyBan(UnrealBanList::BanPtr ban)
+{
+	List<UnrealUser*> victims;
+
+	for (Map<UnrealSocket*, UnrealUser*>::Iterator ui =
+			unreal->local_users.begin(); ui != unreal->local_users.end(); ++ui)
+	{
+		UnrealUser* uptr = ui->second;
+
+		if (!uptr->isRegistered() && ban->type != UnrealBanList::ZLine)
+			continue;
+
+		if (UnrealBanList::matches(*ban, uptr->ident(), uptr->realHostname(),
+				uptr->ip()))
+			victims << uptr;
+	}
+
+	foreach (List<UnrealUser*>::Iterator, vi, victims)
+	{
+		UnrealUser* uptr = *vi;
+		String message = String::format("%s (%s)",
+			UnrealBanList::typeName(ban->type),
+			ban->reason.c_str());
+
+		uptr->sendreply(ERR_YOUREBANNEDCREEP,
+			String::format(MSG_YOUREBANNEDCREEP,
+				ban->reason.c_str()));
+
+		uptr->drop(message);
+	}
+}
+
+/**
+ * GLINE command handler for User connections.
+ *
+ * Usage:
+ * GLINE <[+]user@host|nick> [duration] [:reason]
+ * GLINE -<user@host>
+ *
+ * The duration is given in seconds or like "1d12h"; 0 or no duration
+ * means permanent.
+ *
+ * Message example:
+ * GLINE *@*.example.net 1d :Drones
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_gline::exec(UnrealUser* uptr, StringList* argv)
+{
+	handle(uptr, argv, UnrealBanList::GLine, CMD_GLINE);
+}
+
+/**
+ * KLINE command handler for User connections; same usage as GLINE, but the
+ * ban is local to this server.
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_gline::execKline(UnrealUser* uptr, StringList* argv)
+{
+	handle(uptr, argv, UnrealBanList::KLine, CMD_KLINE);
+}
+
+/**
+ * ZLINE command handler for User connections; same usage as GLINE, with an
+ * IP address or CIDR block instead of user@host.
+ *
+ * Message example:
+ * ZLINE 192.0.2.0/24 2h :Connect flood
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_gline::execZline(UnrealUser* uptr, StringList* argv)
+{
+	handle(uptr, argv, UnrealBanList::ZLine, CMD_ZLINE);
+}
+
+/**
+ * Add or remove a ban.
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ * @param type Ban type
+ * @param cmd Command name
+ */
+void UnrealCH_gline::handle(UnrealUser* uptr, StringList* argv,
+	UnrealBanList::Type type, const char* cmd)
+{
+	if (argv->size() < 2 || argv->at(1).empty() || argv->at(1) == "-")
+	{
+		uptr->sendreply(ERR_NEEDMOREPARAMS,
+			String::format(MSG_NEEDMOREPARAMS,
+				cmd));
+		return;
+	}
+
+	String mask = argv->at(1);
+	const char* name = UnrealBanList::typeName(type);
+
+	if (mask[0] == '-')
+	{
+		mask = mask.mid(1);
+
+		if (!unreal->bans.remove(type, mask))
+		{
+			uptr->sendreply(CMD_NOTICE,
+				String::format(":No %s for %s",
+					name,
+					mask.c_str()));
+		}
+		else
+		{
+			uptr->notifyOpers(String::format("%s removed %s for %s",
+				uptr->nick().c_str(),
+				name,
+				mask.c_str()));
+		}
+
+		return;
+	}
+
+	if (mask[0] == '+')
+		mask = mask.mid(1);
+
+	/* a nickname bans the host of that user */
+	if (mask.find_first_of("@.:/") == String::npos)
+	{
+		UnrealUser* target = UnrealUser::find(mask);
+
+		if (target)
+		{
+			if (type == UnrealBanList::ZLine)
+				mask = target->ip();
+			else
+				mask = "*@" + target->realHostname();
+		}
+	}
+
+	long duration = 0;
+	String reason = "No reason";
+	size_t reason_index = 2;
+
+	if (argv->size() > 2 && (duration = parseDuration(argv->at(2))) >= 0)
+		reason_index++;
+	else
+		duration = 0;
+
+	if (argv->size() > reason_index && !argv->at(reason_index).empty())
+		reason = argv->at(reason_index);
+
+	UnrealBanList::BanPtr ban = unreal->bans.add(type, mask, reason,
+		uptr->nick(), duration);
+
+	if (!ban)
+	{
+		uptr->sendreply(CMD_NOTICE,
+			String::format(":Invalid or too broad mask for %s: %s",
+				name,
+				mask.c_str()));
+		return;
+	}
+
+	if (duration > 0)
+	{
+		uptr->notifyOpers(String::format("%s added %s for %s, expiring in "
+			"%ld seconds: %s",
+				uptr->nick().c_str(),
+				name,
+				ban->mask.c_str(),
+				duration,
+				ban->reason.c_str()));
+	}
+	else
+	{
+		uptr->notifyOpers(String::format("%s added permanent %s for %s: %s",
+			uptr->nick().c_str(),
+			name,
+			ban->mask.c_str(),
+			ban->reason.c_str()));
+	}
+
+	applyBan(ban);
+}
+
+/**
+ * Parse a duration like "3600", "30m" or "1d12h".
+ *
+ * @param str Duration text
+ * @return Seconds, or -1 if the text is no duration
+ */
+long UnrealCH_gline::parseDuration(const String& str)
+{
+	long total = 0, value = 0;
+	bool digits = false;
+
+	if (str.empty())
+		return -1;
+
+	for (size_t i = 0; i < str.length(); ++i)
+	{
+		char ch = String::toLower(str[i]);
+
+		if (ch >= '0' && ch <= '9')
+		{
+			value = value * 10 + (ch - '0');
+			digits = true;
+			continue;
+		}
+
+		if (!digits)
+			return -1;
+
+		switch (ch)
+		{
+			case 's': total += value; break;
+			case 'm': total += value * 60; break;
+			case 'h': total += value * 3600; break;
+			case 'd': total += value * 86400; break;
+			case 'w': total += value * 604800; break;
+			default: return -1;
+		}
+
+		value = 0;
+		digits = false;
+	}
+
+	return total + value;
+}
+
+/**
+ * Updates the module information.
+ *
+ * @param inf Module information object pointer
+ */
+void UnrealCH_gline::setInfo(UnrealModuleInf* inf)
+{
+	inf->setAPIVersion( MODULE_API_VERSION );
+	inf->setAuthor("UnrealIRCd Development Team");
+	inf->setDescription("Command Handler for the /GLINE, /KLINE and /ZLINE "
+		"commands");
+	inf->setName("UnrealCH_gline");
+	inf->setVersion("1.0.0");
+}
+
+/**
+ * Module initialization function.
+ * Called when the Module is loaded.
+ *
+ * @param module Reference to Module
+ */
+UNREAL_DLL UnrealModule::Result unrInit(UnrealModule* mptr)
+{
+	handler = new UnrealCH_gline(mptr);
+	return UnrealModule::Success;
+}
+
+/**
+ * Module close function.
+ * It's called before the Module is unloaded.
+ */
+UNREAL_DLL UnrealModule::Result unrClose(UnrealModule* mptr)
+{
+	delete handler;
+	return UnrealModule::Success;
+}
@@ -89,6 +89,13 @@ void UnrealCH_kill::exec(UnrealUser* uptr, StringList* argv)
 		String message = "Killed (" + argv->at(2) + ")";
 		UnrealSocket::ErrorCode ec;
 
+		uptr->notifyOpers(String::format("Received KILL message for %s from "
+			"%s (%s)",
+				victim->mask().c_str(),
+				uptr->nick().c_str(),
+				argv->at(2).c_str()),
+			UnrealOperIndex::SNKill);
+
 		/* pass quit message to all channels the user is on */
 		victim->exit(ec, message);
 
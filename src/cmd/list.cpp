@@ -88,15 +88,47 @@ void UnrealCH_list::exec(UnrealUser* uptr, StringList* argv)
 
 	uptr->sendreply(RPL_LISTSTART, MSG_LISTSTART);
 
-	for (Map<String, UnrealChannel*>::Iterator ci = unreal->channels.begin();
-			ci != unreal->channels.end(); ++ci)
+	/* the list itself is sent as the send queue drains */
+	uptr->addReplyStream(new UnrealListStream(min_users, max_users));
+}
+
+/**
+ * UnrealListStream constructor.
+ *
+ * @param min_users Only list channels with less users, 0 for no limit
+ * @param max_users Only list channels with more users, 0 for no limit
+ */
+UnrealListStream::UnrealListStream(uint32_t min_users, uint32_t max_users)
+	: min_users_(min_users), max_users_(max_users)
+{ }
+
+/**
+ * Send the next chunk of the channel list.
+ *
+ * @param uptr User receiving the list
+ * @param max_lines Maximum number of lines to send
+ * @return More or Done
+ */
+UnrealReplyStream::Result UnrealListStream::produce(UnrealUser* uptr,
+	size_t max_lines)
+{
+	/* don't spend too much time on channels that are filtered out */
+	size_t max_examined = max_lines * 16, lines = 0, examined = 0;
+	Map<String, UnrealChannel*>::Iterator ci =
+		unreal->channels.upper_bound(cursor_);
+
+	for (; ci != unreal->channels.end(); ++ci)
 	{
+		if (lines >= max_lines || examined++ >= max_examined)
+			return More;
+
 		UnrealChannel* chptr = ci->second;
+		cursor_ = ci->first;
 
 		if (chptr->isPrivate() || chptr->isSecret())
 			continue; /* ignore these */
-		else if ((min_users > 0 && chptr->members.size() > min_users)
-				|| (max_users > 0 && chptr->members.size() < max_users))
+		else if ((min_users_ > 0 && chptr->members.size() > min_users_)
+				|| (max_users_ > 0 && chptr->members.size() < max_users_))
 			continue; /* gently ignore channels that don't fit */
 
 		uptr->sendreply(RPL_LIST,
@@ -105,9 +137,13 @@ void UnrealCH_list::exec(UnrealUser* uptr, StringList* argv)
 				chptr->members.size(),
 				chptr->modestr().c_str(),
 				chptr->topic().c_str()));
+
+		lines++;
 	}
 
 	uptr->sendreply(RPL_LISTEND, MSG_LISTEND);
+
+	return Done;
 }
 
 /**
@@ -0,0 +1,694 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         monitor.cpp
+ * Description  MONITOR and WATCH command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <command.hpp>
+#include <module.hpp>
+#include <stringlist.hpp>
+
+#include <cmd/monitor.hpp>
+
+/** MONITOR lists */
+UnrealNotifyIndex UnrealCH_monitor::monitors;
+
+/** WATCH lists */
+UnrealNotifyIndex UnrealCH_monitor::watches;
+
+/** class instance */
+static UnrealCH_monitor* handler = NULL;
+
+/**
+ * Add a nick to the notify list of a user.
+ *
+ * @param uptr Watching user
+ * @param nick Nick to watch
+ * @return false if the nick was on the list already, otherwise true
+ */
+bool UnrealNotifyIndex::add(UnrealUser* uptr, const String& nick)
+{
+	String ln = String(nick).toLower();
+	TargetMap& tm = targets_[uptr];
+
+	if (tm.contains(ln))
+		return false;
+
+	tm.add(ln, nick);
+	watchers_[ln] << uptr;
+
+	return true;
+}
+
+/**
+ * Remove all entries from the notify list of a user.
+ *
+ * @param uptr Watching user
+ */
+void UnrealNotifyIndex::clear(UnrealUser* uptr)
+{
+	Map<UnrealUser*, TargetMap>::Iterator ti = targets_.find(uptr);
+
+	if (ti == targets_.end())
+		return;
+
+	foreach (TargetMap::Iterator, tmi, ti->second)
+	{
+		HashMap<String, WatcherList>::Iterator wi = watchers_.find(tmi->first);
+
+		if (wi != watchers_.end())
+		{
+			wi->second.remove(uptr);
+
+			if (wi->second.empty())
+				watchers_.erase(wi);
+		}
+	}
+
+	targets_.erase(ti);
+}
+
+/**
+ * Returns the number of entries on the notify list of a user.
+ *
+ * @param uptr Watching user
+ * @return Entry count
+ */
+size_t UnrealNotifyIndex::count(UnrealUser* uptr)
+{
+	Map<UnrealUser*, TargetMap>::Iterator ti = targets_.find(uptr);
+
+	return (ti == targets_.end() ? 0 : ti->second.size());
+}
+
+/**
+ * Remove a nick from the notify list of a user.
+ *
+ * @param uptr Watching user
+ * @param nick Nick to remove
+ * @return false if the nick wasn't on the list, otherwise true
+ */
+bool UnrealNotifyIndex::remove(UnrealUser* uptr, const String& nick)
+{
+	String ln = String(nick).toLower();
+	Map<UnrealUser*, TargetMap>::Iterator ti = targets_.find(uptr);
+
+	if (ti == targets_.end() || !ti->second.contains(ln))
+		return false;
+
+	ti->second.remove(ln);
+
+	if (ti->second.empty())
+		targets_.erase(ti);
+
+	HashMap<String, WatcherList>::Iterator wi = watchers_.find(ln);
+
+	if (wi != watchers_.end())
+	{
+		wi->second.remove(uptr);
+
+		if (wi->second.empty())
+			watchers_.erase(wi);
+	}
+
+	return true;
+}
+
+/**
+ * Returns the notify list of a user.
+ *
+ * @param uptr Watching user
+ * @return Target map, or 0 if the list is empty
+ */
+UnrealNotifyIndex::TargetMap* UnrealNotifyIndex::targets(UnrealUser* uptr)
+{
+	Map<UnrealUser*, TargetMap>::Iterator ti = targets_.find(uptr);
+
+	return (ti == targets_.end() ? 0 : &ti->second);
+}
+
+/**
+ * Returns the users watching a nick.
+ *
+ * @param nick Nick, any case
+ * @return Watcher list, or 0 if nobody watches the nick
+ */
+UnrealNotifyIndex::WatcherList* UnrealNotifyIndex::watchers(
+	const String& nick)
+{
+	HashMap<String, WatcherList>::Iterator wi =
+		watchers_.find(String(nick).toLower());
+
+	return (wi == watchers_.end() ? 0 : &wi->second);
+}
+
+/**
+ * Unreal Command Handler for "MONITOR" - Constructor.
+ *
+ * @param mptr Module pointer
+ */
+UnrealCH_monitor::UnrealCH_monitor(UnrealModule* mptr)
+{
+	setInfo(&mptr->inf);
+	
+	/* allocate additional contents */
+	command_ = new UnrealUserCommand(CMD_MONITOR, &UnrealCH_monitor::exec);
+	watch_command_ = new UnrealUserCommand(CMD_WATCH,
+		&UnrealCH_monitor::execWatch);
+
+	/* announce the list limits */
+	unreal->isupport.add("MONITOR",
+		unreal->config.get("Limits::MaxMonitor", "100"));
+	unreal->isupport.add("WATCH",
+		unreal->config.get("Limits::MaxWatch", "128"));
+
+	/* connect signals we're interested in */
+	UnrealUser::onDestroy.connect(&UnrealCH_monitor::handleLeavingUser);
+	UnrealUser::onNickChange.connect(&UnrealCH_monitor::handleNickChange);
+	UnrealUser::onRegister.connect(&UnrealCH_monitor::handleRegister);
+}
+
+/**
+ * Unreal Command Handler for "MONITOR" - Destructor.
+ */
+UnrealCH_monitor::~UnrealCH_monitor()
+{
+	delete command_;
+	delete watch_command_;
+
+	unreal->isupport.remove("MONITOR");
+	unreal->isupport.remove("WATCH");
+
+	/* disconnect signals */
+	UnrealUser::onDestroy.disconnect(&UnrealCH_monitor::handleLeavingUser);
+	UnrealUser::onNickChange.disconnect(&UnrealCH_monitor::handleNickChange);
+	UnrealUser::onRegister.disconnect(&UnrealCH_monitor::handleRegister);
+}
+
+/**
+ * MONITOR command handler for User connections.
+ *
+ * Usage:
+ * MONITOR + <nick>[,<nick2>[,...]]
+ * MONITOR - <nick>[,<nick2>[,...]]
+ * MONITOR C|L|S
+ *
+ * Message example:
+ * MONITOR + Stealth,Syzop
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_monitor::exec(UnrealUser* uptr, StringList* argv)
+{
+	if (argv->size() < 2 || argv->at(1).empty())
+	{
+		uptr->sendreply(ERR_NEEDMOREPARAMS,
+			String::format(MSG_NEEDMOREPARAMS,
+				CMD_MONITOR));
+		return;
+	}
+
+	char action = argv->at(1).at(0);
+	StringList targets;
+
+	if (action == '+' || action == '-')
+	{
+		if (argv->size() < 3)
+		{
+			uptr->sendreply(ERR_NEEDMOREPARAMS,
+				String::format(MSG_NEEDMOREPARAMS,
+					CMD_MONITOR));
+			return;
+		}
+
+		targets = argv->at(2).split(",");
+
+		if (targets.size() == 0)
+			targets << argv->at(2);
+	}
+
+	switch (action)
+	{
+		case '+':
+		{
+			static size_t limit = unreal->config.get("Limits::MaxMonitor",
+				"100").toSize();
+			StringList added;
+
+			for (StringList::Iterator ti = targets.begin();
+					ti != targets.end(); ++ti)
+			{
+				if (ti->empty())
+					continue;
+				else if (monitors.count(uptr) >= limit)
+				{
+					StringList rest(targets);
+					rest.erase(rest.begin(), rest.begin()
+						+ (ti - targets.begin()));
+
+					uptr->sendreply(ERR_MONLISTFULL,
+						String::format(MSG_MONLISTFULL,
+							static_cast<int>(limit),
+							rest.join(",").c_str()));
+					break;
+				}
+				else if (monitors.add(uptr, *ti))
+					added << *ti;
+			}
+
+			sendMonitorStatus(uptr, added);
+			break;
+		}
+
+		case '-':
+			foreach (StringList::Iterator, ti, targets)
+				monitors.remove(uptr, *ti);
+			break;
+
+		case 'C':
+		case 'c':
+			monitors.clear(uptr);
+			break;
+
+		case 'L':
+		case 'l':
+		{
+			UnrealNotifyIndex::TargetMap* tm = monitors.targets(uptr);
+
+			if (tm)
+			{
+				StringList nicks;
+
+				foreach (UnrealNotifyIndex::TargetMap::Iterator, tmi, (*tm))
+					nicks << tmi->second;
+
+				sendList(uptr, RPL_MONLIST, nicks, ',');
+			}
+
+			uptr->sendreply(RPL_ENDOFMONLIST, MSG_ENDOFMONLIST);
+			break;
+		}
+
+		case 'S':
+		case 's':
+		{
+			UnrealNotifyIndex::TargetMap* tm = monitors.targets(uptr);
+
+			if (tm)
+			{
+				StringList nicks;
+
+				foreach (UnrealNotifyIndex::TargetMap::Iterator, tmi, (*tm))
+					nicks << tmi->second;
+
+				sendMonitorStatus(uptr, nicks);
+			}
+
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+/**
+ * WATCH command handler for User connections.
+ *
+ * Usage:
+ * WATCH [+<nick>|-<nick>|C|S|L|l] [...]
+ *
+ * Message example:
+ * WATCH +Stealth +Syzop
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_monitor::execWatch(UnrealUser* uptr, StringList* argv)
+{
+	static size_t limit = unreal->config.get("Limits::MaxWatch", "128")
+		.toSize();
+	StringList args;
+
+	if (argv->size() < 2)
+		args << "l";
+	else
+		args.insert(args.end(), argv->begin() + 1, argv->end());
+
+	foreach (StringList::Iterator, ai, args)
+	{
+		if (ai->empty())
+			continue;
+
+		char action = ai->at(0);
+		String nick = ai->mid(1);
+		UnrealUser* tuptr = 0;
+
+		if ((action == '+' || action == '-') && !nick.empty())
+		{
+			tuptr = UnrealUser::find(nick);
+
+			if (tuptr && !tuptr->isRegistered())
+				tuptr = 0;
+		}
+
+		switch (action)
+		{
+			case '+':
+			{
+				if (nick.empty())
+					break;
+				else if (watches.count(uptr) >= limit)
+				{
+					uptr->sendreply(ERR_TOOMANYWATCH,
+						String::format(MSG_TOOMANYWATCH,
+							nick.c_str(),
+							static_cast<int>(limit)));
+					break;
+				}
+
+				watches.add(uptr, nick);
+
+				if (tuptr)
+					uptr->sendreply(RPL_NOWON,
+						String::format(MSG_NOWON,
+							tuptr->nick().c_str(),
+							tuptr->ident().c_str(),
+							tuptr->hostname().c_str(),
+							static_cast<int>(tuptr->connectionTime().toTS())));
+				else
+					uptr->sendreply(RPL_NOWOFF,
+						String::format(MSG_NOWOFF,
+							nick.c_str()));
+
+				break;
+			}
+
+			case '-':
+			{
+				if (nick.empty() || !watches.remove(uptr, nick))
+					break;
+
+				if (tuptr)
+					uptr->sendreply(RPL_WATCHOFF,
+						String::format(MSG_WATCHOFF,
+							tuptr->nick().c_str(),
+							tuptr->ident().c_str(),
+							tuptr->hostname().c_str(),
+							static_cast<int>(tuptr->connectionTime().toTS())));
+				else
+					uptr->sendreply(RPL_WATCHOFF,
+						String::format(MSG_WATCHOFF,
+							nick.c_str(),
+							"*",
+							"*",
+							0));
+
+				break;
+			}
+
+			case 'C':
+			case 'c':
+				watches.clear(uptr);
+				break;
+
+			case 'S':
+			case 's':
+			{
+				UnrealNotifyIndex::TargetMap* tm = watches.targets(uptr);
+				UnrealNotifyIndex::WatcherList* wl =
+					watches.watchers(uptr->nick());
+				StringList nicks;
+
+				if (tm)
+				{
+					foreach (UnrealNotifyIndex::TargetMap::Iterator, tmi, (*tm))
+						nicks << tmi->second;
+				}
+
+				uptr->sendreply(RPL_WATCHSTAT,
+					String::format(MSG_WATCHSTAT,
+						static_cast<int>(nicks.size()),
+						static_cast<int>(wl ? wl->size() : 0)));
+
+				sendList(uptr, RPL_WATCHLIST, nicks, ' ');
+
+				uptr->sendreply(RPL_ENDOFWATCHLIST,
+					String::format(MSG_ENDOFWATCHLIST,
+						action));
+				break;
+			}
+
+			case 'L':
+			case 'l':
+			{
+				UnrealNotifyIndex::TargetMap* tm = watches.targets(uptr);
+
+				if (tm)
+				{
+					foreach (UnrealNotifyIndex::TargetMap::Iterator, tmi, (*tm))
+					{
+						UnrealUser* wuptr = UnrealUser::find(tmi->first);
+
+						if (wuptr && wuptr->isRegistered())
+							uptr->sendreply(RPL_NOWON,
+								String::format(MSG_NOWON,
+									wuptr->nick().c_str(),
+									wuptr->ident().c_str(),
+									wuptr->hostname().c_str(),
+									static_cast<int>(
+										wuptr->connectionTime().toTS())));
+						else if (action == 'L')
+							uptr->sendreply(RPL_NOWOFF,
+								String::format(MSG_NOWOFF,
+									tmi->second.c_str()));
+					}
+				}
+
+				uptr->sendreply(RPL_ENDOFWATCHLIST,
+					String::format(MSG_ENDOFWATCHLIST,
+						action));
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+}
+
+/**
+ * Event handler function that is called when a user object is about to be
+ * destroyed. The notify lists of the user are dropped, and the watchers of
+ * the user are told that it has gone offline.
+ *
+ * @param uptr User pointer of leaving user
+ */
+void UnrealCH_monitor::handleLeavingUser(UnrealUser* uptr)
+{
+	monitors.clear(uptr);
+	watches.clear(uptr);
+
+	if (uptr->isRegistered())
+		notifyOffline(uptr, uptr->nick());
+}
+
+/**
+ * Event handler function that is called when a registered user changed
+ * the nick.
+ *
+ * @param uptr User pointer
+ * @param oldnick Previous nick
+ */
+void UnrealCH_monitor::handleNickChange(UnrealUser* uptr,
+	const String& oldnick)
+{
+	/* a change of case only doesn't matter to the watchers */
+	if (String(oldnick).toLower() == uptr->lowerNick())
+		return;
+
+	notifyOffline(uptr, oldnick);
+	notifyOnline(uptr);
+}
+
+/**
+ * Event handler function that is called when a user has completed the
+ * registration.
+ *
+ * @param uptr User pointer
+ */
+void UnrealCH_monitor::handleRegister(UnrealUser* uptr)
+{
+	notifyOnline(uptr);
+}
+
+/**
+ * Tell the watchers of a nick that its user has gone offline.
+ *
+ * @param uptr User pointer
+ * @param nick Nick the user was known as
+ */
+void UnrealCH_monitor::notifyOffline(UnrealUser* uptr, const String& nick)
+{
+	UnrealNotifyIndex::WatcherList* wl;
+
+	if ((wl = monitors.watchers(nick)))
+	{
+		String data = String::format(MSG_MONOFFLINE, nick.c_str());
+
+		foreach (UnrealNotifyIndex::WatcherList::Iterator, wi, (*wl))
+			(*wi)->sendreply(RPL_MONOFFLINE, data);
+	}
+
+	if ((wl = watches.watchers(nick)))
+	{
+		String data = String::format(MSG_LOGOFF,
+			nick.c_str(),
+			uptr->ident().c_str(),
+			uptr->hostname().c_str(),
+			static_cast<int>(UnrealTime::now().toTS()));
+
+		foreach (UnrealNotifyIndex::WatcherList::Iterator, wi, (*wl))
+			(*wi)->sendreply(RPL_LOGOFF, data);
+	}
+}
+
+/**
+ * Tell the watchers of the user's nick that it has come online.
+ *
+ * @param uptr User pointer
+ */
+void UnrealCH_monitor::notifyOnline(UnrealUser* uptr)
+{
+	UnrealNotifyIndex::WatcherList* wl;
+
+	if ((wl = monitors.watchers(uptr->nick())))
+	{
+		String data = String::format(MSG_MONONLINE, uptr->mask().c_str());
+
+		foreach (UnrealNotifyIndex::WatcherList::Iterator, wi, (*wl))
+			(*wi)->sendreply(RPL_MONONLINE, data);
+	}
+
+	if ((wl = watches.watchers(uptr->nick())))
+	{
+		String data = String::format(MSG_LOGON,
+			uptr->nick().c_str(),
+			uptr->ident().c_str(),
+			uptr->hostname().c_str(),
+			static_cast<int>(UnrealTime::now().toTS()));
+
+		foreach (UnrealNotifyIndex::WatcherList::Iterator, wi, (*wl))
+			(*wi)->sendreply(RPL_LOGON, data);
+	}
+}
+
+/**
+ * Send a list of items, split up into multiple replies if necessary.
+ *
+ * @param uptr User to send the list to
+ * @param numeric Reply numeric
+ * @param items Items
+ * @param separator Item separator
+ */
+void UnrealCH_monitor::sendList(UnrealUser* uptr, IRCNumeric numeric,
+	const StringList& items, char separator)
+{
+	String buf;
+
+	for (size_t i = 0; i < items.size(); ++i)
+	{
+		if (!buf.empty())
+			buf.append(1, separator);
+
+		buf += items.at(i);
+
+		if (buf.length() > 400 || i + 1 == items.size())
+		{
+			uptr->sendreply(numeric, ":" + buf);
+			buf.clear();
+		}
+	}
+}
+
+/**
+ * Send the online/offline status of a list of nicks.
+ *
+ * @param uptr User to send the status to
+ * @param nicks Nicks
+ */
+void UnrealCH_monitor::sendMonitorStatus(UnrealUser* uptr,
+	const StringList& nicks)
+{
+	StringList online, offline;
+
+	for (size_t i = 0; i < nicks.size(); ++i)
+	{
+		UnrealUser* tuptr = UnrealUser::find(nicks.at(i));
+
+		if (tuptr && tuptr->isRegistered())
+			online << tuptr->mask();
+		else
+			offline << nicks.at(i);
+	}
+
+	sendList(uptr, RPL_MONONLINE, online, ',');
+	sendList(uptr, RPL_MONOFFLINE, offline, ',');
+}
+
+/**
+ * Updates the module information.
+ *
+ * @param inf Module information object pointer
+ */
+void UnrealCH_monitor::setInfo(UnrealModuleInf* inf)
+{
+	inf->setAPIVersion( MODULE_API_VERSION );
+	inf->setAuthor("UnrealIRCd Development Team");
+	inf->setDescription("Command Handler for the /MONITOR and /WATCH commands");
+	inf->setName("UnrealCH_monitor");
+	inf->setVersion("1.0.0");
+}
+
+/**
+ * Module initialization function.
+ * Called when the Module is loaded.
+ *
+ * @param module Reference to Module
+ */
+UNREAL_DLL UnrealModule::Result unrInit(UnrealModule* mptr)
+{
+	handler = new UnrealCH_monitor(mptr);
+	return UnrealModule::Success;
+}
+
+/**
+ * Module close function.
+ * It's called before the Module is unloaded.
+ */
+UNREAL_DLL UnrealModule::Result unrClose(UnrealModule* mptr)
+{
+	delete handler;
+	return UnrealModule::Success;
+}
@@ -81,67 +81,77 @@ void UnrealCH_names::exec(UnrealUser* uptr, StringList* argv)
 		if (chlist.size() == 0)
 			chlist << argv->at(1);
 
-		for (StringList::Iterator chan = chlist.begin(); chan != chlist.end();
-				++chan)
+		/* a JOIN waits for its NAMES, not for a pending LIST */
+		uptr->addReplyStream(new UnrealNamesStream(chlist), true);
+	}
+}
+
+/**
+ * UnrealNamesStream constructor.
+ *
+ * @param chlist Names of the channels to list
+ */
+UnrealNamesStream::UnrealNamesStream(const StringList& chlist)
+	: channels_(chlist), pos_(0), chunk_(0)
+{ }
+
+/**
+ * Send the next chunk of NAMES replies.
+ *
+ * @param uptr User receiving the reply
+ * @param max_lines Maximum number of lines to send
+ * @return More or Done
+ */
+UnrealReplyStream::Result UnrealNamesStream::produce(UnrealUser* uptr,
+	size_t max_lines)
+{
+	bool namesx = uptr->protoflags().isset(UnrealUser::PFNamesX);
+	size_t lines = 0;
+
+	for (; pos_ < channels_.size(); ++pos_, chunk_ = 0)
+	{
+		UnrealChannel* chptr = UnrealChannel::find(channels_.at(pos_));
+
+		if (!chptr)
+			continue;
+
+		char prefix;
+
+		/*
+		 * It seems that the "=" in the NAMREPLY is for public
+		 * channels, "@" for secret channels.
+		 */
+		if (chptr->isSecret())
+			prefix = '@';
+		else if (chptr->isPrivate())
+			prefix = '*';
+		else
+			prefix = '=';
+
+		UnrealChannel::NamesChunk* chunk;
+
+		while ((chunk = chptr->namesChunkAfter(chunk_)) != 0)
 		{
-			UnrealChannel* chptr = UnrealChannel::find(argv->at(1));
-
-			if (chptr)
-			{
-				String buf;
-				char prefix;
-
-				if (chptr->isSecret())
-					prefix = '@';
-				else if (chptr->isPrivate())
-					prefix = '*';
-				else
-					prefix = '=';
-
-				for (UnrealChannel::MemberIterator cm = chptr->members.begin();
-						cm != chptr->members.end(); ++cm)
-				{
-					UnrealChannel::Member* cmptr = cm->second;
-
-					if (cmptr->flags.isset(UnrealChannel::Member::ChanOp))
-						buf.append(1, '@');
-					else if (cmptr->flags.isset(UnrealChannel::Member::Voice))
-						buf.append(1, '+');
-
-					buf += cmptr->user->nick();
-					buf += " ";
-
-					/*
-					 * It seems that the "=" in the NAMREPLY is for public
-					 * channels, "@" for secret channels.
-					 */
-					if (buf.length() > 420)
-					{
-						uptr->sendreply(RPL_NAMREPLY,
-							String::format(MSG_NAMREPLY,
-								prefix,
-								chptr->name().c_str(),
-								buf.trimmed().c_str()));
-
-						buf.clear();
-						continue;
-					}
-				}
-
-				String trbuf = buf.trimmed();
-				if (trbuf.length() > 0)
-					uptr->sendreply(RPL_NAMREPLY,
-						String::format(MSG_NAMREPLY,
-							prefix,
-							chptr->name().c_str(),
-							trbuf.c_str()));
-
-				uptr->sendreply(RPL_ENDOFNAMES,
-					String::format(MSG_ENDOFNAMES,
-						chptr->name().c_str()));
-			}
+			if (lines++ >= max_lines)
+				return More;
+
+			uptr->sendreply(RPL_NAMREPLY,
+				String::format(MSG_NAMREPLY,
+					prefix,
+					chptr->name().c_str(),
+					chptr->namesChunk(chunk, namesx).c_str()));
+
+			chunk_ = chunk->id;
 		}
+
+		uptr->sendreply(RPL_ENDOFNAMES,
+			String::format(MSG_ENDOFNAMES,
+				chptr->name().c_str()));
+
+		lines++;
 	}
+
+	return Done;
 }
 
 /**
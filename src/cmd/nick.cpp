@@ -121,32 +121,23 @@ void UnrealCH_nick::exec(UnrealUser* uptr, StringList* argv)
 			uptr->setNick(argv->at(1));
 
 		uptr->authflags().revoke(UnrealUser::AFNick);
+		uptr->registrationTrace().mark(UnrealRegistrationTrace::Nick);
 
 		if (uptr->authflags().value() == 0)
 			uptr->sendPing();
 	}
 	else
 	{
-		uptr->sendlocalreply(CMD_NICK,
-				String::format(":%s",
-						argv->at(1).c_str()));
-
+		/* the prefix has to carry the old nick */
+		String reply = String::format(":%s %s :%s",
+			uptr->mask().c_str(),
+			CMD_NICK,
+			argv->at(1).c_str());
+
+		/* send this nick change to the user and everyone on common
+		 * channels, once each */
+		uptr->sendNeighbors(reply, true);
 		uptr->setNick(argv->at(1));
-
-		/* send this nick change to all users on common channels */
-		if (uptr->channels.size() > 0)
-		{
-			for (List<UnrealChannel*>::Iterator uci = uptr->channels.begin();
-					uci != uptr->channels.end(); ++uci)
-			{
-				UnrealChannel* chptr = *uci;
-
-				chptr->sendlocalreply(uptr, CMD_NICK,
-						String::format(":%s",
-							argv->at(1).c_str()),
-						true);
-			}
-		}
 	}
 }
 
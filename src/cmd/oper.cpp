@@ -28,11 +28,7 @@
 #include <hash.hpp>
 #include <stringlist.hpp>
 
-#ifndef HAVE_CRYPTOPP
-#include <cryptopp/sha.h>
-#else
-#include <cryptopp/sha.h>
-#endif
+#include <boost/bind.hpp>
 
 #include <cmd/mode.hpp>
 #include <cmd/oper.hpp>
@@ -61,6 +57,8 @@ struct OperatorType
 			String name = config.getSeqVal("Operator", i, "Name", "");
 			String mask = config.getSeqVal("Operator", i, "Mask", "*!*@*");
 			String pass = config.getSeqVal("Operator", i, "Password", "");
+			String snomask = config.getSeqVal("Operator", i, "Snomask",
+				"+ckos");
 
 			if (name.empty() || mask.empty() || pass.empty())
 				continue;
@@ -70,6 +68,7 @@ struct OperatorType
 				ret.mask = mask;
 				ret.name = name;
 				ret.password = pass;
+				ret.snomask = snomask;
 
 				break;
 			}
@@ -86,28 +85,21 @@ struct OperatorType
 	 */
 	bool checkPassword(const String& pw)
 	{
-		UnrealHash::Type hash_type = UnrealHash::Invalid;
-		size_t pos_s, pos_e;
-
-		if ((pos_s = password.find_first_of("$")) != String::npos)
-		{
-			if ((pos_e = password.find_first_of("$", pos_s + 1))
-					!= String::npos)
-			{
-				String typestr = password.mid(pos_s + 1, (pos_e - pos_s - 1));
-
-				if ((hash_type = UnrealHash::strtotype(typestr))
-						!= UnrealHash::Invalid)
-				{
-					String real_pw = password.mid(pos_e + 1);
-					String hash = UnrealHash::calculate(pw, hash_type);
-					
-					return (hash.toUpper() == real_pw.toUpper());
-				}
-			}
-		}
+		return UnrealHash::verify(pw, password);
+	}
 
-		return password == pw;
+	/**
+	 * Worker job for checking the operator password; hashing may take
+	 * a while, so it doesn't run on the reactor.
+	 *
+	 * @param oper Operator entry
+	 * @param pw Plain password to check
+	 * @param valid Receives the result
+	 */
+	static void checkPasswordJob(OperatorType oper, String pw,
+		boost::shared_ptr<bool> valid)
+	{
+		*valid = oper.checkPassword(pw);
 	}
 
 	/** operator mask, if any */
@@ -118,6 +110,9 @@ struct OperatorType
 
 	/** operator password */
 	String password;
+
+	/** server notice mask set on OPER */
+	String snomask;
 };
 
 /**
@@ -168,33 +163,84 @@ void UnrealCH_oper::exec(UnrealUser* uptr, StringList* argv)
 		if (oper.name.empty() || (!oper.mask.empty() 
 				&& !uptr->match(oper.mask)))
 			uptr->sendreply(ERR_NOOPERHOST, MSG_NOOPERHOST);
-		else if (!oper.checkPassword(argv->at(2)))
-			uptr->sendreply(ERR_PASSWDMISMATCH, MSG_PASSWDMISMATCH);
 		else
 		{
-			uptr->sendreply(RPL_YOUREOPER, MSG_YOUREOPER);
+			boost::shared_ptr<bool> valid(new bool(false));
 
-			/* apply operator flag if necessary */
-			if (!uptr->isOper())
-			{
-				using namespace UnrealUserProperties;
+			/* check the password off the reactor */
+			bool queued = unreal->workers.submit(uptr,
+				boost::bind(&OperatorType::checkPasswordJob,
+					oper,
+					argv->at(2),
+					valid),
+				boost::bind(&UnrealCH_oper::handlePasswordCheck,
+					uptr,
+					oper.snomask,
+					valid));
 
-				uptr->modes().add(ModeTable.value(Operator));
-				unreal->stats.operators++;
+			if (!queued)
+			{
+				uptr->sendreply(RPL_TRYAGAIN,
+					String::format(MSG_TRYAGAIN,
+						CMD_OPER));
 			}
+		}
+	}
+}
 
-			/* send new modes back */
-			uptr->sendlocalreply(CMD_MODE,
-				String::format("%s +%s",
-					uptr->nick().c_str(),
-					uptr->modestr().c_str()));
+/**
+ * Completion of the password check started by OPER; runs on the reactor
+ * and only while the user still exists.
+ *
+ * @param uptr Originating user
+ * @param snomask Server notice mask of the operator entry
+ * @param valid Whether the password was correct
+ */
+void UnrealCH_oper::handlePasswordCheck(UnrealUser* uptr,
+	const String& snomask, boost::shared_ptr<bool> valid)
+{
+	if (!*valid)
+		uptr->sendreply(ERR_PASSWDMISMATCH, MSG_PASSWDMISMATCH);
+	else
+	{
+		uptr->sendreply(RPL_YOUREOPER, MSG_YOUREOPER);
+
+		/* apply operator flag if necessary */
+		if (!uptr->isOper())
+		{
+			using namespace UnrealUserProperties;
+
+			uptr->modes().add(ModeTable.value(Operator));
+			unreal->stats.operators++;
+
+			/* subscribe to the configured server notices */
+			uint8_t mask = UnrealOperIndex::parseMask(snomask, 0);
+			unreal->opers.add(uptr, mask);
+
+			if (mask != 0)
+				uptr->modes().add(ModeTable.value(ServerNotice));
+		}
 
-			/* let other operators know about this */
-			uptr->notifyOpers(String::format("%s (%s@%s) is now an IRC operator",
+		/* send new modes back */
+		uptr->sendlocalreply(CMD_MODE,
+			String::format("%s +%s",
 				uptr->nick().c_str(),
-				uptr->ident().c_str(),
-				uptr->hostname().c_str()));
+				uptr->modestr().c_str()));
+
+		if (unreal->opers.mask(uptr) != 0)
+		{
+			uptr->sendreply(RPL_SNOMASK,
+				String::format(MSG_SNOMASK,
+					UnrealOperIndex::maskString(unreal->opers.mask(uptr))
+						.c_str()));
 		}
+
+		/* let other operators know about this */
+		uptr->notifyOpers(String::format("%s (%s@%s) is now an IRC operator",
+			uptr->nick().c_str(),
+			uptr->ident().c_str(),
+			uptr->hostname().c_str()),
+			UnrealOperIndex::SNOper);
 	}
 }
 
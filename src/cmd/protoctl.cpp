@@ -0,0 +1,130 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         protoctl.cpp
+ * Description  PROTOCTL command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <command.hpp>
+#include <module.hpp>
+#include <stringlist.hpp>
+
+#include <cmd/protoctl.hpp>
+
+/** class instance */
+static UnrealCH_protoctl* handler = NULL;
+
+/**
+ * Unreal Command Handler for "PROTOCTL" - Constructor.
+ *
+ * @param mptr Module pointer
+ */
+UnrealCH_protoctl::UnrealCH_protoctl(UnrealModule* mptr)
+{
+	setInfo(&mptr->inf);
+	
+	/* allocate additional contents */
+	command_ = new UnrealUserCommand(CMD_PROTOCTL, &UnrealCH_protoctl::exec,
+		false, false);
+
+	unreal->isupport.add("NAMESX", "");
+}
+
+/**
+ * Unreal Command Handler for "PROTOCTL" - Destructor.
+ */
+UnrealCH_protoctl::~UnrealCH_protoctl()
+{
+	delete command_;
+
+	unreal->isupport.remove("NAMESX");
+}
+
+/**
+ * PROTOCTL command handler for User connections.
+ * Clients use it to enable protocol extensions; unknown tokens are
+ * ignored.
+ *
+ * Usage:
+ * PROTOCTL <token> [<token2>[ <token3>[ ...]]]
+ *
+ * Message example:
+ * PROTOCTL NAMESX
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_protoctl::exec(UnrealUser* uptr, StringList* argv)
+{
+	if (argv->size() < 2)
+	{
+		uptr->sendreply(ERR_NEEDMOREPARAMS,
+				String::format(MSG_NEEDMOREPARAMS,
+						CMD_PROTOCTL));
+		return;
+	}
+
+	for (StringList::Iterator i = argv->begin() + 1; i != argv->end(); ++i)
+	{
+		String token = i->toUpper();
+
+		/* show all member prefixes in NAMES replies */
+		if (token == "NAMESX")
+			uptr->protoflags() << UnrealUser::PFNamesX;
+	}
+}
+
+/**
+ * Updates the module information.
+ *
+ * @param inf Module information object pointer
+ */
+void UnrealCH_protoctl::setInfo(UnrealModuleInf* inf)
+{
+	inf->setAPIVersion( MODULE_API_VERSION );
+	inf->setAuthor("UnrealIRCd Development Team");
+	inf->setDescription("Command Handler for the /PROTOCTL command");
+	inf->setName("UnrealCH_protoctl");
+	inf->setVersion("1.0.0");
+}
+
+/**
+ * Module initialization function.
+ * Called when the Module is loaded.
+ *
+ * @param module Reference to Module
+ */
+UNREAL_DLL UnrealModule::Result unrInit(UnrealModule* mptr)
+{
+	handler = new UnrealCH_protoctl(mptr);
+	return UnrealModule::Success;
+}
+
+/**
+ * Module close function.
+ * It's called before the Module is unloaded.
+ */
+UNREAL_DLL UnrealModule::Result unrClose(UnrealModule* mptr)
+{
+	delete handler;
+	return UnrealModule::Success;
+}
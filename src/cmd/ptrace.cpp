@@ -0,0 +1,313 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         ptrace.cpp
+ * Description  PTRACE command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <command.hpp>
+#include <module.hpp>
+#include <stringlist.hpp>
+
+#include <cmd/notice.hpp>
+#include <cmd/ptrace.hpp>
+
+#include <cerrno>
+#include <cstring>
+
+/** class instance */
+static UnrealCH_ptrace* handler = NULL;
+
+/**
+ * Unreal Command Handler for "PTRACE" - Constructor.
+ *
+ * @param mptr Module pointer
+ */
+UnrealCH_ptrace::UnrealCH_ptrace(UnrealModule* mptr)
+{
+	setInfo(&mptr->inf);
+	
+	/* allocate additional contents */
+	command_ = new UnrealUserCommand(CMD_PTRACE, &UnrealCH_ptrace::exec,
+		true);
+}
+
+/**
+ * Unreal Command Handler for "PTRACE" - Destructor.
+ */
+UnrealCH_ptrace::~UnrealCH_ptrace()
+{
+	delete command_;
+}
+
+/**
+ * PTRACE command handler for User connections.
+ *
+ * Usage:
+ * PTRACE [STATUS]             show the trace state
+ * PTRACE ON|OFF               enable or disable recording
+ * PTRACE DUMP [<nickname>]    write the trace into Trace::File
+ * PTRACE WATCH <nickname>     only record this and other watched users
+ * PTRACE WATCH *              record all users again
+ * PTRACE UNWATCH <nickname>   stop watching a user; once nobody is
+ *                             watched, nothing is recorded
+ * PTRACE CLEAR                remove all recorded lines
+ * PTRACE CAPTURE ON|OFF       start or stop the traffic capture into
+ *                             Capture::File
+ *
+ * Message example:
+ * PTRACE DUMP somenick
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_ptrace::exec(UnrealUser* uptr, StringList* argv)
+{
+	UnrealProtocolTrace& trace = unreal->trace;
+	String sub = argv->size() > 1 ? argv->at(1).toUpper() : String("STATUS");
+
+	if (sub == "STATUS")
+	{
+		sendStatus(uptr);
+	}
+	else if (sub == "ON" || sub == "OFF")
+	{
+		if (trace.size() == 0)
+		{
+			uptr->sendreply(CMD_NOTICE,
+				":Protocol trace is disabled by Trace::Size");
+			return;
+		}
+
+		trace.setEnabled(sub == "ON");
+
+		uptr->notifyOpers(String::format("%s turned the protocol trace %s",
+			uptr->nick().c_str(),
+			sub == "ON" ? "on" : "off"));
+	}
+	else if (sub == "DUMP")
+	{
+		uint64_t connection = 0;
+		size_t count;
+
+		if (argv->size() > 2)
+		{
+			UnrealUser* target = findTarget(uptr, argv);
+
+			if (!target)
+				return;
+
+			connection = target->socket()->id();
+		}
+
+		if (!trace.dump(trace.fileName(), connection, count))
+		{
+			uptr->sendreply(CMD_NOTICE,
+				String::format(":Couldn't write %s: %s",
+					trace.fileName().c_str(),
+					std::strerror(errno)));
+		}
+		else
+		{
+			uptr->sendreply(CMD_NOTICE,
+				String::format(":Wrote %d lines to %s",
+					static_cast<int>(count),
+					trace.fileName().c_str()));
+		}
+	}
+	else if (sub == "WATCH" && argv->size() > 2 && argv->at(2) == "*")
+	{
+		trace.watchAll();
+
+		uptr->notifyOpers(String::format("%s is watching all connections in "
+			"the protocol trace",
+			uptr->nick().c_str()));
+	}
+	else if (sub == "WATCH" || sub == "UNWATCH")
+	{
+		UnrealUser* target = findTarget(uptr, argv);
+
+		if (!target)
+			return;
+
+		if (sub == "WATCH")
+			trace.watch(target->socket());
+		else
+			trace.unwatch(target->socket());
+
+		uptr->notifyOpers(String::format("%s %s %s in the protocol trace",
+			uptr->nick().c_str(),
+			sub == "WATCH" ? "is watching" : "stopped watching",
+			target->nick().c_str()));
+	}
+	else if (sub == "CLEAR")
+	{
+		trace.clear();
+		uptr->sendreply(CMD_NOTICE, ":Protocol trace cleared");
+	}
+	else if (sub == "CAPTURE" && argv->size() > 2
+			&& (argv->at(2).toUpper() == "ON"
+				|| argv->at(2).toUpper() == "OFF"))
+	{
+		UnrealTrafficCapture& capture = unreal->capture;
+
+		if (argv->at(2).toUpper() == "OFF")
+		{
+			capture.stop();
+		}
+		else if (!capture.start())
+		{
+			uptr->sendreply(CMD_NOTICE,
+				String::format(":Couldn't create %s: %s",
+					capture.fileName().c_str(),
+					std::strerror(errno)));
+			return;
+		}
+
+		uptr->notifyOpers(String::format("%s turned the traffic capture %s",
+			uptr->nick().c_str(),
+			capture.enabled() ? "on" : "off"));
+	}
+	else
+	{
+		uptr->sendreply(CMD_NOTICE,
+			":Usage: PTRACE [STATUS|ON|OFF|DUMP [nick]|WATCH <nick|*>|"
+			"UNWATCH <nick>|CLEAR|CAPTURE ON|OFF]");
+	}
+}
+
+/**
+ * Find the local user named by the third argument.
+ *
+ * @param uptr Originating user; receives an error reply on failure
+ * @param argv Argument list
+ * @return User, or 0 if there's none
+ */
+UnrealUser* UnrealCH_ptrace::findTarget(UnrealUser* uptr, StringList* argv)
+{
+	if (argv->size() < 3)
+	{
+		uptr->sendreply(ERR_NEEDMOREPARAMS,
+			String::format(MSG_NEEDMOREPARAMS,
+				CMD_PTRACE));
+		return 0;
+	}
+
+	UnrealUser* target = UnrealUser::find(argv->at(2));
+
+	if (!target || !target->socket())
+	{
+		uptr->sendreply(ERR_NOSUCHNICK,
+			String::format(MSG_NOSUCHNICK,
+				argv->at(2).c_str()));
+		return 0;
+	}
+
+	return target;
+}
+
+/**
+ * Send the trace state.
+ *
+ * @param uptr User to send the state to
+ */
+void UnrealCH_ptrace::sendStatus(UnrealUser* uptr)
+{
+	UnrealProtocolTrace& trace = unreal->trace;
+	List<UnrealSocket*> watched = trace.watched();
+	String watching;
+
+	foreach (List<UnrealSocket*>::Iterator, si, watched)
+	{
+		UnrealUser* target = UnrealUser::find(*si);
+
+		if (!watching.empty())
+			watching += " ";
+
+		watching += target ? target->nick() : String("?");
+	}
+
+	if (trace.watchingAll())
+		watching = "all connections";
+	else if (watching.empty())
+		watching = "no connections";
+
+	uptr->sendreply(CMD_NOTICE,
+		String::format(":Protocol trace is %s: %d lines, %d of %d bytes, "
+			"recording %s",
+			trace.enabled() ? "on" : "off",
+			static_cast<int>(trace.records()),
+			static_cast<int>(trace.bytes()),
+			static_cast<int>(trace.size()),
+			watching.c_str()));
+
+	UnrealTrafficCapture& capture = unreal->capture;
+
+	if (capture.enabled())
+	{
+		uptr->sendreply(CMD_NOTICE,
+			String::format(":Traffic capture is on: %d records, %d bytes, "
+				"%d connections, writing %s",
+				static_cast<int>(capture.records()),
+				static_cast<int>(capture.bytes()),
+				static_cast<int>(capture.connections()),
+				capture.fileName().c_str()));
+	}
+	else
+		uptr->sendreply(CMD_NOTICE, ":Traffic capture is off");
+}
+
+/**
+ * Updates the module information.
+ *
+ * @param inf Module information object pointer
+ */
+void UnrealCH_ptrace::setInfo(UnrealModuleInf* inf)
+{
+	inf->setAPIVersion( MODULE_API_VERSION );
+	inf->setAuthor("UnrealIRCd Development Team");
+	inf->setDescription("Command Handler for the /PTRACE command");
+	inf->setName("UnrealCH_ptrace");
+	inf->setVersion("1.0.0");
+}
+
+/**
+ * Module initialization function.
+ * Called when the Module is loaded.
+ *
+ * @param module Reference to Module
+ */
+UNREAL_DLL UnrealModule::Result unrInit(UnrealModule* mptr)
+{
+	handler = new UnrealCH_ptrace(mptr);
+	return UnrealModule::Success;
+}
+
+/**
+ * Module close function.
+ * It's called before the Module is unloaded.
+ */
+UNREAL_DLL UnrealModule::Result unrClose(UnrealModule* mptr)
+{
+	delete handler;
+	return UnrealModule::Success;
+}
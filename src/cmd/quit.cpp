@@ -69,16 +69,11 @@ void UnrealCH_quit::exec(UnrealUser* uptr, StringList* argv)
 	if (argv->size() > 1)
 		quitMessage = argv->at(1);
 
-	/* send quit message to all channels the user is on */
-	while (uptr->channels.size() > 0)
-	{
-		UnrealChannel* chptr = uptr->channels.takeFirst();
+	/* send quit message to everyone on common channels and leave them */
+	UnrealSocket::ErrorCode ec;
+	uptr->exit(ec, quitMessage);
 
-		/* remove from channel */
-		uptr->leaveChannel(chptr->name(), quitMessage, CMD_QUIT);
-	}
-
-	uptr->socket()->close();
+	uptr->socket()->disconnect(ec);
 }
 
 /**
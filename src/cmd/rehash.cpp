@@ -65,6 +65,7 @@ UnrealCH_rehash::~UnrealCH_rehash()
 void UnrealCH_rehash::exec(UnrealUser* uptr, StringList* argv)
 {
 	unreal->config.rehash();
+	UnrealUserCommand::loadSettings();
 
 	uptr->sendreply(RPL_REHASHING,
 		String::format(MSG_REHASHING,
@@ -0,0 +1,488 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         stats.cpp
+ * Description  STATS command handler
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <command.hpp>
+#include <memstat.hpp>
+#include <module.hpp>
+#include <resolver.hpp>
+#include <stringlist.hpp>
+
+#include <cmd/stats.hpp>
+
+#include <algorithm>
+#include <vector>
+
+/** class instance */
+static UnrealCH_stats* handler = NULL;
+
+/** available reports */
+static const UnrealCH_stats::Report reports[] = {
+	{ 'b', "bans", "K-, G- and Z-lines", true,
+		&UnrealCH_stats::sendBans },
+	{ 'd', "dns", "DNS cache and query counters", true,
+		&UnrealCH_stats::sendDNS },
+	{ 'e', "loop", "Event loop lag and handler times", true,
+		&UnrealCH_stats::sendLoop },
+	{ 'i', "ident", "Ident client counters", true,
+		&UnrealCH_stats::sendIdent },
+	{ 'm', "commands", "Command calls, execution and CPU time", true,
+		&UnrealCH_stats::sendCommands },
+	{ 'r', "registration", "Registration latency per phase and listener",
+		true, &UnrealCH_stats::sendRegistration },
+	{ 't', "throttle", "Connection throttle counters", true,
+		&UnrealCH_stats::sendThrottle },
+	{ 'z', "memory", "Memory usage per subsystem", true,
+		&UnrealCH_stats::sendMemory }
+};
+
+/** maximum number of ban entries listed by STATS b */
+static const size_t max_ban_lines = 100;
+
+/** percentiles shown for latency histograms */
+static const double latency_percentiles[] = { 0.5, 0.9, 0.99 };
+
+/**
+ * Order commands by total execution time, longest first.
+ */
+static bool compareCommandTime(UnrealUserCommand* a, UnrealUserCommand* b)
+{
+	return a->latency.sum() > b->latency.sum();
+}
+
+/** number of available reports */
+static const size_t report_count = sizeof(reports) / sizeof(reports[0]);
+
+/**
+ * Unreal Command Handler for "STATS" - Constructor.
+ *
+ * @param mptr Module pointer
+ */
+UnrealCH_stats::UnrealCH_stats(UnrealModule* mptr)
+{
+	setInfo(&mptr->inf);
+	
+	/* allocate additional contents */
+	command_ = new UnrealUserCommand(CMD_STATS, &UnrealCH_stats::exec);
+}
+
+/**
+ * Unreal Command Handler for "STATS" - Destructor.
+ */
+UnrealCH_stats::~UnrealCH_stats()
+{
+	delete command_;
+}
+
+/**
+ * STATS command handler for User connections.
+ *
+ * Usage:
+ * STATS [<letter>|<name>]
+ *
+ * Message example:
+ * STATS d
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ */
+void UnrealCH_stats::exec(UnrealUser* uptr, StringList* argv)
+{
+	if (argv->size() < 2 || argv->at(1).empty())
+	{
+		sendReportList(uptr);
+		return;
+	}
+
+	String query = argv->at(1);
+	const Report* rptr = 0;
+
+	for (size_t i = 0; i < report_count && !rptr; ++i)
+	{
+		if ((query.length() == 1 && query.at(0) == reports[i].letter)
+				|| query.toLower() == reports[i].name)
+			rptr = &reports[i];
+	}
+
+	if (!rptr)
+		sendReportList(uptr);
+	else if (rptr->oper_only && !uptr->isOper())
+		uptr->sendreply(ERR_NOPRIVILEGES, MSG_NOPRIVILEGES);
+	else
+	{
+		rptr->handler(uptr);
+
+		uptr->sendreply(RPL_ENDOFSTATS,
+			String::format(MSG_ENDOFSTATS,
+				query.c_str()));
+	}
+}
+
+/**
+ * Report the ban counts and list the ban entries, up to a fixed number of
+ * lines.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendBans(UnrealUser* uptr)
+{
+	UnrealBanList::BanList bans = unreal->bans.entries();
+	std::time_t now = UnrealTime::now().toTS();
+	size_t count[3] = { 0, 0, 0 }, lines = 0;
+
+	foreach (UnrealBanList::BanList::Iterator, bi, bans)
+	{
+		UnrealBanList::BanPtr ban = *bi;
+
+		if (ban->type == UnrealBanList::KLine)
+			count[0]++;
+		else if (ban->type == UnrealBanList::GLine)
+			count[1]++;
+		else
+			count[2]++;
+
+		if (lines++ >= max_ban_lines)
+			continue;
+
+		uptr->sendreply(RPL_STATSDEBUG,
+			String::format(":%s %s %s by %s: %s",
+				UnrealBanList::typeName(ban->type),
+				ban->mask.c_str(),
+				ban->expires > 0
+					? String::format("expires in %ds",
+						static_cast<int>(ban->expires - now)).c_str()
+					: "permanent",
+				ban->setter.c_str(),
+				ban->reason.c_str()));
+	}
+
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Bans: %d K-lines, %d G-lines, %d Z-lines%s",
+			static_cast<int>(count[0]),
+			static_cast<int>(count[1]),
+			static_cast<int>(count[2]),
+			lines > max_ban_lines ? " (list truncated)" : ""));
+}
+
+/**
+ * Report the calls, execution time, CPU time and output of all commands
+ * used so far, by total execution time.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendCommands(UnrealUser* uptr)
+{
+	std::vector<UnrealUserCommand*> commands;
+
+	for (Map<String, UnrealUserCommand*>::Iterator ci =
+			unreal->user_commands.begin();
+			ci != unreal->user_commands.end(); ++ci)
+	{
+		if (ci->second->latency.count() > 0)
+			commands.push_back(ci->second);
+	}
+
+	std::sort(commands.begin(), commands.end(), compareCommandTime);
+
+	for (size_t i = 0; i < commands.size(); ++i)
+	{
+		UnrealUserCommand* ucptr = commands[i];
+		const UnrealHistogram& hist = ucptr->latency;
+
+		uptr->sendreply(RPL_STATSDEBUG,
+			String::format(":%s %d calls, %dms total, p50 %dus, "
+				"p99 %dus, max %dus, %dms CPU, %d bytes sent, %d slow",
+				ucptr->name().c_str(),
+				static_cast<int>(hist.count()),
+				static_cast<int>(hist.sum() / 1000),
+				static_cast<int>(hist.percentile(0.5)),
+				static_cast<int>(hist.percentile(0.99)),
+				static_cast<int>(hist.max()),
+				static_cast<int>(ucptr->cpu_time / 1000),
+				static_cast<int>(ucptr->bytes_sent),
+				static_cast<int>(ucptr->slow_calls)));
+	}
+}
+
+/**
+ * Report the DNS cache and query counters.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendDNS(UnrealUser* uptr)
+{
+	UnrealResolverChannel& chan = UnrealResolver::channel();
+	const UnrealResolverChannel::Counters& cnt = chan.counters();
+	size_t requests = cnt.hits + cnt.misses + cnt.shared;
+
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":DNS cache: %d entries, %d hits, %d misses, "
+			"%d shared lookups (%d%% answered without a query)",
+			static_cast<int>(chan.cacheSize()),
+			static_cast<int>(cnt.hits),
+			static_cast<int>(cnt.misses),
+			static_cast<int>(cnt.shared),
+			static_cast<int>(requests > 0
+				? (cnt.hits + cnt.shared) * 100 / requests : 0)));
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":DNS lookups: %d pending, %d failed",
+			static_cast<int>(chan.pending()),
+			static_cast<int>(cnt.failures)));
+}
+
+/**
+ * Report the ident client counters.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendIdent(UnrealUser* uptr)
+{
+	const UnrealIdentClient::Counters& cnt = unreal->ident.counters();
+
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Ident: %d running, %d sent, %d timed out",
+			static_cast<int>(unreal->ident.active()),
+			static_cast<int>(cnt.queries),
+			static_cast<int>(cnt.timeouts)));
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Ident skipped: %d cached replies, %d unreachable "
+			"hosts, %d busy",
+			static_cast<int>(cnt.cache_hits),
+			static_cast<int>(cnt.unreachable_skips),
+			static_cast<int>(cnt.busy_skips)));
+}
+
+/**
+ * Report the event loop health: timer lag, handler execution times and
+ * handlers ready per wakeup.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendLoop(UnrealUser* uptr)
+{
+	UnrealLoopMonitor& mon = unreal->monitor;
+	const UnrealHistogram& lag = mon.lag();
+	const UnrealHistogram& handlers = mon.handlers();
+	const UnrealHistogram& depth = mon.depth();
+
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Timer lag: last %dus, p50 %dus, p99 %dus, "
+			"max %dus, %d times above the threshold",
+			static_cast<int>(mon.lastLag()),
+			static_cast<int>(lag.percentile(0.5)),
+			static_cast<int>(lag.percentile(0.99)),
+			static_cast<int>(lag.max()),
+			static_cast<int>(mon.lagEvents())));
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Handlers: %d run, p50 %dus, p99 %dus, "
+			"longest %dus (%s)",
+			static_cast<int>(handlers.count()),
+			static_cast<int>(handlers.percentile(0.5)),
+			static_cast<int>(handlers.percentile(0.99)),
+			static_cast<int>(mon.longest()),
+			mon.longestTag()));
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Ready handlers per wakeup: p50 %d, p99 %d, max %d",
+			static_cast<int>(depth.percentile(0.5)),
+			static_cast<int>(depth.percentile(0.99)),
+			static_cast<int>(depth.max())));
+}
+
+/**
+ * Report the memory accounted per subsystem, current and peak.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendMemory(UnrealUser* uptr)
+{
+	for (int i = 0; i < UnrealMemoryStats::SubsystemCount; ++i)
+	{
+		UnrealMemoryStats::Subsystem sub =
+			static_cast<UnrealMemoryStats::Subsystem>(i);
+		const UnrealMemoryStats::Usage& u = UnrealMemoryStats::usage(sub);
+
+		uptr->sendreply(RPL_STATSDEBUG,
+			String::format(":%s: %d kB in %d objects (peak %d kB, "
+				"%d objects)",
+				UnrealMemoryStats::name(sub),
+				static_cast<int>(u.bytes / 1024),
+				static_cast<int>(u.objects),
+				static_cast<int>(u.peak_bytes / 1024),
+				static_cast<int>(u.peak_objects)));
+	}
+
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Total: %d kB",
+			static_cast<int>(UnrealMemoryStats::totalBytes() / 1024)));
+}
+
+/**
+ * Report the registration latency, for all listeners and per listener.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendRegistration(UnrealUser* uptr)
+{
+	UnrealRegistrationStats total;
+
+	foreach (List<UnrealListener*>::Iterator, lit, unreal->listeners)
+		total.merge((*lit)->registrations);
+
+	sendRegistrationStats(uptr, "all", total);
+
+	foreach (List<UnrealListener*>::Iterator, lit, unreal->listeners)
+	{
+		UnrealListener* lptr = *lit;
+
+		if (lptr->type() != UnrealListener::LClient)
+			continue;
+
+		sendRegistrationStats(uptr,
+			String::format("%s/%d",
+				lptr->bindAddress().c_str(),
+				static_cast<int>(lptr->bindPort())),
+			lptr->registrations);
+	}
+}
+
+/**
+ * Send one line per reached phase of a set of registration histograms.
+ * Times are measured from accepting the connection.
+ *
+ * @param uptr User to send the report to
+ * @param label Label to prefix the lines with
+ * @param stats Registration histograms
+ */
+void UnrealCH_stats::sendRegistrationStats(UnrealUser* uptr,
+	const String& label, const UnrealRegistrationStats& stats)
+{
+	for (int i = UnrealRegistrationTrace::FirstByte;
+			i < UnrealRegistrationTrace::PhaseCount; ++i)
+	{
+		UnrealRegistrationTrace::Phase ph =
+			static_cast<UnrealRegistrationTrace::Phase>(i);
+		const UnrealHistogram& hist = stats.phase(ph);
+
+		if (hist.count() == 0)
+			continue;
+
+		String line = String::format(":Registration %s %s: %d samples",
+			label.c_str(),
+			UnrealRegistrationTrace::phaseName(ph),
+			static_cast<int>(hist.count()));
+
+		for (size_t p = 0; p < sizeof(latency_percentiles)
+				/ sizeof(latency_percentiles[0]); ++p)
+		{
+			line.append(String::format(", p%d %dus",
+				static_cast<int>(latency_percentiles[p] * 100),
+				static_cast<int>(hist.percentile(latency_percentiles[p]))));
+		}
+
+		line.append(String::format(", max %dus",
+			static_cast<int>(hist.max())));
+
+		uptr->sendreply(RPL_STATSDEBUG, line);
+	}
+}
+
+/**
+ * Report the connection throttle counters.
+ *
+ * @param uptr User to send the report to
+ */
+void UnrealCH_stats::sendThrottle(UnrealUser* uptr)
+{
+	const UnrealThrottle::Counters& cnt = unreal->throttle.counters();
+
+	uptr->sendreply(RPL_STATSDEBUG,
+		String::format(":Throttle: %d hosts tracked, %d accepted, "
+			"%d rejected for too many connections, %d for connecting "
+			"too fast",
+			static_cast<int>(unreal->throttle.size()),
+			static_cast<int>(cnt.accepted),
+			static_cast<int>(cnt.too_many),
+			static_cast<int>(cnt.too_fast)));
+}
+
+/**
+ * Send the list of available reports.
+ *
+ * @param uptr User to send the list to
+ */
+void UnrealCH_stats::sendReportList(UnrealUser* uptr)
+{
+	for (size_t i = 0; i < report_count; ++i)
+	{
+		if (reports[i].oper_only && !uptr->isOper())
+			continue;
+
+		uptr->sendreply(RPL_STATSDEBUG,
+			String::format(":%c %s - %s",
+				reports[i].letter,
+				reports[i].name,
+				reports[i].description));
+	}
+
+	uptr->sendreply(RPL_ENDOFSTATS,
+		String::format(MSG_ENDOFSTATS,
+			"*"));
+}
+
+/**
+ * Updates the module information.
+ *
+ * @param inf Module information object pointer
+ */
+void UnrealCH_stats::setInfo(UnrealModuleInf* inf)
+{
+	inf->setAPIVersion( MODULE_API_VERSION );
+	inf->setAuthor("UnrealIRCd Development Team");
+	inf->setDescription("Command Handler for the /STATS command");
+	inf->setName("UnrealCH_stats");
+	inf->setVersion("1.0.0");
+}
+
+/**
+ * Module initialization function.
+ * Called when the Module is loaded.
+ *
+ * @param module Reference to Module
+ */
+UNREAL_DLL UnrealModule::Result unrInit(UnrealModule* mptr)
+{
+	handler = new UnrealCH_stats(mptr);
+	return UnrealModule::Success;
+}
+
+/**
+ * Module close function.
+ * It's called before the Module is unloaded.
+ */
+UNREAL_DLL UnrealModule::Result unrClose(UnrealModule* mptr)
+{
+	delete handler;
+	return UnrealModule::Success;
+}
@@ -88,6 +88,7 @@ void UnrealCH_user::exec(UnrealUser* uptr, StringList* argv)
 
 		uptr->setRealname(argv->at(argv->size() - 1));
 		uptr->authflags().revoke(UnrealUser::AFUser);
+		uptr->registrationTrace().mark(UnrealRegistrationTrace::User);
 
 		if (uptr->authflags().value() == 0)
 			uptr->sendPing();
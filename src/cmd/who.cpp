@@ -28,6 +28,7 @@
 #include <stringlist.hpp>
 
 #include <cmd/who.hpp>
+#include <algorithm>
 
 /** class instance */
 static UnrealCH_who* handler = NULL;
@@ -43,6 +44,8 @@ UnrealCH_who::UnrealCH_who(UnrealModule* mptr)
 	
 	/* allocate additional contents */
 	command_ = new UnrealUserCommand(CMD_WHO, &UnrealCH_who::exec);
+
+	unreal->isupport.add("WHOX", "");
 }
 
 /**
@@ -51,6 +54,63 @@ UnrealCH_who::UnrealCH_who(UnrealModule* mptr)
 UnrealCH_who::~UnrealCH_who()
 {
 	delete command_;
+
+	unreal->isupport.remove("WHOX");
+}
+
+/**
+ * Collect the candidate users for a WHO query from the user index.
+ * The result is a superset of the matching users; every candidate still
+ * has to be checked with matches().
+ *
+ * @param q Query
+ * @param result List the candidates are added to
+ * @return false if the mask can't be answered from the index and all users
+ *         have to be checked, otherwise true
+ */
+bool UnrealCH_who::collect(Query& q, List<UnrealUser*>& result)
+{
+	/* the literal parts before the first and after the last wildcard;
+	 * '_' matches a space as well, so it ends a literal too */
+	static const char* wildcards = "*?_";
+	size_t first = q.mask.find_first_of(wildcards);
+	size_t last = q.mask.find_last_of(wildcards);
+	String prefix = q.mask.left(first);
+	String suffix = (last == String::npos ? q.mask : q.mask.mid(last + 1));
+	uint8_t fields = q.match_fields;
+
+	if (fields == 0)
+	{
+		/* a full mask nick!user@host starts with the nick and ends with
+		 * the host, so either of them narrows it down */
+		String nick_prefix = prefix.left(prefix.find_first_of("!@"));
+		size_t at = suffix.rfind('@');
+		String host_suffix = (at == String::npos ? suffix : suffix.mid(at + 1));
+
+		if (nick_prefix.empty() && host_suffix.empty())
+			return false;
+		else if (nick_prefix.size() >= host_suffix.size())
+			unreal->userindex.findPrefix(UnrealUserIndex::Nick, nick_prefix,
+				result);
+		else
+			unreal->userindex.findSuffix(UnrealUserIndex::Host, host_suffix,
+				result);
+
+		/* the nick and the host are matched on their own as well */
+		fields = MFNick | MFHost;
+	}
+
+	for (uint8_t f = MFNick; f <= MFRealname; f <<= 1)
+	{
+		if ((fields & f) && !lookup(f, prefix, suffix, result))
+			return false;
+	}
+
+	/* remove duplicates found through several fields */
+	std::sort(result.begin(), result.end());
+	result.erase(std::unique(result.begin(), result.end()), result.end());
+
+	return true;
 }
 
 /**
@@ -60,6 +120,10 @@ UnrealCH_who::~UnrealCH_who()
  */
 UnrealChannel* UnrealCH_who::commonChannel(UnrealUser* uptr, UnrealUser* tuptr)
 {
+	/* walk through the shorter channel list */
+	if (tuptr->channels.size() < uptr->channels.size())
+		std::swap(uptr, tuptr);
+
 	foreach (List<UnrealChannel*>::Iterator, ci, uptr->channels)
 	{
 		UnrealChannel* chptr = *ci;
@@ -75,106 +139,513 @@ UnrealChannel* UnrealCH_who::commonChannel(UnrealUser* uptr, UnrealUser* tuptr)
  * WHO command handler for User connections.
  *
  * Usage:
- * WHO [<mask>] ["o"]
+ * WHO [<mask> [<flags>[%<fields>[,<querytype>]]]]
+ *
+ * The flags select the fields the mask is matched against: n (nick),
+ * u (username), h (hostname), i (IP address, IRC operators only) and
+ * r (real name). Without any of them, the mask is matched against the
+ * nick, the hostname and the full nick!user@host mask. The flag o lists
+ * IRC operators only. Other users asking for i get ERR_NOPRIVILEGES
+ * and an empty reply.
+ * The fields after % select the WHOX reply fields (tcuihsnfdlaor).
  *
  * Message example:
  * WHO #test
+ * WHO *.example.com h%nuhr,42
  *
  * @param uptr Originating user
  * @param argv Argument list
  */
 void UnrealCH_who::exec(UnrealUser* uptr, StringList* argv)
 {
-	bool want_oper = (argv->size() >= 3 && argv->at(2) == "o");
-	String mask = "*";
+	Query q;
+
+	if (!parseQuery(uptr, argv, q))
+	{
+		uptr->sendreply(RPL_ENDOFWHO,
+			String::format(MSG_ENDOFWHO,
+				q.mask.c_str()));
 
-	if (argv->size() >= 2)
-		mask = argv->at(1);
+		return;
+	}
 
-	/* TODO: this is a very minimal WHO implementation. No mask matching
-	 * has been added yet.
-	 */
-	if (mask.at(0) == '#' || mask.at(0) == '&')
+	/* the replies are sent as the send queue drains */
+	if (q.mask.at(0) == '#' || q.mask.at(0) == '&')
+		uptr->addReplyStream(new UnrealWhoStream(q, UnrealWhoStream::Channel));
+	else
 	{
-		UnrealChannel* chptr = UnrealChannel::find(mask);
+		List<UnrealUser*> candidates;
 
-		if (chptr)
+		/* try to answer the query from the user index before falling back
+		 * to a walk over all users */
+		if (collect(q, candidates))
 		{
-			/* define whether the user can receive invisible entries */
-			bool can_recv_inv = (chptr->findMember(uptr) || uptr->isOper());
+			UnrealWhoStream* stream =
+				new UnrealWhoStream(q, UnrealWhoStream::Candidates);
+
+			stream->setCandidates(candidates);
+			uptr->addReplyStream(stream);
+		}
+		else
+			uptr->addReplyStream(new UnrealWhoStream(q, UnrealWhoStream::All));
+	}
+}
+
+/**
+ * Look up the candidates for a single field in the user index.
+ *
+ * @param field MatchField
+ * @param prefix Literal mask prefix
+ * @param suffix Literal mask suffix
+ * @param result List the candidates are appended to
+ * @return false if the field can't be looked up, otherwise true
+ */
+bool UnrealCH_who::lookup(uint8_t field, const String& prefix,
+	const String& suffix, List<UnrealUser*>& result)
+{
+	UnrealUserIndex::Field f;
+
+	switch (field)
+	{
+		case MFNick:
+			f = UnrealUserIndex::Nick;
+			break;
+
+		case MFHost:
+			f = UnrealUserIndex::Host;
+			break;
+
+		case MFIP:
+			f = UnrealUserIndex::IP;
+			break;
+
+		case MFRealname:
+			f = UnrealUserIndex::Realname;
+			break;
+
+		default:
+			return false;
+	}
+
+	/* use the longer literal, as it's the more selective one */
+	if (!prefix.empty() && prefix.size() >= suffix.size())
+		return unreal->userindex.findPrefix(f, prefix, result);
+	else if (!suffix.empty())
+		return unreal->userindex.findSuffix(f, suffix, result);
+	else
+		return false;
+}
+
+/**
+ * Returns whether a user matches the WHO query.
+ *
+ * @param q Query
+ * @param tuptr User to check
+ * @return true if matching, otherwise false
+ */
+bool UnrealCH_who::matches(Query& q, UnrealUser* tuptr)
+{
+	if (q.match_fields == 0)
+	{
+		return (tuptr->match(q.mask)
+			|| String(tuptr->nick()).match(q.mask)
+			|| String(tuptr->hostname()).match(q.mask));
+	}
+
+	if ((q.match_fields & MFNick) && String(tuptr->nick()).match(q.mask))
+		return true;
+	if ((q.match_fields & MFUser) && String(tuptr->ident()).match(q.mask))
+		return true;
+	if ((q.match_fields & MFHost) && String(tuptr->hostname()).match(q.mask))
+		return true;
+	if ((q.match_fields & MFIP) && String(tuptr->ip()).match(q.mask))
+		return true;
+	if ((q.match_fields & MFRealname)
+			&& String(tuptr->realname()).match(q.mask))
+		return true;
+
+	return false;
+}
+
+/**
+ * Parse the WHO arguments.
+ *
+ * @param uptr Originating user
+ * @param argv Argument list
+ * @param q Query to fill in
+ * @return false if the query has been refused, otherwise true
+ */
+bool UnrealCH_who::parseQuery(UnrealUser* uptr, StringList* argv, Query& q)
+{
+	q.mask = "*";
+	q.opers_only = false;
+	q.match_fields = 0;
+	q.whox = false;
+
+	if (argv->size() >= 2 && !argv->at(1).empty())
+		q.mask = argv->at(1);
+
+	if (argv->size() < 3)
+		return true;
+
+	String flags = argv->at(2);
+	size_t pct = flags.find('%');
+
+	if (pct != String::npos)
+	{
+		String sel = flags.mid(pct + 1);
+		size_t comma = sel.find(',');
+
+		q.whox = true;
+		q.fields = sel.left(comma);
+
+		if (comma != String::npos)
+			q.querytype = sel.mid(comma + 1, 3);
+
+		flags = flags.left(pct);
+	}
+
+	foreach_str (fi, flags)
+	{
+		switch (*fi)
+		{
+			case 'o':
+				q.opers_only = true;
+				break;
 
-			for (UnrealChannel::MemberIterator i = chptr->members.begin();
-					i != chptr->members.end(); ++i)
+			case 'n':
+				q.match_fields |= MFNick;
+				break;
+
+			case 'u':
+				q.match_fields |= MFUser;
+				break;
+
+			case 'h':
+				q.match_fields |= MFHost;
+				break;
+
+			case 'i':
+				/* IP addresses are not revealed to normal users */
+				if (!uptr->isOper())
+				{
+					uptr->sendreply(ERR_NOPRIVILEGES, MSG_NOPRIVILEGES);
+					return false;
+				}
+
+				q.match_fields |= MFIP;
+				break;
+
+			case 'r':
+				q.match_fields |= MFRealname;
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Send a single WHO reply entry, either as RPL_WHOREPLY or, when fields
+ * have been selected, as WHOX RPL_WHOSPCRPL.
+ *
+ * @param uptr Originating user
+ * @param tuptr User to describe
+ * @param chptr Channel to show, may be 0
+ * @param q Query
+ */
+void UnrealCH_who::sendEntry(UnrealUser* uptr, UnrealUser* tuptr,
+	UnrealChannel* chptr, Query& q)
+{
+	String chname = (chptr ? chptr->name() : String("*"));
+	String status = (tuptr->isAway() ? "G" : "H");
+
+	if (tuptr->isOper())
+		status.append(1, '*');
+
+	if (chptr)
+	{
+		UnrealChannel::Member* mptr = chptr->findMember(tuptr);
+
+		if (mptr && mptr->isChanOp())
+			status.append(1, '@');
+		else if (mptr && mptr->isHalfOp())
+			status.append(1, '%');
+		else if (mptr && mptr->isVoiced())
+			status.append(1, '+');
+	}
+
+	if (!q.whox)
+	{
+		uptr->sendreply(RPL_WHOREPLY,
+			String::format(MSG_WHOREPLY,
+				chname.c_str(),
+				tuptr->ident().c_str(),
+				tuptr->hostname().c_str(),
+				unreal->me->name().c_str(),
+				tuptr->nick().c_str(),
+				status.c_str(),
+				0,
+				tuptr->realname().c_str()));
+		return;
+	}
+
+	/* WHOX fields are always sent in this order */
+	static const char* order = "tcuihsnfdlaor";
+	StringList reply;
+
+	for (const char* fp = order; *fp; ++fp)
+	{
+		if (q.fields.find(*fp) == String::npos)
+			continue;
+
+		switch (*fp)
+		{
+			case 't':
+				reply << (q.querytype.empty() ? String("0") : q.querytype);
+				break;
+
+			case 'c':
+				reply << chname;
+				break;
+
+			case 'u':
+				reply << tuptr->ident();
+				break;
+
+			case 'i':
+				if (uptr->isOper() || uptr == tuptr)
+					reply << tuptr->ip();
+				else
+					reply << "255.255.255.255";
+				break;
+
+			case 'h':
+				reply << tuptr->hostname();
+				break;
+
+			case 's':
+				reply << unreal->me->name();
+				break;
+
+			case 'n':
+				reply << tuptr->nick();
+				break;
+
+			case 'f':
+				reply << status;
+				break;
+
+			case 'd':
+				reply << "0";
+				break;
+
+			case 'l':
 			{
-				UnrealUser* tuptr = i->first;
-
-				if (tuptr->isInvisible() && !can_recv_inv)
-					continue;
-				else if (want_oper && !tuptr->isOper())
-					continue;
-
-				String status = (tuptr->isAway() ? "G" : "H");
-
-				if (tuptr->isOper())
-					status.append(1, '*');
-
-				uptr->sendreply(RPL_WHOREPLY,
-					String::format(MSG_WHOREPLY,
-						chptr->name().c_str(),
-						tuptr->ident().c_str(),
-						tuptr->hostname().c_str(),
-						unreal->me->name().c_str(),
-						tuptr->nick().c_str(),
-						status.c_str(),
-						0,
-						tuptr->realname().c_str()));
+				UnrealTime idle = UnrealTime::now();
+				idle.addSeconds(-tuptr->lastActionTime().toTS());
+
+				reply << String(static_cast<int64_t>(idle.toTS()));
+				break;
 			}
+
+			case 'a':
+				reply << "0";
+				break;
+
+			case 'o':
+				reply << "n/a";
+				break;
+
+			case 'r':
+				reply << ":" + tuptr->realname();
+				break;
 		}
 	}
-	else
+
+	uptr->sendreply(RPL_WHOSPCRPL,
+		String::format(MSG_WHOSPCRPL,
+			reply.join(" ").c_str()));
+}
+
+/**
+ * UnrealWhoStream constructor.
+ *
+ * @param q Parsed WHO request
+ * @param source Where the users are taken from
+ */
+UnrealWhoStream::UnrealWhoStream(const UnrealCH_who::Query& q, Source source)
+	: query_(q), source_(source), member_cursor_(0), pos_(0), replies_(0),
+	  done_(false), truncated_(false)
+{
+	max_replies_ = unreal->config.get("Limits::MaxWhoReplies", "200")
+		.toSize();
+}
+
+/**
+ * Returns the next user to check, and advances the cursor.
+ *
+ * @param chptr Set to the channel for Channel streams, otherwise 0
+ * @return User pointer, or 0 if the user is gone or the end is reached
+ */
+UnrealUser* UnrealWhoStream::next(UnrealChannel*& chptr)
+{
+	chptr = 0;
+
+	switch (source_)
+	{
+		case Channel:
+		{
+			chptr = UnrealChannel::find(query_.mask);
+
+			if (!chptr)
+			{
+				done_ = true;
+				return 0;
+			}
+
+			UnrealChannel::MemberIterator mi = (member_cursor_
+				? chptr->members.upper_bound(member_cursor_)
+				: chptr->members.begin());
+
+			if (mi == chptr->members.end())
+			{
+				done_ = true;
+				return 0;
+			}
+
+			member_cursor_ = mi->first;
+			return mi->first;
+		}
+
+		case Candidates:
+		{
+			if (pos_ >= candidates_.size())
+			{
+				done_ = true;
+				return 0;
+			}
+
+			return unreal->nicks.value(candidates_.at(pos_++));
+		}
+
+		case All:
+		{
+			Map<String, UnrealUser*>::Iterator ni =
+				unreal->nicks.upper_bound(nick_cursor_);
+
+			if (ni == unreal->nicks.end())
+			{
+				done_ = true;
+				return 0;
+			}
+
+			nick_cursor_ = ni->first;
+			return ni->second;
+		}
+	}
+
+	done_ = true;
+	return 0;
+}
+
+/**
+ * Send the next chunk of WHO replies.
+ *
+ * @param uptr User receiving the reply
+ * @param max_lines Maximum number of lines to send
+ * @return More or Done
+ */
+UnrealReplyStream::Result UnrealWhoStream::produce(UnrealUser* uptr,
+	size_t max_lines)
+{
+	/* don't spend too much time on users that are filtered out */
+	size_t budget = max_lines * 16, lines = 0;
+
+	while (lines < max_lines && budget-- > 0)
 	{
 		UnrealChannel* chptr;
-		bool can_recv_inv;
-	
+		UnrealUser* tuptr = next(chptr);
+
+		if (done_)
+			break;
+		else if (!tuptr)
+			continue;
+
+		if (source_ == Channel)
+		{
+			/* define whether the user can receive invisible entries */
+			bool can_recv_inv = (chptr->findMember(uptr) || uptr->isOper());
 
-		foreach (List<UnrealUser*>::Iterator, ui, unreal->users)
+			if (tuptr->isInvisible() && !can_recv_inv)
+				continue;
+			else if (query_.opers_only && !tuptr->isOper())
+				continue;
+		}
+		else
 		{
-			UnrealUser* tuptr = *ui;
-			
+			/* only registered users are listed */
+			if (!unreal->userindex.contains(tuptr))
+				continue;
+			else if (query_.opers_only && !tuptr->isOper())
+				continue;
+			else if (!UnrealCH_who::matches(query_, tuptr))
+				continue;
+
 			/* just list that user if it's visible to the other user in some
 			 * way; IRC operators can always see anyone
 			 */
-			can_recv_inv = ((chptr = UnrealCH_who::commonChannel(uptr, tuptr))
-				|| uptr->isOper());
+			if (tuptr != uptr)
+				chptr = UnrealCH_who::commonChannel(uptr, tuptr);
 
-			if (tuptr->isInvisible() && !can_recv_inv && tuptr != uptr)
-				continue;
-			else if (want_oper && !tuptr->isOper())
-				continue;
-			else if (!tuptr->match(mask) && tuptr != uptr)
+			if (tuptr->isInvisible() && !chptr && !uptr->isOper()
+					&& tuptr != uptr)
 				continue;
+		}
 
-			String status = (tuptr->isAway() ? "G" : "H");
-
-			if (tuptr->isOper())
-				status.append(1, '*');
-			
-			uptr->sendreply(RPL_WHOREPLY,
-				String::format(MSG_WHOREPLY,
-					chptr ? chptr->name().c_str() : "*",
-					tuptr->ident().c_str(),
-					tuptr->hostname().c_str(),
-					unreal->me->name().c_str(),
-					tuptr->nick().c_str(),
-					status.c_str(),
-					0,
-					tuptr->realname().c_str()));
+		if (max_replies_ > 0 && replies_ >= max_replies_)
+		{
+			truncated_ = true;
+			break;
 		}
+
+		UnrealCH_who::sendEntry(uptr, tuptr, chptr, query_);
+		replies_++;
+		lines++;
+	}
+
+	if (!done_ && !truncated_)
+		return More;
+
+	if (truncated_)
+	{
+		uptr->sendreply(ERR_TOOMANYMATCHES,
+			String::format(MSG_TOOMANYMATCHES,
+				query_.mask.c_str()));
 	}
 
 	uptr->sendreply(RPL_ENDOFWHO,
 		String::format(MSG_ENDOFWHO,
-			mask.c_str()));
+			query_.mask.c_str()));
+
+	return Done;
+}
+
+/**
+ * Set the users for a Candidates stream. They're kept by nick, so users
+ * leaving in the meantime are skipped.
+ *
+ * @param candidates Candidate users
+ */
+void UnrealWhoStream::setCandidates(List<UnrealUser*>& candidates)
+{
+	foreach (List<UnrealUser*>::Iterator, ui, candidates)
+		candidates_ << (*ui)->lowerNick();
+
+	std::sort(candidates_.begin(), candidates_.end());
 }
 
 /**
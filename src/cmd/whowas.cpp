@@ -25,16 +25,214 @@
 
 #include <base.hpp>
 #include <command.hpp>
+#include <memstat.hpp>
 #include <stringlist.hpp>
 
 #include <cmd/whowas.hpp>
 
-/** WHOWAS entry mapping */
-std::multimap<String, WhowasEntry_t> UnrealCH_whowas::entries;
+/** WHOWAS history */
+UnrealWhowasHistory* UnrealCH_whowas::history = NULL;
 
 /** class instance */
 static UnrealCH_whowas* handler = NULL;
 
+/**
+ * UnrealWhowasHistory constructor.
+ *
+ * @param max_entries Maximum number of entries
+ * @param max_bytes Memory limit in bytes, 0 for no limit
+ * @param max_per_nick Maximum number of entries per nick, 0 for no limit
+ */
+UnrealWhowasHistory::UnrealWhowasHistory(size_t max_entries,
+	size_t max_bytes, size_t max_per_nick)
+	: head_(0), count_(0), bytes_(0), max_bytes_(max_bytes),
+	  max_per_nick_(max_per_nick)
+{
+	if (max_entries == 0)
+		max_entries = 1;
+
+	WhowasEntry_t empty;
+	empty.used = false;
+	empty.bytes = 0;
+	empty.newer = npos;
+	empty.older = npos;
+
+	ring_.assign(max_entries, empty);
+}
+
+/**
+ * UnrealWhowasHistory destructor.
+ */
+UnrealWhowasHistory::~UnrealWhowasHistory()
+{
+	UnrealMemoryStats::release(UnrealMemoryStats::Whowas, bytes_, count_);
+}
+
+/**
+ * Add a new entry to the history. When the ring is full, the oldest entry
+ * is overwritten. Afterwards, the per-nick and memory limits are enforced
+ * by dropping the oldest entries of the nick, respectively of the whole
+ * history.
+ *
+ * @param nick Nickname
+ * @param user Username
+ * @param hostname Hostname
+ * @param realname Real name
+ */
+void UnrealWhowasHistory::add(const String& nick, const String& user,
+	const String& hostname, const String& realname)
+{
+	size_t pos = head_;
+
+	/* the slot under the write cursor always holds the oldest entry */
+	if (ring_[pos].used)
+		remove(pos);
+
+	WhowasEntry_t* e = &ring_[pos];
+
+	e->nick = nick;
+	e->user = user;
+	e->hostname = hostname;
+	e->realname = realname;
+	e->lnick = String(nick).toLower();
+	e->used = true;
+	e->bytes = sizeof(WhowasEntry_t) + sizeof(Chain) + e->nick.size()
+		+ e->user.size() + e->hostname.size() + e->realname.size()
+		+ e->lnick.size() * 2;
+	e->newer = npos;
+
+	HashMap<String, Chain>::Iterator ci = index_.find(e->lnick);
+
+	if (ci == index_.end())
+	{
+		Chain ch;
+		ch.newest = pos;
+		ch.oldest = pos;
+		ch.count = 1;
+
+		e->older = npos;
+		index_.add(e->lnick, ch);
+	}
+	else
+	{
+		e->older = ci->second.newest;
+		ring_[ci->second.newest].newer = pos;
+		ci->second.newest = pos;
+		ci->second.count++;
+
+		if (max_per_nick_ > 0 && ci->second.count > max_per_nick_)
+			remove(ci->second.oldest);
+	}
+
+	head_ = (head_ + 1) % ring_.size();
+	count_++;
+	bytes_ += e->bytes;
+	UnrealMemoryStats::allocate(UnrealMemoryStats::Whowas, e->bytes);
+
+	/* drop the oldest entries until we're within the memory limit again,
+	 * but never the entry just added */
+	for (size_t i = 0; max_bytes_ > 0 && bytes_ > max_bytes_ && count_ > 1
+		&& i < ring_.size() - 1; ++i)
+	{
+		size_t victim = (head_ + i) % ring_.size();
+
+		if (ring_[victim].used)
+			remove(victim);
+	}
+}
+
+/**
+ * Returns the estimated memory usage of the history.
+ *
+ * @return Bytes
+ */
+size_t UnrealWhowasHistory::bytes() const
+{
+	return bytes_;
+}
+
+/**
+ * Returns the newest entry for the specified nick.
+ *
+ * @param nick Nickname (any case)
+ * @return Entry pointer, or NULL when there is no history for that nick
+ */
+const WhowasEntry_t* UnrealWhowasHistory::newest(const String& nick)
+{
+	HashMap<String, Chain>::Iterator ci = index_.find(String(nick).toLower());
+
+	if (ci == index_.end())
+		return NULL;
+	else
+		return &ring_[ci->second.newest];
+}
+
+/**
+ * Returns the next older entry with the same nick.
+ *
+ * @param entry Entry pointer as returned by newest() or older()
+ * @return Entry pointer, or NULL when there are no older entries
+ */
+const WhowasEntry_t* UnrealWhowasHistory::older(const WhowasEntry_t* entry)
+	const
+{
+	if (entry->older == npos)
+		return NULL;
+	else
+		return &ring_[entry->older];
+}
+
+/**
+ * Remove the entry at the specified ring slot and unlink it from its
+ * nick chain.
+ *
+ * @param pos Ring slot
+ */
+void UnrealWhowasHistory::remove(size_t pos)
+{
+	WhowasEntry_t* e = &ring_[pos];
+	HashMap<String, Chain>::Iterator ci = index_.find(e->lnick);
+
+	if (ci != index_.end())
+	{
+		if (--ci->second.count == 0)
+			index_.erase(ci);
+		else
+		{
+			if (e->newer != npos)
+				ring_[e->newer].older = e->older;
+			else
+				ci->second.newest = e->older;
+
+			if (e->older != npos)
+				ring_[e->older].newer = e->newer;
+			else
+				ci->second.oldest = e->newer;
+		}
+	}
+
+	count_--;
+	bytes_ -= e->bytes;
+	UnrealMemoryStats::release(UnrealMemoryStats::Whowas, e->bytes);
+
+	/* release the string storage as well */
+	e->nick = e->user = e->hostname = e->realname = e->lnick = String();
+	e->used = false;
+	e->bytes = 0;
+	e->newer = npos;
+	e->older = npos;
+}
+
+/**
+ * Returns the number of entries in the history.
+ *
+ * @return Entry count
+ */
+size_t UnrealWhowasHistory::size() const
+{
+	return count_;
+}
+
 /**
  * Unreal Command Handler for "WHOWAS" - Constructor.
  *
@@ -46,6 +244,10 @@ UnrealCH_whowas::UnrealCH_whowas(UnrealModule* mptr)
 	
 	/* allocate additional contents */
 	command_ = new UnrealUserCommand(CMD_WHOWAS, &UnrealCH_whowas::exec);
+	history = new UnrealWhowasHistory(
+		unreal->config.get("Limits::WhowasHistory", "600").toSize(),
+		unreal->config.get("Limits::WhowasMemory", "0").toSize(),
+		unreal->config.get("Limits::WhowasPerNick", "10").toSize());
 
 	/* connect signals we're interested in */
 	UnrealUser::onDestroy.connect(&UnrealCH_whowas::handleLeavingUser);
@@ -60,6 +262,9 @@ UnrealCH_whowas::~UnrealCH_whowas()
 
 	/* disconnect signals */
 	UnrealUser::onDestroy.disconnect(&UnrealCH_whowas::handleLeavingUser);
+
+	delete history;
+	history = NULL;
 }
 
 /**
@@ -81,28 +286,18 @@ void UnrealCH_whowas::exec(UnrealUser* uptr, StringList* argv)
 		uptr->sendreply(ERR_NEEDMOREPARAMS,
 			String::format(MSG_NEEDMOREPARAMS,
 				CMD_WHOWAS));
+		return;
 	}
 
 	size_t count = -1, current = 0;
 
-	if (argv->size() > 2)
+	if (argv->size() > 2 && argv->at(2).toSize() > 0)
 		count = argv->at(2).toSize();
 
-	/* use lowercase nick to search through the history */
-	String ln = argv->at(1).toLower();
-
-	std::multimap<String, WhowasEntry_t>* history = &UnrealCH_whowas::entries;
-	std::multimap<String, WhowasEntry_t>::const_iterator wi;
-	
-	for (wi = history->find(ln); wi != history->end(); ++wi)
+	/* walk the nick chain from the newest to the oldest entry */
+	for (const WhowasEntry_t* e = history->newest(argv->at(1));
+		e && current++ < count; e = history->older(e))
 	{
-		if (wi->first != ln)
-			continue;
-		else if (current++ >= count)
-			break;
-
-		const WhowasEntry_t* e = &(wi->second);
-		
 		uptr->sendreply(RPL_WHOWASUSER,
 			String::format(MSG_WHOWASUSER,
 				e->nick.c_str(),
@@ -116,36 +311,18 @@ void UnrealCH_whowas::exec(UnrealUser* uptr, StringList* argv)
 
 /**
  * Event handler function that is called when a user object is about to be
- * destroyed. We use that to catch the nick for the WHOWAS entries map.
+ * destroyed. We use that to catch the nick for the WHOWAS history.
  *
  * @param uptr User pointer of leaving user
  */
 void UnrealCH_whowas::handleLeavingUser(UnrealUser* uptr)
 {
-	static size_t history_limit = unreal->config.get("Limits::WhowasHistory",
-		"600").toSize();
-	String ln = uptr->lowerNick();
-	std::multimap<String, WhowasEntry_t>* history = &UnrealCH_whowas::entries;
-	
-	/* limit the number of entries in the WHOWAS history list.
-	 * if that limit exceeds, remove the last entry from the list. */
-	if (history->size() >= history_limit)
-	{
-		std::multimap<String, WhowasEntry_t>::iterator ent_iter=history->end();
-		
-		if (ent_iter != history->begin())
-			history->erase(ent_iter);
-	}
-
-	WhowasEntry_t wwent;
-
-	wwent.nick = uptr->nick();
-	wwent.user = uptr->ident();
-	wwent.hostname = uptr->hostname();
-	wwent.realname = uptr->realname();
+	/* unregistered connections never had a nick to remember */
+	if (uptr->nick().empty())
+		return;
 
-	/* add into the history map */
-	history->insert(std::pair<String, WhowasEntry_t>(ln, wwent));
+	history->add(uptr->nick(), uptr->ident(), uptr->hostname(),
+		uptr->realname());
 }
 
 /**
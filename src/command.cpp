@@ -26,6 +26,9 @@
 #include "base.hpp"
 #include "command.hpp"
 
+bool UnrealUserCommand::cpu_accounting_ = true;
+uint64_t UnrealUserCommand::slow_threshold_ = 0;
+
 /**
  * UnrealUserCommand constructor.
  *
@@ -36,7 +39,7 @@
  */
 UnrealUserCommand::UnrealUserCommand(const String& name, Function cfn,
 		bool oper_only, bool reg_only)
-	: name_(name), fn_(cfn)
+	: cpu_time(0), bytes_sent(0), slow_calls(0), name_(name), fn_(cfn)
 {
 	if (oper_only)
 		flags_ << OperOnly;
@@ -54,6 +57,34 @@ UnrealUserCommand::~UnrealUserCommand()
 	unreal->user_commands.remove(name_);
 }
 
+/**
+ * Account a completed call.
+ *
+ * @param usec Execution time in microseconds
+ * @param cpu_usec CPU time in microseconds
+ * @param bytes Bytes queued for sending during the call
+ */
+void UnrealUserCommand::account(uint64_t usec, uint64_t cpu_usec,
+	uint64_t bytes)
+{
+	latency.add(usec);
+	cpu_time += cpu_usec;
+	bytes_sent += bytes;
+
+	if (slow_threshold_ > 0 && usec >= slow_threshold_)
+		slow_calls++;
+}
+
+/**
+ * Returns whether the CPU time of commands is measured.
+ *
+ * @return true if Commands::CPUAccounting is enabled
+ */
+bool UnrealUserCommand::cpuAccounting()
+{
+	return cpu_accounting_;
+}
+
 /**
  * Lookup a command.
  *
@@ -117,6 +148,18 @@ bool UnrealUserCommand::isRegistered()
 	return flags_.isset(Registered);
 }
 
+/**
+ * Read the accounting settings, Commands::CPUAccounting and
+ * Commands::SlowThreshold (in milliseconds).
+ */
+void UnrealUserCommand::loadSettings()
+{
+	cpu_accounting_ = unreal->config.get("Commands::CPUAccounting",
+		"true").toBool();
+	slow_threshold_ = static_cast<uint64_t>(unreal->config.get(
+		"Commands::SlowThreshold", "0").toUInt()) * 1000;
+}
+
 /**
  * Set the command activeness state.
  *
@@ -155,3 +198,13 @@ void UnrealUserCommand::setRegistered(bool state)
 	else if (!state && flags_.isset(Registered))
 		flags_.revoke(Registered);
 }
+
+/**
+ * Returns the time from which on calls are logged as slow.
+ *
+ * @return Microseconds; 0 if slow calls are not logged
+ */
+uint64_t UnrealUserCommand::slowThreshold()
+{
+	return slow_threshold_;
+}
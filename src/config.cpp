@@ -26,6 +26,7 @@
 #include "base.hpp"
 #include "config.hpp"
 #include "config.h"
+#include "memstat.hpp"
 #include "platform.hpp"
 #include <fstream>
 #include <iostream>
@@ -39,13 +40,53 @@
  * http://wiki.commx.ws/wiki/Unreal4/Config
  */
 
+/**
+ * Returns the memory used by a configuration entry, including the map node.
+ *
+ * @param key Key
+ * @param value Value
+ * @return Number of bytes
+ */
+static size_t entryBytes(const String& key, const String& value)
+{
+	return 4 * sizeof(void*) + 2 * sizeof(String)
+		+ UnrealMemoryStats::bytes(key)
+		+ UnrealMemoryStats::bytes(value);
+}
+
 /**
  * Config constructor.
  */
 UnrealConfig::UnrealConfig()
-	: filename_(CONFIG_DEFAULT_FILE), warnings_(0)
+	: filename_(CONFIG_DEFAULT_FILE), warnings_(0), memory_(0)
 {
+	UnrealMemoryStats::allocate(UnrealMemoryStats::Config, 0);
 	initDefaults();
+	accountMemory();
+}
+
+/**
+ * Update the memory accounted for the configuration entries.
+ */
+void UnrealConfig::accountMemory()
+{
+	size_t bytes = sizeof(UnrealConfig);
+
+	for (Map<String, String>::Iterator i = entries_.begin();
+			i != entries_.end(); ++i)
+		bytes += entryBytes(i->first, i->second);
+
+	for (StringList::Iterator i = files_.begin(); i != files_.end(); ++i)
+		bytes += sizeof(String) + UnrealMemoryStats::bytes(*i);
+
+	for (StringList::Iterator i = modules_.begin(); i != modules_.end(); ++i)
+		bytes += sizeof(String) + UnrealMemoryStats::bytes(*i);
+
+	for (StringList::Iterator i = sequences_.begin(); i != sequences_.end();
+			++i)
+		bytes += sizeof(String) + UnrealMemoryStats::bytes(*i);
+
+	UnrealMemoryStats::resize(UnrealMemoryStats::Config, memory_, bytes);
 }
 
 /**
@@ -700,7 +741,10 @@ bool UnrealConfig::rehash()
 
 	initDefaults();
 
-	return read(filename_);
+	bool result = read(filename_);
+	accountMemory();
+
+	return result;
 }
 
 /**
@@ -787,17 +831,29 @@ size_t UnrealConfig::sequenceCount(const String& blk)
 }
 
 /**
- * Set configuration item.
+ * Set configuration item. Only the size difference of this entry is
+ * accounted, so setting many items stays linear.
  *
  * @param key Key
  * @param value Value
  */
 void UnrealConfig::set(const String& key, const String& value)
 {
-	if (entries_.contains(key))
-		entries_.remove(key);
+	size_t bytes = memory_;
+	Map<String, String>::Iterator ei = entries_.find(key);
+
+	if (ei != entries_.end())
+	{
+		bytes -= entryBytes(ei->first, ei->second);
+		entries_.erase(ei);
+	}
 
 	entries_.add(key, value);
+
+	ei = entries_.find(key);
+	bytes += entryBytes(ei->first, ei->second);
+
+	UnrealMemoryStats::resize(UnrealMemoryStats::Config, memory_, bytes);
 }
 
 /**
@@ -817,7 +873,10 @@ void UnrealConfig::setFileName(const String& file)
  */
 void UnrealConfig::startRead()
 {
-	if (!read(filename_))
+	bool result = read(filename_);
+	accountMemory();
+
+	if (!result)
 	{
 		std::cout << "Error: Can't read configuration file \""
 				  << filename_
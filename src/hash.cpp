@@ -26,9 +26,19 @@
 #include "config.h"
 #include "hash.hpp"
 
+#include "stringlist.hpp"
+
 #include <cryptopp/hex.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/pwdbased.h>
 #include <cryptopp/sha.h>
 
+/** default number of PBKDF2 iterations for new passwords */
+static const uint32_t pbkdf2_default_iterations = 100000;
+
+/** length of PBKDF2 keys, in bytes */
+static const size_t pbkdf2_key_length = CryptoPP::SHA256::DIGESTSIZE;
+
 /**
  * Calculate the hash of the specified message and type and returns it
  * as the hexadecimal notation.
@@ -112,6 +122,39 @@ String UnrealHash::calculate(const String& message, Type type)
 	return String((char *)out_buffer);
 }
 
+/**
+ * Derive a key from a password with PBKDF2-HMAC-SHA256. This is slow on
+ * purpose; don't call it on the reactor.
+ *
+ * @param password Plain password
+ * @param salt Salt, in hexadecimal notation
+ * @param iterations Number of iterations
+ * @return Derived key in hexadecimal notation
+ */
+String UnrealHash::derive(const String& password, const String& salt,
+	uint32_t iterations)
+{
+	std::string raw_salt;
+	byte key[pbkdf2_key_length];
+	byte out_buffer[(pbkdf2_key_length * 2) + 1];
+	CryptoPP::PKCS5_PBKDF2_HMAC<CryptoPP::SHA256> kdf;
+	CryptoPP::HexEncoder he;
+
+	CryptoPP::StringSource(salt, true,
+		new CryptoPP::HexDecoder(new CryptoPP::StringSink(raw_salt)));
+
+	kdf.DeriveKey(key, sizeof(key), 0,
+		(const byte *)password.c_str(), password.length(),
+		(const byte *)raw_salt.data(), raw_salt.length(),
+		iterations);
+
+	he.Put(key, sizeof(key));
+	he.Get(out_buffer, sizeof(key) * 2);
+	out_buffer[sizeof(key) * 2] = 0;
+
+	return String((char *)out_buffer);
+}
+
 /**
  * Returns the digest size for the specified hash type.
  *
@@ -132,11 +175,79 @@ size_t UnrealHash::digest_size(Type type)
 			return CryptoPP::SHA384::DIGESTSIZE;
 		case SHA512:
 			return CryptoPP::SHA512::DIGESTSIZE;
+		case PBKDF2_SHA256:
+			return pbkdf2_key_length;
 		default:
 			return 0;
 	}
 }
 
+/**
+ * Build the stored form of a password, using PBKDF2 with a random salt.
+ *
+ * @param password Plain password
+ * @param iterations Number of iterations; 0 for the default
+ * @return Password entry for the configuration file
+ */
+String UnrealHash::encode(const String& password, uint32_t iterations)
+{
+	if (iterations == 0)
+		iterations = pbkdf2_default_iterations;
+
+	String salt = randomSalt();
+
+	return String::format("$PBKDF2-SHA256$%u$%s$%s",
+		iterations,
+		salt.c_str(),
+		derive(password, salt, iterations).c_str());
+}
+
+/**
+ * Compare two strings, taking the same time no matter where they differ.
+ *
+ * @param a First string
+ * @param b Second string
+ * @param nocase Whether to ignore the case, for hexadecimal digests
+ * @return True if equal, otherwise false
+ */
+bool UnrealHash::equals(const String& a, const String& b, bool nocase)
+{
+	String ua = nocase ? String(a).toUpper() : a;
+	String ub = nocase ? String(b).toUpper() : b;
+	unsigned char diff = 0;
+
+	if (ua.length() != ub.length())
+		return false;
+
+	for (size_t i = 0; i < ua.length(); ++i)
+		diff |= ua[i] ^ ub[i];
+
+	return (diff == 0);
+}
+
+/**
+ * Generate a random salt.
+ *
+ * @param length Salt length in bytes
+ * @return Salt in hexadecimal notation
+ */
+String UnrealHash::randomSalt(size_t length)
+{
+	CryptoPP::AutoSeededRandomPool rng;
+	std::string out;
+	byte buffer[64];
+
+	if (length > sizeof(buffer))
+		length = sizeof(buffer);
+
+	rng.GenerateBlock(buffer, length);
+
+	CryptoPP::StringSource(buffer, length, true,
+		new CryptoPP::HexEncoder(new CryptoPP::StringSink(out)));
+
+	return String(out);
+}
+
 /**
  * Returns the type identifier for the specified hash type string.
  *
@@ -155,8 +266,52 @@ UnrealHash::Type UnrealHash::strtotype(const String& str)
 		return SHA384;
 	else if (str == "SHA-512")
 		return SHA512;
+	else if (str == "PBKDF2-SHA256")
+		return PBKDF2_SHA256;
 	else if (str == "PLAIN")
 		return Plain;
 	else
 		return Invalid;
 }
+
+/**
+ * Check a password against its stored form. Depending on the stored form
+ * this may be slow; don't call it on the reactor.
+ *
+ * @param password Plain password
+ * @param stored Stored password, see the class description
+ * @return True if the password matches, otherwise false
+ */
+bool UnrealHash::verify(const String& password, const String& stored)
+{
+	if (stored.empty() || stored[0] != '$')
+		return equals(password, stored);
+
+	String entry = stored;
+	StringList parts = entry.mid(1).split("$");
+
+	if (parts.size() < 2)
+		return equals(password, stored);
+
+	Type type = strtotype(parts.at(0));
+
+	if (type == Invalid)
+		return equals(password, stored);
+	else if (type == Plain)
+	{
+		/* everything after "$PLAIN$" is the password */
+		return equals(password, entry.mid(parts.at(0).length() + 2));
+	}
+	else if (type == PBKDF2_SHA256)
+	{
+		if (parts.size() != 4 || parts.at(1).toUInt() == 0)
+			return false;
+
+		return equals(derive(password, parts.at(2), parts.at(1).toUInt()),
+			parts.at(3), true);
+	}
+	else if (parts.size() != 2)
+		return equals(password, stored);
+	else
+		return equals(calculate(password, type), parts.at(1), true);
+}
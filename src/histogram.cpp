@@ -0,0 +1,176 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         histogram.cpp
+ * Description  Log-scale latency histogram
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <histogram.hpp>
+#include <cstring>
+
+/**
+ * UnrealHistogram constructor.
+ */
+UnrealHistogram::UnrealHistogram()
+{
+	reset();
+}
+
+/**
+ * Add a sample.
+ *
+ * @param usec Sample value in microseconds
+ */
+void UnrealHistogram::add(uint64_t usec)
+{
+	size_t index = 0;
+
+	/* bucket i holds samples below 2^i */
+	while (index < BucketCount - 1 && usec >= bucketBound(index))
+		++index;
+
+	buckets_[index]++;
+	count_++;
+	sum_ += usec;
+
+	if (usec > max_)
+		max_ = usec;
+}
+
+/**
+ * Returns the number of samples in a bucket.
+ *
+ * @param index Bucket index
+ * @return Sample count
+ */
+uint64_t UnrealHistogram::bucket(size_t index) const
+{
+	return (index < BucketCount ? buckets_[index] : 0);
+}
+
+/**
+ * Returns the exclusive upper bound of a bucket, in microseconds. The last
+ * bucket is unbounded; zero is returned for it.
+ *
+ * @param index Bucket index
+ * @return Upper bound
+ */
+uint64_t UnrealHistogram::bucketBound(size_t index)
+{
+	if (index >= BucketCount - 1)
+		return 0;
+
+	return (static_cast<uint64_t>(1) << index);
+}
+
+/**
+ * Returns the number of samples.
+ *
+ * @return Sample count
+ */
+uint64_t UnrealHistogram::count() const
+{
+	return count_;
+}
+
+/**
+ * Returns the largest sample seen.
+ *
+ * @return Sample value in microseconds
+ */
+uint64_t UnrealHistogram::max() const
+{
+	return max_;
+}
+
+/**
+ * Add the samples of another histogram to this one.
+ *
+ * @param other Histogram to merge
+ */
+void UnrealHistogram::merge(const UnrealHistogram& other)
+{
+	for (size_t i = 0; i < BucketCount; ++i)
+		buckets_[i] += other.buckets_[i];
+
+	count_ += other.count_;
+	sum_ += other.sum_;
+
+	if (other.max_ > max_)
+		max_ = other.max_;
+}
+
+/**
+ * Returns an estimate for a percentile; that is the upper bound of the
+ * bucket holding it, but never more than the largest sample.
+ *
+ * @param q Percentile, from 0.0 to 1.0
+ * @return Sample value in microseconds; zero if there are no samples
+ */
+uint64_t UnrealHistogram::percentile(double q) const
+{
+	if (count_ == 0)
+		return 0;
+
+	uint64_t rank = static_cast<uint64_t>(q * count_ + 0.5);
+	uint64_t seen = 0;
+
+	if (rank < 1)
+		rank = 1;
+
+	for (size_t i = 0; i < BucketCount; ++i)
+	{
+		seen += buckets_[i];
+
+		if (seen >= rank)
+		{
+			uint64_t bound = bucketBound(i);
+
+			if (bound == 0 || bound > max_)
+				return max_;
+			else
+				return bound;
+		}
+	}
+
+	return max_;
+}
+
+/**
+ * Remove all samples.
+ */
+void UnrealHistogram::reset()
+{
+	std::memset(buckets_, 0, sizeof(buckets_));
+	count_ = 0;
+	sum_ = 0;
+	max_ = 0;
+}
+
+/**
+ * Returns the sum of all samples.
+ *
+ * @return Sum in microseconds
+ */
+uint64_t UnrealHistogram::sum() const
+{
+	return sum_;
+}
@@ -0,0 +1,354 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         ident.cpp
+ * Description  Ident (RFC 1413) client
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <ident.hpp>
+#include <stringlist.hpp>
+
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <boost/bind.hpp>
+
+/**
+ * Query constructor.
+ */
+UnrealIdentClient::Query::Query()
+	: owner(0), remote_port(0), local_port(0), socket(unreal->reactor()),
+	  buffer(512), done(false)
+{ }
+
+/**
+ * UnrealIdentClient constructor.
+ */
+UnrealIdentClient::UnrealIdentClient()
+	: last_expire_(0)
+{
+	memset(&counters_, 0, sizeof(counters_));
+}
+
+/**
+ * UnrealIdentClient destructor.
+ */
+UnrealIdentClient::~UnrealIdentClient()
+{
+	while (!queries_.empty())
+		cancel(queries_.begin()->first);
+}
+
+/**
+ * Returns the number of running queries.
+ *
+ * @return Query count
+ */
+size_t UnrealIdentClient::active()
+{
+	return queries_.size();
+}
+
+/**
+ * Cancel the query of a user. The user won't be notified.
+ *
+ * @param uptr User pointer
+ */
+void UnrealIdentClient::cancel(UnrealUser* uptr)
+{
+	HashMap<UnrealUser*, QueryPtr>::Iterator qi = queries_.find(uptr);
+
+	if (qi == queries_.end())
+		return;
+
+	QueryPtr q = qi->second;
+	ErrorCode ec;
+
+	queries_.erase(qi);
+
+	q->owner = 0;
+	q->done = true;
+	q->socket.close(ec);
+	q->timer.cancel(ec);
+}
+
+/**
+ * Returns the counters.
+ *
+ * @return Counters
+ */
+const UnrealIdentClient::Counters& UnrealIdentClient::counters()
+{
+	return counters_;
+}
+
+/**
+ * Remove expired cache entries; runs at most once a minute.
+ */
+void UnrealIdentClient::expire()
+{
+	std::time_t now = UnrealTime::now().toTS();
+
+	if (now - last_expire_ < 60)
+		return;
+
+	last_expire_ = now;
+
+	for (HashMap<String, CacheEntry>::Iterator ci = cache_.begin();
+			ci != cache_.end(); )
+	{
+		if (ci->second.expires <= now)
+			ci = cache_.erase(ci);
+		else
+			++ci;
+	}
+}
+
+/**
+ * Complete a query and notify the user.
+ *
+ * @param q Query
+ * @param result Result
+ * @param username Username, if found
+ */
+void UnrealIdentClient::finish(QueryPtr q, Result result,
+	const String& username)
+{
+	ErrorCode ec;
+	UnrealUser* owner = q->owner;
+
+	q->done = true;
+	q->socket.close(ec);
+	q->timer.cancel(ec);
+
+	if (owner)
+		queries_.remove(owner);
+
+	/* usernames belong to a single connection, so only failures are
+	 * remembered for the whole host */
+	std::time_t ttl = 0;
+
+	if (result == NoReply)
+		ttl = unreal->config.get("Ident::CacheTTL", "60").toInt();
+	else if (result == Unreachable)
+		ttl = unreal->config.get("Ident::UnreachableTTL", "300").toInt();
+
+	if (ttl > 0)
+	{
+		CacheEntry& entry = cache_[q->ip];
+
+		entry.result = result;
+		entry.expires = UnrealTime::now().toTS() + ttl;
+	}
+
+	if (owner)
+		owner->handleIdentResult(result, username);
+}
+
+/**
+ * Callback for the connection to the ident server.
+ *
+ * @param q Query
+ * @param ec Error code
+ */
+void UnrealIdentClient::handleConnect(QueryPtr q, const ErrorCode& ec)
+{
+	if (q->done)
+		return;
+	else if (ec)
+	{
+		finish(q, Unreachable, String());
+		return;
+	}
+
+	std::ostream os(&q->buffer);
+	os << q->remote_port << ", " << q->local_port << "\r\n";
+
+	boost::asio::async_write(q->socket, q->buffer,
+		boost::bind(&UnrealIdentClient::handleWrite,
+			this,
+			q,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * Callback for the reply of the ident server.
+ *
+ * @param q Query
+ * @param ec Error code
+ */
+void UnrealIdentClient::handleRead(QueryPtr q, const ErrorCode& ec)
+{
+	unreal->monitor.tag("ident");
+
+	if (q->done)
+		return;
+	else if (ec)
+	{
+		finish(q, NoReply, String());
+		return;
+	}
+
+	String username;
+	Result result = parseReply(q, username);
+
+	finish(q, result, username);
+}
+
+/**
+ * Callback for the hard query timeout.
+ *
+ * @param q Query
+ * @param ec Error code
+ */
+void UnrealIdentClient::handleTimeout(QueryPtr q, const ErrorCode& ec)
+{
+	if (ec == boost::asio::error::operation_aborted || q->done)
+		return;
+
+	counters_.timeouts++;
+	finish(q, Unreachable, String());
+}
+
+/**
+ * Callback for the sent request.
+ *
+ * @param q Query
+ * @param ec Error code
+ */
+void UnrealIdentClient::handleWrite(QueryPtr q, const ErrorCode& ec)
+{
+	if (q->done)
+		return;
+	else if (ec)
+	{
+		finish(q, NoReply, String());
+		return;
+	}
+
+	boost::asio::async_read_until(q->socket, q->buffer, '\n',
+		boost::bind(&UnrealIdentClient::handleRead,
+			this,
+			q,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * Start an ident lookup for a user.
+ *
+ * @param uptr User pointer
+ * @param remote Remote endpoint of the user's connection
+ * @param local Local endpoint of the user's connection
+ * @param username Receives the username, if the result is Found
+ * @return Pending if the user is notified later through
+ * UnrealUser::handleIdentResult(), otherwise the result
+ */
+UnrealIdentClient::Result UnrealIdentClient::lookup(UnrealUser* uptr,
+	const tcp::endpoint& remote, const tcp::endpoint& local,
+	String& username)
+{
+	String ip = remote.address().to_string();
+	HashMap<String, CacheEntry>::Iterator ci;
+
+	expire();
+
+	/* known host */
+	if ((ci = cache_.find(ip)) != cache_.end()
+			&& ci->second.expires > UnrealTime::now().toTS())
+	{
+		if (ci->second.result == Unreachable)
+			counters_.unreachable_skips++;
+		else
+			counters_.cache_hits++;
+
+		return ci->second.result;
+	}
+
+	size_t max = unreal->config.get("Ident::MaxQueries", "256").toSize();
+
+	if (queries_.size() >= max)
+	{
+		counters_.busy_skips++;
+		return Busy;
+	}
+
+	cancel(uptr);
+
+	QueryPtr q(new Query);
+	q->owner = uptr;
+	q->ip = ip;
+	q->remote_port = remote.port();
+	q->local_port = local.port();
+
+	counters_.queries++;
+	queries_.add(uptr, q);
+
+	q->socket.async_connect(tcp::endpoint(remote.address(), 113),
+		boost::bind(&UnrealIdentClient::handleConnect,
+			this,
+			q,
+			boost::asio::placeholders::error));
+
+	q->timer.expires_from_now(boost::posix_time::seconds(
+		unreal->config.get("Ident::Timeout", "5").toInt()));
+	q->timer.async_wait(
+		boost::bind(&UnrealIdentClient::handleTimeout,
+			this,
+			q,
+			boost::asio::placeholders::error));
+
+	return Pending;
+}
+
+/**
+ * Parse the reply of the ident server, like
+ * "6193, 23 : USERID : UNIX : stjohns".
+ *
+ * @param q Query
+ * @param username Receives the username
+ * @return Found or NoReply
+ */
+UnrealIdentClient::Result UnrealIdentClient::parseReply(QueryPtr q,
+	String& username)
+{
+	std::istream is(&q->buffer);
+	std::string line;
+
+	std::getline(is, line);
+
+	StringList tokens = String(line).split(":");
+
+	if (tokens.size() < 4)
+		return NoReply;
+
+	StringList ports = tokens.at(0).split(",");
+
+	if (ports.size() < 2
+			|| ports.at(0).trimmed().toUInt16() != q->remote_port
+			|| ports.at(1).trimmed().toUInt16() != q->local_port
+			|| tokens.at(1).trimmed() != "USERID")
+		return NoReply;
+
+	username = tokens.at(3).trimmed();
+
+	return (username.empty() ? NoReply : Found);
+}
@@ -27,6 +27,8 @@
 #include <command.hpp>
 #include <listener.hpp>
 #include <numeric.hpp>
+#include <probes.hpp>
+#include <time.hpp>
 #include <user.hpp>
 #include <cmd/notice.hpp>
 #include <iostream>
@@ -40,7 +42,8 @@
  */
 UnrealListener::UnrealListener(const String& address, const uint16_t& port)
 	: tcp::acceptor(unreal->reactor()), type_(LClient), address_(address),
-	port_(port), ping_freq_(0), max_connections_(0)
+	port_(port), ping_freq_(0), max_connections_(0), accept_delay_(0),
+	accept_logged_(0), accept_suppressed_(0)
 { }
 
 /**
@@ -48,6 +51,8 @@ UnrealListener::UnrealListener(const String& address, const uint16_t& port)
  */
 UnrealListener::~UnrealListener()
 {
+	accept_timer_.cancel();
+
 	for (List<UnrealSocket*>::Iterator i = connections.begin();
 			i != connections.end(); ++i)
 	{
@@ -62,14 +67,6 @@ UnrealListener::~UnrealListener()
  */
 void UnrealListener::addConnection(UnrealSocket* sptr)
 {
-	if (connections.size() >= max_connections_)
-	{
-		/* all connection slots in use, drop the connection */
-		sptr->write("ERROR :All connections in use");
-		sptr->close();
-		return;
-	}
-
 	sptr->onDisconnected.connect(
 		boost::bind(&UnrealListener::removeConnection,
 			this,
@@ -82,9 +79,18 @@ void UnrealListener::addConnection(UnrealSocket* sptr)
 			_1,
 			_2));
 
+	sptr->onWrite.connect(
+		boost::bind(&UnrealListener::handleWriteCompletion,
+			this,
+			_1));
+
 	/* add to the connection list */
 	connections << sptr;
 
+	/* replays are client sessions; server links are never recorded */
+	if (type_ == LClient)
+		unreal->capture.open(sptr);
+
 	/* modify stats; every new connection is marked to be "unknown" */
 	unreal->stats.connections_unk++;
 	unreal->stats.connections_cur++;
@@ -126,6 +132,92 @@ void UnrealListener::addConnection(UnrealSocket* sptr)
 	sptr->waitForLine();
 }
 
+/**
+ * Check a new connection against the connection limit, Z-lines and the
+ * throttle, and add it if it passes.
+ *
+ * @param sptr Socket pointer
+ * @return true if the connection has been added; otherwise the socket has
+ * been destroyed
+ */
+bool UnrealListener::admitConnection(UnrealSocket* sptr)
+{
+	UnrealSocket::ErrorCode rec;
+	tcp::endpoint remote = sptr->remoteEndpoint(rec);
+	UnrealThrottle::Result verdict = UnrealThrottle::Accepted;
+	UnrealBanList::BanPtr zline;
+
+	if (rec)
+	{
+		/* the client is gone already */
+		delete sptr;
+	}
+	else if (connections.size() >= max_connections_)
+	{
+		/* all connection slots in use, drop the connection */
+		rejectConnection(sptr, "All connections in use");
+	}
+	else if (type_ == LClient && (zline = unreal->bans.checkAddress(
+			remote.address().to_string())))
+	{
+		rejectConnection(sptr, String::format("Z-lined (%s)",
+			zline->reason.c_str()));
+	}
+	else if (type_ == LClient && (verdict = unreal->throttle.admit(sptr,
+			remote.address())) != UnrealThrottle::Accepted)
+	{
+		rejectConnection(sptr, verdict == UnrealThrottle::TooMany
+			? "Too many connections from your host"
+			: "Reconnecting too fast, throttled");
+	}
+	else
+	{
+		UNREAL_PROBE2(accept, sptr->native(), port_);
+
+		addConnection(sptr);
+		onNewConnection(this, sptr);
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Attach an in-memory connection, as if a client had connected from the
+ * given address. It goes through the same checks as accepted connections;
+ * the listener doesn't need to be running. See UnrealSocket::setLoopback().
+ *
+ * @param address Client IP address
+ * @param port Client port
+ * @return Socket pointer, or zero if the address is invalid or the
+ * connection has been refused
+ */
+UnrealSocket* UnrealListener::attachLoopback(const String& address,
+	const uint16_t& port)
+{
+	UnrealSocket::ErrorCode ec;
+	boost::asio::ip::address remote =
+		boost::asio::ip::address::from_string(address, ec);
+
+	if (ec)
+		return 0;
+
+	boost::asio::ip::address local =
+		boost::asio::ip::address::from_string(address_, ec);
+
+	if (ec)
+		local = remote.is_v4()
+			? boost::asio::ip::address(address_v4::loopback())
+			: boost::asio::ip::address(address_v6::loopback());
+
+	UnrealSocket* sptr = new UnrealSocket();
+	sptr->setLoopback(tcp::endpoint(remote, port),
+		tcp::endpoint(local, port_));
+
+	return admitConnection(sptr) ? sptr : 0;
+}
+
 /**
  * Returns the address of the endpoint we're bound to.
  *
@@ -154,23 +246,69 @@ uint16_t UnrealListener::bindPort()
  */
 void UnrealListener::handleAccept(const ErrorCode& ec, UnrealSocket* sptr)
 {
+	unreal->monitor.tag("accept");
+
 	if (ec)
 	{
-		ErrorCode edupl = ec;
-		
-		unreal->log.write(UnrealLog::Error, "UnrealListener handleAccept(): %s",
-			edupl.message().c_str());
+		delete sptr;
+
+		/* the listener has been closed */
+		if (ec == boost::asio::error::operation_aborted)
+			return;
+
+		/* errors like running out of descriptors are temporary, but the
+		 * pending connection stays queued, so retrying right away spins;
+		 * back off from 100ms up to a second and log once a minute
+		 */
+		std::time_t now = UnrealTime::now().toTS();
+
+		if (now - accept_logged_ >= 60)
+		{
+			ErrorCode edupl = ec;
+
+			unreal->log.write(UnrealLog::Error, "UnrealListener handleAccept(): "
+				"%s (%u more since the last report)",
+				edupl.message().c_str(), accept_suppressed_);
+
+			accept_logged_ = now;
+			accept_suppressed_ = 0;
+		}
+		else
+			accept_suppressed_++;
+
+		if (accept_delay_ == 0)
+			accept_delay_ = 100;
+		else if (accept_delay_ < 1000)
+			accept_delay_ = (accept_delay_ * 2 > 1000) ? 1000 : accept_delay_ * 2;
+
+		accept_timer_.expires_from_now(
+			boost::posix_time::milliseconds(accept_delay_));
+		accept_timer_.async_wait(
+			boost::bind(&UnrealListener::handleAcceptRetry,
+				this,
+				boost::asio::placeholders::error));
 	}
 	else
 	{
-		addConnection(sptr);
-		onNewConnection(this, sptr);
-		
+		accept_delay_ = 0;
+		admitConnection(sptr);
+
 		/* wait for the next client */
 		waitForAccept();
 	}
 }
 
+/**
+ * Timer callback to accept again after an accept error.
+ *
+ * @param ec Error code
+ */
+void UnrealListener::handleAcceptRetry(const UnrealTimer::ErrorCode& ec)
+{
+	if (!ec)
+		waitForAccept();
+}
+
 /**
  * Socket notification callback for new data available.
  *
@@ -179,8 +317,6 @@ void UnrealListener::handleAccept(const ErrorCode& ec, UnrealSocket* sptr)
  */
 void UnrealListener::handleDataResponse(UnrealSocket* sptr, String& data)
 {
-	unreal->log.write(UnrealLog::Debug, ">> %s", data.c_str());
-
 	if (type_ == LClient)
 	{
 		UnrealUser* uptr = UnrealUser::find(sptr);
@@ -200,6 +336,10 @@ void UnrealListener::handleDataResponse(UnrealSocket* sptr, String& data)
 			if (fc)
 				uptr->score++;
 
+			if (!uptr->isRegistered())
+				uptr->registrationTrace().mark(
+					UnrealRegistrationTrace::FirstByte);
+
 			/* add message to recvQ */
 			uptr->recvQ.add(data);
 
@@ -208,6 +348,11 @@ void UnrealListener::handleDataResponse(UnrealSocket* sptr, String& data)
 			else if (uptr->recvQ.length() >
 				uptr->recvQ.limit(UnrealRecvQueue::RQL_HARD))
 			{
+				uptr->notifyOpers(String::format("Flood from %s (recvQ "
+					"exceeded)",
+						uptr->mask().c_str()),
+					UnrealOperIndex::SNFlood);
+
 				/* instant disconnect */
 				uptr->drop("recvQ exceeded");
 			}
@@ -231,6 +376,23 @@ void UnrealListener::handleDataResponse(UnrealSocket* sptr, String& data)
 	}
 }
 
+/**
+ * Socket notification callback for completed writes. Continues pending
+ * large replies of the user, as the send queue has drained.
+ *
+ * @param sptr Socket pointer
+ */
+void UnrealListener::handleWriteCompletion(UnrealSocket* sptr)
+{
+	if (type_ == LClient)
+	{
+		UnrealUser* uptr = UnrealUser::find(sptr);
+
+		if (uptr)
+			uptr->pumpReplyStreams();
+	}
+}
+
 /**
  * Returns the maximum amount of connections permitted for this listener.
  *
@@ -290,9 +452,43 @@ void UnrealListener::processRecvQueue(UnrealUser* uptr, bool process_multi)
 			else
 			{
 				UnrealUserCommand::Function fn = ucptr->fn();
+				bool cpu = UnrealUserCommand::cpuAccounting();
+				uint64_t queued = UnrealSocket::queuedTotal();
+				uint64_t cpu_started = cpu ? UnrealTime::threadCPU() : 0;
+				uint64_t started = UnrealTime::monotonic();
+
+				ucptr->calls.add();
+				unreal->monitor.tag(cmd.c_str());
+
+				UNREAL_PROBE2(command__start, uptr->socket()->native(),
+					cmd.c_str());
 
 				/* call the command function */
 				fn(uptr, &tokens);
+
+				uint64_t elapsed = UnrealTime::monotonic() - started;
+				uint64_t cpu_used = cpu
+					? UnrealTime::threadCPU() - cpu_started : 0;
+
+				UNREAL_PROBE4(command__done, uptr->socket()->native(),
+					cmd.c_str(), elapsed,
+					UnrealSocket::queuedTotal() - queued);
+
+				/* the command may have unloaded its own module */
+				if (UnrealUserCommand::find(cmd) == ucptr)
+					ucptr->account(elapsed, cpu_used,
+						UnrealSocket::queuedTotal() - queued);
+
+				if (UnrealUserCommand::slowThreshold() > 0
+						&& elapsed >= UnrealUserCommand::slowThreshold())
+				{
+					unreal->log.write(UnrealLog::Normal, "Slow command: %s "
+						"from %s took %dus (%dus CPU)",
+						cmd.c_str(),
+						uptr->nick().c_str(),
+						static_cast<int>(elapsed),
+						static_cast<int>(cpu_used));
+				}
 			}
 		}
 		else
@@ -333,17 +529,52 @@ void UnrealListener::removeConnection(UnrealSocket* sptr,
 	if (unreal->stats.connections_cur > 0)
 		unreal->stats.connections_cur--;
 
+	UnrealSocketTrafficType traffic = sptr->traffic();
+
+	closed_traffic.in += traffic.in;
+	closed_traffic.out += traffic.out;
+
+	unreal->throttle.release(sptr);
+	unreal->capture.close(sptr);
 	connections.remove(sptr);
 }
 
+/**
+ * Refuse a freshly accepted connection. Nothing has been set up for it yet,
+ * so the error is written without waiting and the socket is destroyed
+ * right away.
+ *
+ * @param sptr Socket pointer
+ * @param reason Reason sent to the client
+ */
+void UnrealListener::rejectConnection(UnrealSocket* sptr,
+	const String& reason)
+{
+	UnrealSocket::ErrorCode ec;
+	String message = String::format("ERROR :Closing Link: %s\r\n",
+		reason.c_str());
+
+	if (!sptr->isLoopback())
+	{
+		sptr->non_blocking(true, ec);
+		sptr->send(boost::asio::buffer(message.data(), message.length()), 0,
+			ec);
+	}
+
+	sptr->disconnect(ec);
+
+	delete sptr;
+}
+
 /**
  * Resolve the endpoint, bind to it and listen for incoming connections.
  */
 void UnrealListener::run()
 {
-	UnrealResolver resolv;
+	/* a blocking lookup is fine here, as it only happens on startup */
+	tcp::resolver resolv(unreal->reactor());
 	UnrealResolver::ErrorCode ec;
-	UnrealResolver::Query query(address_, String(port_));
+	tcp::resolver::query query(address_, String(port_));
 	UnrealResolver::Endpoint endpoint = *resolv.resolve(query, ec);
 	
 	if (ec)
@@ -25,10 +25,14 @@
 
 #include "base.hpp"
 #include "log.hpp"
+#include "memstat.hpp"
 #include "time.hpp"
 #include <cstdarg>
 #include <iostream>
 
+/** timestamp format of log lines */
+static const char* time_format = "%Y-%m-%dT%H:%M:%S %Z";
+
 /**
  * UnrealLog constructor.
  * If `filename' has been specified, the log file is opened automatically.
@@ -36,7 +40,10 @@
  * @param filename Initial log file name
  */
 UnrealLog::UnrealLog(const String& filename)
-	: filename_(filename), level_(Normal), last_level_flag_(Normal)
+	: filename_(filename), level_(Normal), last_level_flag_(Normal),
+	  slots_(0), mask_(0), enqueue_pos_(0), dequeue_pos_(0), dropped_(0),
+	  reported_drops_(0), running_(0), stopping_(0), thread_(0),
+	  flush_interval_(0), batch_size_(0), cached_second_(-1)
 {
 	if (!filename_.empty())
 		open();
@@ -47,18 +54,55 @@ UnrealLog::UnrealLog(const String& filename)
  */
 UnrealLog::~UnrealLog()
 {
-	if (stream_.is_open())
+	close();
+
+	if (slots_)
+		UnrealMemoryStats::release(UnrealMemoryStats::Log,
+			(mask_ + 1) * sizeof(Slot));
+
+	delete[] slots_;
+}
+
+/**
+ * Stop the writer thread, write out all pending messages and close the
+ * log file. Further messages are written synchronously.
+ */
+void UnrealLog::close()
+{
+	if (thread_)
 	{
-		stream_.close();
+		UnrealAtomic::store(&stopping_, 1);
+		thread_->join();
+		delete thread_;
+		thread_ = 0;
+
+		UnrealAtomic::store(&running_, 0);
+		UnrealAtomic::store(&stopping_, 0);
+
+		/* messages pushed while the writer was about to exit */
+		boost::mutex::scoped_lock lock(mutex_);
+		std::string batch;
+
+		while (pop(batch))
+			;
+
+		flush(batch);
 	}
+
+	boost::mutex::scoped_lock lock(mutex_);
+
+	if (stream_.is_open())
+		stream_.close();
 }
 
 /**
- * Close log file.
+ * Returns the number of messages dropped as the ring was full.
+ *
+ * @return Dropped messages
  */
-void UnrealLog::close()
+size_t UnrealLog::dropped()
 {
-	stream_.close();
+	return UnrealAtomic::load(&dropped_);
 }
 
 /**
@@ -71,6 +115,60 @@ const String& UnrealLog::fileName()
 	return filename_;
 }
 
+/**
+ * Write a batch of lines to the log file and, if not daemonized, to
+ * stdout. The caller must hold mutex_.
+ *
+ * @param batch Lines to write; cleared afterwards
+ */
+void UnrealLog::flush(std::string& batch)
+{
+	if (batch.empty())
+		return;
+
+	/* print to file if opened */
+	if (stream_.good())
+	{
+		stream_.write(batch.data(), batch.size());
+		stream_.flush();
+	}
+
+	/* just print to stdout if not deamonized */
+	if (unreal->fstate() != UnrealBase::Daemonized)
+	{
+		std::cout.write(batch.data(), batch.size());
+		std::cout.flush();
+	}
+
+	batch.clear();
+}
+
+/**
+ * Append a log line to a batch. The timestamp is only formatted once per
+ * second. The caller must hold mutex_.
+ *
+ * @param batch Batch to append to
+ * @param level Log level
+ * @param ts Time the message was written
+ * @param text Message text
+ */
+void UnrealLog::format(std::string& batch, LogLevel level, std::time_t ts,
+	const char* text)
+{
+	if (ts != cached_second_)
+	{
+		cached_time_ = UnrealTime(ts).toString(time_format);
+		cached_second_ = ts;
+	}
+
+	batch += cached_time_;
+	batch += ' ';
+	batch += levelToStr(level);
+	batch += ' ';
+	batch += text;
+	batch += '\n';
+}
+
 /**
  * Return a readable version of the loglevel.
  *
@@ -101,10 +199,140 @@ String UnrealLog::levelToStr(LogLevel ll)
  */
 bool UnrealLog::open()
 {
+	boost::mutex::scoped_lock lock(mutex_);
+
 	stream_.open(filename_.c_str(), std::ios_base::out | std::ios_base::app);
 	return stream_.good();
 }
 
+/**
+ * Take the next message off the ring and append it to a batch; writer
+ * thread only, or after it has been stopped.
+ *
+ * Each slot carries a sequence number: a slot at ring position `pos' is
+ * free if its sequence is `pos', and holds a message once it is `pos + 1'.
+ * Reading the message frees the slot for the next round of the ring.
+ *
+ * @param batch Batch to append to
+ * @return true if a message has been taken, false if the ring is empty
+ */
+bool UnrealLog::pop(std::string& batch)
+{
+	if (!slots_)
+		return false;
+
+	Slot& slot = slots_[dequeue_pos_ & mask_];
+
+	if (UnrealAtomic::load(&slot.sequence) != dequeue_pos_ + 1)
+		return false;
+
+	format(batch, slot.level, slot.ts, slot.text);
+
+	UnrealAtomic::store(&slot.sequence, dequeue_pos_ + mask_ + 1);
+	dequeue_pos_++;
+
+	return true;
+}
+
+/**
+ * Format a message into a free ring slot. Any number of threads may push
+ * at the same time; a slot is claimed by advancing enqueue_pos_, and
+ * published to the writer by updating its sequence.
+ *
+ * @param level Log level
+ * @param fmt Format string
+ * @param vl Format arguments
+ * @return true if the message has been queued, false if the ring is full
+ */
+bool UnrealLog::push(LogLevel level, const char* fmt, va_list vl)
+{
+	uint32_t pos = UnrealAtomic::load(&enqueue_pos_);
+	Slot* slot;
+
+	for (;;)
+	{
+		slot = &slots_[pos & mask_];
+
+		int32_t diff = static_cast<int32_t>(
+			UnrealAtomic::load(&slot->sequence) - pos);
+
+		if (diff == 0)
+		{
+			if (UnrealAtomic::cas(&enqueue_pos_, pos, pos + 1))
+				break;
+		}
+		else if (diff < 0)
+		{
+			UnrealAtomic::add(&dropped_, 1);
+			return false;
+		}
+
+		pos = UnrealAtomic::load(&enqueue_pos_);
+	}
+
+	slot->level = level;
+	slot->ts = std::time(0);
+	vsnprintf(slot->text, sizeof(slot->text), fmt, vl);
+
+	UnrealAtomic::store(&slot->sequence, pos + 1);
+
+	return true;
+}
+
+/**
+ * Writer thread; collects messages from the ring and writes them in
+ * batches until close() is called.
+ */
+void UnrealLog::run()
+{
+	std::string batch;
+	uint64_t last_flush = UnrealTime::monotonic();
+
+	batch.reserve(batch_size_ + TextSize * 2);
+
+	for (;;)
+	{
+		bool stopping = UnrealAtomic::load(&stopping_) != 0;
+		size_t count = 0;
+
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			while (batch.size() < batch_size_ && pop(batch))
+				count++;
+
+			uint32_t dropped = UnrealAtomic::load(&dropped_);
+
+			if (dropped != reported_drops_)
+			{
+				String note = String::format("%d log messages dropped",
+					static_cast<int>(dropped - reported_drops_));
+
+				format(batch, Error, std::time(0), note.c_str());
+				reported_drops_ = dropped;
+			}
+
+			uint64_t now = UnrealTime::monotonic();
+
+			if (batch.size() >= batch_size_ || stopping
+					|| now - last_flush >= flush_interval_)
+			{
+				flush(batch);
+				last_flush = now;
+			}
+		}
+
+		if (count == 0)
+		{
+			/* the ring was empty when the stop request was seen */
+			if (stopping)
+				break;
+
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		}
+	}
+}
+
 /**
  * Set the file name.
  *
@@ -125,46 +353,79 @@ void UnrealLog::setLevel(LogLevel ll)
 	level_ = ll;
 }
 
+/**
+ * Start the writer thread. This has to be done after fork(), as threads
+ * don't survive it.
+ */
+void UnrealLog::start()
+{
+	if (thread_)
+		return;
+
+	size_t queue_size =
+		unreal->config.get("Log::QueueSize", "2048").toSize();
+	uint32_t size = 16;
+
+	while (size < queue_size && size < 0x100000)
+		size <<= 1;
+
+	if (slots_)
+		UnrealMemoryStats::release(UnrealMemoryStats::Log,
+			(mask_ + 1) * sizeof(Slot));
+
+	delete[] slots_;
+	slots_ = new Slot[size];
+	mask_ = size - 1;
+
+	UnrealMemoryStats::allocate(UnrealMemoryStats::Log, size * sizeof(Slot));
+
+	for (uint32_t i = 0; i < size; ++i)
+		slots_[i].sequence = i;
+
+	enqueue_pos_ = 0;
+	dequeue_pos_ = 0;
+
+	flush_interval_ = static_cast<uint64_t>(
+		unreal->config.get("Log::FlushInterval", "200").toUInt()) * 1000;
+	batch_size_ = unreal->config.get("Log::BatchSize", "16384").toSize();
+
+	if (batch_size_ < TextSize)
+		batch_size_ = TextSize;
+
+	UnrealAtomic::store(&running_, 1);
+	thread_ = new boost::thread(boost::bind(&UnrealLog::run, this));
+}
+
 /**
  * Write a line to log file.
  */
 void UnrealLog::write(LogLevel level, const char* fmt, ...)
 {
-	static char buffer[2048];
 	va_list vl;
 
 	/* always print error/fatal messages */
 	if (level > level_ && (level != Error && level != Fatal))
 		return;
 
-	va_start(vl, fmt);
-	vsnprintf(buffer, sizeof(buffer), fmt, vl);
-	va_end(vl);
-
-	// time string
-	UnrealTime now = UnrealTime::now();
-	String timeFmt = now.toString("%Y-%m-%dT%H:%M:%S %Z");
-
-	/* print to file if opened */
-	if (stream_.good())
+	if (UnrealAtomic::load(&running_))
 	{
-		stream_ << timeFmt
-				<< " "
-				<< levelToStr(level)
-				<< " "
-				<< buffer
-				<< std::endl;
+		va_start(vl, fmt);
+		push(level, fmt, vl);
+		va_end(vl);
 	}
-
-	/* just print to stdout if not deamonized */
-	if (unreal->fstate() != UnrealBase::Daemonized)
+	else
 	{
-		std::cout << timeFmt
-				  << " "
-				  << levelToStr(level)
-				  << " "
-				  << buffer
-				  << std::endl;
+		char buffer[TextSize];
+
+		va_start(vl, fmt);
+		vsnprintf(buffer, sizeof(buffer), fmt, vl);
+		va_end(vl);
+
+		boost::mutex::scoped_lock lock(mutex_);
+		std::string line;
+
+		format(line, level, std::time(0), buffer);
+		flush(line);
 	}
 
 	/* Fatal errors always have to terminate the program execution */
@@ -180,7 +441,7 @@ void UnrealLog::write(LogLevel level, const char* fmt, ...)
  */
 UnrealLog& UnrealLog::operator<<(const String& str)
 {
-	write(last_level_flag_, str.c_str());
+	write(last_level_flag_, "%s", str.c_str());
 	return *this;
 }
 
@@ -0,0 +1,251 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         loopmonitor.cpp
+ * Description  Event loop health monitor
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <loopmonitor.hpp>
+
+#include <cstring>
+
+/** tag of handlers which haven't tagged themselves */
+static const char* untagged = "other";
+
+/**
+ * Copy a tag, truncating it if needed.
+ *
+ * @param dst Destination of TagSize bytes
+ * @param src Tag
+ */
+static void copyTag(char* dst, const char* src)
+{
+	std::strncpy(dst, src, UnrealLoopMonitor::TagSize - 1);
+	dst[UnrealLoopMonitor::TagSize - 1] = '\0';
+}
+
+/**
+ * UnrealLoopMonitor constructor.
+ */
+UnrealLoopMonitor::UnrealLoopMonitor()
+	: due_(0), last_lag_(0), lag_events_(0), last_notice_(0), longest_(0),
+	  window_longest_(0)
+{
+	copyTag(tag_, untagged);
+	copyTag(longest_tag_, untagged);
+	copyTag(window_tag_, untagged);
+}
+
+/**
+ * Account a handler that has completed.
+ *
+ * @param usec Execution time in microseconds
+ */
+void UnrealLoopMonitor::account(uint64_t usec)
+{
+	handlers_.add(usec);
+
+	if (usec > window_longest_)
+	{
+		window_longest_ = usec;
+		copyTag(window_tag_, tag_);
+	}
+
+	if (usec > longest_)
+	{
+		longest_ = usec;
+		copyTag(longest_tag_, tag_);
+	}
+}
+
+/**
+ * Returns the number of handlers run per wakeup.
+ *
+ * @return Histogram of counts
+ */
+const UnrealHistogram& UnrealLoopMonitor::depth()
+{
+	return depth_;
+}
+
+/**
+ * Returns the handler execution times.
+ *
+ * @return Histogram
+ */
+const UnrealHistogram& UnrealLoopMonitor::handlers()
+{
+	return handlers_;
+}
+
+/**
+ * Returns the main loop timer drift.
+ *
+ * @return Histogram
+ */
+const UnrealHistogram& UnrealLoopMonitor::lag()
+{
+	return lag_;
+}
+
+/**
+ * Returns the number of times the timer drift exceeded the threshold.
+ *
+ * @return Count
+ */
+size_t UnrealLoopMonitor::lagEvents()
+{
+	return lag_events_;
+}
+
+/**
+ * Returns the last timer drift measured.
+ *
+ * @return Microseconds
+ */
+uint64_t UnrealLoopMonitor::lastLag()
+{
+	return last_lag_;
+}
+
+/**
+ * Returns the execution time of the longest handler so far.
+ *
+ * @return Microseconds
+ */
+uint64_t UnrealLoopMonitor::longest()
+{
+	return longest_;
+}
+
+/**
+ * Returns the tag of the longest handler so far.
+ *
+ * @return Tag
+ */
+const char* UnrealLoopMonitor::longestTag()
+{
+	return longest_tag_;
+}
+
+/**
+ * Run the event loop until it runs out of work.
+ *
+ * @param reactor Event reactor
+ */
+void UnrealLoopMonitor::run(UnrealReactor& reactor)
+{
+	UnrealReactor::ErrorCode ec;
+
+	for (;;)
+	{
+		uint64_t count = 0;
+
+		/* run the handlers that are ready */
+		for (;;)
+		{
+			copyTag(tag_, untagged);
+
+			uint64_t started = UnrealTime::monotonic();
+
+			if (reactor.poll_one(ec) == 0)
+				break;
+
+			account(UnrealTime::monotonic() - started);
+			count++;
+		}
+
+		if (count > 0)
+			depth_.add(count);
+
+		/* wait for the next event; its handler is measured by CPU time */
+		copyTag(tag_, untagged);
+
+		uint64_t cpu_started = UnrealTime::threadCPU();
+
+		if (reactor.run_one(ec) == 0)
+			break;
+
+		account(UnrealTime::threadCPU() - cpu_started);
+	}
+}
+
+/**
+ * The main loop timer has been armed.
+ *
+ * @param usec Time until the timer is due, in microseconds
+ */
+void UnrealLoopMonitor::schedule(uint64_t usec)
+{
+	due_ = UnrealTime::monotonic() + usec;
+}
+
+/**
+ * Tag the handler running right now.
+ *
+ * @param name Tag
+ */
+void UnrealLoopMonitor::tag(const char* name)
+{
+	copyTag(tag_, name);
+}
+
+/**
+ * The main loop timer has fired; measure its drift and warn about lag.
+ */
+void UnrealLoopMonitor::tick()
+{
+	uint64_t now = UnrealTime::monotonic();
+
+	tag("timer");
+
+	last_lag_ = now > due_ ? now - due_ : 0;
+	lag_.add(last_lag_);
+
+	uint64_t threshold = static_cast<uint64_t>(unreal->config.get(
+		"Monitor::LagThreshold", "500").toUInt()) * 1000;
+
+	if (threshold > 0 && last_lag_ >= threshold)
+	{
+		std::time_t interval = unreal->config.get("Monitor::NoticeInterval",
+			"60").toUInt();
+
+		lag_events_++;
+
+		std::time_t ts = UnrealTime::now().toTS();
+
+		if (ts - last_notice_ >= interval)
+		{
+			last_notice_ = ts;
+
+			unreal->opers.notice(UnrealOperIndex::SNGeneral,
+				String::format("Event loop lag of %dms; longest handler "
+					"took %dms (%s)",
+					static_cast<int>(last_lag_ / 1000),
+					static_cast<int>(window_longest_ / 1000),
+					window_tag_));
+		}
+	}
+
+	window_longest_ = 0;
+	copyTag(window_tag_, untagged);
+}
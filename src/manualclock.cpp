@@ -0,0 +1,147 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         manualclock.cpp
+ * Description  Manually advanced clock for deterministic tests
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <manualclock.hpp>
+#include <time.hpp>
+#include <timer.hpp>
+
+/**
+ * UnrealManualClock constructor.
+ *
+ * @param epoch Wall clock time to start at, in seconds
+ * @param start Monotonic time to start at, in microseconds
+ */
+UnrealManualClock::UnrealManualClock(std::time_t epoch, uint64_t start)
+	: epoch_(epoch), start_(start), now_(start), seq_(0)
+{ }
+
+/**
+ * UnrealManualClock destructor.
+ * Timers still waiting are canceled; their handlers are posted to the
+ * reactor with operation_aborted.
+ */
+UnrealManualClock::~UnrealManualClock()
+{
+	if (UnrealTime::clock() == this)
+		UnrealTime::setClock(0);
+
+	Queue waiting;
+	waiting.swap(queue_);
+
+	for (Queue::iterator qi = waiting.begin(); qi != waiting.end(); ++qi)
+		qi->second->abort();
+}
+
+/**
+ * Move the clock forward. Timers becoming due on the way are run in order;
+ * timers they arm are run as well if they are due before the new time.
+ *
+ * @param usec Microseconds to move forward
+ */
+void UnrealManualClock::advance(uint64_t usec)
+{
+	uint64_t target = now_ + usec;
+
+	while (!queue_.empty() && queue_.begin()->first.first <= target)
+	{
+		Queue::iterator qi = queue_.begin();
+		UnrealTimer* timer = qi->second;
+
+		if (qi->first.first > now_)
+			now_ = qi->first.first;
+
+		queue_.erase(qi);
+		timer->fire();
+	}
+
+	now_ = target;
+}
+
+/**
+ * Move the clock forward by whole seconds.
+ *
+ * @param sec Seconds to move forward
+ */
+void UnrealManualClock::advanceSeconds(std::time_t sec)
+{
+	advance(static_cast<uint64_t>(sec) * 1000000);
+}
+
+/**
+ * Returns the current monotonic time.
+ *
+ * @return Microseconds
+ */
+uint64_t UnrealManualClock::monotonic()
+{
+	return now_;
+}
+
+/**
+ * Returns the number of timers waiting.
+ *
+ * @return Timer count
+ */
+size_t UnrealManualClock::pending()
+{
+	return queue_.size();
+}
+
+/**
+ * Queue a timer.
+ *
+ * @param timer Timer
+ * @param due Monotonic time the timer is due, in microseconds
+ * @return Sequence number, needed to unschedule the timer
+ */
+uint64_t UnrealManualClock::schedule(UnrealTimer* timer, uint64_t due)
+{
+	uint64_t seq = ++seq_;
+
+	queue_.insert(Queue::value_type(Key(due, seq), timer));
+
+	return seq;
+}
+
+/**
+ * Remove a timer from the queue. Nothing happens if it has run already.
+ *
+ * @param due Monotonic time the timer is due, in microseconds
+ * @param seq Sequence number returned by schedule()
+ */
+void UnrealManualClock::unschedule(uint64_t due, uint64_t seq)
+{
+	queue_.erase(Key(due, seq));
+}
+
+/**
+ * Returns the current wall clock time.
+ *
+ * @return Seconds since the epoch
+ */
+std::time_t UnrealManualClock::wallclock()
+{
+	return epoch_ + static_cast<std::time_t>((now_ - start_) / 1000000);
+}
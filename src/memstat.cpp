@@ -0,0 +1,136 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         memstat.cpp
+ * Description  Memory accounting per subsystem
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <memstat.hpp>
+
+/** usage per subsystem; zero-initialized before any constructor runs */
+UnrealMemoryStats::Usage UnrealMemoryStats::usage_[SubsystemCount];
+
+/** subsystem names, as shown by STATS z and in metrics labels */
+static const char* subsystem_names[UnrealMemoryStats::SubsystemCount] = {
+	"users", "channels", "bans", "recvq", "sendq", "whowas", "config",
+	"trace", "log"
+};
+
+/**
+ * Account newly allocated memory.
+ *
+ * @param sub Subsystem
+ * @param bytes Number of bytes
+ * @param objects Number of objects; 0 if an existing object grew
+ */
+void UnrealMemoryStats::allocate(Subsystem sub, size_t bytes, size_t objects)
+{
+	Usage& u = usage_[sub];
+
+	u.bytes += bytes;
+	u.objects += objects;
+
+	if (u.bytes > u.peak_bytes)
+		u.peak_bytes = u.bytes;
+
+	if (u.objects > u.peak_objects)
+		u.peak_objects = u.objects;
+}
+
+/**
+ * Returns the heap memory held by a string.
+ *
+ * @param str String
+ * @return Number of bytes
+ */
+size_t UnrealMemoryStats::bytes(const String& str)
+{
+	return str.capacity();
+}
+
+/**
+ * Returns the name of a subsystem.
+ *
+ * @param sub Subsystem
+ * @return Name
+ */
+const char* UnrealMemoryStats::name(Subsystem sub)
+{
+	return (sub < SubsystemCount ? subsystem_names[sub] : "unknown");
+}
+
+/**
+ * Account released memory.
+ *
+ * @param sub Subsystem
+ * @param bytes Number of bytes
+ * @param objects Number of objects; 0 if an existing object shrank
+ */
+void UnrealMemoryStats::release(Subsystem sub, size_t bytes, size_t objects)
+{
+	Usage& u = usage_[sub];
+
+	u.bytes -= (bytes < u.bytes ? bytes : u.bytes);
+	u.objects -= (objects < u.objects ? objects : u.objects);
+}
+
+/**
+ * Update the memory accounted for an object whose size changes.
+ *
+ * @param sub Subsystem
+ * @param accounted Bytes accounted for the object so far; updated
+ * @param bytes Current size of the object
+ */
+void UnrealMemoryStats::resize(Subsystem sub, size_t& accounted, size_t bytes)
+{
+	if (bytes > accounted)
+		allocate(sub, bytes - accounted, 0);
+	else if (bytes < accounted)
+		release(sub, accounted - bytes, 0);
+
+	accounted = bytes;
+}
+
+/**
+ * Returns the memory accounted for all subsystems.
+ *
+ * @return Number of bytes
+ */
+uint64_t UnrealMemoryStats::totalBytes()
+{
+	uint64_t result = 0;
+
+	for (int i = 0; i < SubsystemCount; ++i)
+		result += usage_[i].bytes;
+
+	return result;
+}
+
+/**
+ * Returns the usage of a subsystem.
+ *
+ * @param sub Subsystem
+ * @return Usage
+ */
+const UnrealMemoryStats::Usage& UnrealMemoryStats::usage(Subsystem sub)
+{
+	return usage_[sub];
+}
@@ -0,0 +1,606 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         metrics.cpp
+ * Description  Metrics registry and exporter
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <metrics.hpp>
+
+#include <boost/bind.hpp>
+
+using namespace boost::asio::ip;
+
+/** maximum size of an HTTP request */
+static const size_t max_request_size = 8192;
+
+/** time a client may take to send its request and read the response */
+static const long request_timeout = 5;
+
+THREAD_LOCAL int UnrealMetricCounter::thread_shard_ = -1;
+volatile uint32_t UnrealMetricCounter::next_shard_ = 0;
+
+/**
+ * Format a sample value; integral values are written without fraction.
+ *
+ * @param value Value
+ * @return Formatted value
+ */
+static String formatValue(double value)
+{
+	if (value == static_cast<double>(static_cast<int64_t>(value)))
+		return String::format("%lld", static_cast<long long>(value));
+	else
+		return String::format("%.6f", value);
+}
+
+/**
+ * Collector for a registered counter.
+ */
+static void writeCounter(UnrealMetricWriter& out, const String& name,
+	const String& help, const UnrealMetricCounter* counter,
+	const String& labels)
+{
+	out.counter(name, help, static_cast<double>(counter->value()), labels);
+}
+
+/**
+ * Collector for a registered gauge.
+ */
+static void writeGauge(UnrealMetricWriter& out, const String& name,
+	const String& help, const UnrealMetrics::Function& fn,
+	const String& labels)
+{
+	out.gauge(name, help, fn(), labels);
+}
+
+/**
+ * Collector for a registered histogram.
+ */
+static void writeHistogram(UnrealMetricWriter& out, const String& name,
+	const String& help, const UnrealHistogram* hist, const String& labels)
+{
+	out.histogram(name, help, *hist, labels);
+}
+
+/**
+ * UnrealMetricCounter constructor.
+ */
+UnrealMetricCounter::UnrealMetricCounter()
+{
+	for (size_t i = 0; i < ShardCount; ++i)
+		shards_[i].value = 0;
+}
+
+/**
+ * Assign a shard to the calling thread.
+ */
+void UnrealMetricCounter::assignShard()
+{
+	uint32_t index = UnrealAtomic::add(&next_shard_, 1);
+
+	thread_shard_ = static_cast<int>(index < ShardCount - 1
+		? index : ShardCount - 1);
+}
+
+/**
+ * Returns the counter value, summed up over all shards.
+ *
+ * @return Value
+ */
+uint64_t UnrealMetricCounter::value() const
+{
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < ShardCount; ++i)
+		sum += shards_[i].value;
+
+	return sum;
+}
+
+/**
+ * Add a counter sample.
+ *
+ * @param name Metric name
+ * @param help Help text
+ * @param value Value
+ * @param labels Label list as built by label(), comma separated
+ */
+void UnrealMetricWriter::counter(const String& name, const String& help,
+	double value, const String& labels)
+{
+	sample(family(name, help, "counter"), name, labels, value);
+}
+
+/**
+ * Returns the sample group of a metric, creating it if needed.
+ *
+ * @param name Metric name
+ * @param help Help text
+ * @param type Metric type
+ * @return Sample group
+ */
+UnrealMetricWriter::Family& UnrealMetricWriter::family(const String& name,
+	const String& help, const char* type)
+{
+	HashMap<String, size_t>::Iterator fi = index_.find(name);
+
+	if (fi != index_.end())
+		return families_.at(fi->second);
+
+	Family fam;
+	fam.name = name;
+	fam.help = help;
+	fam.type = type;
+
+	index_[name] = families_.size();
+	families_ << fam;
+
+	return families_.at(families_.size() - 1);
+}
+
+/**
+ * Add a gauge sample.
+ *
+ * @param name Metric name
+ * @param help Help text
+ * @param value Value
+ * @param labels Label list as built by label(), comma separated
+ */
+void UnrealMetricWriter::gauge(const String& name, const String& help,
+	double value, const String& labels)
+{
+	sample(family(name, help, "gauge"), name, labels, value);
+}
+
+/**
+ * Add a histogram. Bucket bounds and the sum are converted from
+ * microseconds into seconds.
+ *
+ * @param name Metric name
+ * @param help Help text
+ * @param hist Histogram
+ * @param labels Label list as built by label(), comma separated
+ */
+void UnrealMetricWriter::histogram(const String& name, const String& help,
+	const UnrealHistogram& hist, const String& labels)
+{
+	Family& fam = family(name, help, "histogram");
+	String sep = labels.empty() ? "" : ",";
+	uint64_t cumulative = 0;
+
+	for (size_t i = 0; i < UnrealHistogram::BucketCount; ++i)
+	{
+		uint64_t bound = UnrealHistogram::bucketBound(i);
+
+		cumulative += hist.bucket(i);
+
+		String le = bound > 0
+			? String::format("%.6f", bound / 1000000.0)
+			: String("+Inf");
+
+		sample(fam, name + "_bucket", labels + sep + label("le", le),
+			static_cast<double>(cumulative));
+	}
+
+	sample(fam, name + "_sum", labels, hist.sum() / 1000000.0);
+	sample(fam, name + "_count", labels, static_cast<double>(hist.count()));
+}
+
+/**
+ * Build a label, escaping the value.
+ *
+ * @param key Label name
+ * @param value Label value
+ * @return Label text
+ */
+String UnrealMetricWriter::label(const String& key, const String& value)
+{
+	String result = key + "=\"";
+
+	for (size_t i = 0; i < value.length(); ++i)
+	{
+		if (value[i] == '\\' || value[i] == '"')
+			result += '\\';
+		else if (value[i] == '\n')
+		{
+			result += "\\n";
+			continue;
+		}
+
+		result += value[i];
+	}
+
+	return result + "\"";
+}
+
+/**
+ * Append a sample line.
+ *
+ * @param fam Sample group
+ * @param name Sample name
+ * @param labels Labels
+ * @param value Value
+ */
+void UnrealMetricWriter::sample(Family& fam, const String& name,
+	const String& labels, double value)
+{
+	fam.samples += name;
+
+	if (!labels.empty())
+		fam.samples += "{" + labels + "}";
+
+	fam.samples += " " + formatValue(value) + "\n";
+}
+
+/**
+ * Returns all samples in the Prometheus text format.
+ *
+ * @return Text
+ */
+String UnrealMetricWriter::str()
+{
+	String result;
+
+	foreach (List<Family>::Iterator, fi, families_)
+	{
+		result += "# HELP " + fi->name + " " + fi->help + "\n";
+		result += "# TYPE " + fi->name + " " + fi->type + "\n";
+		result += fi->samples;
+	}
+
+	return result;
+}
+
+/**
+ * HTTP connection constructor.
+ *
+ * @param ios Event reactor
+ */
+UnrealMetrics::Connection::Connection(boost::asio::io_service& ios)
+	: socket(ios), request(max_request_size), timer(ios)
+{ }
+
+/**
+ * UnrealMetrics constructor.
+ */
+UnrealMetrics::UnrealMetrics()
+	: acceptor_(0)
+{ }
+
+/**
+ * UnrealMetrics destructor.
+ */
+UnrealMetrics::~UnrealMetrics()
+{
+	stop();
+}
+
+/**
+ * Wait for the next HTTP client.
+ */
+void UnrealMetrics::accept()
+{
+	ConnectionPtr conn(new Connection(unreal->reactor()));
+
+	acceptor_->async_accept(conn->socket,
+		boost::bind(&UnrealMetrics::handleAccept,
+			this,
+			conn,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * Register a collector.
+ *
+ * @param owner Owner, for removeCollectors()
+ * @param fn Collector
+ */
+void UnrealMetrics::addCollector(const void* owner, const Collector& fn)
+{
+	Entry entry;
+	entry.owner = owner;
+	entry.fn = fn;
+
+	collectors_ << entry;
+}
+
+/**
+ * Register a counter; it must live until its owner's collectors are
+ * removed.
+ *
+ * @param owner Owner
+ * @param name Metric name
+ * @param help Help text
+ * @param counter Counter
+ * @param labels Labels
+ */
+void UnrealMetrics::addCounter(const void* owner, const String& name,
+	const String& help, const UnrealMetricCounter* counter,
+	const String& labels)
+{
+	addCollector(owner, boost::bind(&writeCounter, _1, name, help, counter,
+		labels));
+}
+
+/**
+ * Register a gauge, whose value is read when metrics are requested.
+ *
+ * @param owner Owner
+ * @param name Metric name
+ * @param help Help text
+ * @param fn Function returning the value
+ * @param labels Labels
+ */
+void UnrealMetrics::addGauge(const void* owner, const String& name,
+	const String& help, const Function& fn, const String& labels)
+{
+	addCollector(owner, boost::bind(&writeGauge, _1, name, help, fn,
+		labels));
+}
+
+/**
+ * Register a histogram; it must live until its owner's collectors are
+ * removed.
+ *
+ * @param owner Owner
+ * @param name Metric name
+ * @param help Help text
+ * @param hist Histogram
+ * @param labels Labels
+ */
+void UnrealMetrics::addHistogram(const void* owner, const String& name,
+	const String& help, const UnrealHistogram* hist, const String& labels)
+{
+	addCollector(owner, boost::bind(&writeHistogram, _1, name, help, hist,
+		labels));
+}
+
+/**
+ * Close an HTTP connection.
+ *
+ * @param conn Connection
+ */
+void UnrealMetrics::close(ConnectionPtr conn)
+{
+	ErrorCode ec;
+
+	conn->timer.cancel(ec);
+	conn->socket.close(ec);
+}
+
+/**
+ * A client has connected; read its request.
+ *
+ * @param conn Connection
+ * @param ec Error code
+ */
+void UnrealMetrics::handleAccept(ConnectionPtr conn, const ErrorCode& ec)
+{
+	if (ec == boost::asio::error::operation_aborted || !acceptor_)
+		return;
+
+	if (!ec)
+	{
+		ErrorCode rec;
+		tcp::endpoint remote = conn->socket.remote_endpoint(rec);
+
+		if (rec || !remote.address().is_loopback())
+			close(conn);
+		else
+		{
+			conn->timer.expires_from_now(
+				boost::posix_time::seconds(request_timeout));
+			conn->timer.async_wait(
+				boost::bind(&UnrealMetrics::handleTimeout,
+					conn,
+					boost::asio::placeholders::error));
+
+			boost::asio::async_read_until(conn->socket, conn->request,
+				"\r\n\r\n",
+				boost::bind(&UnrealMetrics::handleRequest,
+					this,
+					conn,
+					boost::asio::placeholders::error));
+		}
+	}
+
+	accept();
+}
+
+/**
+ * The request has been read; send the metrics or an error.
+ *
+ * @param conn Connection
+ * @param ec Error code
+ */
+void UnrealMetrics::handleRequest(ConnectionPtr conn, const ErrorCode& ec)
+{
+	if (ec)
+	{
+		close(conn);
+		return;
+	}
+
+	unreal->monitor.tag("metrics");
+
+	std::istream is(&conn->request);
+	String method, path, status = "200 OK", body;
+
+	is >> method >> path;
+
+	if (method != "GET")
+	{
+		status = "405 Method Not Allowed";
+		body = "Only GET is supported\n";
+	}
+	else if (path != "/metrics" && path.find("/metrics?") != 0)
+	{
+		status = "404 Not Found";
+		body = "Metrics are served at /metrics\n";
+	}
+	else
+	{
+		requests_.add();
+		body = render();
+	}
+
+	conn->response = String::format("HTTP/1.0 %s\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %d\r\n"
+		"Connection: close\r\n\r\n",
+			status.c_str(),
+			static_cast<int>(body.length())) + body;
+
+	boost::asio::async_write(conn->socket,
+		boost::asio::buffer(conn->response.data(), conn->response.length()),
+		boost::bind(&UnrealMetrics::handleWritten,
+			conn,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * The client took too long; close the connection.
+ *
+ * @param conn Connection
+ * @param ec Error code
+ */
+void UnrealMetrics::handleTimeout(ConnectionPtr conn, const ErrorCode& ec)
+{
+	if (ec != boost::asio::error::operation_aborted)
+		close(conn);
+}
+
+/**
+ * The response has been written; close the connection.
+ *
+ * @param conn Connection
+ * @param ec Error code
+ */
+void UnrealMetrics::handleWritten(ConnectionPtr conn, const ErrorCode& ec)
+{
+	ErrorCode sec;
+
+	conn->socket.shutdown(tcp::socket::shutdown_both, sec);
+	close(conn);
+}
+
+/**
+ * Remove all collectors of an owner.
+ *
+ * @param owner Owner
+ */
+void UnrealMetrics::removeCollectors(const void* owner)
+{
+	for (List<Entry>::Iterator ei = collectors_.begin();
+			ei != collectors_.end(); )
+	{
+		if (ei->owner == owner)
+			ei = collectors_.erase(ei);
+		else
+			++ei;
+	}
+}
+
+/**
+ * Call all collectors and return the metrics in the Prometheus text
+ * format.
+ *
+ * @return Text
+ */
+String UnrealMetrics::render()
+{
+	UnrealMetricWriter out;
+
+	foreach (List<Entry>::Iterator, ei, collectors_)
+		ei->fn(out);
+
+	out.counter("unrealircd_metrics_requests_total",
+		"Metrics requests served",
+		static_cast<double>(requests_.value()));
+
+	return out.str();
+}
+
+/**
+ * Start the HTTP listener on Metrics::Address and Metrics::Port.
+ */
+void UnrealMetrics::start()
+{
+	uint16_t port = unreal->config.get("Metrics::Port", "0").toUInt16();
+	String host = unreal->config.get("Metrics::Address", "127.0.0.1");
+
+	if (port == 0 || acceptor_)
+		return;
+
+	ErrorCode ec;
+	address addr = address::from_string(host, ec);
+
+	if (ec || !addr.is_loopback())
+	{
+		unreal->log.write(UnrealLog::Error, "Metrics::Address \"%s\" is no "
+			"loopback address; metrics are not served", host.c_str());
+		return;
+	}
+
+	tcp::endpoint endpoint(addr, port);
+
+	acceptor_ = new tcp::acceptor(unreal->reactor());
+	acceptor_->open(endpoint.protocol(), ec);
+
+	if (!ec)
+		acceptor_->set_option(tcp::acceptor::reuse_address(true), ec);
+
+	if (!ec)
+		acceptor_->bind(endpoint, ec);
+
+	if (!ec)
+		acceptor_->listen(boost::asio::socket_base::max_connections, ec);
+
+	if (ec)
+	{
+		unreal->log.write(UnrealLog::Error, "Metrics listener on %s:%d "
+			"failed: %s", host.c_str(), static_cast<int>(port),
+			ec.message().c_str());
+
+		delete acceptor_;
+		acceptor_ = 0;
+		return;
+	}
+
+	accept();
+}
+
+/**
+ * Stop the HTTP listener.
+ */
+void UnrealMetrics::stop()
+{
+	if (acceptor_)
+	{
+		ErrorCode ec;
+
+		acceptor_->close(ec);
+		delete acceptor_;
+		acceptor_ = 0;
+	}
+}
@@ -0,0 +1,234 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         operindex.cpp
+ * Description  Index of local IRC operators and server notice masks
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <operindex.hpp>
+
+#include <cmd/notice.hpp>
+
+/** server notice mask letters, in display order */
+static const struct
+{
+	char letter;
+	uint8_t category;
+} snomask_letters[] = {
+	{ 'c', UnrealOperIndex::SNConnect },
+	{ 'f', UnrealOperIndex::SNFlood },
+	{ 'k', UnrealOperIndex::SNKill },
+	{ 'o', UnrealOperIndex::SNOper },
+	{ 's', UnrealOperIndex::SNGeneral }
+};
+
+/**
+ * Add a user to the operator index.
+ *
+ * @param uptr User pointer
+ * @param snomask Initially subscribed categories
+ */
+void UnrealOperIndex::add(UnrealUser* uptr, uint8_t snomask)
+{
+	if (!contains(uptr))
+	{
+		opers_ << uptr;
+		masks_.add(uptr, 0);
+	}
+
+	setMask(uptr, snomask);
+}
+
+/**
+ * Returns whether the user is in the operator index.
+ *
+ * @param uptr User pointer
+ * @return true when indexed, otherwise false
+ */
+bool UnrealOperIndex::contains(UnrealUser* uptr)
+{
+	return masks_.contains(uptr);
+}
+
+/**
+ * Returns the categories the operator has subscribed to.
+ *
+ * @param uptr User pointer
+ * @return Category bitmask, 0 if the user isn't an operator
+ */
+uint8_t UnrealOperIndex::mask(UnrealUser* uptr)
+{
+	Map<UnrealUser*, uint8_t>::Iterator mi = masks_.find(uptr);
+
+	return (mi == masks_.end() ? 0 : mi->second);
+}
+
+/**
+ * Returns the letters for a category bitmask.
+ *
+ * @param snomask Category bitmask
+ * @return Letters, like "cko"
+ */
+String UnrealOperIndex::maskString(uint8_t snomask)
+{
+	String result;
+
+	for (size_t i = 0; i < SnomaskCount; ++i)
+	{
+		if (snomask & snomask_letters[i].category)
+			result.append(1, snomask_letters[i].letter);
+	}
+
+	return result;
+}
+
+/**
+ * Send a server notice to all operators subscribed to the category.
+ * The notice is formatted once; only the target nick differs per
+ * recipient.
+ *
+ * @param category Notice category
+ * @param msg Notice text
+ */
+void UnrealOperIndex::notice(Snomask category, const String& msg)
+{
+	List<UnrealUser*>& subscribers = subscribers_[slot(category)];
+
+	if (subscribers.empty())
+		return;
+
+	String prefix = ":" + unreal->me->name() + " " + CMD_NOTICE + " ";
+	String suffix = " :*** Notice -- " + msg;
+
+	foreach (List<UnrealUser*>::Iterator, ui, subscribers)
+	{
+		UnrealUser* uptr = *ui;
+
+		if (uptr->socket())
+			uptr->send(prefix + uptr->nick() + suffix);
+	}
+}
+
+/**
+ * Returns the list of local operators.
+ *
+ * @return User list
+ */
+const List<UnrealUser*>& UnrealOperIndex::opers()
+{
+	return opers_;
+}
+
+/**
+ * Apply a snomask change string like "+ck-f" to a category bitmask.
+ * Letters without a leading sign are added. Unknown letters are ignored.
+ *
+ * @param changes Change string
+ * @param snomask Current category bitmask
+ * @return Resulting category bitmask
+ */
+uint8_t UnrealOperIndex::parseMask(const String& changes, uint8_t snomask)
+{
+	bool adding = true;
+
+	for (size_t i = 0; i < changes.length(); ++i)
+	{
+		char ch = changes.at(i);
+
+		if (ch == '+' || ch == '-')
+		{
+			adding = (ch == '+');
+			continue;
+		}
+
+		for (size_t j = 0; j < SnomaskCount; ++j)
+		{
+			if (snomask_letters[j].letter != ch)
+				continue;
+			else if (adding)
+				snomask |= snomask_letters[j].category;
+			else
+				snomask &= ~snomask_letters[j].category;
+		}
+	}
+
+	return snomask;
+}
+
+/**
+ * Remove a user from the operator index and all subscriber lists.
+ *
+ * @param uptr User pointer
+ */
+void UnrealOperIndex::remove(UnrealUser* uptr)
+{
+	if (!contains(uptr))
+		return;
+
+	setMask(uptr, 0);
+	masks_.remove(uptr);
+	opers_.remove(uptr);
+}
+
+/**
+ * Update the categories an operator has subscribed to.
+ *
+ * @param uptr User pointer; must be in the index
+ * @param snomask New category bitmask
+ */
+void UnrealOperIndex::setMask(UnrealUser* uptr, uint8_t snomask)
+{
+	Map<UnrealUser*, uint8_t>::Iterator mi = masks_.find(uptr);
+
+	if (mi == masks_.end())
+		return;
+
+	uint8_t old = mi->second;
+
+	for (size_t i = 0; i < SnomaskCount; ++i)
+	{
+		uint8_t category = static_cast<uint8_t>(1 << i);
+
+		if ((snomask & category) && !(old & category))
+			subscribers_[i] << uptr;
+		else if (!(snomask & category) && (old & category))
+			subscribers_[i].remove(uptr);
+	}
+
+	mi->second = snomask;
+}
+
+/**
+ * Returns the subscriber list slot of a category.
+ *
+ * @param category Single category flag
+ * @return Slot index
+ */
+size_t UnrealOperIndex::slot(uint8_t category)
+{
+	size_t i = 0;
+
+	while (i < SnomaskCount - 1 && !(category & (1 << i)))
+		++i;
+
+	return i;
+}
@@ -0,0 +1,540 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         prototrace.cpp
+ * Description  Protocol trace ring
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <memstat.hpp>
+#include <prototrace.hpp>
+#include <socket.hpp>
+#include <time.hpp>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+/** trace dumped on crashes */
+static UnrealProtocolTrace* crash_trace = 0;
+
+/** set by SIGUSR2, handled in poll() */
+static volatile sig_atomic_t dump_requested = 0;
+
+/**
+ * Append a decimal number to a buffer; usable from signal handlers.
+ *
+ * @param p Write position, advanced past the number
+ * @param value Number
+ * @param width Minimum number of digits, padded with zeros
+ */
+static void appendNumber(char*& p, uint64_t value, int width = 1)
+{
+	char digits[24];
+	int n = 0;
+
+	do
+	{
+		digits[n++] = static_cast<char>('0' + value % 10);
+		value /= 10;
+	}
+	while (value > 0);
+
+	while (n < width)
+		digits[n++] = '0';
+
+	while (n > 0)
+		*p++ = digits[--n];
+}
+
+/**
+ * Write a buffer completely; usable from signal handlers.
+ *
+ * @param out File descriptor
+ * @param data Data
+ * @param len Data length
+ * @return true on success
+ */
+static bool writeAll(int out, const char* data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t res = ::write(out, data, len);
+
+		if (res < 0)
+			return false;
+
+		data += res;
+		len -= static_cast<size_t>(res);
+	}
+
+	return true;
+}
+
+/**
+ * UnrealProtocolTrace constructor.
+ */
+UnrealProtocolTrace::UnrealProtocolTrace()
+	: buffer_(0), size_(0), head_(0), tail_(0), records_(0), enabled_(false),
+	  watch_all_(true), wall_offset_(0)
+{
+	crash_file_[0] = '\0';
+}
+
+/**
+ * UnrealProtocolTrace destructor.
+ */
+UnrealProtocolTrace::~UnrealProtocolTrace()
+{
+	if (crash_trace == this)
+		crash_trace = 0;
+
+	if (buffer_)
+		UnrealMemoryStats::release(UnrealMemoryStats::Trace, size_);
+
+	delete[] buffer_;
+}
+
+/**
+ * Copy a record into the ring and drop the oldest records to make room.
+ *
+ * @param sptr Socket
+ * @param dir Direction
+ * @param line Line without CRLF
+ */
+void UnrealProtocolTrace::append(UnrealSocket* sptr, Direction dir,
+	const String& line)
+{
+	if (!watch_all_ && !watched_.contains(sptr))
+		return;
+
+	const char* text = line.data();
+	size_t len = line.length();
+
+	/* keep passwords out of the trace */
+	if (dir == In && len > 4 && text[4] == ' '
+			&& (strncasecmp(text, "OPER", 4) == 0
+				|| strncasecmp(text, "PASS", 4) == 0))
+		len = 4;
+
+	if (len > 0xffff)
+		len = 0xffff;
+
+	size_t total = sizeof(Header) + len;
+
+	if (total > size_)
+		return;
+
+	while (head_ + total - tail_ > size_)
+	{
+		Header old;
+
+		copyOut(tail_, &old, sizeof(old));
+		tail_ += sizeof(old) + old.length;
+		records_--;
+	}
+
+	Header hdr;
+
+	hdr.time = UnrealTime::monotonic();
+	hdr.connection = sptr->id();
+	hdr.fd = static_cast<int32_t>(sptr->native());
+	hdr.length = static_cast<uint16_t>(len);
+	hdr.direction = static_cast<uint8_t>(dir);
+	hdr.reserved = 0;
+
+	copyIn(head_, &hdr, sizeof(hdr));
+	copyIn(head_ + sizeof(hdr), text, len);
+
+	head_ += total;
+	records_++;
+}
+
+/**
+ * Returns the number of bytes in use.
+ *
+ * @return Bytes
+ */
+size_t UnrealProtocolTrace::bytes()
+{
+	return static_cast<size_t>(head_ - tail_);
+}
+
+/**
+ * Remove all records.
+ */
+void UnrealProtocolTrace::clear()
+{
+	head_ = tail_ = 0;
+	records_ = 0;
+}
+
+/**
+ * Copy data into the ring at a stream position, wrapping around the end.
+ *
+ * @param pos Stream position
+ * @param src Data
+ * @param len Data length
+ */
+void UnrealProtocolTrace::copyIn(uint64_t pos, const void* src, size_t len)
+{
+	size_t offset = static_cast<size_t>(pos % size_);
+	size_t first = len < size_ - offset ? len : size_ - offset;
+
+	std::memcpy(buffer_ + offset, src, first);
+	std::memcpy(buffer_, static_cast<const char*>(src) + first, len - first);
+}
+
+/**
+ * Copy data out of the ring at a stream position, wrapping around the end.
+ *
+ * @param pos Stream position
+ * @param dst Destination
+ * @param len Data length
+ */
+void UnrealProtocolTrace::copyOut(uint64_t pos, void* dst, size_t len)
+{
+	size_t offset = static_cast<size_t>(pos % size_);
+	size_t first = len < size_ - offset ? len : size_ - offset;
+
+	std::memcpy(dst, buffer_ + offset, first);
+	std::memcpy(static_cast<char*>(dst) + first, buffer_, len - first);
+}
+
+/**
+ * Write the trace into a file, oldest line first. Each line reads
+ * "<unix time>.<microseconds> fd <fd> id <connection> >> <text>" for
+ * received lines and "... << <text>" for sent ones.
+ *
+ * @param file File name
+ * @param connection Only write lines of this connection; 0 for all
+ * @param count Set to the number of lines written
+ * @return true on success
+ */
+bool UnrealProtocolTrace::dump(const String& file, uint64_t connection,
+	size_t& count)
+{
+	count = 0;
+
+	int out = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	if (out < 0)
+		return false;
+
+	bool result = dumpTo(out, connection, count);
+
+	::close(out);
+
+	return result;
+}
+
+/**
+ * Write the records to a file descriptor. This only uses functions which
+ * are safe in signal handlers.
+ *
+ * @param out Output file descriptor
+ * @param connection Only write lines of this connection; 0 for all
+ * @param count Incremented per line written
+ * @return true on success
+ */
+bool UnrealProtocolTrace::dumpTo(int out, uint64_t connection, size_t& count)
+{
+	if (!buffer_)
+		return true;
+
+	for (uint64_t pos = tail_; pos < head_; )
+	{
+		Header hdr;
+
+		copyOut(pos, &hdr, sizeof(hdr));
+
+		uint64_t text = pos + sizeof(hdr);
+		pos = text + hdr.length;
+
+		if (connection != 0 && hdr.connection != connection)
+			continue;
+
+		char prefix[96];
+		char* p = prefix;
+		uint64_t us = static_cast<uint64_t>(
+			static_cast<int64_t>(hdr.time) + wall_offset_);
+
+		appendNumber(p, us / 1000000);
+		*p++ = '.';
+		appendNumber(p, us % 1000000, 6);
+		std::memcpy(p, " fd ", 4);
+		p += 4;
+
+		if (hdr.fd < 0)
+			*p++ = '-';
+		else
+			appendNumber(p, static_cast<uint64_t>(hdr.fd));
+
+		std::memcpy(p, " id ", 4);
+		p += 4;
+		appendNumber(p, hdr.connection);
+		*p++ = ' ';
+		*p++ = static_cast<char>(hdr.direction);
+		*p++ = static_cast<char>(hdr.direction);
+		*p++ = ' ';
+
+		size_t offset = static_cast<size_t>(text % size_);
+		size_t first = hdr.length < size_ - offset
+			? hdr.length : size_ - offset;
+
+		if (!writeAll(out, prefix, p - prefix)
+				|| !writeAll(out, buffer_ + offset, first)
+				|| !writeAll(out, buffer_, hdr.length - first)
+				|| !writeAll(out, "\n", 1))
+			return false;
+
+		count++;
+	}
+
+	return true;
+}
+
+/**
+ * Returns whether lines are recorded.
+ *
+ * @return true if enabled
+ */
+bool UnrealProtocolTrace::enabled()
+{
+	return enabled_;
+}
+
+/**
+ * Returns the dump file name.
+ *
+ * @return File name
+ */
+const String& UnrealProtocolTrace::fileName()
+{
+	return file_;
+}
+
+/**
+ * Crash signal handler; dumps the trace and re-raises the signal, which
+ * is handled by the default action then.
+ *
+ * @param sig Signal number
+ */
+void UnrealProtocolTrace::handleCrash(int sig)
+{
+	if (crash_trace && crash_trace->crash_file_[0])
+	{
+		int out = ::open(crash_trace->crash_file_,
+			O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+		if (out >= 0)
+		{
+			size_t count = 0;
+
+			crash_trace->dumpTo(out, 0, count);
+			::close(out);
+		}
+	}
+
+	raise(sig);
+}
+
+/**
+ * SIGUSR2 handler; the dump itself is done by poll().
+ *
+ * @param sig Signal number
+ */
+void UnrealProtocolTrace::handleDumpSignal(int sig)
+{
+	dump_requested = 1;
+}
+
+/**
+ * Allocate the ring of Trace::Size bytes and install the signal handlers.
+ * A size of 0 disables tracing.
+ */
+void UnrealProtocolTrace::init()
+{
+	if (buffer_)
+		UnrealMemoryStats::release(UnrealMemoryStats::Trace, size_);
+
+	size_ = unreal->config.get("Trace::Size", "1048576").toSize();
+	file_ = unreal->config.get("Trace::File", "trace.log");
+
+	delete[] buffer_;
+	buffer_ = size_ > 0 ? new char[size_] : 0;
+	enabled_ = buffer_ != 0;
+
+	if (buffer_)
+		UnrealMemoryStats::allocate(UnrealMemoryStats::Trace, size_);
+	clear();
+
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+
+	wall_offset_ = static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec
+		- static_cast<int64_t>(UnrealTime::monotonic());
+
+	String crash_file = file_ + ".crash";
+	std::strncpy(crash_file_, crash_file.c_str(), sizeof(crash_file_) - 1);
+	crash_file_[sizeof(crash_file_) - 1] = '\0';
+
+	if (!buffer_)
+		return;
+
+	crash_trace = this;
+
+	struct sigaction sa;
+	static const int crash_signals[] = {
+		SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV
+	};
+
+	std::memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sa.sa_handler = &UnrealProtocolTrace::handleDumpSignal;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, 0);
+
+	sa.sa_handler = &UnrealProtocolTrace::handleCrash;
+	sa.sa_flags = SA_RESETHAND;
+
+	for (size_t i = 0; i < sizeof(crash_signals) / sizeof(int); ++i)
+		sigaction(crash_signals[i], &sa, 0);
+}
+
+/**
+ * Returns whether a connection is recorded.
+ *
+ * @param sptr Socket
+ * @return true if all connections or this one are recorded
+ */
+bool UnrealProtocolTrace::isWatched(UnrealSocket* sptr)
+{
+	return watch_all_ || watched_.contains(sptr);
+}
+
+/**
+ * Handle a dump requested by signal; called by the main loop timer.
+ */
+void UnrealProtocolTrace::poll()
+{
+	if (!dump_requested)
+		return;
+
+	dump_requested = 0;
+
+	size_t count;
+
+	if (dump(file_, 0, count))
+		unreal->log.write(UnrealLog::Normal, "Protocol trace: wrote %d lines "
+			"to %s", static_cast<int>(count), file_.c_str());
+	else
+		unreal->log.write(UnrealLog::Error, "Protocol trace: couldn't "
+			"write %s: %s", file_.c_str(), std::strerror(errno));
+}
+
+/**
+ * Returns the number of records in the ring.
+ *
+ * @return Records
+ */
+size_t UnrealProtocolTrace::records()
+{
+	return records_;
+}
+
+/**
+ * Enable or disable recording. Recording can't be enabled if Trace::Size
+ * is 0.
+ *
+ * @param enable Whether to record lines
+ */
+void UnrealProtocolTrace::setEnabled(bool enable)
+{
+	enabled_ = enable && buffer_ != 0;
+}
+
+/**
+ * Returns the ring size in bytes.
+ *
+ * @return Size
+ */
+size_t UnrealProtocolTrace::size()
+{
+	return size_;
+}
+
+/**
+ * Stop recording a connection. If no connection is left, nothing is
+ * recorded until watchAll() or watch() is called.
+ *
+ * @param sptr Socket
+ */
+void UnrealProtocolTrace::unwatch(UnrealSocket* sptr)
+{
+	watched_.remove(sptr);
+}
+
+/**
+ * Limit recording to a connection; further connections may be added.
+ *
+ * @param sptr Socket
+ */
+void UnrealProtocolTrace::watch(UnrealSocket* sptr)
+{
+	watch_all_ = false;
+
+	if (!watched_.contains(sptr))
+		watched_ << sptr;
+}
+
+/**
+ * Record all connections again.
+ */
+void UnrealProtocolTrace::watchAll()
+{
+	watch_all_ = true;
+	watched_.clear();
+}
+
+/**
+ * Returns the watched connections; only meaningful unless watchingAll().
+ *
+ * @return Watched sockets
+ */
+const List<UnrealSocket*>& UnrealProtocolTrace::watched()
+{
+	return watched_;
+}
+
+/**
+ * Returns whether all connections are recorded.
+ *
+ * @return true if no watch limits the recording
+ */
+bool UnrealProtocolTrace::watchingAll()
+{
+	return watch_all_;
+}
@@ -23,6 +23,7 @@
  * GNU General Public License for more details.
  ******************************************************************/
 
+#include <memstat.hpp>
 #include <recvq.hpp>
 #include <stringlist.hpp>
 
@@ -31,8 +32,27 @@
  */
 UnrealRecvQueue::UnrealRecvQueue()
 	: hard_limit_(static_cast<uint16_t>(RQL_HARD)),
-	  soft_limit_(static_cast<uint16_t>(RQL_SOFT))
-{ }
+	  soft_limit_(static_cast<uint16_t>(RQL_SOFT)), memory_(0)
+{
+	UnrealMemoryStats::allocate(UnrealMemoryStats::RecvQ, 0);
+}
+
+/**
+ * Receive Queue destructor.
+ */
+UnrealRecvQueue::~UnrealRecvQueue()
+{
+	UnrealMemoryStats::release(UnrealMemoryStats::RecvQ, memory_);
+}
+
+/**
+ * Update the memory accounted for the queue contents.
+ */
+void UnrealRecvQueue::accountMemory()
+{
+	UnrealMemoryStats::resize(UnrealMemoryStats::RecvQ, memory_,
+		UnrealMemoryStats::bytes(queue_str_));
+}
 
 /**
  * Add a line to the queue.
@@ -47,6 +67,7 @@ void UnrealRecvQueue::add(const String& str)
 		queue_str_.append(1, '\n');
 
 	queue_str_.append(str);
+	accountMemory();
 }
 
 /**
@@ -62,6 +83,7 @@ String UnrealRecvQueue::getline()
 	{
 		String result = queue_str_;
 		queue_str_.clear();
+		accountMemory();
 		
 		return result;
 	}
@@ -71,6 +93,7 @@ String UnrealRecvQueue::getline()
 		String result = sq.takeFirst();
 
 		queue_str_ = sq.join("\n");
+		accountMemory();
 
 		return result;
 	}
@@ -0,0 +1,137 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         regtrace.cpp
+ * Description  Registration latency tracing
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <regtrace.hpp>
+#include <time.hpp>
+#include <cstring>
+
+/** phase names, as shown in reports */
+static const char* phase_names[UnrealRegistrationTrace::PhaseCount] = {
+	"accept",
+	"first-byte",
+	"dns",
+	"ident",
+	"nick",
+	"user",
+	"ping",
+	"pong",
+	"welcome"
+};
+
+/**
+ * UnrealRegistrationTrace constructor.
+ */
+UnrealRegistrationTrace::UnrealRegistrationTrace()
+{
+	std::memset(marks_, 0, sizeof(marks_));
+}
+
+/**
+ * Returns the time from accept until a phase was reached.
+ *
+ * @param phase Phase
+ * @return Microseconds; zero if the phase wasn't reached
+ */
+uint64_t UnrealRegistrationTrace::elapsed(Phase phase) const
+{
+	if (!reached(phase) || !reached(Accept) || marks_[phase] < marks_[Accept])
+		return 0;
+
+	return marks_[phase] - marks_[Accept];
+}
+
+/**
+ * Record that a phase has been reached. Only the first time counts.
+ *
+ * @param phase Phase
+ */
+void UnrealRegistrationTrace::mark(Phase phase)
+{
+	if (marks_[phase] == 0)
+		marks_[phase] = UnrealTime::monotonic();
+}
+
+/**
+ * Returns the name of a phase.
+ *
+ * @param phase Phase
+ * @return Phase name
+ */
+const char* UnrealRegistrationTrace::phaseName(Phase phase)
+{
+	return (phase < PhaseCount ? phase_names[phase] : "unknown");
+}
+
+/**
+ * Returns whether a phase has been reached.
+ *
+ * @param phase Phase
+ * @return True if reached, otherwise false
+ */
+bool UnrealRegistrationTrace::reached(Phase phase) const
+{
+	return (marks_[phase] != 0);
+}
+
+/**
+ * Add the phases reached by a finished registration.
+ *
+ * @param trace Registration trace
+ */
+void UnrealRegistrationStats::add(const UnrealRegistrationTrace& trace)
+{
+	for (int i = UnrealRegistrationTrace::FirstByte;
+			i < UnrealRegistrationTrace::PhaseCount; ++i)
+	{
+		UnrealRegistrationTrace::Phase ph =
+			static_cast<UnrealRegistrationTrace::Phase>(i);
+
+		if (trace.reached(ph))
+			phases_[i].add(trace.elapsed(ph));
+	}
+}
+
+/**
+ * Add the samples of another set of histograms.
+ *
+ * @param other Histograms to merge
+ */
+void UnrealRegistrationStats::merge(const UnrealRegistrationStats& other)
+{
+	for (int i = 0; i < UnrealRegistrationTrace::PhaseCount; ++i)
+		phases_[i].merge(other.phases_[i]);
+}
+
+/**
+ * Returns the histogram for a phase.
+ *
+ * @param phase Phase
+ * @return Histogram
+ */
+const UnrealHistogram& UnrealRegistrationStats::phase(
+	UnrealRegistrationTrace::Phase phase) const
+{
+	return phases_[phase];
+}
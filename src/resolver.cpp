@@ -25,47 +25,1023 @@
 
 #include "base.hpp"
 #include "resolver.hpp"
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <arpa/nameser.h>
+#include <ares_dns.h>
 #include <boost/bind.hpp>
 
+/**
+ * UnrealResolverEntry constructor.
+ *
+ * @param ep Address
+ * @param hostname Hostname
+ */
+UnrealResolverEntry::UnrealResolverEntry(const tcp::endpoint& ep,
+	const String& hostname)
+	: endpoint_(ep), hostname_(hostname)
+{ }
+
+/**
+ * Returns the address of the entry.
+ *
+ * @return Endpoint
+ */
+const tcp::endpoint& UnrealResolverEntry::endpoint() const
+{
+	return endpoint_;
+}
+
+/**
+ * Returns the hostname of the entry.
+ *
+ * @return Hostname
+ */
+const String& UnrealResolverEntry::host_name() const
+{
+	return hostname_;
+}
+
+/**
+ * Converts the entry into its address.
+ */
+UnrealResolverEntry::operator tcp::endpoint() const
+{
+	return endpoint_;
+}
+
+/**
+ * UnrealResolverIterator constructor; creates an end iterator.
+ */
+UnrealResolverIterator::UnrealResolverIterator()
+	: pos_(0)
+{ }
+
+/**
+ * UnrealResolverIterator constructor.
+ *
+ * @param r Result to iterate over
+ */
+UnrealResolverIterator::UnrealResolverIterator(
+	const boost::shared_ptr<UnrealResolverResult>& r)
+	: result_(r), pos_(0)
+{
+	if (result_ && result_->endpoints.empty())
+		result_.reset();
+}
+
+/**
+ * Returns the current entry.
+ *
+ * @return Resolver entry
+ */
+UnrealResolverEntry UnrealResolverIterator::operator*() const
+{
+	return UnrealResolverEntry(result_->endpoints.at(pos_),
+		result_->hostname);
+}
+
+/**
+ * Advance to the next entry (prefix).
+ *
+ * @return Reference to this iterator
+ */
+UnrealResolverIterator& UnrealResolverIterator::operator++()
+{
+	if (result_ && ++pos_ >= result_->endpoints.size())
+	{
+		result_.reset();
+		pos_ = 0;
+	}
+
+	return *this;
+}
+
+/**
+ * Advance to the next entry (postfix).
+ *
+ * @return Iterator before advancing
+ */
+UnrealResolverIterator UnrealResolverIterator::operator++(int)
+{
+	UnrealResolverIterator prev = *this;
+	++(*this);
+
+	return prev;
+}
+
+/**
+ * Compare two iterators.
+ *
+ * @param other Iterator to compare with
+ * @return true when both point to the same entry
+ */
+bool UnrealResolverIterator::operator==(
+	const UnrealResolverIterator& other) const
+{
+	return result_ == other.result_ && pos_ == other.pos_;
+}
+
+/**
+ * Compare two iterators.
+ *
+ * @param other Iterator to compare with
+ * @return true when the iterators point to different entries
+ */
+bool UnrealResolverIterator::operator!=(
+	const UnrealResolverIterator& other) const
+{
+	return !(*this == other);
+}
+
+/**
+ * Watch constructor. c-ares keeps ownership of its socket, so the
+ * reactor gets a duplicate which can be closed at any time.
+ *
+ * @param reactor Event reactor
+ * @param sock c-ares socket
+ */
+UnrealResolverChannel::Watch::Watch(UnrealReactor& reactor,
+	ares_socket_t sock)
+	: fd(sock), descriptor(reactor), want_read(false), want_write(false),
+	  reading(false), writing(false)
+{
+	descriptor.assign(::dup(sock));
+}
+
+/**
+ * UnrealResolverChannel constructor.
+ * Options are read from the DNS configuration block.
+ */
+UnrealResolverChannel::UnrealResolverChannel()
+	: initialized_(false), active_(0)
+{
+	static bool library_initialized = false;
+	struct ares_options opts;
+	int status;
+
+	if (!library_initialized)
+	{
+		ares_library_init(ARES_LIB_INIT_ALL);
+		library_initialized = true;
+	}
+
+	memset(&counters_, 0, sizeof(counters_));
+
+	max_active_ = unreal->config.get("DNS::MaxQueries", "512").toSize();
+	cache_max_ = unreal->config.get("DNS::CacheSize", "4096").toSize();
+	max_ttl_ = unreal->config.get("DNS::CacheMaxTTL", "3600").toUInt();
+	negative_ttl_ = unreal->config.get("DNS::NegativeTTL", "60").toUInt();
+
+	if (max_active_ == 0)
+		max_active_ = 1;
+
+	memset(&opts, 0, sizeof(opts));
+	opts.sock_state_cb = &UnrealResolverChannel::handleSocketState;
+	opts.sock_state_cb_data = this;
+	opts.timeout = unreal->config.get("DNS::Timeout", "3000").toInt();
+	opts.tries = unreal->config.get("DNS::Tries", "2").toInt();
+
+	status = ares_init_options(&channel_, &opts,
+		ARES_OPT_SOCK_STATE_CB | ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES);
+
+	if (status != ARES_SUCCESS)
+	{
+		unreal->log.write(UnrealLog::Error, "UnrealResolverChannel: "
+			"Initialization failed: %s", ares_strerror(status));
+		return;
+	}
+
+	initialized_ = true;
+
+	/* nameservers as "addr[:port],..."; the system ones by default */
+	String servers = unreal->config.get("DNS::Nameservers", "");
+
+	if (!servers.empty()
+			&& (status = ares_set_servers_ports_csv(channel_, servers.c_str()))
+				!= ARES_SUCCESS)
+	{
+		unreal->log.write(UnrealLog::Error, "UnrealResolverChannel: "
+			"Invalid DNS::Nameservers \"%s\": %s", servers.c_str(),
+			ares_strerror(status));
+	}
+}
+
+/**
+ * UnrealResolverChannel destructor.
+ * Lookups still in flight are finished with an error.
+ */
+UnrealResolverChannel::~UnrealResolverChannel()
+{
+	timer_.cancel();
+
+	/* lookups that never started */
+	foreach (List<Lookup*>::Iterator, li, waiting_)
+	{
+		inflight_.remove((*li)->key);
+
+		foreach (List<Request*>::Iterator, ri, (*li)->waiters)
+			delete *ri;
+
+		delete *li;
+	}
+
+	waiting_.clear();
+
+	if (initialized_)
+		ares_destroy(channel_);
+
+	watches_.clear();
+}
+
+/**
+ * Returns the lowest TTL of the answer records in a DNS reply.
+ *
+ * @param abuf Reply
+ * @param alen Reply length
+ * @return TTL in seconds; 0 if there is no answer record
+ */
+uint32_t UnrealResolverChannel::answerTTL(const unsigned char* abuf,
+	int alen)
+{
+	const unsigned char* p = abuf + NS_HFIXEDSZ;
+	const unsigned char* end = abuf + alen;
+	uint32_t ttl = 0;
+	bool found = false;
+
+	if (alen < NS_HFIXEDSZ)
+		return 0;
+
+	int qdcount = DNS_HEADER_QDCOUNT(abuf);
+	int ancount = DNS_HEADER_ANCOUNT(abuf);
+
+	for (int i = 0; i < qdcount + ancount; ++i)
+	{
+		char* name;
+		long len;
+
+		if (ares_expand_name(p, abuf, alen, &name, &len) != ARES_SUCCESS)
+			break;
+
+		ares_free_string(name);
+		p += len;
+
+		if (i < qdcount)
+		{
+			p += NS_QFIXEDSZ;
+			continue;
+		}
+		else if (p + NS_RRFIXEDSZ > end)
+			break;
+
+		uint32_t rttl = DNS_RR_TTL(p);
+
+		if (!found || rttl < ttl)
+			ttl = rttl;
+
+		found = true;
+		p += NS_RRFIXEDSZ + DNS_RR_LEN(p);
+	}
+
+	return ttl;
+}
+
+/**
+ * Returns the number of cached results.
+ *
+ * @return Entry count
+ */
+size_t UnrealResolverChannel::cacheSize()
+{
+	return cache_index_.size();
+}
+
+/**
+ * Cancel a request. The owner won't be notified about the result.
+ * A lookup that has already been sent is completed anyway, so its result
+ * ends up in the cache.
+ *
+ * @param req Request
+ */
+void UnrealResolverChannel::cancel(Request* req)
+{
+	Lookup* lookup = req->lookup;
+
+	if (!lookup)
+	{
+		/* the result is on its way; it's deleted on delivery */
+		req->owner = 0;
+		return;
+	}
+
+	lookup->waiters.remove(req);
+	delete req;
+
+	if (lookup->waiters.empty() && !lookup->started)
+	{
+		waiting_.remove(lookup);
+		inflight_.remove(lookup->key);
+		delete lookup;
+	}
+}
+
+/**
+ * A lookup has completed; cache the result and pass it on to all
+ * waiting requests.
+ *
+ * @param lookup Lookup
+ * @param ec Error code
+ * @param result Hostname and addresses
+ * @param ttl TTL of the records in seconds
+ */
+void UnrealResolverChannel::complete(Lookup* lookup, const ErrorCode& ec,
+	const UnrealResolverResult& result, uint32_t ttl)
+{
+	inflight_.remove(lookup->key);
+	store(lookup->key, ec, result, ttl);
+
+	if (lookup->started)
+		latency_.add(UnrealTime::monotonic() - lookup->started_at);
+
+	if (ec)
+		counters_.failures++;
+
+	foreach (List<Request*>::Iterator, ri, lookup->waiters)
+		post(*ri, ec, result);
+
+	delete lookup;
+}
+
+/**
+ * Returns the cache and query counters.
+ *
+ * @return Counters
+ */
+const UnrealResolverChannel::Counters& UnrealResolverChannel::counters()
+{
+	return counters_;
+}
+
+/**
+ * Hand a result to the owner of a request.
+ *
+ * @param req Request
+ * @param ec Error code
+ * @param result Result iterator
+ */
+void UnrealResolverChannel::deliver(Request* req, const ErrorCode& ec,
+	UnrealResolverIterator result)
+{
+	UnrealResolver* owner = req->owner;
+
+	delete req;
+
+	if (owner)
+	{
+		owner->request_ = 0;
+		owner->onResolve(ec, result);
+	}
+}
+
+/**
+ * Map a c-ares status code to an error code.
+ *
+ * @param status c-ares status
+ * @return Error code
+ */
+UnrealResolverChannel::ErrorCode UnrealResolverChannel::errorFromStatus(
+	int status)
+{
+	switch (status)
+	{
+		case ARES_SUCCESS:
+			return ErrorCode();
+
+		case ARES_ENODATA:
+		case ARES_ENOTFOUND:
+		case ARES_EBADNAME:
+			return boost::asio::error::host_not_found;
+
+		case ARES_ETIMEOUT:
+			return boost::asio::error::timed_out;
+
+		case ARES_ECANCELLED:
+		case ARES_EDESTRUCTION:
+			return boost::asio::error::operation_aborted;
+
+		default:
+			return boost::asio::error::host_not_found_try_again;
+	}
+}
+
+/**
+ * A lookup handed to c-ares has completed; start the next waiting one.
+ */
+void UnrealResolverChannel::finish()
+{
+	if (active_ > 0)
+		active_--;
+
+	while (active_ < max_active_ && !waiting_.empty())
+	{
+		Lookup* lookup = waiting_.front();
+		waiting_.removeFirst();
+
+		start(lookup);
+	}
+}
+
+/**
+ * c-ares callback for DNS replies.
+ *
+ * @param arg Lookup
+ * @param status c-ares status
+ * @param timeouts Number of timeouts
+ * @param abuf Reply
+ * @param alen Reply length
+ */
+void UnrealResolverChannel::handleAnswer(void* arg, int status, int timeouts,
+	unsigned char* abuf, int alen)
+{
+	Lookup* lookup = static_cast<Lookup*>(arg);
+	UnrealResolverChannel& chan = UnrealResolver::channel();
+	UnrealResolverResult result;
+	struct hostent* host = 0;
+
+	if (status == ARES_SUCCESS && lookup->type == Request::Reverse)
+	{
+		if (lookup->addr.is_v4())
+		{
+			address_v4::bytes_type bytes = lookup->addr.to_v4().to_bytes();
+			status = ares_parse_ptr_reply(abuf, alen, bytes.data(),
+				bytes.size(), AF_INET, &host);
+		}
+		else
+		{
+			address_v6::bytes_type bytes = lookup->addr.to_v6().to_bytes();
+			status = ares_parse_ptr_reply(abuf, alen, bytes.data(),
+				bytes.size(), AF_INET6, &host);
+		}
+
+		if (status == ARES_SUCCESS)
+			result.hostname = host->h_name;
+	}
+	else if (status == ARES_SUCCESS)
+	{
+		if (lookup->current_family == AF_INET)
+			status = ares_parse_a_reply(abuf, alen, &host, NULL, NULL);
+		else
+			status = ares_parse_aaaa_reply(abuf, alen, &host, NULL, NULL);
+
+		for (char** ap = (status == ARES_SUCCESS ? host->h_addr_list : 0);
+				ap && *ap; ++ap)
+		{
+			address addr;
+
+			if (host->h_addrtype == AF_INET)
+			{
+				address_v4::bytes_type bytes;
+				memcpy(bytes.data(), *ap, bytes.size());
+				addr = address_v4(bytes);
+			}
+			else
+			{
+				address_v6::bytes_type bytes;
+				memcpy(bytes.data(), *ap, bytes.size());
+				addr = address_v6(bytes);
+			}
+
+			result.endpoints.push_back(tcp::endpoint(addr, 0));
+		}
+
+		result.hostname = lookup->name;
+
+		if (status == ARES_SUCCESS && result.endpoints.empty())
+			status = ARES_ENODATA;
+	}
+
+	if (host)
+		ares_free_hostent(host);
+
+	/* without a specific family, IPv6 is tried if IPv4 has nothing */
+	if (lookup->type == Request::Forward && lookup->family == AF_UNSPEC
+			&& lookup->current_family == AF_INET
+			&& (status == ARES_ENOTFOUND || status == ARES_ENODATA))
+	{
+		lookup->current_family = AF_INET6;
+		chan.send(lookup);
+		return;
+	}
+
+	chan.complete(lookup, errorFromStatus(status), result,
+		status == ARES_SUCCESS ? answerTTL(abuf, alen) : 0);
+	chan.finish();
+}
+
+/**
+ * Reactor callback for readable c-ares sockets.
+ *
+ * @param watch Socket watch
+ * @param ec Error code
+ */
+void UnrealResolverChannel::handleReadable(WatchPtr watch,
+	const ErrorCode& ec)
+{
+	watch->reading = false;
+
+	/* the socket has been closed by c-ares meanwhile, and the descriptor
+	 * may have been reused for a new one */
+	if (ec == boost::asio::error::operation_aborted || !isCurrent(watch))
+		return;
+
+	unreal->monitor.tag("dns");
+	ares_process_fd(channel_, watch->fd, ARES_SOCKET_BAD);
+
+	if (isCurrent(watch))
+		startWait(watch);
+
+	scheduleTimeout();
+}
+
+/**
+ * c-ares callback for socket state changes.
+ *
+ * @param data Channel
+ * @param fd c-ares socket
+ * @param readable Whether to wait for the socket to become readable
+ * @param writable Whether to wait for the socket to become writable
+ */
+void UnrealResolverChannel::handleSocketState(void* data, ares_socket_t fd,
+	int readable, int writable)
+{
+	UnrealResolverChannel* chan = static_cast<UnrealResolverChannel*>(data);
+	Map<ares_socket_t, WatchPtr>::Iterator wi = chan->watches_.find(fd);
+
+	/* socket is about to be closed */
+	if (!readable && !writable)
+	{
+		if (wi != chan->watches_.end())
+		{
+			ErrorCode ec;
+			wi->second->descriptor.close(ec);
+			chan->watches_.erase(wi);
+		}
+
+		return;
+	}
+
+	WatchPtr watch;
+
+	if (wi != chan->watches_.end())
+		watch = wi->second;
+	else
+	{
+		watch.reset(new Watch(unreal->reactor(), fd));
+		chan->watches_.add(fd, watch);
+	}
+
+	watch->want_read = readable;
+	watch->want_write = writable;
+
+	chan->startWait(watch);
+}
+
+/**
+ * Timer callback; lets c-ares handle its timeouts and retries.
+ *
+ * @param ec Error code
+ */
+void UnrealResolverChannel::handleTimeout(const ErrorCode& ec)
+{
+	if (ec == boost::asio::error::operation_aborted)
+		return;
+
+	unreal->monitor.tag("dns");
+	ares_process_fd(channel_, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+	scheduleTimeout();
+}
+
+/**
+ * Reactor callback for writable c-ares sockets.
+ *
+ * @param watch Socket watch
+ * @param ec Error code
+ */
+void UnrealResolverChannel::handleWritable(WatchPtr watch,
+	const ErrorCode& ec)
+{
+	watch->writing = false;
+
+	if (ec == boost::asio::error::operation_aborted || !isCurrent(watch))
+		return;
+
+	ares_process_fd(channel_, ARES_SOCKET_BAD, watch->fd);
+
+	if (isCurrent(watch))
+		startWait(watch);
+
+	scheduleTimeout();
+}
+
+/**
+ * Returns whether a watch is still the one registered for its socket.
+ *
+ * @param watch Socket watch
+ * @return true if c-ares hasn't closed the socket meanwhile
+ */
+bool UnrealResolverChannel::isCurrent(WatchPtr watch)
+{
+	Map<ares_socket_t, WatchPtr>::Iterator wi = watches_.find(watch->fd);
+
+	return (wi != watches_.end() && wi->second == watch);
+}
+
+/**
+ * Returns the lookup latency histogram.
+ *
+ * @return Histogram
+ */
+const UnrealHistogram& UnrealResolverChannel::latency()
+{
+	return latency_;
+}
+
+/**
+ * Returns the number of lookups that haven't completed yet.
+ *
+ * @return Lookup count
+ */
+size_t UnrealResolverChannel::pending()
+{
+	return inflight_.size();
+}
+
+/**
+ * Post a result for a request to the reactor, so owners never see their
+ * result before query() returned.
+ *
+ * @param req Request
+ * @param ec Error code
+ * @param result Hostname and addresses, without port
+ */
+void UnrealResolverChannel::post(Request* req, const ErrorCode& ec,
+	const UnrealResolverResult& result)
+{
+	boost::shared_ptr<UnrealResolverResult> r(new UnrealResolverResult);
+
+	r->hostname = result.hostname;
+
+	if (req->type == Request::Reverse)
+		r->endpoints.push_back(req->endpoint);
+	else
+	{
+		for (size_t i = 0; i < result.endpoints.size(); ++i)
+			r->endpoints.push_back(tcp::endpoint(
+				result.endpoints[i].address(), req->port));
+	}
+
+	req->lookup = 0;
+
+	unreal->reactor().post(
+		boost::bind(&UnrealResolverChannel::deliver,
+			this,
+			req,
+			ec,
+			ec ? UnrealResolverIterator() : UnrealResolverIterator(r)));
+}
+
+/**
+ * Arm the timer for the next c-ares timeout, if any query is running.
+ */
+void UnrealResolverChannel::scheduleTimeout()
+{
+	struct timeval tv;
+
+	if (!initialized_ || !ares_timeout(channel_, NULL, &tv))
+	{
+		timer_.cancel();
+		return;
+	}
+
+	timer_.expires_from_now(boost::posix_time::seconds(tv.tv_sec)
+		+ boost::posix_time::microseconds(tv.tv_usec));
+	timer_.async_wait(
+		boost::bind(&UnrealResolverChannel::handleTimeout,
+			this,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * Send the DNS query for a lookup.
+ *
+ * @param lookup Lookup
+ */
+void UnrealResolverChannel::send(Lookup* lookup)
+{
+	if (lookup->type == Request::Reverse)
+	{
+		ares_query(channel_, lookup->name.c_str(), ns_c_in, ns_t_ptr,
+			&UnrealResolverChannel::handleAnswer, lookup);
+	}
+	else
+	{
+		ares_search(channel_, lookup->name.c_str(), ns_c_in,
+			lookup->current_family == AF_INET6 ? ns_t_aaaa : ns_t_a,
+			&UnrealResolverChannel::handleAnswer, lookup);
+	}
+
+	scheduleTimeout();
+}
+
+/**
+ * Hand a lookup to c-ares.
+ *
+ * @param lookup Lookup
+ */
+void UnrealResolverChannel::start(Lookup* lookup)
+{
+	lookup->started = true;
+	lookup->started_at = UnrealTime::monotonic();
+	lookup->current_family = (lookup->family == AF_UNSPEC
+		? AF_INET : lookup->family);
+	active_++;
+
+	send(lookup);
+}
+
+/**
+ * Wait for the socket states c-ares is interested in.
+ *
+ * @param watch Socket watch
+ */
+void UnrealResolverChannel::startWait(WatchPtr watch)
+{
+	if (watch->want_read && !watch->reading)
+	{
+		watch->reading = true;
+		watch->descriptor.async_read_some(boost::asio::null_buffers(),
+			boost::bind(&UnrealResolverChannel::handleReadable,
+				this,
+				watch,
+				boost::asio::placeholders::error));
+	}
+
+	if (watch->want_write && !watch->writing)
+	{
+		watch->writing = true;
+		watch->descriptor.async_write_some(boost::asio::null_buffers(),
+			boost::bind(&UnrealResolverChannel::handleWritable,
+				this,
+				watch,
+				boost::asio::placeholders::error));
+	}
+}
+
+/**
+ * Add a lookup result to the cache, evicting the least recently used
+ * entries when the cache is full.
+ *
+ * @param key Cache key
+ * @param ec Error code of the lookup
+ * @param result Hostname and addresses
+ * @param ttl TTL of the records in seconds
+ */
+void UnrealResolverChannel::store(const String& key, const ErrorCode& ec,
+	const UnrealResolverResult& result, uint32_t ttl)
+{
+	if (cache_max_ == 0 || ec == boost::asio::error::operation_aborted)
+		return;
+
+	uint32_t lifetime = (ec ? negative_ttl_ : std::min(ttl, max_ttl_));
+
+	if (lifetime == 0)
+		return;
+
+	HashMap<String, CacheList::iterator>::Iterator ci =
+		cache_index_.find(key);
+
+	if (ci != cache_index_.end())
+	{
+		cache_.erase(ci->second);
+		cache_index_.erase(ci);
+	}
+
+	CacheEntry entry;
+	entry.key = key;
+	entry.expires = UnrealTime::now().toTS() + lifetime;
+	entry.ec = ec;
+	entry.result = result;
+
+	cache_.push_front(entry);
+	cache_index_.add(key, cache_.begin());
+
+	while (cache_index_.size() > cache_max_)
+	{
+		cache_index_.remove(cache_.back().key);
+		cache_.pop_back();
+	}
+}
+
+/**
+ * Submit a request. It's answered from the cache if possible, joins an
+ * identical lookup in flight, or starts a new lookup.
+ *
+ * @param req Request; owned by the channel from now on
+ */
+void UnrealResolverChannel::submit(Request* req)
+{
+	String key, name;
+
+	req->lookup = 0;
+
+	if (!initialized_)
+	{
+		post(req, boost::asio::error::host_not_found_try_again,
+			UnrealResolverResult());
+		return;
+	}
+
+	if (req->type == Request::Reverse)
+	{
+		address addr = req->endpoint.address();
+
+		if (addr.is_v4())
+		{
+			address_v4::bytes_type b = addr.to_v4().to_bytes();
+
+			name.sprintf("%d.%d.%d.%d.in-addr.arpa", b[3], b[2], b[1], b[0]);
+		}
+		else
+		{
+			address_v6::bytes_type b = addr.to_v6().to_bytes();
+			static const char* hex = "0123456789abcdef";
+
+			for (int i = b.size() - 1; i >= 0; --i)
+			{
+				name.append(1, hex[b[i] & 0x0f]);
+				name.append(1, '.');
+				name.append(1, hex[b[i] >> 4]);
+				name.append(1, '.');
+			}
+
+			name += "ip6.arpa";
+		}
+
+		key = "PTR " + addr.to_string();
+	}
+	else
+	{
+		name = String(req->hostname).toLower();
+
+		switch (req->family)
+		{
+			case AF_INET:
+				key = "A " + name;
+				break;
+
+			case AF_INET6:
+				key = "AAAA " + name;
+				break;
+
+			default:
+				key = "ANY " + name;
+				break;
+		}
+	}
+
+	/* answer from the cache */
+	HashMap<String, CacheList::iterator>::Iterator ci =
+		cache_index_.find(key);
+
+	if (ci != cache_index_.end())
+	{
+		CacheList::iterator ei = ci->second;
+
+		if (ei->expires > UnrealTime::now().toTS())
+		{
+			counters_.hits++;
+			cache_.splice(cache_.begin(), cache_, ei);
+			post(req, ei->ec, ei->result);
+
+			return;
+		}
+
+		cache_.erase(ei);
+		cache_index_.erase(ci);
+	}
+
+	/* join a lookup in flight */
+	Lookup* lookup = inflight_.value(key);
+
+	if (lookup)
+	{
+		counters_.shared++;
+		req->lookup = lookup;
+		lookup->waiters << req;
+
+		return;
+	}
+
+	counters_.misses++;
+
+	lookup = new Lookup;
+	lookup->key = key;
+	lookup->name = name;
+	lookup->type = req->type;
+	lookup->addr = req->endpoint.address();
+	lookup->family = req->family;
+	lookup->current_family = req->family;
+	lookup->started = false;
+	lookup->waiters << req;
+
+	req->lookup = lookup;
+	inflight_.add(key, lookup);
+
+	if (active_ < max_active_)
+		start(lookup);
+	else
+		waiting_ << lookup;
+}
+
 /**
  * UnrealResolver constructor.
  */
 UnrealResolver::UnrealResolver()
-	: tcp::resolver(unreal->reactor())
+	: request_(0)
 { }
 
 /**
- * Callback for resolver result.
+ * UnrealResolver destructor.
+ * A pending query is cancelled.
  */
-void UnrealResolver::handleResult(const ErrorCode& ec, Iterator ep_iter)
+UnrealResolver::~UnrealResolver()
 {
-	onResolve(ec, ep_iter);
+	cancel();
 }
 
 /**
- * Initiate an DNS query using endpoint specification.
+ * Cancel the pending query, if any.
+ */
+void UnrealResolver::cancel()
+{
+	if (request_)
+	{
+		channel().cancel(request_);
+		request_ = 0;
+	}
+}
+
+/**
+ * Returns the DNS channel shared by all resolvers. It is created on
+ * first use.
+ *
+ * @return Channel reference
+ */
+UnrealResolverChannel& UnrealResolver::channel()
+{
+	static UnrealResolverChannel* chan = new UnrealResolverChannel();
+
+	return *chan;
+}
+
+/**
+ * Initiate a reverse DNS query for an address.
  *
  * @param ep Endpoint to lookup
  */
 void UnrealResolver::query(Endpoint& ep)
 {
-	async_resolve(ep,
-		boost::bind(&UnrealResolver::handleResult,
-			this,
-			boost::asio::placeholders::error,
-			boost::asio::placeholders::iterator));
+	cancel();
+
+	request_ = new UnrealResolverChannel::Request;
+	request_->owner = this;
+	request_->type = UnrealResolverChannel::Request::Reverse;
+	request_->endpoint = ep;
+	request_->port = ep.port();
+	request_->family = (ep.address().is_v4() ? AF_INET : AF_INET6);
+
+	channel().submit(request_);
 }
 
 /**
- * Initiate an DNS query using host/port.
+ * Initiate a DNS query for the addresses of a hostname.
+ *
+ * @param hostname Hostname to lookup
+ * @param port Port number for the resulting endpoints
+ * @param family AF_INET, AF_INET6 or AF_UNSPEC for any
  */
-void UnrealResolver::query(const String& hostname, const uint16_t& port)
+void UnrealResolver::query(const String& hostname, const uint16_t& port,
+	int family)
 {
-	Query q(hostname, String(port));
-	
-	async_resolve(q,
-		boost::bind(&UnrealResolver::handleResult,
-			this,
-			boost::asio::placeholders::error,
-			boost::asio::placeholders::iterator));
+	cancel();
+
+	request_ = new UnrealResolverChannel::Request;
+	request_->owner = this;
+	request_->type = UnrealResolverChannel::Request::Forward;
+	request_->hostname = hostname;
+	request_->port = port;
+	request_->family = family;
+
+	channel().submit(request_);
 }
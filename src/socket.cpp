@@ -24,6 +24,8 @@
  ******************************************************************/
 
 #include "base.hpp"
+#include "memstat.hpp"
+#include "probes.hpp"
 #include "resolver.hpp"
 #include "reactor.hpp"
 #include "socket.hpp"
@@ -33,18 +35,69 @@
 /** active resolver queries map */
 Map<UnrealSocket*, UnrealResolver*> resolver_queries;
 
+uint64_t UnrealSocket::last_id_ = 0;
+uint64_t UnrealSocket::queued_total_ = 0;
+
 /**
  * UnrealSocket constructor.
  */
 UnrealSocket::UnrealSocket()
-	: boost::asio::ip::tcp::socket(unreal->reactor())
-{ }
+	: boost::asio::ip::tcp::socket(unreal->reactor()), writing_(false),
+	  memory_(0), loopback_(false), loopback_open_(false),
+	  loopback_eof_(false), loopback_reading_(false), id_(++last_id_)
+{
+	UnrealMemoryStats::allocate(UnrealMemoryStats::SendQ, 0);
+}
 
 /**
  * UnrealSocket destructor.
  */
 UnrealSocket::~UnrealSocket()
-{ }
+{
+	UnrealMemoryStats::release(UnrealMemoryStats::SendQ, memory_);
+	unreal->trace.unwatch(this);
+
+	if (alive_)
+		*alive_ = false;
+}
+
+/**
+ * Update the memory accounted for the send queue buffers. Both buffers
+ * keep their capacity once they have grown.
+ */
+void UnrealSocket::accountMemory()
+{
+	UnrealMemoryStats::resize(UnrealMemoryStats::SendQ, memory_,
+		UnrealMemoryStats::bytes(sendq_)
+		+ UnrealMemoryStats::bytes(write_buffer_));
+}
+
+/**
+ * Hand a line that has been read over to the listeners and wait for the
+ * next one.
+ *
+ * @param buffer Line, with or without line terminator
+ * @param bytes_read Number of bytes read for the line
+ */
+void UnrealSocket::deliverLine(String& buffer, size_t bytes_read)
+{
+	size_t trpos = buffer.find_last_not_of("\r\n");
+
+	if (trpos != String::npos)
+		buffer.erase(trpos + 1);
+
+	UNREAL_PROBE2(line, native(), bytes_read);
+
+	if (buffer.length() > 0)
+	{
+		unreal->trace.record(this, UnrealProtocolTrace::In, buffer);
+		unreal->capture.record(this, buffer);
+		onRead(this, buffer);
+	}
+
+	/* wait for the next line */
+	waitForLine();
+}
 
 /**
  * Connect to an external host using the specified endpoint.
@@ -94,6 +147,38 @@ void UnrealSocket::destroyResolverQuery()
 	}
 }
 
+/**
+ * Close the connection. A read still waiting completes with
+ * operation_aborted.
+ *
+ * @param ec Set on errors
+ */
+void UnrealSocket::disconnect(ErrorCode& ec)
+{
+	if (!loopback_)
+	{
+		close(ec);
+		return;
+	}
+
+	if (!loopback_open_)
+		return;
+
+	loopback_open_ = false;
+	loopback_input_.clear();
+
+	if (loopback_reading_)
+	{
+		loopback_reading_ = false;
+
+		unreal->reactor().post(
+			boost::bind(&UnrealSocket::handleLoopbackRead,
+				this,
+				alive_,
+				ErrorCode(boost::asio::error::operation_aborted)));
+	}
+}
+
 /**
  * Callback for asyncronous connecting to an remote host.
  *
@@ -131,6 +216,58 @@ void UnrealSocket::handleConnect(const ErrorCode& ec,
 	}
 }
 
+/**
+ * Completion of a read on an in-memory connection.
+ *
+ * @param alive Cleared if the socket has been destroyed meanwhile
+ * @param ec Error code
+ */
+void UnrealSocket::handleLoopbackRead(boost::shared_ptr<bool> alive,
+	const ErrorCode& ec)
+{
+	if (!*alive)
+		return;
+
+	if (ec)
+	{
+		handleRead(ec, 0);
+		return;
+	}
+
+	/* closed after the read completed; nobody waits for the line */
+	if (!loopback_open_)
+		return;
+
+	size_t eol = loopback_input_.find('\n');
+
+	if (eol == String::npos)
+	{
+		/* the peer has hung up */
+		handleRead(boost::asio::error::eof, 0);
+		return;
+	}
+
+	String buffer = loopback_input_.substr(0, eol);
+	loopback_input_.erase(0, eol + 1);
+
+	traffic_.in += static_cast<uint64_t>(eol + 1);
+
+	deliverLine(buffer, eol + 1);
+}
+
+/**
+ * Completion of a write on an in-memory connection.
+ *
+ * @param alive Cleared if the socket has been destroyed meanwhile
+ * @param bytes_written Number of bytes written
+ */
+void UnrealSocket::handleLoopbackWrite(boost::shared_ptr<bool> alive,
+	size_t bytes_written)
+{
+	if (*alive)
+		handleWrite(ErrorCode(), bytes_written);
+}
+
 /**
  * Callback for asyncronous reading on the socket.
  * It's called when a new line has arrived for reading or the particular socket
@@ -158,16 +295,8 @@ void UnrealSocket::handleRead(const ErrorCode& ec, size_t bytes_read)
 		
 		std::istream is(&streambuf_);
 		std::getline(is, buffer);
-		size_t trpos = buffer.find_last_not_of("\r\n");
-		
-		if (trpos != String::npos)
-			buffer.erase(trpos + 1);
-		
-		if (buffer.length() > 0)
-			onRead(this, buffer);
 
-		/* wait for the next line */
-		waitForLine();
+		deliverLine(buffer, bytes_read);
 	}
 }
 
@@ -209,6 +338,13 @@ void UnrealSocket::handleResolveResponse(const ErrorCode& ec,
  */
 void UnrealSocket::handleWrite(const ErrorCode& ec, size_t bytes_written)
 {
+	traffic_.out += static_cast<uint64_t>(bytes_written);
+
+	writing_ = false;
+	write_buffer_.clear();
+
+	UNREAL_PROBE2(write__done, native(), bytes_written);
+
 	if (ec)
 	{
 		ErrorCode edupl = ec;
@@ -217,9 +353,216 @@ void UnrealSocket::handleWrite(const ErrorCode& ec, size_t bytes_written)
 			"error: %s", native(), edupl.message().c_str());
 
 		onDisconnected(this, ec);
+		return;
 	}
 
-	traffic_.out += static_cast<uint64_t>(bytes_written);
+	/* write out whatever has been queued in the meantime */
+	startWrite();
+
+	onWrite(this);
+}
+
+/**
+ * Let the peer of an in-memory connection hang up. Once the lines
+ * injected before have been read, the connection is closed with eof.
+ */
+void UnrealSocket::hangup()
+{
+	if (!loopback_ || !loopback_open_)
+		return;
+
+	loopback_eof_ = true;
+	pollLoopback();
+}
+
+/**
+ * Returns the connection number. Numbers start at 1 and are never reused
+ * while the server runs, unlike file descriptors.
+ *
+ * @return Connection number
+ */
+uint64_t UnrealSocket::id()
+{
+	return id_;
+}
+
+/**
+ * Feed data to an in-memory connection, as if the peer had sent it.
+ * Lines are read once they are complete.
+ *
+ * @param data Data, usually one or more CRLF terminated lines
+ */
+void UnrealSocket::inject(const String& data)
+{
+	if (!loopback_ || !loopback_open_ || loopback_eof_)
+		return;
+
+	loopback_input_.append(data);
+	pollLoopback();
+}
+
+/**
+ * Returns whether this is an in-memory connection.
+ *
+ * @return true if setLoopback() has been called
+ */
+bool UnrealSocket::isLoopback()
+{
+	return loopback_;
+}
+
+/**
+ * Returns whether the connection is still open.
+ *
+ * @return true if open
+ */
+bool UnrealSocket::isOpen()
+{
+	return loopback_ ? loopback_open_ : is_open();
+}
+
+/**
+ * Returns the local endpoint of the connection.
+ *
+ * @param ec Set on errors
+ * @return Local endpoint
+ */
+tcp::endpoint UnrealSocket::localEndpoint(ErrorCode& ec)
+{
+	if (!loopback_)
+		return local_endpoint(ec);
+
+	if (!loopback_open_)
+		ec = boost::asio::error::not_connected;
+
+	return loopback_local_;
+}
+
+/**
+ * Complete the read waiting on an in-memory connection, if a line is
+ * available or the peer has hung up.
+ */
+void UnrealSocket::pollLoopback()
+{
+	if (!loopback_reading_ || (!loopback_eof_
+			&& loopback_input_.find('\n') == String::npos))
+		return;
+
+	loopback_reading_ = false;
+
+	unreal->reactor().post(
+		boost::bind(&UnrealSocket::handleLoopbackRead,
+			this,
+			alive_,
+			ErrorCode()));
+}
+
+/**
+ * Returns the number of bytes queued for sending on all sockets so far.
+ *
+ * @return Bytes
+ */
+uint64_t UnrealSocket::queuedTotal()
+{
+	return queued_total_;
+}
+
+/**
+ * Returns the remote endpoint of the connection.
+ *
+ * @param ec Set on errors
+ * @return Remote endpoint
+ */
+tcp::endpoint UnrealSocket::remoteEndpoint(ErrorCode& ec)
+{
+	if (!loopback_)
+		return remote_endpoint(ec);
+
+	if (!loopback_open_)
+		ec = boost::asio::error::not_connected;
+
+	return loopback_remote_;
+}
+
+/**
+ * Returns the number of bytes waiting to be written to the socket.
+ *
+ * @return Send queue size in bytes
+ */
+size_t UnrealSocket::sendqSize()
+{
+	return sendq_.length() + write_buffer_.length();
+}
+
+/**
+ * Turn this socket into an in-memory connection, which is fed with
+ * inject() and whose output is collected for takeOutput(). It takes the
+ * place of a TCP connection, so tests can drive a client without the
+ * network. The descriptor is never opened.
+ *
+ * @param remote Endpoint reported for the peer
+ * @param local Endpoint reported for our side
+ */
+void UnrealSocket::setLoopback(const tcp::endpoint& remote,
+	const tcp::endpoint& local)
+{
+	loopback_ = true;
+	loopback_open_ = true;
+	loopback_remote_ = remote;
+	loopback_local_ = local;
+
+	if (!alive_)
+		alive_.reset(new bool(true));
+}
+
+/**
+ * Start writing the queued data, unless a write operation is still in
+ * progress. All data queued so far is written at once.
+ */
+void UnrealSocket::startWrite()
+{
+	if (writing_ || sendq_.empty())
+		return;
+
+	/* the buffer has to stay valid until the write has completed */
+	write_buffer_.swap(sendq_);
+	writing_ = true;
+
+	if (loopback_)
+	{
+		/* data written after closing is dropped */
+		if (loopback_open_)
+			loopback_output_.append(write_buffer_);
+
+		unreal->reactor().post(
+			boost::bind(&UnrealSocket::handleLoopbackWrite,
+				this,
+				alive_,
+				write_buffer_.length()));
+		return;
+	}
+
+	boost::asio::async_write(*this,
+		boost::asio::buffer(write_buffer_.c_str(), write_buffer_.length()),
+		boost::bind(&UnrealSocket::handleWrite,
+			this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+}
+
+/**
+ * Returns the data written to an in-memory connection since the last
+ * call.
+ *
+ * @return Data, as CRLF terminated lines
+ */
+String UnrealSocket::takeOutput()
+{
+	String output;
+
+	output.swap(loopback_output_);
+
+	return output;
 }
 
 /**
@@ -238,6 +581,13 @@ UnrealSocketTrafficType UnrealSocket::traffic()
  */
 void UnrealSocket::waitForLine()
 {
+	if (loopback_)
+	{
+		loopback_reading_ = loopback_open_;
+		pollLoopback();
+		return;
+	}
+
 	boost::asio::async_read_until(*this,
 		streambuf_,
 		'\n',
@@ -249,21 +599,21 @@ void UnrealSocket::waitForLine()
 
 /**
  * Write a line to the socket.
- * This automatically appends CRLF to the data.
+ * This automatically appends CRLF to the data. The line is added to the
+ * send queue, which is written asyncronously.
  *
  * @param data String to be written
  */
 void UnrealSocket::write(const String& data)
 {
-	String buffer = data + "\r\n";
+	sendq_.append(data);
+	sendq_.append("\r\n");
+	queued_total_ += data.length() + 2;
 
-	boost::asio::async_write(*this,
-		boost::asio::buffer(buffer.c_str(), buffer.length()),
-		boost::bind(&UnrealSocket::handleWrite,
-			this,
-			boost::asio::placeholders::error,
-			boost::asio::placeholders::bytes_transferred));
+	UNREAL_PROBE2(write, native(), data.length() + 2);
+
+	startWrite();
+	accountMemory();
 
-	/* debug message */
-	unreal->log.write(UnrealLog::Debug, "<< %s", data.c_str());
+	unreal->trace.record(this, UnrealProtocolTrace::Out, data);
 }
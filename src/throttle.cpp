@@ -0,0 +1,264 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         throttle.cpp
+ * Description  Per-host connection throttling
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <stringlist.hpp>
+#include <throttle.hpp>
+
+#include <cstring>
+
+/**
+ * Entry constructor.
+ */
+UnrealThrottle::Entry::Entry()
+	: current(0), score(0), updated(0), reported(false)
+{ }
+
+/**
+ * UnrealThrottle constructor.
+ */
+UnrealThrottle::UnrealThrottle()
+	: last_expire_(0)
+{
+	memset(&counters_, 0, sizeof(counters_));
+}
+
+/**
+ * Decide whether a new connection may proceed, and account it if so.
+ * Accepted sockets have to be released once they're closed.
+ *
+ * @param sptr Socket of the new connection
+ * @param addr Remote address
+ * @return Verdict
+ */
+UnrealThrottle::Result UnrealThrottle::admit(UnrealSocket* sptr,
+	const boost::asio::ip::address& addr)
+{
+	UnrealConfig& cfg = unreal->config;
+	uint32_t max_per_host = cfg.get("Throttle::MaxPerHost", "8").toUInt();
+	uint32_t burst = cfg.get("Throttle::Burst", "5").toUInt();
+	std::time_t now = UnrealTime::now().toTS();
+
+	String key = hostKey(addr);
+
+	expire();
+
+	/* v4-mapped addresses are checked in their IPv4 form as well */
+	if (isExempt(String(addr.to_string())) || isExempt(key))
+	{
+		counters_.accepted++;
+		return Accepted;
+	}
+
+	Entry& entry = hosts_[key];
+	Result result = Accepted;
+
+	decay(entry, now);
+
+	if (max_per_host > 0 && entry.current >= max_per_host)
+		result = TooMany;
+	else if (burst > 0 && entry.score + 1 > burst)
+		result = TooFast;
+
+	if (result != Accepted)
+	{
+		if (result == TooMany)
+			counters_.too_many++;
+		else
+			counters_.too_fast++;
+
+		/* tell the operators once per host and flood */
+		if (!entry.reported)
+		{
+			entry.reported = true;
+
+			unreal->opers.notice(UnrealOperIndex::SNFlood,
+				String::format("Connect flood from %s (%s), rejecting "
+					"connections",
+					key.c_str(),
+					result == TooMany ? "too many connections"
+						: "connecting too fast"));
+		}
+
+		if (entry.current == 0 && entry.score <= 0)
+			hosts_.erase(key);
+
+		return result;
+	}
+
+	entry.current++;
+	entry.score += 1;
+	sockets_[sptr] = key;
+	counters_.accepted++;
+
+	return Accepted;
+}
+
+/**
+ * Returns the counters.
+ *
+ * @return Counters
+ */
+const UnrealThrottle::Counters& UnrealThrottle::counters()
+{
+	return counters_;
+}
+
+/**
+ * Let the connection allowance of a host refill for the time passed.
+ *
+ * @param entry Host entry
+ * @param now Current time
+ */
+void UnrealThrottle::decay(Entry& entry, std::time_t now)
+{
+	UnrealConfig& cfg = unreal->config;
+	double burst = cfg.get("Throttle::Burst", "5").toUInt();
+	double period = cfg.get("Throttle::Period", "20").toUInt();
+
+	if (entry.updated != 0 && now > entry.updated && period > 0)
+	{
+		entry.score -= (now - entry.updated) * burst / period;
+
+		if (entry.score <= 0)
+		{
+			entry.score = 0;
+			entry.reported = false;
+		}
+	}
+
+	entry.updated = now;
+}
+
+/**
+ * Remove hosts which hold no connections and have their allowance
+ * refilled. Runs once a minute at most.
+ */
+void UnrealThrottle::expire()
+{
+	std::time_t now = UnrealTime::now().toTS();
+
+	if (now - last_expire_ < 60)
+		return;
+
+	last_expire_ = now;
+
+	for (HashMap<String, Entry>::Iterator hi = hosts_.begin();
+			hi != hosts_.end(); )
+	{
+		decay(hi->second, now);
+
+		if (hi->second.current == 0 && hi->second.score <= 0)
+			hi = hosts_.erase(hi);
+		else
+			++hi;
+	}
+}
+
+/**
+ * Returns the key connections of an address are accounted to; the /64
+ * prefix for IPv6 addresses, otherwise the address itself.
+ *
+ * @param addr Address
+ * @return Host key
+ */
+String UnrealThrottle::hostKey(const boost::asio::ip::address& addr)
+{
+	if (addr.is_v6())
+	{
+		boost::asio::ip::address_v6 v6 = addr.to_v6();
+
+		if (v6.is_v4_mapped())
+			return String(v6.to_v4().to_string());
+
+		boost::asio::ip::address_v6::bytes_type bytes = v6.to_bytes();
+
+		for (size_t i = 8; i < bytes.size(); ++i)
+			bytes[i] = 0;
+
+		return String(boost::asio::ip::address_v6(bytes).to_string())
+			.append("/64");
+	}
+
+	return String(addr.to_string());
+}
+
+/**
+ * Returns whether an address is exempt from throttling.
+ *
+ * @param ip Address in text form
+ * @return True if exempt, otherwise false
+ */
+bool UnrealThrottle::isExempt(const String& ip)
+{
+	String exempt = unreal->config.get("Throttle::Exempt", "");
+
+	if (exempt.empty())
+		return false;
+
+	StringList entries = exempt.split(",");
+
+	/* split() only returns something if there's a separator */
+	if (entries.empty())
+		entries << exempt;
+
+	foreach (StringList::Iterator, ei, entries)
+	{
+		if ((*ei).trimmed() == ip)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Release the slot of a closed connection.
+ *
+ * @param sptr Socket of the connection
+ */
+void UnrealThrottle::release(UnrealSocket* sptr)
+{
+	HashMap<UnrealSocket*, String>::Iterator si = sockets_.find(sptr);
+
+	if (si == sockets_.end())
+		return;
+
+	HashMap<String, Entry>::Iterator hi = hosts_.find(si->second);
+
+	if (hi != hosts_.end() && hi->second.current > 0)
+		hi->second.current--;
+
+	sockets_.erase(si);
+}
+
+/**
+ * Returns the number of hosts tracked.
+ *
+ * @return Host count
+ */
+size_t UnrealThrottle::size()
+{
+	return hosts_.size();
+}
@@ -24,8 +24,15 @@
  ******************************************************************/
 
 #include <base.hpp>
+#include <manualclock.hpp>
 #include <time.hpp>
 
+#if !defined(OS_WINDOWS)
+#  include <time.h>
+#endif
+
+UnrealManualClock* UnrealTime::clock_ = 0;
+
 /**
  * UnrealTime constructor.
  *
@@ -48,6 +55,38 @@ UnrealTime& UnrealTime::addSeconds(const std::time_t& sec)
 	return *this;
 }
 
+/**
+ * Returns the clock installed with setClock(), if any.
+ *
+ * @return Clock, or zero if the system clock is used
+ */
+UnrealManualClock* UnrealTime::clock()
+{
+	return clock_;
+}
+
+/**
+ * Returns a monotonic timestamp in microseconds. The value has no relation
+ * to the wall clock and is only meant for measuring intervals.
+ *
+ * @return Microseconds since an unspecified starting point
+ */
+uint64_t UnrealTime::monotonic()
+{
+	if (clock_)
+		return clock_->monotonic();
+
+#if defined(OS_WINDOWS)
+	return static_cast<uint64_t>(GetTickCount64()) * 1000;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000
+		+ static_cast<uint64_t>(ts.tv_nsec) / 1000;
+#endif
+}
+
 /**
  * Returns the global network time.
  * If we have not received any remote time yet, the local time is returned.
@@ -70,10 +109,21 @@ UnrealTime UnrealTime::nettime()
 UnrealTime UnrealTime::now()
 {
 	UnrealTime ut;
-	ut.setTS(std::time(0));
+	ut.setTS(clock_ ? clock_->wallclock() : std::time(0));
 	return ut;
 }
 
+/**
+ * Use a manually advanced clock instead of the system clock, for the
+ * current time as well as for timers armed from now on.
+ *
+ * @param clock Clock to use, or zero for the system clock
+ */
+void UnrealTime::setClock(UnrealManualClock* clock)
+{
+	clock_ = clock;
+}
+
 /**
  * Update the internal timestamp.
  *
@@ -89,7 +139,32 @@ void UnrealTime::setTS(const std::time_t& ts)
  */
 void UnrealTime::sync()
 {
-	setTS(std::time(0));
+	setTS(now().toTS());
+}
+
+/**
+ * Returns the CPU time used by the calling thread, in microseconds.
+ *
+ * @return Microseconds of CPU time
+ */
+uint64_t UnrealTime::threadCPU()
+{
+#if defined(OS_WINDOWS)
+	FILETIME created, exited, kernel, user;
+
+	GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user);
+
+	return ((static_cast<uint64_t>(kernel.dwHighDateTime) << 32
+			| kernel.dwLowDateTime)
+		+ (static_cast<uint64_t>(user.dwHighDateTime) << 32
+			| user.dwLowDateTime)) / 10;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000
+		+ static_cast<uint64_t>(ts.tv_nsec) / 1000;
+#endif
 }
 
 /**
@@ -101,10 +176,16 @@ void UnrealTime::sync()
  */
 String UnrealTime::toString(const String& fmt)
 {
-	static char buf[1024];
-	struct tm* tmx = localtime(&timestamp_);
+	char buf[1024];
+	struct tm tmx;
+
+#if defined(OS_WINDOWS)
+	localtime_s(&tmx, &timestamp_);
+#else
+	localtime_r(&timestamp_, &tmx);
+#endif
 
-	if (std::strftime(buf, sizeof(buf), fmt.c_str(), tmx) == 0)
+	if (std::strftime(buf, sizeof(buf), fmt.c_str(), &tmx) == 0)
 		return String("Invalid");
 	else
 		return String(buf);
@@ -23,9 +23,136 @@
  * GNU General Public License for more details.
  ******************************************************************/
 
-#include "base.hpp" 
+#include "base.hpp"
+#include "manualclock.hpp"
 #include "timer.hpp"
- 
+#include <boost/bind.hpp>
+
+/**
+ * UnrealTimer constructor.
+ */
 UnrealTimer::UnrealTimer()
-	: boost::asio::deadline_timer(unreal->reactor())
-{ }
\ No newline at end of file
+	: timer_(unreal->reactor()), clock_(0), due_(0), seq_(0)
+{ }
+
+/**
+ * UnrealTimer destructor.
+ * A pending wait is canceled, its handler is called with
+ * operation_aborted.
+ */
+UnrealTimer::~UnrealTimer()
+{
+	abort();
+}
+
+/**
+ * Cancel the wait pending on the manual clock, if any. The handler is
+ * posted to the reactor with operation_aborted, as the reactor timer does.
+ *
+ * @return Number of waits canceled
+ */
+size_t UnrealTimer::abort()
+{
+	if (!clock_)
+		return 0;
+
+	Handler handler = handler_;
+
+	clock_->unschedule(due_, seq_);
+	clock_ = 0;
+	handler_.clear();
+
+	unreal->reactor().post(
+		boost::bind(handler,
+			ErrorCode(boost::asio::error::operation_aborted)));
+
+	return 1;
+}
+
+/**
+ * Wait for the timer to expire. As with deadline_timer, the expiry time
+ * is kept after a wait; without a new expires_from_now(), a wait on the
+ * manual clock has expired already and completes right away.
+ *
+ * @param handler Called once the timer has expired or was canceled
+ */
+void UnrealTimer::async_wait(const Handler& handler)
+{
+	UnrealManualClock* clock = UnrealTime::clock();
+
+	if (!clock)
+	{
+		timer_.async_wait(handler);
+		return;
+	}
+
+	if (due_ <= clock->monotonic())
+	{
+		abort();
+
+		unreal->reactor().post(boost::bind(handler, ErrorCode()));
+		return;
+	}
+
+	handler_ = handler;
+	clock_ = clock;
+	seq_ = clock->schedule(this, due_);
+}
+
+/**
+ * Cancel the pending wait.
+ *
+ * @return Number of waits canceled
+ */
+size_t UnrealTimer::cancel()
+{
+	ErrorCode ec;
+
+	return cancel(ec);
+}
+
+/**
+ * Cancel the pending wait.
+ *
+ * @param ec Set on errors
+ * @return Number of waits canceled
+ */
+size_t UnrealTimer::cancel(ErrorCode& ec)
+{
+	return abort() + timer_.cancel(ec);
+}
+
+/**
+ * Set the expiry time relative to now. A pending wait is canceled.
+ *
+ * @param duration Time until the timer expires
+ * @return Number of waits canceled
+ */
+size_t UnrealTimer::expires_from_now(const Duration& duration)
+{
+	UnrealManualClock* clock = UnrealTime::clock();
+	size_t canceled = abort();
+
+	if (!clock)
+		return canceled + timer_.expires_from_now(duration);
+
+	int64_t usec = duration.total_microseconds();
+
+	due_ = clock->monotonic() + (usec > 0 ? static_cast<uint64_t>(usec) : 0);
+
+	return canceled;
+}
+
+/**
+ * The manual clock has reached the due time; run the handler.
+ */
+void UnrealTimer::fire()
+{
+	/* the handler may destroy or rearm the timer */
+	Handler handler = handler_;
+
+	clock_ = 0;
+	handler_.clear();
+
+	handler(ErrorCode());
+}
@@ -25,6 +25,8 @@
 
 #include <base.hpp>
 #include <limits.hpp>
+#include <memstat.hpp>
+#include <probes.hpp>
 #include <user.hpp>
 
 #include <cmd/join.hpp>
@@ -43,9 +45,6 @@
 #include <boost/bind.hpp>
 #include <boost/thread/mutex.hpp>
 
-/** ident check query map */
-Map<UnrealUser*, UnrealSocket*> icheck_queries;
-
 /** a list with user entries that should be destroyed once all additional
   * operations have finished
   */
@@ -54,6 +53,10 @@ List<UnrealUser*> user_destructs;
 /** special signals */
 boost::signal<void(UnrealUser*)> UnrealUser::onCreate;
 boost::signal<void(UnrealUser*)> UnrealUser::onDestroy;
+boost::signal<void(UnrealUser*, const String&)> UnrealUser::onNickChange;
+boost::signal<void(UnrealUser*)> UnrealUser::onRegister;
+
+uint32_t UnrealUser::neighbor_epoch_ = 0;
 
 /** user mode definitions */
 namespace UnrealUserProperties
@@ -67,6 +70,9 @@ namespace UnrealUserProperties
 	/** user is marked as being IRC operator */
 	UnrealUserMode Operator('o');
 
+	/** user is receiving server notices */
+	UnrealUserMode ServerNotice('s');
+
 	/** user is receiving wallop messages */
 	UnrealUserMode Wallops('w');
 
@@ -80,8 +86,17 @@ namespace UnrealUserProperties
  * @param sptr Socket pointer if attached to the server directly.
  */
 UnrealUser::UnrealUser(UnrealSocket* sptr)
-	: score(0), socket_(sptr), connection_time_(UnrealTime::now())
+	: score(0), socket_(sptr), listener_(0),
+	  connection_time_(UnrealTime::now()), first_streams_(0),
+	  pumping_(false), pump_posted_(false), alive_(new bool(true)),
+	  registered_(false), exited_(false), memory_(0), neighbor_mark_(0)
 {
+	UnrealMemoryStats::allocate(UnrealMemoryStats::Users, 0);
+	accountMemory();
+
+	if (sptr)
+		reg_trace_.mark(UnrealRegistrationTrace::Accept);
+
 	UnrealUser::onCreate(this);
 }
 
@@ -100,12 +115,65 @@ UnrealUser::~UnrealUser()
 	if (isOper() && unreal->stats.operators > 0)
 		unreal->stats.operators--;
 
-	if (icheck_queries.contains(this))
-		icheck_queries.free(this);
+	unreal->opers.remove(this);
+
+	unreal->ident.cancel(this);
+	unreal->workers.cancel(this);
+
+	unreal->userindex.remove(this);
+
+	/* drop unfinished replies and a posted continuation */
+	*alive_ = false;
+	foreach (List<UnrealReplyStream*>::Iterator, rsi, reply_streams_)
+		delete *rsi;
+
+	UnrealMemoryStats::release(UnrealMemoryStats::Users, memory_);
 
 	UnrealUser::onDestroy(this);
 }
 
+/**
+ * Update the memory accounted for this user after one of its strings
+ * has changed.
+ */
+void UnrealUser::accountMemory()
+{
+	size_t bytes = sizeof(UnrealUser)
+		+ UnrealMemoryStats::bytes(nickname_)
+		+ UnrealMemoryStats::bytes(ident_)
+		+ UnrealMemoryStats::bytes(hostname_)
+		+ UnrealMemoryStats::bytes(real_hostname_)
+		+ UnrealMemoryStats::bytes(ip_)
+		+ UnrealMemoryStats::bytes(realname_)
+		+ UnrealMemoryStats::bytes(away_message_);
+
+	UnrealMemoryStats::resize(UnrealMemoryStats::Users, memory_, bytes);
+}
+
+/**
+ * Queue a large reply. The stream is served right away as long as the
+ * send queue is below the watermark, and continued by pumpReplyStreams()
+ * once the send queue has drained. The user object takes ownership of
+ * the stream.
+ *
+ * @param stream Reply stream
+ * @param first Serve the stream before those which are queued already,
+ *   e.g. the NAMES reply of a JOIN ahead of a pending LIST
+ */
+void UnrealUser::addReplyStream(UnrealReplyStream* stream, bool first)
+{
+	if (first)
+	{
+		reply_streams_.insert(reply_streams_.begin() + first_streams_,
+			stream);
+		first_streams_++;
+	}
+	else
+		reply_streams_ << stream;
+
+	pumpReplyStreams();
+}
+
 /**
  * Start authentication process.
  */
@@ -116,6 +184,29 @@ void UnrealUser::auth()
 				<< AFDNS
 				<< AFRDNS;
 
+	/* remember the remote address */
+	UnrealSocket::ErrorCode ec;
+	UnrealResolver::Endpoint ep = socket_->remoteEndpoint(ec);
+
+	if (!ec)
+	{
+		ip_ = ep.address().to_string();
+		accountMemory();
+	}
+
+	/* in-memory connections have nothing to look up */
+	if (socket_->isLoopback())
+	{
+		auth_flags_.revoke(AFDNS);
+		auth_flags_.revoke(AFRDNS);
+		setHostname(ip_);
+		setRealHostname(ip_);
+		reg_trace_.mark(UnrealRegistrationTrace::DNS);
+
+		scheduleAuthTimeout();
+		return;
+	}
+
 	send(":%s NOTICE AUTH :*** Looking up your hostname",
 	    unreal->me->name().c_str());
 
@@ -165,12 +256,7 @@ void UnrealUser::checkAuthTimeout(const UnrealTimer::ErrorCode& ec)
 		{
 			if (auth_flags_.isset(AFIdent))
 			{
-				if (icheck_queries.contains(this))
-				{
-					UnrealSocket* sptr = icheck_queries[this];
-					sptr->cancel();
-				}
-
+				unreal->ident.cancel(this);
 				destroyIdentRequest();
 				sendPing();
 			}
@@ -207,53 +293,46 @@ void UnrealUser::checkPingTimeout(const UnrealTimer::ErrorCode& ec)
  */
 void UnrealUser::checkRemoteIdent()
 {
-	UnrealSocket* sptr = new UnrealSocket();
-
-	send(":%s NOTICE AUTH :*** Checking Ident",
-		unreal->me->name().c_str());
-
-	sptr->onConnected.connect(
-		boost::bind(&UnrealUser::handleIdentCheckConnected,
-			this,
-			_1));
-	sptr->onDisconnected.connect(
-		boost::bind(&UnrealUser::handleIdentCheckDisconnected,
-			this,
-			_1,
-			_2));
-	sptr->onError.connect(
-		boost::bind(&UnrealUser::handleIdentCheckError,
-			this,
-			_1,
-			_2));
-	sptr->onRead.connect(
-		boost::bind(&UnrealUser::handleIdentCheckRead,
-			this,
-			_1,
-			_2));
-
-	/* validate socket */
 	UnrealSocket::ErrorCode ec;
-	UnrealResolver::Endpoint endpoint = socket_->remote_endpoint(ec);
+	UnrealResolver::Endpoint remote = socket_->remoteEndpoint(ec);
+	UnrealResolver::Endpoint local;
+
+	if (!ec)
+		local = socket_->localEndpoint(ec);
 
 	if (ec)
 	{
 		unreal->log.write(UnrealLog::Debug, "checkRemoteIdent: Client socket "
 			"disappeared before we could get remote endpoint");
 
-		delete sptr;
 		return;
 	}
 
-	endpoint.port(113);
+	send(":%s NOTICE AUTH :*** Checking Ident",
+		unreal->me->name().c_str());
 
-	/* connect to remote ident server */
-	sptr->connectTo(endpoint);
+	String username;
+	UnrealIdentClient::Result result = unreal->ident.lookup(this, remote,
+		local, username);
 
-	/* add ident check to query map */
-	icheck_queries.add(this, sptr);
+	if (result == UnrealIdentClient::Pending)
+		auth_flags_ << AFIdent;
+	else
+		handleIdentResult(result, username);
+}
 
-	auth_flags_ << AFIdent;
+/**
+ * Continue sending queued reply streams on a later turn of the reactor.
+ *
+ * @param alive Cleared if the user has been destroyed meanwhile
+ */
+void UnrealUser::continueReplyStreams(boost::shared_ptr<bool> alive)
+{
+	if (!*alive)
+		return;
+
+	pump_posted_ = false;
+	pumpReplyStreams();
 }
 
 /**
@@ -300,6 +379,9 @@ void UnrealUser::destroy(UnrealUser* uptr)
 		/* and global user list */
 		unreal->users.remove(uptr);
 
+		UNREAL_PROBE2(user__destroy, uptr->socket()
+			? uptr->socket()->native() : -1, uptr->nick().c_str());
+
 		delete uptr;
 	}
 	else
@@ -324,6 +406,7 @@ void UnrealUser::destroy(UnrealUser* uptr)
 void UnrealUser::destroyIdentRequest()
 {
 	auth_flags_.revoke(AFIdent);
+	reg_trace_.mark(UnrealRegistrationTrace::Ident);
 
 	if (auth_flags_.value() == 0)
 		sendPing();
@@ -366,11 +449,38 @@ void UnrealUser::exit(UnrealSocket::ErrorCode& ec, const String& msg)
 	else
 		message = "Exiting";
 
-	/* broadcast quit on all channels */
+	/* let the operators know, but only once */
+	if (registered_ && !exited_)
+	{
+		unreal->opers.notice(UnrealOperIndex::SNConnect,
+			String::format("Client exiting: %s (%s@%s) [%s]",
+				nickname_.c_str(),
+				ident_.c_str(),
+				hostname_.c_str(),
+				message.c_str()));
+	}
+
+	exited_ = true;
+
+	/* broadcast quit once to everyone sharing a channel */
+	if (channels.size() > 0)
+	{
+		sendNeighbors(String::format(":%s!%s@%s %s :%s",
+			nickname_.c_str(),
+			ident_.c_str(),
+			hostname_.c_str(),
+			CMD_QUIT,
+			message.c_str()));
+	}
+
 	while (channels.size() > 0)
 	{
 		UnrealChannel* chptr = channels.at(0);
-		leaveChannel(chptr->name(), message, CMD_QUIT);
+
+		chptr->removeMember(this);
+
+		if (chptr->members.size() == 0)
+			delete chptr;
 	}
 }
 
@@ -382,7 +492,7 @@ void UnrealUser::exit(UnrealSocket::ErrorCode& ec, const String& msg)
 void UnrealUser::exit(const String& message)
 {
 	/* close socket */
-	if (socket_->is_open())
+	if (socket_->isOpen())
 	{
 		String reply;
 		UnrealSocket::ErrorCode ec;
@@ -393,7 +503,7 @@ void UnrealUser::exit(const String& message)
 			message.c_str());
 
 		send(reply);
-		socket_->close(ec);
+		socket_->disconnect(ec);
 
 		if (ec)
 		{
@@ -436,34 +546,27 @@ UnrealUser* UnrealUser::find(const String& nickname)
 }
 
 /**
- * Asyncronous callback that is called once the remote ident check
- * socket is connected and ready to send the request.
+ * Callback for ident lookup results.
  *
- * @param sptr Pointer to Socket
+ * @param result Lookup result
+ * @param username Username, if found
  */
-void UnrealUser::handleIdentCheckConnected(UnrealSocket* sptr)
+void UnrealUser::handleIdentResult(UnrealIdentClient::Result result,
+	const String& username)
 {
-	String request_str;
-
-	request_str.sprintf("%d, %d",
-		socket_->remote_endpoint().port(),
-		socket_->local_endpoint().port());
+	if (result == UnrealIdentClient::Found)
+	{
+		setIdent(username);
 
-	/* send ident request */
-	sptr->write(request_str);
-}
+		send(":%s NOTICE AUTH :*** Got ident response",
+			unreal->me->name().c_str());
+	}
+	else
+	{
+		send(":%s NOTICE AUTH :*** No ident response",
+			unreal->me->name().c_str());
+	}
 
-/**
- * Asyncronous callback that indicates that an disconnected happened while
- * trying to fetch data from the ident request socket.
- *
- * @param sptr Pointer to Socket
- */
-void UnrealUser::handleIdentCheckDisconnected(UnrealSocket* sptr,
-	const UnrealSocket::ErrorCode& ec)
-{
-	icheck_queries.remove(this);
-	delete sptr;
 	destroyIdentRequest();
 
 	/* check for destruction request, as ident request is done */
@@ -471,85 +574,6 @@ void UnrealUser::handleIdentCheckDisconnected(UnrealSocket* sptr,
 		UnrealUser::destroy(this);
 }
 
-/**
- * Asyncronous callback that indicates that an error occured on the ident check
- * socket.
- *
- * @param sptr Pointer to Socket
- * @param ec Error code
- */
-void UnrealUser::handleIdentCheckError(UnrealSocket* sptr,
-	const UnrealSocket::ErrorCode& ec)
-{
-	send(":%s NOTICE AUTH :*** No ident response",
-	    unreal->me->name().c_str());
-
-	UnrealSocket::ErrorCode err = ec;
-
-	if (err.value() == boost::asio::error::operation_aborted)
-		icheck_queries.free(this);
-
-	destroyIdentRequest();
-}
-
-/**
- * Asyncronous callback that indicates that we received an response message
- * from the remote ident server.
- *
- * @param sptr Pointer to Socket
- * @param data Last line read from socket
- */
-void UnrealUser::handleIdentCheckRead(UnrealSocket* sptr, String& data)
-{
-	StringList tokens = data.split(":");
-	bool haveError = false;
-
-	if (tokens.size() >= 3)
-	{
-		StringList ports = tokens.at(0).split(",");
-		uint16_t local_port = 0, remote_port = 0;
-
-		unreal->log.write(UnrealLog::Debug, "icheck_read: ports.size() = %u",
-			ports.size());
-	
-		if (ports.size() >= 2)
-		{
-			remote_port = ports.at(0).trimmed().toUInt16();
-			local_port = ports.at(1).trimmed().toUInt16();
-
-			String replCmd = tokens.at(1).trimmed();
-
-			unreal->log.write(UnrealLog::Debug, "icheck_read: replCmd = [%s]",
-				replCmd.c_str());
-
-			if (replCmd == "USERID" && tokens.size() >= 4)
-			{
-				String username = tokens.at(3).trimmed();
-
-				/* ident reply was OK, set the username */
-				setIdent(username);
-			}
-			else
-			{
-				haveError = true;
-			}
-		}
-		else
-		{
-			haveError = true;
-		}
-	}
-
-	if (haveError)
-		send(":%s NOTICE AUTH :*** No valid ident response",
-		    unreal->me->name().c_str());
-	else
-		send(":%s NOTICE AUTH :*** Got ident response",
-		    unreal->me->name().c_str());
-
-	destroyIdentRequest();
-}
-
 /**
  * Callback for resolver replies.
  *
@@ -588,15 +612,27 @@ void UnrealUser::handleResolveResponse(const UnrealResolver::ErrorCode& ec,
 			}
 			else
 			{
-				/* query hostname -> address */
-				rq->query((*response).host_name(), endpoint.port());
+				/* query hostname -> address, in the family of the client */
+				rq->query((*response).host_name(), endpoint.port(),
+					endpoint.address().is_v4() ? AF_INET : AF_INET6);
 				
 				return;
 			}
 		}
 		else
 		{
-			if (endpoint.address() != socket_->remote_endpoint().address())
+			UnrealResolver::Iterator end;
+			bool matched = false;
+
+			/* any of the forward addresses may match */
+			for (; response != end && !matched; ++response)
+			{
+				if ((*response).endpoint().address()
+						== socket_->remote_endpoint().address())
+					matched = true;
+			}
+
+			if (!matched)
 			{
 				send(":%s NOTICE AUTH :*** Forward and reverse hostname do not "
 					"match, using IP-Address instead",
@@ -618,6 +654,7 @@ void UnrealUser::handleResolveResponse(const UnrealResolver::ErrorCode& ec,
 	/* update entries */
 	setHostname(address);
 	setRealHostname(address);
+	reg_trace_.mark(UnrealRegistrationTrace::DNS);
 
 	/* remove the previously allocated resolver */
 	socket_->destroyResolverQuery();
@@ -665,6 +702,16 @@ const String& UnrealUser::ident()
 	return ident_;
 }
 
+/**
+ * Returns the IP address of this user.
+ *
+ * @return IP address in text notation
+ */
+const String& UnrealUser::ip()
+{
+	return ip_;
+}
+
 /**
  * Returns whether the user is marked as away.
  */
@@ -723,6 +770,14 @@ bool UnrealUser::isOper()
 		return false;
 }
 
+/**
+ * Returns whether the user has completed the registration.
+ */
+bool UnrealUser::isRegistered()
+{
+	return registered_;
+}
+
 /**
  * Join user into a channel.
  *
@@ -1006,24 +1061,76 @@ const String& UnrealUser::nick()
 }
 
 /**
- * Sends a notice to all IRC operators.
+ * Sends a server notice to all IRC operators subscribed to the category.
  *
  * @param msg Message to send
+ * @param category Server notice category
  */
-void UnrealUser::notifyOpers(const String& msg)
+void UnrealUser::notifyOpers(const String& msg,
+	UnrealOperIndex::Snomask category)
 {
-	List<UnrealUser*>::Iterator ui;
-	UnrealUser* uptr;
-	String preparedMsg = ":*** Notice -- " + msg;
+	unreal->opers.notice(category, msg);
+}
+
+/**
+ * Returns the protocol extension flags enabled by the client.
+ *
+ * @return Bitmask
+ */
+Bitmask<uint8_t>& UnrealUser::protoflags()
+{
+	return proto_flags_;
+}
+
+/**
+ * Continue sending queued reply streams while the send queue is below
+ * Limits::SendQWatermark. One burst is produced per call; if there is
+ * more to send and the send queue has room, the rest is posted to the
+ * reactor, so a filtered WHO or LIST which sends little does not walk
+ * the whole table in one turn. Users without a socket get the whole
+ * reply at once.
+ */
+void UnrealUser::pumpReplyStreams()
+{
+	static size_t watermark = unreal->config.get("Limits::SendQWatermark",
+		"16384").toSize();
+	static size_t burst = unreal->config.get("Limits::ReplyBurst",
+		"20").toSize();
+
+	if (pumping_)
+		return;
+
+	pumping_ = true;
 
-	for (ui = unreal->users.begin(); ui != unreal->users.end(); ++ui)
+	while (!reply_streams_.empty()
+			&& (!socket_ || socket_->sendqSize() < watermark))
 	{
-		uptr = *ui;
+		UnrealReplyStream* stream = reply_streams_.front();
 
-		if (!uptr->isOper())
-			continue;
-		else
-			uptr->sendreply(CMD_NOTICE, preparedMsg);
+		if (stream->produce(this, burst > 0 ? burst : 1)
+				== UnrealReplyStream::Done)
+		{
+			reply_streams_.removeFirst();
+			if (first_streams_ > 0)
+				first_streams_--;
+			delete stream;
+		}
+
+		if (socket_)
+			break;
+	}
+
+	pumping_ = false;
+
+	/* above the watermark the next write completion continues */
+	if (socket_ && !reply_streams_.empty() && !pump_posted_
+			&& socket_->sendqSize() < watermark)
+	{
+		pump_posted_ = true;
+		unreal->reactor().post(
+			boost::bind(&UnrealUser::continueReplyStreams,
+				this,
+				alive_));
 	}
 }
 
@@ -1037,6 +1144,8 @@ void UnrealUser::parseModeChange(StringList* argv)
 	ModeBuf::StateType state = ModeBuf::Add, last_state = ModeBuf::None;
 	String flagset = argv->at(0);
 	String changeset;
+	size_t param = 1;
+	bool snomask_changed = false;
 
 	/* mode table */
 	UnrealUserModeTable& modetab = UnrealUserProperties::ModeTable;
@@ -1058,14 +1167,27 @@ void UnrealUser::parseModeChange(StringList* argv)
 
 			UnrealUserMode umo = modetab.lookup(*ch);
 			uint16_t fl = modetab.value(umo);
+			ModeBuf::StateType flag_state = state;
+
+			/* a server notice mask without any category turns server
+			 * notices off, just like -s */
+			if (state == ModeBuf::Add
+					&& umo == UnrealUserProperties::ServerNotice
+					&& isOper() && argv->size() > param
+					&& UnrealOperIndex::parseMask(argv->at(param),
+						unreal->opers.mask(this)) == 0)
+			{
+				param++;
+				flag_state = ModeBuf::Remove;
+			}
 
-			if (last_state != state)
+			if (last_state != flag_state)
 			{
-				last_state = state;
+				last_state = flag_state;
 
 				String change_str;
 
-				switch (state)
+				switch (flag_state)
 				{
 					case ModeBuf::Add:
 						change_str = "+";
@@ -1078,10 +1200,35 @@ void UnrealUser::parseModeChange(StringList* argv)
 				changeset << change_str;
 			}
 
-			if (state == ModeBuf::Add)
+			if (flag_state == ModeBuf::Add)
 			{
+				if (umo == UnrealUserProperties::ServerNotice)
+				{
+					/* server notices are available to operators only;
+					 * an optional parameter changes the categories */
+					if (!isOper())
+						continue;
+
+					uint8_t snomask = unreal->opers.mask(this);
+
+					if (argv->size() > param)
+						snomask = UnrealOperIndex::parseMask(argv->at(param++),
+							snomask);
+					else if (snomask == 0)
+						snomask = UnrealOperIndex::SNGeneral;
+
+					unreal->opers.setMask(this, snomask);
+					snomask_changed = true;
+
+					if (!modes_.isset(fl))
+					{
+						modes_ << fl;
+						changeset.append(1, *ch);
+					}
+				}
 				/* apply mode flag */
-				if (!modes_.isset(fl) && umo != UnrealUserProperties::Operator)
+				else if (!modes_.isset(fl)
+						&& umo != UnrealUserProperties::Operator)
 				{
 					modes_ << fl;
 					changeset.append(1, *ch);
@@ -1092,7 +1239,7 @@ void UnrealUser::parseModeChange(StringList* argv)
 					}
 				}
 			}
-			else if (state == ModeBuf::Remove)
+			else if (flag_state == ModeBuf::Remove)
 			{
 				/* apply mode flag */
 				if (modes_.isset(fl))
@@ -1107,6 +1254,21 @@ void UnrealUser::parseModeChange(StringList* argv)
 					else if (umo == UnrealUserProperties::Operator)
 					{
 						unreal->stats.operators--;
+						unreal->opers.remove(this);
+
+						/* server notices go along with the operator status */
+						uint16_t snofl = modetab.value(
+							UnrealUserProperties::ServerNotice);
+
+						if (modes_.isset(snofl))
+						{
+							modes_.revoke(snofl);
+							changeset.append(1, 's');
+						}
+					}
+					else if (umo == UnrealUserProperties::ServerNotice)
+					{
+						unreal->opers.setMask(this, 0);
 					}
 				}
 			}
@@ -1116,6 +1278,14 @@ void UnrealUser::parseModeChange(StringList* argv)
 	/* send mode changes */
 	if (changeset.length() > 1)
 		sendreply(CMD_MODE, changeset);
+
+	if (snomask_changed && unreal->opers.mask(this) != 0)
+	{
+		sendreply(RPL_SNOMASK,
+			String::format(MSG_SNOMASK,
+				UnrealOperIndex::maskString(unreal->opers.mask(this))
+					.c_str()));
+	}
 }
 
 /**
@@ -1147,6 +1317,26 @@ void UnrealUser::registerUser()
 	UnrealConfig& cfg = unreal->config;
 	String version = String(PACKAGE_VERSTR);
 
+	reg_trace_.mark(UnrealRegistrationTrace::Pong);
+
+	/* DNS and ident are done now, so user@host bans can be checked; a
+	 * Z-line may have been added since the connection was accepted */
+	UnrealBanList::BanPtr ban = unreal->bans.checkAddress(ip_);
+
+	if (!ban)
+		ban = unreal->bans.checkUser(ident_, real_hostname_, ip_);
+
+	if (ban)
+	{
+		sendreply(ERR_YOUREBANNEDCREEP,
+			String::format(MSG_YOUREBANNEDCREEP,
+				ban->reason.c_str()));
+		exit(String::format("%s (%s)",
+			UnrealBanList::typeName(ban->type),
+			ban->reason.c_str()));
+		return;
+	}
+
 	/* collect user mode flags */
 	String user_modes;
 
@@ -1201,6 +1391,17 @@ void UnrealUser::registerUser()
 
 	unreal->stats.users_local_cur++;
 
+	/* make the user searchable */
+	unreal->userindex.add(this);
+	registered_ = true;
+
+	unreal->opers.notice(UnrealOperIndex::SNConnect,
+		String::format("Client connecting: %s (%s@%s) [%s]",
+			nickname_.c_str(),
+			ident_.c_str(),
+			hostname_.c_str(),
+			ip_.c_str()));
+
 	if (unreal->users.size() > unreal->stats.users_max)
 		unreal->stats.users_max = unreal->users.size();
 	if (unreal->stats.users_local_cur > unreal->stats.users_local_max)
@@ -1241,6 +1442,24 @@ void UnrealUser::registerUser()
 	 * propagate this message to other servers
 	 */
 	schedulePingTimeout();
+
+	/* account the registration latency to the listener */
+	reg_trace_.mark(UnrealRegistrationTrace::Welcome);
+
+	if (listener_)
+		listener_->registrations.add(reg_trace_);
+
+	UnrealUser::onRegister(this);
+}
+
+/**
+ * Returns the registration phase timestamps of this user.
+ *
+ * @return Registration trace
+ */
+UnrealRegistrationTrace& UnrealUser::registrationTrace()
+{
+	return reg_trace_;
 }
 
 /**
@@ -1249,7 +1468,7 @@ void UnrealUser::registerUser()
 void UnrealUser::resolveHostname()
 {
 	UnrealSocket::ErrorCode ec;
-	UnrealResolver::Endpoint endpoint = socket_->remote_endpoint(ec);
+	UnrealResolver::Endpoint endpoint = socket_->remoteEndpoint(ec);
 
 	if (ec)
 	{
@@ -1257,6 +1476,7 @@ void UnrealUser::resolveHostname()
 			"disappeared when getting remote endpoint");
 
 		auth_flags_.revoke(AFDNS);
+		reg_trace_.mark(UnrealRegistrationTrace::DNS);
 		return;
 	}
 
@@ -1339,14 +1559,25 @@ void UnrealUser::sendISupport()
 	for (UnrealISupport::Iterator i = unreal->isupport.begin();
 			i != unreal->isupport.end(); ++i)
 	{
-		buf += i->first + "=" + i->second + " ";
+		if (!buf.empty())
+			buf.append(1, ' ');
+
+		/* tokens without a value are sent without '=' */
+		if (i->second.empty())
+			buf += i->first;
+		else
+			buf += i->first + "=" + i->second;
 
 		if (buf.length() > 400)
-			sendreply(RPL_ISUPPORT, buf);
+		{
+			sendreply(RPL_ISUPPORT,
+				String::format(MSG_ISUPPORT, buf.c_str()));
+			buf.clear();
+		}
 	}
 
 	if (!buf.empty())
-		sendreply(RPL_ISUPPORT, buf);
+		sendreply(RPL_ISUPPORT, String::format(MSG_ISUPPORT, buf.c_str()));
 }
 
 /**
@@ -1369,6 +1600,49 @@ void UnrealUser::sendlocalreply(const String& cmd, const String& data)
 	send(reply);
 }
 
+/**
+ * Send a line to every user sharing at least one channel with this user.
+ * Each neighbor gets the line exactly once, no matter how many channels
+ * it has in common with this user. Visited users are stamped with the
+ * current walk number instead of being collected in a temporary set.
+ *
+ * @param data Pre-formatted line
+ * @param include_self Whether to send the line to this user as well
+ */
+void UnrealUser::sendNeighbors(const String& data, bool include_self)
+{
+	/* on wrap-around, stale stamps could match the new walk */
+	if (++neighbor_epoch_ == 0)
+	{
+		foreach (List<UnrealUser*>::Iterator, ui, unreal->users)
+			(*ui)->neighbor_mark_ = 0;
+
+		neighbor_epoch_ = 1;
+	}
+
+	neighbor_mark_ = neighbor_epoch_;
+
+	if (include_self && socket_)
+		send(data);
+
+	foreach (List<UnrealChannel*>::Iterator, ci, channels)
+	{
+		foreach (UnrealChannel::MemberIterator, cmi, (*ci)->members)
+		{
+			UnrealUser* uptr = cmi->first;
+
+			if (uptr->neighbor_mark_ == neighbor_epoch_)
+				continue;
+
+			uptr->neighbor_mark_ = neighbor_epoch_;
+
+			/* virtual users don't have a connection to write to */
+			if (uptr->socket_)
+				uptr->send(data);
+		}
+	}
+}
+
 /**
  * Send a reply originating from the server using a numeric reply.
  *
@@ -1442,6 +1716,9 @@ void UnrealUser::sendPing()
 	request_str.sprintf("PING :%s",
 			unreal->me->name().c_str());
 
+	if (!registered_)
+		reg_trace_.mark(UnrealRegistrationTrace::Ping);
+
 	send(request_str);
 }
 
@@ -1453,6 +1730,7 @@ void UnrealUser::sendPing()
 void UnrealUser::setAwayMessage(const String& msg)
 {
 	away_message_ = msg;
+	accountMemory();
 }
 
 /**
@@ -1463,6 +1741,8 @@ void UnrealUser::setAwayMessage(const String& msg)
 void UnrealUser::setHostname(const String& newhost)
 {
 	hostname_ = newhost;
+	accountMemory();
+	unreal->userindex.update(this);
 }
 
 /**
@@ -1473,6 +1753,7 @@ void UnrealUser::setHostname(const String& newhost)
 void UnrealUser::setIdent(const String& newident)
 {
 	ident_ = newident;
+	accountMemory();
 }
 
 /**
@@ -1512,6 +1793,8 @@ void UnrealUser::setListener(UnrealListener* lptr)
  */
 void UnrealUser::setNick(const String& newnick)
 {
+	String oldnick = nickname_;
+
 	/* if there is already a nickname set, remove it from the nicklist */
 	if (!nickname_.empty())
 	{
@@ -1522,9 +1805,18 @@ void UnrealUser::setNick(const String& newnick)
 	}
 
 	nickname_ = newnick;
+	accountMemory();
 
 	/* add the new nick into the nick map */
 	unreal->nicks.add(lowerNick(), this);
+	unreal->userindex.update(this);
+
+	/* the nick is cached in the NAMES replies */
+	foreach (List<UnrealChannel*>::Iterator, ci, channels)
+		(*ci)->updateNames(this);
+
+	if (registered_)
+		UnrealUser::onNickChange(this, oldnick);
 }
 
 /**
@@ -1535,6 +1827,7 @@ void UnrealUser::setNick(const String& newnick)
 void UnrealUser::setRealHostname(const String& newhost)
 {
 	real_hostname_ = newhost;
+	accountMemory();
 }
 
 /**
@@ -1545,6 +1838,8 @@ void UnrealUser::setRealHostname(const String& newhost)
 void UnrealUser::setRealname(const String& rn)
 {
 	realname_ = rn;
+	accountMemory();
+	unreal->userindex.update(this);
 }
 
 /**
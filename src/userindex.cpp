@@ -0,0 +1,275 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         userindex.cpp
+ * Description  User search index
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <userindex.hpp>
+
+/**
+ * UnrealUserIndex constructor.
+ */
+UnrealUserIndex::UnrealUserIndex()
+	: index_realname_(false)
+{ }
+
+/**
+ * Add a user to the index.
+ *
+ * @param uptr User pointer
+ */
+void UnrealUserIndex::add(UnrealUser* uptr)
+{
+	if (keys_.contains(uptr))
+		return;
+
+	Keys k;
+	k.nick = uptr->lowerNick();
+	k.host = String(uptr->hostname()).toLower();
+	k.ip = String(uptr->ip()).toLower();
+
+	insert(nick_, k.nick, uptr);
+	insert(rnick_, reversed(k.nick), uptr);
+	insert(host_, k.host, uptr);
+	insert(rhost_, reversed(k.host), uptr);
+	insert(ip_, k.ip, uptr);
+	insert(rip_, reversed(k.ip), uptr);
+
+	if (index_realname_)
+	{
+		k.realname = String(uptr->realname()).toLower();
+
+		insert(realname_, k.realname, uptr);
+		insert(rrealname_, reversed(k.realname), uptr);
+	}
+
+	keys_.add(uptr, k);
+}
+
+/**
+ * Returns whether the specified user is indexed.
+ *
+ * @param uptr User pointer
+ * @return true when indexed, otherwise false
+ */
+bool UnrealUserIndex::contains(UnrealUser* uptr) const
+{
+	return keys_.contains(uptr);
+}
+
+/**
+ * Remove a single (key, user) pair from a tree.
+ *
+ * @param tree Tree
+ * @param key Key the user has been inserted with
+ * @param uptr User pointer
+ */
+void UnrealUserIndex::erase(Tree& tree, const String& key, UnrealUser* uptr)
+{
+	std::pair<Tree::iterator, Tree::iterator> range = tree.equal_range(key);
+
+	for (Tree::iterator i = range.first; i != range.second; ++i)
+	{
+		if (i->second == uptr)
+		{
+			tree.erase(i);
+			break;
+		}
+	}
+}
+
+/**
+ * Find all users with a property starting with the specified prefix.
+ * The prefix must not contain any wildcards.
+ *
+ * @param field Property to search
+ * @param prefix Prefix, any case
+ * @param result List the matching users are appended to
+ * @return false if the property is not indexed, otherwise true
+ */
+bool UnrealUserIndex::findPrefix(Field field, const String& prefix,
+	List<UnrealUser*>& result)
+{
+	String lp = String(prefix).toLower();
+
+	switch (field)
+	{
+		case Nick:
+			lookup(nick_, lp, result);
+			return true;
+
+		case Host:
+			lookup(host_, lp, result);
+			return true;
+
+		case IP:
+			lookup(ip_, lp, result);
+			return true;
+
+		case Realname:
+			if (!index_realname_)
+				return false;
+
+			lookup(realname_, lp, result);
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Find all users with a property ending with the specified suffix.
+ * The suffix must not contain any wildcards.
+ *
+ * @param field Property to search
+ * @param suffix Suffix, any case
+ * @param result List the matching users are appended to
+ * @return false if the property is not indexed, otherwise true
+ */
+bool UnrealUserIndex::findSuffix(Field field, const String& suffix,
+	List<UnrealUser*>& result)
+{
+	String ls = reversed(String(suffix).toLower());
+
+	switch (field)
+	{
+		case Nick:
+			lookup(rnick_, ls, result);
+			return true;
+
+		case Host:
+			lookup(rhost_, ls, result);
+			return true;
+
+		case IP:
+			lookup(rip_, ls, result);
+			return true;
+
+		case Realname:
+			if (!index_realname_)
+				return false;
+
+			lookup(rrealname_, ls, result);
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Insert a (key, user) pair into a tree.
+ *
+ * @param tree Tree
+ * @param key Key
+ * @param uptr User pointer
+ */
+void UnrealUserIndex::insert(Tree& tree, const String& key, UnrealUser* uptr)
+{
+	tree.insert(std::pair<String, UnrealUser*>(key, uptr));
+}
+
+/**
+ * Append all users of a tree whose key starts with the specified prefix.
+ *
+ * @param tree Tree
+ * @param prefix Lowercase prefix
+ * @param result List the users are appended to
+ */
+void UnrealUserIndex::lookup(Tree& tree, const String& prefix,
+	List<UnrealUser*>& result)
+{
+	for (Tree::iterator i = tree.lower_bound(prefix);
+		i != tree.end() && i->first.compare(0, prefix.size(), prefix) == 0;
+		++i)
+	{
+		result << i->second;
+	}
+}
+
+/**
+ * Remove a user from the index.
+ *
+ * @param uptr User pointer
+ */
+void UnrealUserIndex::remove(UnrealUser* uptr)
+{
+	Map<UnrealUser*, Keys>::Iterator ki = keys_.find(uptr);
+
+	if (ki == keys_.end())
+		return;
+
+	Keys& k = ki->second;
+
+	erase(nick_, k.nick, uptr);
+	erase(rnick_, reversed(k.nick), uptr);
+	erase(host_, k.host, uptr);
+	erase(rhost_, reversed(k.host), uptr);
+	erase(ip_, k.ip, uptr);
+	erase(rip_, reversed(k.ip), uptr);
+
+	if (index_realname_)
+	{
+		erase(realname_, k.realname, uptr);
+		erase(rrealname_, reversed(k.realname), uptr);
+	}
+
+	keys_.erase(ki);
+}
+
+/**
+ * Returns the reversed version of a string.
+ *
+ * @param str Input string
+ * @return Reversed string
+ */
+String UnrealUserIndex::reversed(const String& str)
+{
+	return String(std::string(str.rbegin(), str.rend()));
+}
+
+/**
+ * Set whether real names are indexed. This must be called before any user
+ * has been added.
+ *
+ * @param enabled Enable flag
+ */
+void UnrealUserIndex::setIndexRealname(bool enabled)
+{
+	if (keys_.empty())
+		index_realname_ = enabled;
+}
+
+/**
+ * Update the index entries of a user after its nickname, hostname,
+ * IP address or real name has changed. Users not in the index are ignored.
+ *
+ * @param uptr User pointer
+ */
+void UnrealUserIndex::update(UnrealUser* uptr)
+{
+	if (keys_.contains(uptr))
+	{
+		remove(uptr);
+		add(uptr);
+	}
+}
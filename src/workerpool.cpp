@@ -0,0 +1,280 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         workerpool.cpp
+ * Description  Worker threads for blocking operations
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <workerpool.hpp>
+
+#include <cstring>
+#include <exception>
+#include <boost/bind.hpp>
+
+/**
+ * UnrealWorkerPool constructor.
+ */
+UnrealWorkerPool::UnrealWorkerPool()
+	: stopping_(false), pending_(0), generation_(0)
+{
+	memset(&counters_, 0, sizeof(counters_));
+}
+
+/**
+ * UnrealWorkerPool destructor.
+ */
+UnrealWorkerPool::~UnrealWorkerPool()
+{
+	stop();
+}
+
+/**
+ * Detach all jobs from a user, so their completion handlers won't be
+ * called. The jobs themselves still run to the end.
+ *
+ * @param uptr User pointer
+ */
+void UnrealWorkerPool::cancel(UnrealUser* uptr)
+{
+	HashMap<UnrealUser*, List<TaskPtr> >::Iterator oi = owned_.find(uptr);
+
+	if (oi == owned_.end())
+		return;
+
+	foreach (List<TaskPtr>::Iterator, ti, oi->second)
+		(*ti)->orphaned = true;
+
+	owned_.erase(oi);
+}
+
+/**
+ * Run on the reactor once a job has been done; calls the completion handler
+ * unless the owner has gone in between.
+ *
+ * @param task Finished task
+ */
+void UnrealWorkerPool::complete(TaskPtr task)
+{
+	if (task->generation != generation_)
+		return;
+
+	if (pending_ > 0)
+		pending_--;
+
+	if (task->orphaned)
+	{
+		/* the owner was destroyed while the job was running */
+		counters_.orphaned++;
+		return;
+	}
+
+	if (task->owner)
+	{
+		HashMap<UnrealUser*, List<TaskPtr> >::Iterator oi =
+			owned_.find(task->owner);
+
+		if (oi != owned_.end())
+		{
+			oi->second.remove(task);
+
+			if (oi->second.empty())
+				owned_.erase(oi);
+		}
+	}
+
+	if (task->done)
+		task->done();
+}
+
+/**
+ * Returns the counters.
+ *
+ * @return Counters
+ */
+const UnrealWorkerPool::Counters& UnrealWorkerPool::counters()
+{
+	return counters_;
+}
+
+/**
+ * Returns the number of jobs which haven't completed yet.
+ *
+ * @return Job count
+ */
+size_t UnrealWorkerPool::pending()
+{
+	return pending_;
+}
+
+/**
+ * Launch the worker threads.
+ */
+void UnrealWorkerPool::start()
+{
+	size_t count = unreal->config.get("Workers::Threads", "2").toSize();
+
+	stopping_ = false;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		threads_ << new boost::thread(
+			boost::bind(&UnrealWorkerPool::work, this));
+	}
+}
+
+/**
+ * Stop and join the worker threads. Jobs still waiting for a thread are
+ * discarded, and completions not run yet are dropped. The pool is started
+ * again with the next job.
+ */
+void UnrealWorkerPool::stop()
+{
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		stopping_ = true;
+		queue_.clear();
+	}
+
+	wakeup_.notify_all();
+
+	foreach (List<boost::thread*>::Iterator, ti, threads_)
+	{
+		(*ti)->join();
+		delete *ti;
+	}
+
+	threads_.clear();
+	owned_.clear();
+	pending_ = 0;
+	generation_++;
+}
+
+/**
+ * Queue a job for the worker threads. Must be called on the reactor.
+ *
+ * @param owner User the completion belongs to; 0 for none
+ * @param job Work to be done on a worker thread
+ * @param done Completion handler, run on the reactor afterwards
+ * @return False if the queue is full, otherwise true
+ */
+bool UnrealWorkerPool::submit(UnrealUser* owner, const Job& job,
+	const Completion& done)
+{
+	size_t max_queue = unreal->config.get("Workers::MaxQueue", "1024")
+		.toSize();
+
+	if (threads_.empty())
+		start();
+
+	TaskPtr task(new Task);
+	task->owner = owner;
+	task->orphaned = false;
+	task->job = job;
+	task->done = done;
+	task->generation = generation_;
+
+	if (threads_.empty())
+	{
+		/* no worker threads configured; do the work right here */
+		try
+		{
+			job();
+		}
+		catch (std::exception&)
+		{ }
+	}
+	else
+	{
+		boost::mutex::scoped_lock lock(mutex_);
+
+		if (max_queue > 0 && queue_.size() >= max_queue)
+		{
+			counters_.rejected++;
+			return false;
+		}
+
+		queue_.push_back(task);
+	}
+
+	if (owner)
+		owned_[owner] << task;
+
+	pending_++;
+	counters_.submitted++;
+
+	if (threads_.empty())
+	{
+		unreal->reactor().post(
+			boost::bind(&UnrealWorkerPool::complete, this, task));
+	}
+	else
+		wakeup_.notify_one();
+
+	return true;
+}
+
+/**
+ * Returns the number of worker threads.
+ *
+ * @return Thread count
+ */
+size_t UnrealWorkerPool::threads()
+{
+	return threads_.size();
+}
+
+/**
+ * Worker thread main loop.
+ */
+void UnrealWorkerPool::work()
+{
+	for (;;)
+	{
+		TaskPtr task;
+
+		{
+			boost::mutex::scoped_lock lock(mutex_);
+
+			while (queue_.empty() && !stopping_)
+				wakeup_.wait(lock);
+
+			if (stopping_)
+				return;
+
+			task = queue_.front();
+			queue_.pop_front();
+		}
+
+		try
+		{
+			task->job();
+		}
+		catch (std::exception&)
+		{
+			/* the completion handler has to check the outcome anyway */
+		}
+
+		unreal->reactor().post(
+			boost::bind(&UnrealWorkerPool::complete, this, task));
+	}
+}
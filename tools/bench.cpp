@@ -0,0 +1,761 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         bench.cpp
+ * Description  Microbenchmarks of the core primitives
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <listener.hpp>
+#include <manualclock.hpp>
+#include <recvq.hpp>
+#include <version.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * unreal-bench measures the cost of the primitives on the hot paths of
+ * the server: string handling, line parsing, the receive queue, container
+ * lookups, mode tables, channel bans and channel fanout.
+ *
+ * Each benchmark is calibrated to run for --min-time, repeated
+ * --repetitions times, and reported as nanoseconds per operation. With
+ * --json, the results are printed as one JSON document, so runs of
+ * different releases can be compared by scripts.
+ *
+ * The server core is set up from a minimal configuration without
+ * listeners or modules. Channel members are users on local socket pairs,
+ * so fanout includes the real write path. The loopback benchmarks attach
+ * in-memory clients and step through their timeouts on a manual clock;
+ * they exit with an error if the clients don't behave as expected.
+ */
+
+/** nanoseconds excluded from the current measurement */
+static uint64_t paused_ns = 0;
+
+/** start of the current pause */
+static uint64_t pause_started = 0;
+
+/** sink for results, so the compiler can't drop the benchmarked code */
+static volatile size_t sink = 0;
+
+/**
+ * Returns the monotonic time in nanoseconds.
+ *
+ * @return Time in nanoseconds
+ */
+static uint64_t now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL
+		+ static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/**
+ * Stop the clock, e.g. while draining sockets between batches.
+ */
+static void pauseTiming()
+{
+	pause_started = now();
+}
+
+/**
+ * Continue the clock after pauseTiming().
+ */
+static void resumeTiming()
+{
+	paused_ns += now() - pause_started;
+}
+
+/**
+ * Users connected through socket pairs, for fanout benchmarks.
+ */
+class UnrealBenchUsers
+{
+public:
+	/**
+	 * Returns a user, creating it if needed.
+	 *
+	 * @param index User number
+	 * @return User
+	 */
+	static UnrealUser* get(size_t index)
+	{
+		while (users_.size() <= index)
+		{
+			int fds[2];
+
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+			{
+				std::perror("socketpair");
+				std::exit(1);
+			}
+
+			int size = 1 << 20;
+			setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+			UnrealSocket* sptr = new UnrealSocket();
+			sptr->assign(tcp::v4(), fds[0]);
+
+			UnrealUser* uptr = new UnrealUser(sptr);
+			uptr->setNick(String::format("bench%d",
+				static_cast<int>(users_.size())));
+			uptr->setIdent("bench");
+			uptr->setHostname(String::format("host%d.bench.example.net",
+				static_cast<int>(users_.size())));
+
+			users_ << uptr;
+			peers_ << fds[1];
+		}
+
+		return users_[index];
+	}
+
+	/**
+	 * Complete pending writes and discard what the users have received.
+	 */
+	static void drain()
+	{
+		char buffer[65536];
+
+		unreal->reactor().poll();
+
+		for (size_t i = 0; i < peers_.size(); ++i)
+		{
+			while (recv(peers_[i], buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+				;
+		}
+
+		unreal->reactor().poll();
+	}
+
+private:
+	/** users */
+	static List<UnrealUser*> users_;
+
+	/** receiving ends of the socket pairs */
+	static List<int> peers_;
+};
+
+List<UnrealUser*> UnrealBenchUsers::users_;
+List<int> UnrealBenchUsers::peers_;
+
+/**
+ * Benchmark function; runs the operation the given number of times.
+ */
+typedef void (*UnrealBenchFunction)(uint64_t iterations, size_t param);
+
+/**
+ * Benchmark entry.
+ */
+struct UnrealBenchmark
+{
+	/** name */
+	const char* name;
+
+	/** function */
+	UnrealBenchFunction fn;
+
+	/** parameter, e.g. the number of bans or members */
+	size_t param;
+};
+
+/**
+ * String::match against a literal mask.
+ */
+static void benchMatchLiteral(uint64_t iterations, size_t param)
+{
+	String str = "nick!user@host.example.net";
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += str.match("nick!user@host.example.net");
+}
+
+/**
+ * String::match against a mask with wildcards.
+ */
+static void benchMatchWildcard(uint64_t iterations, size_t param)
+{
+	String str = "nick!user@host.example.net";
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += str.match("*!*@*.example.?et");
+}
+
+/**
+ * String::split of a typical command line.
+ */
+static void benchSplit(uint64_t iterations, size_t param)
+{
+	String str = ":nick!user@host PRIVMSG #channel :hello there, how are you";
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += str.split(" ").size();
+}
+
+/**
+ * String::toLower of a nickname.
+ */
+static void benchToLower(uint64_t iterations, size_t param)
+{
+	String str = "SomeNickName[AWAY]";
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += str.toLower().length();
+}
+
+/**
+ * String::toUpper of a command name.
+ */
+static void benchToUpper(uint64_t iterations, size_t param)
+{
+	String str = "privmsg";
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += str.toUpper().length();
+}
+
+/**
+ * UnrealListener::splitLine of a message with a trailing argument.
+ */
+static void benchSplitLine(uint64_t iterations, size_t param)
+{
+	for (uint64_t i = 0; i < iterations; ++i)
+	{
+		String str = "PRIVMSG #channel :hello there, how are you doing today";
+		sink += UnrealListener::splitLine(str).size();
+	}
+}
+
+/**
+ * UnrealRecvQueue::add followed by getline.
+ */
+static void benchRecvQAddGetline(uint64_t iterations, size_t param)
+{
+	UnrealRecvQueue rq;
+	String line = "PRIVMSG #channel :hello there, how are you doing today";
+
+	for (uint64_t i = 0; i < iterations; ++i)
+	{
+		rq.add(line);
+		sink += rq.getline().length();
+	}
+}
+
+/**
+ * UnrealRecvQueue::size with a number of lines queued.
+ */
+static void benchRecvQSize(uint64_t iterations, size_t param)
+{
+	pauseTiming();
+
+	UnrealRecvQueue rq;
+
+	for (size_t i = 0; i < param; ++i)
+		rq.add("PRIVMSG #channel :hello there, how are you doing today");
+
+	resumeTiming();
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += rq.size();
+}
+
+/**
+ * Map lookup by nickname.
+ */
+static void benchMapFind(uint64_t iterations, size_t param)
+{
+	pauseTiming();
+
+	Map<String, size_t> map;
+	List<String> keys;
+
+	for (size_t i = 0; i < param; ++i)
+	{
+		keys << String::format("nick%d", static_cast<int>(i));
+		map.add(keys.back(), i);
+	}
+
+	resumeTiming();
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += map.find(keys[i % param])->second;
+}
+
+/**
+ * List::contains of the last element.
+ */
+static void benchListContains(uint64_t iterations, size_t param)
+{
+	pauseTiming();
+
+	List<size_t> list;
+
+	for (size_t i = 0; i < param; ++i)
+		list << i;
+
+	resumeTiming();
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += list.contains(param - 1);
+}
+
+/**
+ * Channel mode table lookup.
+ */
+static void benchModeLookup(uint64_t iterations, size_t param)
+{
+	static const char modes[] = "biklmnopstv";
+
+	for (uint64_t i = 0; i < iterations; ++i)
+	{
+		sink += UnrealChannelProperties::ModeTable.lookup(
+			modes[i % (sizeof(modes) - 1)]).mode_char;
+	}
+}
+
+/**
+ * UnrealChannel::isBanned for a user matching none of the bans.
+ */
+static void benchIsBanned(uint64_t iterations, size_t param)
+{
+	pauseTiming();
+
+	UnrealChannel* chptr = new UnrealChannel(
+		String::format("#bans%d", static_cast<int>(param)));
+	UnrealUser* uptr = UnrealBenchUsers::get(0);
+
+	for (size_t i = 0; i < param; ++i)
+		chptr->addBan(String::format("*!*@host%d.banned.example.org",
+			static_cast<int>(i)), "bench");
+
+	resumeTiming();
+
+	for (uint64_t i = 0; i < iterations; ++i)
+		sink += chptr->isBanned(uptr);
+
+	pauseTiming();
+
+	delete chptr;
+
+	resumeTiming();
+}
+
+/**
+ * UnrealChannel::sendlocalreply to a number of members.
+ */
+static void benchSendLocalReply(uint64_t iterations, size_t param)
+{
+	pauseTiming();
+
+	UnrealChannel* chptr = new UnrealChannel(
+		String::format("#fanout%d", static_cast<int>(param)));
+
+	for (size_t i = 0; i < param; ++i)
+		chptr->addMember(UnrealBenchUsers::get(i), 0);
+
+	UnrealUser* uptr = UnrealBenchUsers::get(0);
+
+	resumeTiming();
+
+	for (uint64_t i = 0; i < iterations; ++i)
+	{
+		chptr->sendlocalreply(uptr, "PRIVMSG",
+			":hello there, how are you doing today", true);
+
+		/* keep the send queues from growing */
+		if ((i & 63) == 63)
+		{
+			pauseTiming();
+			UnrealBenchUsers::drain();
+			resumeTiming();
+		}
+	}
+
+	pauseTiming();
+
+	UnrealBenchUsers::drain();
+
+	/* the members keep a pointer to the channel */
+	while (!chptr->members.empty())
+		chptr->removeMember(chptr->members.begin()->first);
+
+	delete chptr;
+
+	resumeTiming();
+}
+
+/**
+ * Abort the run when a benchmark doesn't behave as expected.
+ *
+ * @param bench Benchmark name
+ * @param message What went wrong
+ */
+static void benchFailure(const char* bench, const String& message)
+{
+	std::fprintf(stderr, "%s: %s\n", bench, message.c_str());
+	std::exit(1);
+}
+
+/**
+ * Listener for loopback clients; it is never bound.
+ *
+ * @return Listener
+ */
+static UnrealListener* loopbackListener()
+{
+	static UnrealListener* lptr = 0;
+
+	if (!lptr)
+	{
+		lptr = new UnrealListener("127.0.0.1", 6667);
+		lptr->setMaxConnections(100000);
+		lptr->setPingFrequency(120);
+	}
+
+	return lptr;
+}
+
+/**
+ * Lifecycle of loopback clients on a manual clock. Every iteration
+ * attaches a number of clients and registers every other one; the others
+ * run into the auth timeout. The registered ones get a PING on the first
+ * ping check and, as they never answer, exit on the second one.
+ */
+static void benchLoopbackLifecycle(uint64_t iterations, size_t param)
+{
+	static const char* name = "loopback.lifecycle";
+
+	pauseTiming();
+
+	UnrealListener* lptr = loopbackListener();
+	UnrealManualClock clock(UnrealTime::now().toTS(),
+		UnrealTime::monotonic());
+	std::time_t auth_timeout =
+		unreal->config.get("Limits::AuthTimeout", "12").toInt();
+	std::time_t ping_freq = lptr->pingFrequency();
+
+	UnrealTime::setClock(&clock);
+
+	resumeTiming();
+
+	for (uint64_t i = 0; i < iterations; ++i)
+	{
+		List<UnrealSocket*> registered;
+
+		for (size_t c = 0; c < param; ++c)
+		{
+			UnrealSocket* sptr = lptr->attachLoopback("127.0.0.1",
+				static_cast<uint16_t>(1024 + c));
+
+			if (!sptr)
+				benchFailure(name, "loopback client refused");
+
+			if (c % 2 != 0)
+				continue;
+
+			/* what NICK, USER and PONG do; bench runs without modules */
+			UnrealUser* uptr = UnrealUser::find(sptr);
+
+			uptr->setNick(String::format("loop%d", static_cast<int>(c)));
+			uptr->setIdent("~loop");
+			uptr->setRealname("loopback client");
+			uptr->authflags().revoke(UnrealUser::AFNick);
+			uptr->authflags().revoke(UnrealUser::AFUser);
+			uptr->sendPing();
+			uptr->registerUser();
+			uptr->setLastPongTime(UnrealTime::now());
+
+			registered << sptr;
+		}
+
+		unreal->reactor().poll();
+
+		foreach (List<UnrealSocket*>::Iterator, si, registered)
+		{
+			if ((*si)->takeOutput().find(" 001 ") == String::npos)
+				benchFailure(name, "no RPL_WELCOME after registration");
+		}
+
+		/* the unregistered half times out */
+		clock.advanceSeconds(auth_timeout);
+		unreal->reactor().poll();
+
+		if (lptr->connections.size() != registered.size())
+		{
+			benchFailure(name, String::format("%d connections left after "
+				"the auth timeout, expected %d",
+				static_cast<int>(lptr->connections.size()),
+				static_cast<int>(registered.size())));
+		}
+
+		/* the first ping check sends a PING */
+		clock.advanceSeconds(ping_freq);
+		unreal->reactor().poll();
+
+		foreach (List<UnrealSocket*>::Iterator, si, registered)
+		{
+			if ((*si)->takeOutput().find("PING :") == String::npos)
+				benchFailure(name, "no PING on the ping check");
+		}
+
+		/* no PONG, so the second one drops them */
+		clock.advanceSeconds(ping_freq);
+		unreal->reactor().poll();
+
+		if (!lptr->connections.empty())
+		{
+			benchFailure(name, String::format("%d connections left after "
+				"the ping timeout",
+				static_cast<int>(lptr->connections.size())));
+		}
+	}
+
+	pauseTiming();
+
+	UnrealTime::setClock(0);
+
+	resumeTiming();
+}
+
+/** all benchmarks */
+static const UnrealBenchmark benchmarks[] = {
+	{ "string.match.literal", &benchMatchLiteral, 0 },
+	{ "string.match.wildcard", &benchMatchWildcard, 0 },
+	{ "string.split", &benchSplit, 0 },
+	{ "string.toLower", &benchToLower, 0 },
+	{ "string.toUpper", &benchToUpper, 0 },
+	{ "listener.splitLine", &benchSplitLine, 0 },
+	{ "recvq.add_getline", &benchRecvQAddGetline, 0 },
+	{ "recvq.size/1", &benchRecvQSize, 1 },
+	{ "recvq.size/10", &benchRecvQSize, 10 },
+	{ "map.find/100", &benchMapFind, 100 },
+	{ "map.find/10000", &benchMapFind, 10000 },
+	{ "list.contains/10", &benchListContains, 10 },
+	{ "list.contains/1000", &benchListContains, 1000 },
+	{ "modetable.lookup", &benchModeLookup, 0 },
+	{ "channel.isBanned/0", &benchIsBanned, 0 },
+	{ "channel.isBanned/10", &benchIsBanned, 10 },
+	{ "channel.isBanned/100", &benchIsBanned, 100 },
+	{ "channel.sendlocalreply/1", &benchSendLocalReply, 1 },
+	{ "channel.sendlocalreply/10", &benchSendLocalReply, 10 },
+	{ "channel.sendlocalreply/100", &benchSendLocalReply, 100 },
+	{ "channel.sendlocalreply/1000", &benchSendLocalReply, 1000 },
+	{ "loopback.lifecycle/10", &benchLoopbackLifecycle, 10 },
+	{ "loopback.lifecycle/100", &benchLoopbackLifecycle, 100 }
+};
+
+/** number of benchmarks */
+static const size_t benchmark_count =
+	sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+/**
+ * Run a benchmark once.
+ *
+ * @param bench Benchmark
+ * @param iterations Number of iterations
+ * @return Elapsed nanoseconds, without paused time
+ */
+static uint64_t measure(const UnrealBenchmark& bench, uint64_t iterations)
+{
+	paused_ns = 0;
+
+	uint64_t started = now();
+	bench.fn(iterations, bench.param);
+	uint64_t elapsed = now() - started;
+
+	return (elapsed > paused_ns ? elapsed - paused_ns : 0);
+}
+
+/**
+ * Set up the server core from a minimal configuration. Its log output
+ * is discarded.
+ *
+ * @param argv0 Program name
+ */
+static void setupCore(const char* argv0)
+{
+	char path[] = "/tmp/unreal-bench.XXXXXX";
+	int fd = mkstemp(path);
+
+	if (fd == -1)
+	{
+		std::perror("mkstemp");
+		std::exit(1);
+	}
+
+	std::ofstream conf(path);
+	conf << "Me {\n"
+		 << "  ServerName \"bench.example.net\";\n"
+		 << "  Numeric 1;\n"
+		 << "};\n"
+		 << "Bans {\n"
+		 << "  File \"/nonexistent/bans.db\";\n"
+		 << "};\n"
+		 << "Throttle {\n"
+		 << "  Exempt \"127.0.0.1\";\n"
+		 << "};\n"
+		 << "Trace {\n"
+		 << "  Size 0;\n"
+		 << "};\n";
+	conf.close();
+	close(fd);
+
+	char* args[] = { const_cast<char*>(argv0), const_cast<char*>("-i"),
+		const_cast<char*>("-c"), path, 0 };
+	std::ostringstream discard;
+	std::streambuf* out = std::cout.rdbuf(discard.rdbuf());
+
+	new UnrealBase(4, args);
+
+	std::cout.rdbuf(out);
+	unlink(path);
+}
+
+/**
+ * Print the command line help.
+ *
+ * @param name Program name
+ */
+static void usage(const char* name)
+{
+	std::cerr
+		<< "Usage: " << name << " [options] [filter]\n"
+		<< "  --json               print the results as JSON\n"
+		<< "  --list               list the benchmarks\n"
+		<< "  --min-time=SECS      minimum time per repetition (0.2)\n"
+		<< "  --repetitions=N      repetitions per benchmark (3)\n"
+		<< "Only benchmarks whose name contains the filter are run.\n";
+}
+
+int main(int argc, char** argv)
+{
+	bool json = false;
+	double min_time = 0.2;
+	int repetitions = 3;
+	std::string filter;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--json")
+			json = true;
+		else if (arg == "--list")
+		{
+			for (size_t b = 0; b < benchmark_count; ++b)
+				std::cout << benchmarks[b].name << std::endl;
+
+			return 0;
+		}
+		else if (arg.compare(0, 11, "--min-time=") == 0)
+			min_time = std::atof(arg.c_str() + 11);
+		else if (arg.compare(0, 14, "--repetitions=") == 0)
+			repetitions = std::atoi(arg.c_str() + 14);
+		else if (arg.compare(0, 2, "--") == 0)
+		{
+			usage(argv[0]);
+			return (arg == "--help" ? 0 : 1);
+		}
+		else
+			filter = arg;
+	}
+
+	if (repetitions < 1)
+		repetitions = 1;
+
+	setupCore(argv[0]);
+
+	if (json)
+		std::printf("{\"version\":\"%s\",\"benchmarks\":[", PACKAGE_VERSION);
+	else
+		std::printf("%-30s %12s %12s %12s %12s\n", "benchmark", "iterations",
+			"ns/op", "min ns/op", "max ns/op");
+
+	bool first = true;
+
+	for (size_t b = 0; b < benchmark_count; ++b)
+	{
+		const UnrealBenchmark& bench = benchmarks[b];
+
+		if (!filter.empty() && std::strstr(bench.name, filter.c_str()) == 0)
+			continue;
+
+		/* calibrate the number of iterations to the minimum time */
+		uint64_t target = static_cast<uint64_t>(min_time * 1e9);
+		uint64_t iterations = 1;
+		uint64_t elapsed;
+
+		while ((elapsed = measure(bench, iterations)) < target / 10
+				&& iterations < (1ULL << 40))
+			iterations *= 10;
+
+		if (elapsed > 0 && elapsed < target)
+			iterations = iterations * target / elapsed + 1;
+
+		std::vector<double> results;
+
+		for (int r = 0; r < repetitions; ++r)
+		{
+			results.push_back(static_cast<double>(
+				measure(bench, iterations)) / iterations);
+		}
+
+		std::sort(results.begin(), results.end());
+
+		double median = results[results.size() / 2];
+
+		if (json)
+		{
+			std::printf("%s\n{\"name\":\"%s\",\"iterations\":%llu,"
+				"\"ns_per_op\":%.2f,\"min_ns_per_op\":%.2f,"
+				"\"max_ns_per_op\":%.2f}", first ? "" : ",", bench.name,
+				static_cast<unsigned long long>(iterations), median,
+				results.front(), results.back());
+		}
+		else
+		{
+			std::printf("%-30s %12llu %12.1f %12.1f %12.1f\n", bench.name,
+				static_cast<unsigned long long>(iterations), median,
+				results.front(), results.back());
+		}
+
+		std::fflush(stdout);
+		first = false;
+	}
+
+	if (json)
+		std::printf("\n]}\n");
+
+	return 0;
+}
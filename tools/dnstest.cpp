@@ -0,0 +1,779 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         dnstest.cpp
+ * Description  Resolver tests against a stub nameserver
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <base.hpp>
+#include <resolver.hpp>
+#include <timer.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+
+/**
+ * unreal-dnstest runs the resolver of the server core against a stub
+ * nameserver on 127.0.0.1. The stub lives in the same reactor and
+ * answers A and PTR queries from a table; answers can be delayed or
+ * withheld per name. The cases are:
+ *
+ *   timeout      a lookup the stub never answers fails after DNS::Timeout
+ *   mismatch     a client whose PTR name resolves to another address
+ *                keeps its IP address as hostname
+ *   concurrency  many lookups at once never exceed DNS::MaxQueries at the
+ *                nameserver, and all of them complete
+ *
+ * The exit status is 0 if all cases passed.
+ */
+
+using boost::asio::ip::udp;
+
+/** DNS::Timeout for the tests, in milliseconds */
+static const int dns_timeout = 500;
+
+/** DNS::MaxQueries for the tests */
+static const size_t dns_max_queries = 8;
+
+/** number of lookups started by the concurrency case */
+static const size_t burst_lookups = 200;
+
+/**
+ * Stub nameserver.
+ */
+class UnrealStubDNS
+{
+public:
+	/** how the stub handles a name */
+	struct Rule
+	{
+		/** address (A) or hostname (PTR) to answer with */
+		String answer;
+
+		/** delay of the answer, in milliseconds */
+		uint32_t delay;
+
+		/** whether to never answer */
+		bool drop;
+	};
+
+	/** answer waiting for its delay */
+	struct Reply
+	{
+		/** timer of the delay */
+		UnrealTimer timer;
+
+		/** packet */
+		std::string packet;
+
+		/** address of the resolver */
+		udp::endpoint to;
+	};
+
+public:
+	/**
+	 * UnrealStubDNS constructor.
+	 *
+	 * @param fd UDP socket, already bound
+	 */
+	UnrealStubDNS(int fd)
+		: socket_(unreal->reactor()), pending_(0), max_pending_(0),
+		  received_(0)
+	{
+		socket_.assign(udp::v4(), fd);
+		receive();
+	}
+
+	/**
+	 * Add an answer for a name.
+	 *
+	 * @param type "A" or "PTR"
+	 * @param name Queried name
+	 * @param answer Address or hostname
+	 * @param delay Delay in milliseconds
+	 */
+	void add(const String& type, const String& name, const String& answer,
+		uint32_t delay = 0)
+	{
+		Rule rule;
+		rule.answer = answer;
+		rule.delay = delay;
+		rule.drop = false;
+
+		rules_[type + " " + name] = rule;
+	}
+
+	/**
+	 * Never answer queries for a name.
+	 *
+	 * @param type "A" or "PTR"
+	 * @param name Queried name
+	 */
+	void drop(const String& type, const String& name)
+	{
+		Rule rule;
+		rule.delay = 0;
+		rule.drop = true;
+
+		rules_[type + " " + name] = rule;
+	}
+
+	/**
+	 * Returns the highest number of queries waiting for their answer at
+	 * the same time, since the last reset().
+	 *
+	 * @return Number of queries
+	 */
+	size_t maxPending()
+	{
+		return max_pending_;
+	}
+
+	/**
+	 * Returns the number of queries received since the last reset().
+	 *
+	 * @return Number of queries
+	 */
+	size_t received()
+	{
+		return received_;
+	}
+
+	/**
+	 * Reset the counters.
+	 */
+	void reset()
+	{
+		max_pending_ = pending_;
+		received_ = 0;
+	}
+
+private:
+	/**
+	 * Build the reply to a query.
+	 *
+	 * @param query Query packet
+	 * @param qend End of the question section
+	 * @param qtype Query type
+	 * @param rule Rule of the name; 0 for NXDOMAIN
+	 * @return Reply packet; empty if the answer is invalid
+	 */
+	static std::string build(const std::string& query, size_t qend,
+		uint16_t qtype, const Rule* rule)
+	{
+		std::string rdata;
+
+		if (rule && qtype == ns_t_a)
+		{
+			struct in_addr addr;
+
+			if (inet_pton(AF_INET, rule->answer.c_str(), &addr) != 1)
+				return std::string();
+
+			rdata.assign(reinterpret_cast<const char*>(&addr), 4);
+		}
+		else if (rule && qtype == ns_t_ptr)
+		{
+			StringList labels = String(rule->answer).split(".");
+
+			for (StringList::Iterator li = labels.begin();
+					li != labels.end(); ++li)
+			{
+				rdata += static_cast<char>(li->length());
+				rdata += *li;
+			}
+
+			rdata += '\0';
+		}
+
+		std::string reply = query.substr(0, qend);
+
+		/* response, recursion desired as asked, recursion available */
+		reply[2] = static_cast<char>(0x80 | (query[2] & 0x01));
+		reply[3] = static_cast<char>(rule ? 0x80 : 0x83);
+
+		/* one question, answer count, no authority or additional records */
+		const char counts[8] = { 0, 1, 0, rule ? 1 : 0, 0, 0, 0, 0 };
+		reply.replace(4, 8, counts, 8);
+
+		if (rule)
+		{
+			/* pointer to the question name, type, class IN, TTL 60 */
+			const char answer[10] = {
+				static_cast<char>(0xc0), 12,
+				static_cast<char>(qtype >> 8), static_cast<char>(qtype & 0xff),
+				0, 1, 0, 0, 0, 60
+			};
+
+			reply.append(answer, 10);
+			reply += static_cast<char>(rdata.length() >> 8);
+			reply += static_cast<char>(rdata.length() & 0xff);
+			reply += rdata;
+		}
+
+		return reply;
+	}
+
+	/**
+	 * Receive callback.
+	 *
+	 * @param ec Error code
+	 * @param size Size of the packet
+	 */
+	void handleReceive(const boost::system::error_code& ec, size_t size)
+	{
+		if (ec == boost::asio::error::operation_aborted)
+			return;
+
+		if (!ec)
+			handleQuery(std::string(reinterpret_cast<char*>(buffer_), size));
+
+		receive();
+	}
+
+	/**
+	 * Handle a query.
+	 *
+	 * @param query Query packet
+	 */
+	void handleQuery(const std::string& query)
+	{
+		String name;
+		size_t pos = 12;
+
+		if (query.length() <= pos)
+			return;
+
+		/* question name, without compression as sent by resolvers */
+		while (pos < query.length() && query[pos] != 0)
+		{
+			size_t len = static_cast<unsigned char>(query[pos]);
+
+			if (pos + 1 + len > query.length())
+				return;
+
+			if (!name.empty())
+				name += ".";
+
+			name += query.substr(pos + 1, len);
+			pos += 1 + len;
+		}
+
+		if (pos + 5 > query.length())
+			return;
+
+		uint16_t qtype = (static_cast<unsigned char>(query[pos + 1]) << 8)
+			| static_cast<unsigned char>(query[pos + 2]);
+		size_t qend = pos + 5;
+
+		received_++;
+
+		String key = String(qtype == ns_t_ptr ? "PTR " : "A ")
+			+ String(name).toLower();
+		Map<String, Rule>::Iterator ri = rules_.find(key);
+		const Rule* rule = (ri != rules_.end() ? &ri->second : 0);
+
+		if (qtype != ns_t_a && qtype != ns_t_ptr)
+			rule = 0;
+		else if (rule && rule->drop)
+			return;
+
+		Reply* reply = new Reply();
+		reply->packet = build(query, qend, qtype, rule);
+		reply->to = sender_;
+
+		if (reply->packet.empty())
+		{
+			delete reply;
+			return;
+		}
+
+		if (++pending_ > max_pending_)
+			max_pending_ = pending_;
+
+		reply->timer.expires_from_now(boost::posix_time::milliseconds(
+			rule ? rule->delay : 0));
+		reply->timer.async_wait(
+			boost::bind(&UnrealStubDNS::sendReply,
+				this,
+				boost::asio::placeholders::error,
+				reply));
+	}
+
+	/**
+	 * Wait for the next query.
+	 */
+	void receive()
+	{
+		socket_.async_receive_from(
+			boost::asio::buffer(buffer_, sizeof(buffer_)),
+			sender_,
+			boost::bind(&UnrealStubDNS::handleReceive,
+				this,
+				boost::asio::placeholders::error,
+				boost::asio::placeholders::bytes_transferred));
+	}
+
+	/**
+	 * Send a reply once its delay is over.
+	 *
+	 * @param ec Error code
+	 * @param reply Reply
+	 */
+	void sendReply(const UnrealTimer::ErrorCode& ec, Reply* reply)
+	{
+		boost::system::error_code sec;
+
+		if (!ec)
+			socket_.send_to(boost::asio::buffer(reply->packet), reply->to, 0,
+				sec);
+
+		pending_--;
+		delete reply;
+	}
+
+private:
+	/** socket */
+	udp::socket socket_;
+
+	/** receive buffer */
+	unsigned char buffer_[512];
+
+	/** address of the last query */
+	udp::endpoint sender_;
+
+	/** rules by "type name" */
+	Map<String, Rule> rules_;
+
+	/** queries waiting for their answer */
+	size_t pending_;
+
+	/** highest value of pending_ */
+	size_t max_pending_;
+
+	/** queries received */
+	size_t received_;
+};
+
+/**
+ * Lookup started by a test case.
+ */
+struct UnrealDNSTestLookup
+{
+	UnrealDNSTestLookup()
+		: done(false), started(UnrealTime::monotonic()), finished(0)
+	{
+		resolver.onResolve.connect(
+			boost::bind(&UnrealDNSTestLookup::handleResolve,
+				this,
+				boost::asio::placeholders::error,
+				boost::asio::placeholders::iterator));
+	}
+
+	/**
+	 * Resolver callback.
+	 *
+	 * @param e Error code
+	 * @param it Result
+	 */
+	void handleResolve(const UnrealResolver::ErrorCode& e,
+		UnrealResolver::Iterator it)
+	{
+		UnrealResolver::Iterator end;
+
+		done = true;
+		ec = e;
+		finished = UnrealTime::monotonic();
+
+		if (!ec && it != end)
+			address = (*it).endpoint().address().to_string();
+	}
+
+	/** resolver */
+	UnrealResolver resolver;
+
+	/** whether the result arrived */
+	bool done;
+
+	/** error code of the result */
+	UnrealResolver::ErrorCode ec;
+
+	/** first address of the result */
+	String address;
+
+	/** monotonic start time */
+	uint64_t started;
+
+	/** monotonic time the result arrived */
+	uint64_t finished;
+};
+
+/** stub nameserver */
+static UnrealStubDNS* stub = 0;
+
+/**
+ * Run the reactor for a while.
+ *
+ * @param ms Milliseconds
+ * @param done Flag to stop on once set, if any
+ */
+static void runFor(uint32_t ms, const bool* done = 0)
+{
+	uint64_t until = UnrealTime::monotonic() + ms * 1000ULL;
+
+	while (UnrealTime::monotonic() < until && !(done && *done))
+	{
+		unreal->reactor().poll();
+		usleep(1000);
+	}
+}
+
+/**
+ * Report the result of a case.
+ *
+ * @param name Case name
+ * @param failure Reason of the failure; empty if it passed
+ * @return True if the case passed
+ */
+static bool report(const char* name, const String& failure)
+{
+	if (failure.empty())
+		std::printf("PASS %s\n", name);
+	else
+		std::printf("FAIL %s: %s\n", name, failure.c_str());
+
+	std::fflush(stdout);
+
+	return failure.empty();
+}
+
+/**
+ * A lookup the nameserver never answers fails once DNS::Timeout is over.
+ *
+ * @return True if the case passed
+ */
+static bool testTimeout()
+{
+	stub->drop("A", "silent.dnstest.example");
+
+	UnrealDNSTestLookup lookup;
+	lookup.resolver.query("silent.dnstest.example", 6667, AF_INET);
+
+	runFor(dns_timeout * 10, &lookup.done);
+
+	uint64_t elapsed = (lookup.finished - lookup.started) / 1000;
+	String failure;
+
+	if (!lookup.done)
+		failure = "no result after ten times DNS::Timeout";
+	else if (!lookup.ec)
+		failure = "lookup succeeded";
+	else if (elapsed < static_cast<uint64_t>(dns_timeout) * 8 / 10)
+		failure = String::format("failed after %llu ms, before the timeout",
+			static_cast<unsigned long long>(elapsed));
+
+	return report("timeout", failure);
+}
+
+/**
+ * A client whose PTR name resolves to another address keeps its IP
+ * address as hostname.
+ *
+ * @param port Port of the client listener
+ * @return True if the case passed
+ */
+static bool testMismatch(uint16_t port)
+{
+	stub->add("PTR", "1.0.0.127.in-addr.arpa", "spoofed.dnstest.example");
+	stub->add("A", "spoofed.dnstest.example", "192.0.2.1");
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in sin;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	/* the connection completes in the kernel backlog */
+	if (fd == -1 || connect(fd, reinterpret_cast<struct sockaddr*>(&sin),
+			sizeof(sin)) != 0)
+	{
+		if (fd != -1)
+			close(fd);
+
+		return report("mismatch", "can't connect to the listener");
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	std::string received;
+	String failure = "no DNS notice within five seconds";
+	uint64_t until = UnrealTime::monotonic() + 5000000;
+
+	while (UnrealTime::monotonic() < until)
+	{
+		char buffer[4096];
+		ssize_t len;
+
+		unreal->reactor().poll();
+
+		while ((len = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+			received.append(buffer, len);
+
+		if (received.find("do not match") != std::string::npos)
+		{
+			failure.clear();
+			break;
+		}
+		else if (received.find("Retrieved hostname") != std::string::npos)
+		{
+			failure = "the PTR name was accepted";
+			break;
+		}
+		else if (received.find("Couldn't look up") != std::string::npos)
+		{
+			failure = "the lookup failed";
+			break;
+		}
+
+		usleep(1000);
+	}
+
+	close(fd);
+
+	/* let the server clean up the connection */
+	runFor(50);
+
+	return report("mismatch", failure);
+}
+
+/**
+ * Many lookups at once never exceed DNS::MaxQueries at the nameserver,
+ * and all of them complete.
+ *
+ * @return True if the case passed
+ */
+static bool testConcurrency()
+{
+	List<UnrealDNSTestLookup*> lookups;
+
+	for (size_t i = 0; i < burst_lookups; ++i)
+	{
+		String name = String::format("burst%d.dnstest.example",
+			static_cast<int>(i));
+
+		stub->add("A", name, String::format("192.0.2.%d",
+			static_cast<int>(i % 250 + 1)), 20);
+	}
+
+	stub->reset();
+
+	for (size_t i = 0; i < burst_lookups; ++i)
+	{
+		UnrealDNSTestLookup* lookup = new UnrealDNSTestLookup();
+
+		lookup->resolver.query(String::format("burst%d.dnstest.example",
+			static_cast<int>(i)), 6667, AF_INET);
+		lookups << lookup;
+	}
+
+	/* all of them in flight at once would take just the delay */
+	uint64_t until = UnrealTime::monotonic() + dns_timeout * 20000ULL;
+	size_t done = 0;
+
+	while (done < burst_lookups && UnrealTime::monotonic() < until)
+	{
+		runFor(10);
+
+		done = 0;
+
+		for (size_t i = 0; i < burst_lookups; ++i)
+			done += lookups[i]->done;
+	}
+
+	String failure;
+
+	for (size_t i = 0; i < burst_lookups && failure.empty(); ++i)
+	{
+		String expected = String::format("192.0.2.%d",
+			static_cast<int>(i % 250 + 1));
+
+		if (!lookups[i]->done)
+			failure = String::format("%d of %d lookups complete",
+				static_cast<int>(done), static_cast<int>(burst_lookups));
+		else if (lookups[i]->ec)
+			failure = String::format("lookup %d failed: %s",
+				static_cast<int>(i), lookups[i]->ec.message().c_str());
+		else if (lookups[i]->address != expected)
+			failure = String::format("lookup %d returned %s",
+				static_cast<int>(i), lookups[i]->address.c_str());
+	}
+
+	if (failure.empty() && stub->maxPending() > dns_max_queries)
+		failure = String::format("%d queries at the nameserver at once",
+			static_cast<int>(stub->maxPending()));
+
+	for (size_t i = 0; i < burst_lookups; ++i)
+		delete lookups[i];
+
+	return report("concurrency", failure);
+}
+
+/**
+ * Bind a socket to an ephemeral port of 127.0.0.1.
+ *
+ * @param type SOCK_DGRAM or SOCK_STREAM
+ * @param port Returns the port
+ * @return Socket
+ */
+static int bindLoopback(int type, uint16_t& port)
+{
+	int fd = socket(AF_INET, type, 0);
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (fd == -1 || bind(fd, reinterpret_cast<struct sockaddr*>(&sin),
+			sizeof(sin)) != 0
+			|| getsockname(fd, reinterpret_cast<struct sockaddr*>(&sin),
+				&len) != 0)
+	{
+		std::perror("bind");
+		std::exit(1);
+	}
+
+	port = ntohs(sin.sin_port);
+
+	return fd;
+}
+
+/**
+ * Set up the server core with a client listener and the stub as its
+ * only nameserver. Its log output is discarded.
+ *
+ * @param argv0 Program name
+ * @param dns_port Port of the stub nameserver
+ * @param client_port Port for the client listener
+ */
+static void setupCore(const char* argv0, uint16_t dns_port,
+	uint16_t client_port)
+{
+	char path[] = "/tmp/unreal-dnstest.XXXXXX";
+	int fd = mkstemp(path);
+
+	if (fd == -1)
+	{
+		std::perror("mkstemp");
+		std::exit(1);
+	}
+
+	/* no cache, so every lookup reaches the stub */
+	std::ofstream conf(path);
+	conf << "Me {\n"
+		 << "  ServerName \"dnstest.example.net\";\n"
+		 << "  Numeric 1;\n"
+		 << "};\n"
+		 << "Bans {\n"
+		 << "  File \"/nonexistent/bans.db\";\n"
+		 << "};\n"
+		 << "DNS {\n"
+		 << "  CacheSize 0;\n"
+		 << "  MaxQueries " << dns_max_queries << ";\n"
+		 << "  Nameservers \"127.0.0.1:" << dns_port << "\";\n"
+		 << "  Timeout " << dns_timeout << ";\n"
+		 << "  Tries 1;\n"
+		 << "};\n"
+		 << "Ident {\n"
+		 << "  Timeout 1;\n"
+		 << "};\n"
+		 << "Listener {\n"
+		 << "  Address \"127.0.0.1\";\n"
+		 << "  Port " << client_port << ";\n"
+		 << "  Type \"Client\";\n"
+		 << "};\n"
+		 << "Trace {\n"
+		 << "  Size 0;\n"
+		 << "};\n";
+	conf.close();
+	close(fd);
+
+	char* args[] = { const_cast<char*>(argv0), const_cast<char*>("-i"),
+		const_cast<char*>("-c"), path, 0 };
+	std::ostringstream discard;
+	std::streambuf* out = std::cout.rdbuf(discard.rdbuf());
+
+	new UnrealBase(4, args);
+
+	std::cout.rdbuf(out);
+	unlink(path);
+}
+
+int main(int argc, char** argv)
+{
+	String filter = (argc > 1 ? argv[1] : "");
+
+	if (filter == "--help")
+	{
+		std::cerr << "Usage: " << argv[0] << " [timeout|mismatch|concurrency]"
+			<< std::endl;
+		return 0;
+	}
+
+	uint16_t dns_port, client_port;
+	int dns_fd = bindLoopback(SOCK_DGRAM, dns_port);
+	int client_fd = bindLoopback(SOCK_STREAM, client_port);
+
+	/* free the client port again for the listener */
+	close(client_fd);
+
+	setupCore(argv[0], dns_port, client_port);
+
+	stub = new UnrealStubDNS(dns_fd);
+
+	bool passed = true;
+
+	if (filter.empty() || filter == "timeout")
+		passed = testTimeout() && passed;
+
+	if (filter.empty() || filter == "mismatch")
+		passed = testMismatch(client_port) && passed;
+
+	if (filter.empty() || filter == "concurrency")
+		passed = testConcurrency() && passed;
+
+	return (passed ? 0 : 1);
+}
@@ -0,0 +1,1247 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         loadgen.cpp
+ * Description  Synthetic client load generator
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <histogram.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <time.h>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+/**
+ * unreal-loadgen opens a number of client connections to a server,
+ * registers them, joins them to channels picked by a Zipf distribution and
+ * drives a mix of PRIVMSG, NICK, JOIN, PART and WHO at a target rate.
+ *
+ * Channel messages carry the time they were sent, so the delivery latency
+ * is measured end to end by the receiving clients. As all clients live in
+ * this process, they share the same clock.
+ *
+ * For meaningful results, the server should run with
+ * Features::FloodCheck false and Listener::MaxConnections above the
+ * number of clients; the throttle exempts 127.0.0.1 by default.
+ */
+
+using boost::asio::ip::tcp;
+
+typedef boost::system::error_code ErrorCode;
+
+class UnrealLoadGenerator;
+
+/** workload operations */
+enum UnrealLoadOperation
+{
+	OpPrivmsg,
+	OpNick,
+	OpJoin,
+	OpPart,
+	OpWho,
+	OpCount
+};
+
+/** operation names, as used by --mix */
+static const char* op_names[OpCount] = {
+	"privmsg", "nick", "join", "part", "who"
+};
+
+/** interval of the generator tick, in milliseconds */
+static const int tick_interval = 10;
+
+/**
+ * Returns the monotonic time in microseconds.
+ *
+ * @return Time in microseconds
+ */
+static uint64_t monotonic()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000
+		+ static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+/**
+ * Load generator settings, from the command line.
+ */
+struct UnrealLoadSettings
+{
+	UnrealLoadSettings()
+		: host("127.0.0.1"), port(6667), clients(1000), connect_rate(500),
+		  channels(100), zipf(1.0), joins(3), rate(1000.0), duration(30),
+		  prefix("lg"), seed(1), json(false)
+	{
+		mix[OpPrivmsg] = 80;
+		mix[OpNick] = 2;
+		mix[OpJoin] = 8;
+		mix[OpPart] = 8;
+		mix[OpWho] = 2;
+	}
+
+	/** server address */
+	std::string host;
+
+	/** server port */
+	uint16_t port;
+
+	/** number of clients */
+	size_t clients;
+
+	/** new connections per second */
+	size_t connect_rate;
+
+	/** number of channels */
+	size_t channels;
+
+	/** Zipf exponent of the channel popularity */
+	double zipf;
+
+	/** channels joined by each client after registering */
+	size_t joins;
+
+	/** operations per second over all clients */
+	double rate;
+
+	/** length of the measurement, in seconds */
+	uint32_t duration;
+
+	/** nickname prefix */
+	std::string prefix;
+
+	/** random seed */
+	uint32_t seed;
+
+	/** whether to print the summary as JSON */
+	bool json;
+
+	/** operation weights */
+	unsigned mix[OpCount];
+};
+
+/**
+ * A single connection.
+ */
+class UnrealLoadClient
+{
+public:
+	UnrealLoadClient(UnrealLoadGenerator& gen, size_t id);
+	void connect(const tcp::endpoint& ep);
+	bool isConnected() const;
+	bool isRegistered() const;
+	void perform(UnrealLoadOperation op);
+	void quit();
+
+private:
+	void handleConnect(const ErrorCode& ec);
+	void handleLine(const std::string& line);
+	void handleRead(const ErrorCode& ec, size_t bytes);
+	void handleWrite(const ErrorCode& ec, size_t bytes);
+	void fail();
+	void send(const std::string& line);
+	void startRead();
+	void startWrite();
+
+private:
+	/** generator this client belongs to */
+	UnrealLoadGenerator& gen_;
+
+	/** client number */
+	size_t id_;
+
+	/** connection */
+	tcp::socket socket_;
+
+	/** read buffer */
+	boost::asio::streambuf inbuf_;
+
+	/** lines waiting to be written */
+	std::string sendq_;
+
+	/** data being written */
+	std::string write_buffer_;
+
+	/** whether a write is in progress */
+	bool writing_;
+
+	/** whether the connection is established */
+	bool connected_;
+
+	/** whether the server has sent 001 */
+	bool registered_;
+
+	/** whether the connection has failed or been closed */
+	bool closed_;
+
+	/** time the connection was started */
+	uint64_t started_at_;
+
+	/** channels joined */
+	std::vector<size_t> channels_;
+
+	/** send times of WHO requests waiting for RPL_ENDOFWHO */
+	std::deque<uint64_t> who_pending_;
+
+	/** number of nick changes */
+	uint32_t nick_changes_;
+};
+
+/**
+ * Drives the clients and collects the results.
+ */
+class UnrealLoadGenerator
+{
+public:
+	/** phases of a run */
+	enum Phase { Connecting, Running, Done };
+
+	/** counters of a run */
+	struct Counters
+	{
+		Counters() { std::memset(this, 0, sizeof(Counters)); }
+
+		/** operations sent, per type */
+		uint64_t ops[OpCount];
+
+		/** channel messages received */
+		uint64_t delivered;
+
+		/** lines received */
+		uint64_t lines_in;
+
+		/** bytes received */
+		uint64_t bytes_in;
+
+		/** bytes sent */
+		uint64_t bytes_out;
+
+		/** clients registered */
+		uint64_t registered;
+
+		/** failed or closed connections */
+		uint64_t failures;
+	};
+
+public:
+	UnrealLoadGenerator(const UnrealLoadSettings& settings);
+	~UnrealLoadGenerator();
+	Counters& counters();
+	void delivered(uint64_t latency);
+	std::string channelName(size_t index) const;
+	void failed(UnrealLoadClient* client);
+	boost::asio::io_service& io();
+	std::string nick(size_t id, uint32_t generation) const;
+	size_t pickChannel();
+	uint32_t random();
+	void registered(UnrealLoadClient* client, uint64_t latency);
+	int run();
+	const UnrealLoadSettings& settings() const;
+	void whoCompleted(uint64_t latency);
+
+private:
+	UnrealLoadOperation pickOperation();
+	void printProgress(uint64_t now);
+	void printSummary(double seconds);
+	void tick(const ErrorCode& ec);
+
+private:
+	/** settings */
+	UnrealLoadSettings settings_;
+
+	/** I/O service */
+	boost::asio::io_service io_;
+
+	/** generator tick */
+	boost::asio::deadline_timer timer_;
+
+	/** server endpoint */
+	tcp::endpoint endpoint_;
+
+	/** all clients */
+	std::vector<UnrealLoadClient*> clients_;
+
+	/** registered clients, picked from for operations */
+	std::vector<UnrealLoadClient*> active_;
+
+	/** cumulative Zipf distribution of the channels */
+	std::vector<double> zipf_cdf_;
+
+	/** current phase */
+	Phase phase_;
+
+	/** random state (xorshift32) */
+	uint32_t random_;
+
+	/** fractional connections and operations carried to the next tick */
+	double connect_budget_, op_budget_;
+
+	/** time of the last tick */
+	uint64_t last_tick_;
+
+	/** start of the measurement */
+	uint64_t run_started_;
+
+	/** time of the last progress line */
+	uint64_t last_progress_;
+
+	/** counters at the last progress line */
+	Counters last_counters_;
+
+	/** counters since the measurement started */
+	Counters counters_;
+
+	/** channel message delivery latency */
+	UnrealHistogram delivery_;
+
+	/** registration latency */
+	UnrealHistogram registration_;
+
+	/** WHO reply latency */
+	UnrealHistogram who_;
+};
+
+/**
+ * UnrealLoadClient constructor.
+ *
+ * @param gen Generator
+ * @param id Client number
+ */
+UnrealLoadClient::UnrealLoadClient(UnrealLoadGenerator& gen, size_t id)
+	: gen_(gen), id_(id), socket_(gen.io()), writing_(false),
+	  connected_(false), registered_(false), closed_(false), started_at_(0),
+	  nick_changes_(0)
+{ }
+
+/**
+ * Start connecting to the server.
+ *
+ * @param ep Server endpoint
+ */
+void UnrealLoadClient::connect(const tcp::endpoint& ep)
+{
+	started_at_ = monotonic();
+
+	socket_.async_connect(ep,
+		boost::bind(&UnrealLoadClient::handleConnect,
+			this,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * Give up on this client after an error.
+ */
+void UnrealLoadClient::fail()
+{
+	if (closed_)
+		return;
+
+	closed_ = true;
+	registered_ = false;
+
+	ErrorCode ignored;
+	socket_.close(ignored);
+
+	gen_.failed(this);
+}
+
+/**
+ * Connection callback; starts the registration.
+ *
+ * @param ec Error code
+ */
+void UnrealLoadClient::handleConnect(const ErrorCode& ec)
+{
+	if (ec)
+	{
+		fail();
+		return;
+	}
+
+	connected_ = true;
+
+	send("NICK " + gen_.nick(id_, 0));
+	send("USER " + gen_.settings().prefix + " 0 * :load generator");
+
+	startRead();
+}
+
+/**
+ * Handle a line received from the server.
+ *
+ * @param line Line without the line terminator
+ */
+void UnrealLoadClient::handleLine(const std::string& line)
+{
+	std::string::size_type pos = 0;
+
+	/* skip the prefix */
+	if (!line.empty() && line[0] == ':')
+	{
+		pos = line.find(' ');
+
+		if (pos == std::string::npos)
+			return;
+
+		++pos;
+	}
+
+	std::string::size_type end = line.find(' ', pos);
+	std::string cmd = line.substr(pos, end == std::string::npos
+		? std::string::npos : end - pos);
+
+	if (cmd == "PING")
+	{
+		std::string arg = (end == std::string::npos
+			? std::string() : line.substr(end + 1));
+
+		send("PONG " + arg);
+	}
+	else if (cmd == "PRIVMSG")
+	{
+		/* channel messages of the generator: "lg <sender> <sent at>" */
+		std::string::size_type text = line.find(" :lg ", end);
+
+		if (text != std::string::npos)
+		{
+			std::istringstream fields(line.substr(text + 5));
+			unsigned long long sender = 0, sent_at = 0;
+
+			if (fields >> sender >> sent_at)
+				gen_.delivered(monotonic() - sent_at);
+		}
+	}
+	else if (cmd == "001" && !registered_)
+	{
+		registered_ = true;
+		gen_.registered(this, monotonic() - started_at_);
+
+		/* join the initial channels */
+		for (size_t i = 0; i < gen_.settings().joins; ++i)
+			perform(OpJoin);
+	}
+	else if (cmd == "315" && !who_pending_.empty())
+	{
+		gen_.whoCompleted(monotonic() - who_pending_.front());
+		who_pending_.pop_front();
+	}
+	else if (cmd == "433")
+	{
+		/* nickname in use; try the next one */
+		send("NICK " + gen_.nick(id_, ++nick_changes_));
+	}
+	else if (cmd == "ERROR")
+		fail();
+}
+
+/**
+ * Read callback.
+ *
+ * @param ec Error code
+ * @param bytes Number of bytes up to and including the line terminator
+ */
+void UnrealLoadClient::handleRead(const ErrorCode& ec, size_t bytes)
+{
+	if (ec)
+	{
+		fail();
+		return;
+	}
+
+	std::istream is(&inbuf_);
+	std::string line;
+
+	std::getline(is, line);
+
+	if (!line.empty() && line[line.length() - 1] == '\r')
+		line.erase(line.length() - 1);
+
+	gen_.counters().lines_in++;
+	gen_.counters().bytes_in += bytes;
+
+	handleLine(line);
+
+	if (!closed_)
+		startRead();
+}
+
+/**
+ * Write callback.
+ *
+ * @param ec Error code
+ * @param bytes Number of bytes written
+ */
+void UnrealLoadClient::handleWrite(const ErrorCode& ec, size_t bytes)
+{
+	writing_ = false;
+	write_buffer_.clear();
+
+	if (ec)
+	{
+		fail();
+		return;
+	}
+
+	gen_.counters().bytes_out += bytes;
+	startWrite();
+}
+
+/**
+ * Returns whether the connection is established.
+ *
+ * @return True if connected
+ */
+bool UnrealLoadClient::isConnected() const
+{
+	return connected_ && !closed_;
+}
+
+/**
+ * Returns whether the client has registered.
+ *
+ * @return True if registered
+ */
+bool UnrealLoadClient::isRegistered() const
+{
+	return registered_;
+}
+
+/**
+ * Send a workload operation.
+ *
+ * @param op Operation
+ */
+void UnrealLoadClient::perform(UnrealLoadOperation op)
+{
+	if (!registered_)
+		return;
+
+	switch (op)
+	{
+		case OpPrivmsg:
+			if (channels_.empty())
+			{
+				perform(OpJoin);
+				return;
+			}
+			else
+			{
+				size_t ch = channels_[gen_.random() % channels_.size()];
+				std::ostringstream msg;
+
+				msg << "PRIVMSG " << gen_.channelName(ch) << " :lg " << id_
+					<< " " << monotonic();
+
+				send(msg.str());
+			}
+			break;
+
+		case OpNick:
+			send("NICK " + gen_.nick(id_, ++nick_changes_));
+			break;
+
+		case OpJoin:
+		{
+			size_t ch = gen_.pickChannel();
+
+			if (std::find(channels_.begin(), channels_.end(), ch)
+					!= channels_.end())
+				return;
+
+			channels_.push_back(ch);
+			send("JOIN " + gen_.channelName(ch));
+			break;
+		}
+
+		case OpPart:
+		{
+			/* keep at least one channel to receive messages on */
+			if (channels_.size() <= 1)
+				return;
+
+			size_t index = gen_.random() % channels_.size();
+
+			send("PART " + gen_.channelName(channels_[index]));
+			channels_.erase(channels_.begin() + index);
+			break;
+		}
+
+		case OpWho:
+			if (channels_.empty())
+				return;
+
+			who_pending_.push_back(monotonic());
+			send("WHO " + gen_.channelName(
+				channels_[gen_.random() % channels_.size()]));
+			break;
+
+		default:
+			return;
+	}
+
+	gen_.counters().ops[op]++;
+}
+
+/**
+ * Close the connection at the end of the run.
+ */
+void UnrealLoadClient::quit()
+{
+	closed_ = true;
+
+	ErrorCode ignored;
+	socket_.close(ignored);
+}
+
+/**
+ * Queue a line for sending.
+ *
+ * @param line Line without the line terminator
+ */
+void UnrealLoadClient::send(const std::string& line)
+{
+	if (closed_)
+		return;
+
+	sendq_.append(line);
+	sendq_.append("\r\n");
+
+	startWrite();
+}
+
+/**
+ * Wait for the next line.
+ */
+void UnrealLoadClient::startRead()
+{
+	boost::asio::async_read_until(socket_, inbuf_, '\n',
+		boost::bind(&UnrealLoadClient::handleRead,
+			this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+}
+
+/**
+ * Write the queued lines, unless a write is in progress.
+ */
+void UnrealLoadClient::startWrite()
+{
+	if (writing_ || sendq_.empty() || closed_)
+		return;
+
+	write_buffer_.swap(sendq_);
+	writing_ = true;
+
+	boost::asio::async_write(socket_,
+		boost::asio::buffer(write_buffer_.c_str(), write_buffer_.length()),
+		boost::bind(&UnrealLoadClient::handleWrite,
+			this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+}
+
+/**
+ * UnrealLoadGenerator constructor.
+ *
+ * @param settings Settings
+ */
+UnrealLoadGenerator::UnrealLoadGenerator(const UnrealLoadSettings& settings)
+	: settings_(settings), timer_(io_), phase_(Connecting),
+	  random_(settings.seed ? settings.seed : 1), connect_budget_(0),
+	  op_budget_(0), last_tick_(0), run_started_(0), last_progress_(0)
+{
+	double sum = 0;
+
+	/* channel k is picked with a probability proportional to 1 / k^s */
+	for (size_t k = 1; k <= settings_.channels; ++k)
+	{
+		sum += 1.0 / std::pow(static_cast<double>(k), settings_.zipf);
+		zipf_cdf_.push_back(sum);
+	}
+
+	for (size_t k = 0; k < zipf_cdf_.size(); ++k)
+		zipf_cdf_[k] /= sum;
+}
+
+/**
+ * UnrealLoadGenerator destructor.
+ */
+UnrealLoadGenerator::~UnrealLoadGenerator()
+{
+	for (size_t i = 0; i < clients_.size(); ++i)
+		delete clients_[i];
+}
+
+/**
+ * Returns the name of a channel.
+ *
+ * @param index Channel number
+ * @return Channel name
+ */
+std::string UnrealLoadGenerator::channelName(size_t index) const
+{
+	std::ostringstream name;
+	name << "#" << settings_.prefix << index;
+
+	return name.str();
+}
+
+/**
+ * Returns the counters of the run.
+ *
+ * @return Counters
+ */
+UnrealLoadGenerator::Counters& UnrealLoadGenerator::counters()
+{
+	return counters_;
+}
+
+/**
+ * Record the delivery of a channel message.
+ *
+ * @param latency Time since the message was sent, in microseconds
+ */
+void UnrealLoadGenerator::delivered(uint64_t latency)
+{
+	counters_.delivered++;
+
+	if (phase_ == Running)
+		delivery_.add(latency);
+}
+
+/**
+ * Called when a client connection has failed or been closed by the server.
+ *
+ * @param client Client
+ */
+void UnrealLoadGenerator::failed(UnrealLoadClient* client)
+{
+	std::vector<UnrealLoadClient*>::iterator it =
+		std::find(active_.begin(), active_.end(), client);
+
+	if (it != active_.end())
+	{
+		*it = active_.back();
+		active_.pop_back();
+	}
+
+	counters_.failures++;
+}
+
+/**
+ * Returns the I/O service.
+ *
+ * @return I/O service
+ */
+boost::asio::io_service& UnrealLoadGenerator::io()
+{
+	return io_;
+}
+
+/**
+ * Returns the nickname of a client.
+ *
+ * @param id Client number
+ * @param generation Number of nick changes so far
+ * @return Nickname
+ */
+std::string UnrealLoadGenerator::nick(size_t id, uint32_t generation) const
+{
+	std::ostringstream name;
+	name << settings_.prefix << id;
+
+	if (generation > 0)
+		name << "_" << (generation % 1000);
+
+	return name.str();
+}
+
+/**
+ * Pick a channel by its popularity.
+ *
+ * @return Channel number
+ */
+size_t UnrealLoadGenerator::pickChannel()
+{
+	double u = static_cast<double>(random()) / 4294967296.0;
+
+	return std::lower_bound(zipf_cdf_.begin(), zipf_cdf_.end(), u)
+		- zipf_cdf_.begin();
+}
+
+/**
+ * Pick an operation by the weights of the mix.
+ *
+ * @return Operation
+ */
+UnrealLoadOperation UnrealLoadGenerator::pickOperation()
+{
+	unsigned total = 0;
+
+	for (int i = 0; i < OpCount; ++i)
+		total += settings_.mix[i];
+
+	unsigned r = random() % total;
+
+	for (int i = 0; i < OpCount; ++i)
+	{
+		if (r < settings_.mix[i])
+			return static_cast<UnrealLoadOperation>(i);
+
+		r -= settings_.mix[i];
+	}
+
+	return OpPrivmsg;
+}
+
+/**
+ * Print a progress line for the last interval to stderr.
+ *
+ * @param now Current time
+ */
+void UnrealLoadGenerator::printProgress(uint64_t now)
+{
+	double secs = (now - last_progress_) / 1000000.0;
+	uint64_t ops = 0, last_ops = 0;
+
+	for (int i = 0; i < OpCount; ++i)
+	{
+		ops += counters_.ops[i];
+		last_ops += last_counters_.ops[i];
+	}
+
+	std::fprintf(stderr, "[%s] clients %d/%d, ops/s %.0f, delivered/s %.0f, "
+		"in %.1f MB/s, latency p50 %dus p99 %dus\n",
+		phase_ == Connecting ? "connecting" : "running",
+		static_cast<int>(active_.size()),
+		static_cast<int>(settings_.clients),
+		(ops - last_ops) / secs,
+		(counters_.delivered - last_counters_.delivered) / secs,
+		(counters_.bytes_in - last_counters_.bytes_in) / secs / 1048576.0,
+		static_cast<int>(delivery_.percentile(0.5)),
+		static_cast<int>(delivery_.percentile(0.99)));
+
+	last_progress_ = now;
+	last_counters_ = counters_;
+}
+
+/**
+ * Print the results of the run to stdout.
+ *
+ * @param seconds Length of the measurement
+ */
+void UnrealLoadGenerator::printSummary(double seconds)
+{
+	const UnrealHistogram* hists[] = { &delivery_, &registration_, &who_ };
+	const char* hist_names[] = { "delivery", "registration", "who" };
+	uint64_t ops = 0;
+
+	for (int i = 0; i < OpCount; ++i)
+		ops += counters_.ops[i];
+
+	if (settings_.json)
+	{
+		std::printf("{\"clients\":%d,\"registered\":%d,\"failures\":%d,"
+			"\"seconds\":%.3f,\"ops_per_sec\":%.1f,"
+			"\"delivered_per_sec\":%.1f,\"lines_in_per_sec\":%.1f,"
+			"\"bytes_in_per_sec\":%.1f,\"bytes_out_per_sec\":%.1f,\"ops\":{",
+			static_cast<int>(settings_.clients),
+			static_cast<int>(counters_.registered),
+			static_cast<int>(counters_.failures),
+			seconds, ops / seconds, counters_.delivered / seconds,
+			counters_.lines_in / seconds, counters_.bytes_in / seconds,
+			counters_.bytes_out / seconds);
+
+		for (int i = 0; i < OpCount; ++i)
+			std::printf("%s\"%s\":%llu", i ? "," : "", op_names[i],
+				static_cast<unsigned long long>(counters_.ops[i]));
+
+		std::printf("},\"latency_us\":{");
+
+		for (int i = 0; i < 3; ++i)
+			std::printf("%s\"%s\":{\"count\":%llu,\"p50\":%llu,"
+				"\"p90\":%llu,\"p99\":%llu,\"max\":%llu}", i ? "," : "",
+				hist_names[i],
+				static_cast<unsigned long long>(hists[i]->count()),
+				static_cast<unsigned long long>(hists[i]->percentile(0.5)),
+				static_cast<unsigned long long>(hists[i]->percentile(0.9)),
+				static_cast<unsigned long long>(hists[i]->percentile(0.99)),
+				static_cast<unsigned long long>(hists[i]->max()));
+
+		std::printf("}}\n");
+		return;
+	}
+
+	std::printf("Clients:      %d registered, %d failed\n",
+		static_cast<int>(counters_.registered),
+		static_cast<int>(counters_.failures));
+	std::printf("Duration:     %.1fs\n", seconds);
+	std::printf("Operations:   %.0f/s (", ops / seconds);
+
+	for (int i = 0; i < OpCount; ++i)
+		std::printf("%s%s %llu", i ? ", " : "", op_names[i],
+			static_cast<unsigned long long>(counters_.ops[i]));
+
+	std::printf(")\n");
+	std::printf("Delivered:    %.0f messages/s\n",
+		counters_.delivered / seconds);
+	std::printf("Received:     %.0f lines/s, %.2f MB/s\n",
+		counters_.lines_in / seconds,
+		counters_.bytes_in / seconds / 1048576.0);
+	std::printf("Sent:         %.2f MB/s\n",
+		counters_.bytes_out / seconds / 1048576.0);
+
+	for (int i = 0; i < 3; ++i)
+		std::printf("Latency %-13s p50 %lluus, p90 %lluus, p99 %lluus, "
+			"max %lluus (%llu samples)\n",
+			(std::string(hist_names[i]) + ":").c_str(),
+			static_cast<unsigned long long>(hists[i]->percentile(0.5)),
+			static_cast<unsigned long long>(hists[i]->percentile(0.9)),
+			static_cast<unsigned long long>(hists[i]->percentile(0.99)),
+			static_cast<unsigned long long>(hists[i]->max()),
+			static_cast<unsigned long long>(hists[i]->count()));
+}
+
+/**
+ * Returns a pseudo random number (xorshift32), so runs with the same seed
+ * send the same workload.
+ *
+ * @return Random number
+ */
+uint32_t UnrealLoadGenerator::random()
+{
+	random_ ^= random_ << 13;
+	random_ ^= random_ >> 17;
+	random_ ^= random_ << 5;
+
+	return random_;
+}
+
+/**
+ * Called when a client has registered.
+ *
+ * @param client Client
+ * @param latency Time from connecting until 001, in microseconds
+ */
+void UnrealLoadGenerator::registered(UnrealLoadClient* client,
+	uint64_t latency)
+{
+	active_.push_back(client);
+	registration_.add(latency);
+	counters_.registered++;
+}
+
+/**
+ * Run the load generator.
+ *
+ * @return Exit code
+ */
+int UnrealLoadGenerator::run()
+{
+	ErrorCode ec;
+	tcp::resolver resolver(io_);
+	std::ostringstream port;
+
+	port << settings_.port;
+
+	tcp::resolver::iterator it = resolver.resolve(
+		tcp::resolver::query(settings_.host, port.str()), ec);
+
+	if (ec)
+	{
+		std::cerr << "Can't resolve " << settings_.host << ": "
+				  << ec.message() << std::endl;
+		return 1;
+	}
+
+	endpoint_ = *it;
+	last_tick_ = last_progress_ = monotonic();
+
+	timer_.expires_from_now(boost::posix_time::milliseconds(tick_interval));
+	timer_.async_wait(boost::bind(&UnrealLoadGenerator::tick, this,
+		boost::asio::placeholders::error));
+
+	io_.run();
+
+	if (phase_ != Done)
+		return 1;
+
+	printSummary((last_tick_ - run_started_) / 1000000.0);
+
+	return 0;
+}
+
+/**
+ * Returns the settings.
+ *
+ * @return Settings
+ */
+const UnrealLoadSettings& UnrealLoadGenerator::settings() const
+{
+	return settings_;
+}
+
+/**
+ * Generator tick: opens new connections while connecting, sends the
+ * workload while running and ends the run after the configured duration.
+ *
+ * @param ec Error code
+ */
+void UnrealLoadGenerator::tick(const ErrorCode& ec)
+{
+	if (ec)
+		return;
+
+	uint64_t now = monotonic();
+	double elapsed = (now - last_tick_) / 1000000.0;
+
+	last_tick_ = now;
+
+	if (phase_ == Connecting)
+	{
+		connect_budget_ += settings_.connect_rate * elapsed;
+
+		while (connect_budget_ >= 1.0 && clients_.size() < settings_.clients)
+		{
+			UnrealLoadClient* client =
+				new UnrealLoadClient(*this, clients_.size());
+
+			clients_.push_back(client);
+			client->connect(endpoint_);
+			connect_budget_ -= 1.0;
+		}
+
+		/* start measuring once every client has registered or failed */
+		if (clients_.size() == settings_.clients
+				&& counters_.registered + counters_.failures
+					>= settings_.clients)
+		{
+			if (active_.empty())
+			{
+				std::cerr << "No client could register." << std::endl;
+				io_.stop();
+				return;
+			}
+
+			phase_ = Running;
+			run_started_ = now;
+
+			/* the registration counters are kept */
+			Counters reg = counters_;
+			counters_ = Counters();
+			counters_.registered = reg.registered;
+			counters_.failures = reg.failures;
+			last_counters_ = counters_;
+		}
+	}
+	else if (phase_ == Running)
+	{
+		op_budget_ += settings_.rate * elapsed;
+
+		while (op_budget_ >= 1.0 && !active_.empty())
+		{
+			active_[random() % active_.size()]->perform(pickOperation());
+			op_budget_ -= 1.0;
+		}
+
+		if (now - run_started_ >= settings_.duration * 1000000ULL)
+		{
+			phase_ = Done;
+
+			for (size_t i = 0; i < clients_.size(); ++i)
+				clients_[i]->quit();
+
+			return;
+		}
+	}
+
+	if (now - last_progress_ >= 1000000)
+		printProgress(now);
+
+	timer_.expires_from_now(boost::posix_time::milliseconds(tick_interval));
+	timer_.async_wait(boost::bind(&UnrealLoadGenerator::tick, this,
+		boost::asio::placeholders::error));
+}
+
+/**
+ * Record the completion of a WHO request.
+ *
+ * @param latency Time from sending WHO until RPL_ENDOFWHO, in microseconds
+ */
+void UnrealLoadGenerator::whoCompleted(uint64_t latency)
+{
+	if (phase_ == Running)
+		who_.add(latency);
+}
+
+/**
+ * Parse the operation mix, e.g. "privmsg:80,join:10,part:10".
+ *
+ * @param str Mix specification
+ * @param mix Operation weights
+ * @return False if the specification is invalid
+ */
+static bool parseMix(const std::string& str, unsigned* mix)
+{
+	std::istringstream items(str);
+	std::string item;
+	unsigned total = 0;
+
+	for (int i = 0; i < OpCount; ++i)
+		mix[i] = 0;
+
+	while (std::getline(items, item, ','))
+	{
+		std::string::size_type colon = item.find(':');
+		int op = 0;
+
+		if (colon == std::string::npos)
+			return false;
+
+		while (op < OpCount && item.compare(0, colon, op_names[op]) != 0)
+			++op;
+
+		if (op == OpCount)
+			return false;
+
+		mix[op] = static_cast<unsigned>(std::atoi(item.c_str() + colon + 1));
+		total += mix[op];
+	}
+
+	return total > 0;
+}
+
+/**
+ * Raise the limit of open file descriptors as far as permitted.
+ */
+static void raiseFileLimit()
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+/**
+ * Print the command line help.
+ *
+ * @param name Program name
+ */
+static void usage(const char* name)
+{
+	std::cerr
+		<< "Usage: " << name << " [options]\n"
+		<< "  --host=ADDR          server address (127.0.0.1)\n"
+		<< "  --port=PORT          server port (6667)\n"
+		<< "  --clients=N          number of clients (1000)\n"
+		<< "  --connect-rate=N     new connections per second (500)\n"
+		<< "  --channels=N         number of channels (100)\n"
+		<< "  --zipf=S             Zipf exponent of channel popularity (1.0)\n"
+		<< "  --joins=N            channels joined per client (3)\n"
+		<< "  --rate=N             operations per second, all clients (1000)\n"
+		<< "  --mix=SPEC           operation weights "
+			"(privmsg:80,nick:2,join:8,part:8,who:2)\n"
+		<< "  --duration=SECS      length of the measurement (30)\n"
+		<< "  --prefix=STR         nick and channel prefix (lg)\n"
+		<< "  --seed=N             random seed (1)\n"
+		<< "  --json               print the summary as JSON\n";
+}
+
+int main(int argc, char** argv)
+{
+	UnrealLoadSettings settings;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		std::string::size_type eq = arg.find('=');
+		std::string key = arg.substr(0, eq);
+		std::string value = (eq == std::string::npos
+			? std::string() : arg.substr(eq + 1));
+
+		if (key == "--host")
+			settings.host = value;
+		else if (key == "--port")
+			settings.port = static_cast<uint16_t>(std::atoi(value.c_str()));
+		else if (key == "--clients")
+			settings.clients = std::strtoul(value.c_str(), 0, 10);
+		else if (key == "--connect-rate")
+			settings.connect_rate = std::strtoul(value.c_str(), 0, 10);
+		else if (key == "--channels")
+			settings.channels = std::strtoul(value.c_str(), 0, 10);
+		else if (key == "--zipf")
+			settings.zipf = std::atof(value.c_str());
+		else if (key == "--joins")
+			settings.joins = std::strtoul(value.c_str(), 0, 10);
+		else if (key == "--rate")
+			settings.rate = std::atof(value.c_str());
+		else if (key == "--duration")
+			settings.duration = std::strtoul(value.c_str(), 0, 10);
+		else if (key == "--prefix")
+			settings.prefix = value;
+		else if (key == "--seed")
+			settings.seed = std::strtoul(value.c_str(), 0, 10);
+		else if (key == "--json")
+			settings.json = true;
+		else if (key == "--mix")
+		{
+			if (!parseMix(value, settings.mix))
+			{
+				std::cerr << "Invalid operation mix: " << value << std::endl;
+				return 1;
+			}
+		}
+		else
+		{
+			usage(argv[0]);
+			return (key == "--help" ? 0 : 1);
+		}
+	}
+
+	if (settings.clients == 0 || settings.channels == 0
+			|| settings.connect_rate == 0)
+	{
+		std::cerr << "--clients, --channels and --connect-rate must be "
+				  << "above zero." << std::endl;
+		return 1;
+	}
+
+	raiseFileLimit();
+
+	UnrealLoadGenerator gen(settings);
+
+	return gen.run();
+}
@@ -0,0 +1,1184 @@
+/*****************************************************************
+ * Unreal Internet Relay Chat Daemon, Version 4
+ * File         replay.cpp
+ * Description  Replay of captured client traffic
+ *
+ * Copyright(C) 2009, 2010
+ * The UnrealIRCd development team and contributors
+ * http://www.unrealircd.com
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the Free
+ * Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ ******************************************************************/
+
+#include <capture.hpp>
+#include <histogram.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <time.h>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+
+/**
+ * unreal-replay drives a traffic capture, as written by the server on
+ * PTRACE CAPTURE ON, against a server. Every captured connection is opened
+ * again and sends its lines at the captured times, scaled by --speed;
+ * with --speed=max, the lines are sent as fast as possible. The lines of
+ * a connection are always sent in their captured order.
+ *
+ * Registered connections send a "PING :rp<time>" now and then while they
+ * are replaying lines, and once more after the last record; as the server
+ * handles the lines of a connection in order, the time until the PONG
+ * arrives is the latency of the replayed lines. The replay ends when all
+ * probes have been answered. Server PINGs are answered by the tool.
+ *
+ * For meaningful results, the server should run with
+ * Features::FloodCheck false, Listener::MaxConnections above the number of
+ * connections in the capture and without throttling for the replay host;
+ * the throttle exempts 127.0.0.1 by default.
+ */
+
+using boost::asio::ip::tcp;
+
+typedef boost::system::error_code ErrorCode;
+
+class UnrealReplay;
+
+/** interval of the replay tick, in milliseconds */
+static const int tick_interval = 1;
+
+/** records sent per tick with --speed=max */
+static const size_t max_batch = 10000;
+
+/** time to wait for pending writes and probes at the end, in microseconds */
+static const uint64_t drain_timeout = 5000000;
+
+/**
+ * Returns the monotonic time in microseconds.
+ *
+ * @return Time in microseconds
+ */
+static uint64_t monotonic()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000
+		+ static_cast<uint64_t>(ts.tv_nsec) / 1000;
+}
+
+/**
+ * Replay settings, from the command line.
+ */
+struct UnrealReplaySettings
+{
+	UnrealReplaySettings()
+		: host("127.0.0.1"), port(6667), speed(1.0), probe_interval(1000),
+		  json(false), print(false)
+	{ }
+
+	/** capture file */
+	std::string file;
+
+	/** server address */
+	std::string host;
+
+	/** server port */
+	uint16_t port;
+
+	/** time scale; 0 sends as fast as possible */
+	double speed;
+
+	/** minimum time between latency probes of a connection, in ms */
+	uint32_t probe_interval;
+
+	/** whether to print the summary as JSON */
+	bool json;
+
+	/** whether to print the capture instead of replaying it */
+	bool print;
+};
+
+/**
+ * A captured record.
+ */
+struct UnrealReplayRecord
+{
+	/** time since the capture was started, in microseconds */
+	uint64_t time;
+
+	/** connection number */
+	uint32_t connection;
+
+	/** record type, see UnrealTrafficCapture::RecordType */
+	uint8_t type;
+
+	/** line text */
+	std::string text;
+};
+
+/**
+ * Orders records by their capture time.
+ *
+ * @param a Record
+ * @param b Record
+ * @return True if a has been captured before b
+ */
+static bool earlier(const UnrealReplayRecord& a, const UnrealReplayRecord& b)
+{
+	return a.time < b.time;
+}
+
+/**
+ * A replayed connection.
+ */
+class UnrealReplayClient
+{
+public:
+	UnrealReplayClient(UnrealReplay& replay);
+	void close();
+	void connect(const tcp::endpoint& ep);
+	void drain();
+	bool isIdle() const;
+	void quit();
+	void send(const std::string& line);
+
+private:
+	void fail();
+	void finish();
+	void handleConnect(const ErrorCode& ec);
+	void handleLine(const std::string& line);
+	void handleRead(const ErrorCode& ec, size_t bytes);
+	void handleWrite(const ErrorCode& ec, size_t bytes);
+	void hangup();
+	void probe(uint64_t now);
+	void queue(const std::string& line);
+	void startRead();
+	void startWrite();
+
+private:
+	/** replay this connection belongs to */
+	UnrealReplay& replay_;
+
+	/** connection */
+	tcp::socket socket_;
+
+	/** read buffer */
+	boost::asio::streambuf inbuf_;
+
+	/** lines waiting to be written */
+	std::string sendq_;
+
+	/** data being written */
+	std::string write_buffer_;
+
+	/** whether a write is in progress */
+	bool writing_;
+
+	/** whether the connection is established */
+	bool connected_;
+
+	/** whether the server has sent 001 */
+	bool registered_;
+
+	/** whether the capture has closed the connection */
+	bool closing_;
+
+	/** whether all captured lines have been sent */
+	bool draining_;
+
+	/** whether the connection has failed or been closed */
+	bool closed_;
+
+	/** time the connection was started */
+	uint64_t started_at_;
+
+	/** send time of the pending latency probe; 0 if none */
+	uint64_t probe_sent_;
+
+	/** send time of the last latency probe */
+	uint64_t last_probe_;
+};
+
+/**
+ * Loads the capture, drives the connections and collects the results.
+ */
+class UnrealReplay
+{
+public:
+	/** phases of a run */
+	enum Phase { Replaying, Draining, Done };
+
+	/** counters of a run */
+	struct Counters
+	{
+		Counters() { std::memset(this, 0, sizeof(Counters)); }
+
+		/** connections opened */
+		uint64_t opened;
+
+		/** connections registered */
+		uint64_t registered;
+
+		/** connections failed */
+		uint64_t failures;
+
+		/** connections closed by the server */
+		uint64_t closed_by_server;
+
+		/** captured lines sent */
+		uint64_t lines_out;
+
+		/** bytes sent, including probes and PONG replies */
+		uint64_t bytes_out;
+
+		/** lines received */
+		uint64_t lines_in;
+
+		/** bytes received */
+		uint64_t bytes_in;
+	};
+
+public:
+	UnrealReplay(const UnrealReplaySettings& settings);
+	~UnrealReplay();
+	Counters& counters();
+	void failed();
+	boost::asio::io_service& io();
+	bool load();
+	void print();
+	void probed(uint64_t latency);
+	void registered(uint64_t latency);
+	int run();
+	const UnrealReplaySettings& settings() const;
+
+private:
+	void dispatch(const UnrealReplayRecord& rec);
+	bool idle() const;
+	void printProgress(uint64_t now);
+	void printSummary(double seconds);
+	void tick(const ErrorCode& ec);
+
+private:
+	/** settings */
+	UnrealReplaySettings settings_;
+
+	/** I/O service */
+	boost::asio::io_service io_;
+
+	/** replay tick */
+	boost::asio::deadline_timer timer_;
+
+	/** server endpoint */
+	tcp::endpoint endpoint_;
+
+	/** captured records, in capture order */
+	std::vector<UnrealReplayRecord> records_;
+
+	/** next record to send */
+	size_t next_;
+
+	/** number of captured connections */
+	size_t connections_;
+
+	/** connections by their captured number */
+	std::map<uint32_t, UnrealReplayClient*> clients_;
+
+	/** current phase */
+	Phase phase_;
+
+	/** start of the replay */
+	uint64_t started_;
+
+	/** start of the drain phase */
+	uint64_t drain_started_;
+
+	/** end of the replay */
+	uint64_t finished_;
+
+	/** time of the last progress line */
+	uint64_t last_progress_;
+
+	/** counters at the last progress line */
+	Counters last_counters_;
+
+	/** counters of the run */
+	Counters counters_;
+
+	/** replayed line latency, measured by PING probes */
+	UnrealHistogram latency_;
+
+	/** registration latency */
+	UnrealHistogram registration_;
+
+	/** delay of sending records after their scaled capture time */
+	UnrealHistogram schedule_;
+};
+
+/**
+ * UnrealReplayClient constructor.
+ *
+ * @param replay Replay
+ */
+UnrealReplayClient::UnrealReplayClient(UnrealReplay& replay)
+	: replay_(replay), socket_(replay.io()), writing_(false),
+	  connected_(false), registered_(false), closing_(false), draining_(false),
+	  closed_(false), started_at_(0), probe_sent_(0), last_probe_(0)
+{ }
+
+/**
+ * The capture has closed the connection. Once the queued lines have been
+ * written, the sending side is shut down; the server closes the connection
+ * after it has read them.
+ */
+void UnrealReplayClient::close()
+{
+	closing_ = true;
+
+	if (connected_ && !writing_ && sendq_.empty())
+		hangup();
+}
+
+/**
+ * Start connecting to the server.
+ *
+ * @param ep Server endpoint
+ */
+void UnrealReplayClient::connect(const tcp::endpoint& ep)
+{
+	started_at_ = monotonic();
+
+	socket_.async_connect(ep,
+		boost::bind(&UnrealReplayClient::handleConnect,
+			this,
+			boost::asio::placeholders::error));
+}
+
+/**
+ * All captured lines have been sent; send a last latency probe, so the
+ * connection is idle once the server has handled all of them.
+ */
+void UnrealReplayClient::drain()
+{
+	draining_ = true;
+
+	if (!probe_sent_)
+		probe(monotonic());
+}
+
+/**
+ * Give up on this connection after an error.
+ */
+void UnrealReplayClient::fail()
+{
+	if (closed_)
+		return;
+
+	closed_ = true;
+	sendq_.clear();
+
+	ErrorCode ignored;
+	socket_.close(ignored);
+
+	replay_.failed();
+}
+
+/**
+ * Close the connection.
+ */
+void UnrealReplayClient::finish()
+{
+	closed_ = true;
+	probe_sent_ = 0;
+
+	ErrorCode ignored;
+	socket_.close(ignored);
+}
+
+/**
+ * Connection callback; writes the lines queued so far.
+ *
+ * @param ec Error code
+ */
+void UnrealReplayClient::handleConnect(const ErrorCode& ec)
+{
+	if (closed_)
+		return;
+
+	if (ec)
+	{
+		fail();
+		return;
+	}
+
+	connected_ = true;
+
+	startRead();
+	startWrite();
+
+	if (closing_ && !writing_)
+		hangup();
+}
+
+/**
+ * Handle a line received from the server.
+ *
+ * @param line Line without the line terminator
+ */
+void UnrealReplayClient::handleLine(const std::string& line)
+{
+	std::string::size_type pos = 0;
+
+	/* skip the prefix */
+	if (!line.empty() && line[0] == ':')
+	{
+		pos = line.find(' ');
+
+		if (pos == std::string::npos)
+			return;
+
+		++pos;
+	}
+
+	std::string::size_type end = line.find(' ', pos);
+	std::string cmd = line.substr(pos, end == std::string::npos
+		? std::string::npos : end - pos);
+
+	if (cmd == "PING" && !closing_)
+	{
+		queue("PONG " + (end == std::string::npos
+			? std::string() : line.substr(end + 1)));
+		startWrite();
+	}
+	else if (cmd == "PONG" && probe_sent_)
+	{
+		if (line.find(" :rp", end) != std::string::npos)
+		{
+			replay_.probed(monotonic() - probe_sent_);
+			probe_sent_ = 0;
+		}
+	}
+	else if (cmd == "001" && !registered_)
+	{
+		registered_ = true;
+		replay_.registered(monotonic() - started_at_);
+
+		if (draining_)
+			drain();
+	}
+	else if (cmd == "ERROR")
+	{
+		replay_.counters().closed_by_server++;
+		finish();
+	}
+}
+
+/**
+ * Read callback.
+ *
+ * @param ec Error code
+ * @param bytes Number of bytes up to and including the line terminator
+ */
+void UnrealReplayClient::handleRead(const ErrorCode& ec, size_t bytes)
+{
+	if (closed_)
+		return;
+
+	if (ec)
+	{
+		/* the server may close the connection after a captured QUIT */
+		if (closing_)
+			finish();
+		else
+			fail();
+
+		return;
+	}
+
+	std::istream is(&inbuf_);
+	std::string line;
+
+	std::getline(is, line);
+
+	if (!line.empty() && line[line.length() - 1] == '\r')
+		line.erase(line.length() - 1);
+
+	replay_.counters().lines_in++;
+	replay_.counters().bytes_in += bytes;
+
+	handleLine(line);
+
+	if (!closed_)
+		startRead();
+}
+
+/**
+ * Write callback.
+ *
+ * @param ec Error code
+ * @param bytes Number of bytes written
+ */
+void UnrealReplayClient::handleWrite(const ErrorCode& ec, size_t bytes)
+{
+	writing_ = false;
+	write_buffer_.clear();
+
+	if (closed_)
+		return;
+
+	if (ec)
+	{
+		fail();
+		return;
+	}
+
+	replay_.counters().bytes_out += bytes;
+	startWrite();
+
+	if (closing_ && !writing_)
+		hangup();
+}
+
+/**
+ * Shut down the sending side of the connection.
+ */
+void UnrealReplayClient::hangup()
+{
+	ErrorCode ignored;
+	socket_.shutdown(tcp::socket::shutdown_send, ignored);
+}
+
+/**
+ * Returns whether the connection has nothing left to write and no latency
+ * probe pending. Connections which are still registering or closing
+ * aren't idle.
+ *
+ * @return True if idle
+ */
+bool UnrealReplayClient::isIdle() const
+{
+	return closed_ || (connected_ && !writing_ && sendq_.empty()
+		&& !probe_sent_ && registered_ && !closing_);
+}
+
+/**
+ * Queue a latency probe, if registered and no probe is pending.
+ *
+ * @param now Current time
+ */
+void UnrealReplayClient::probe(uint64_t now)
+{
+	if (!registered_ || probe_sent_ || closing_ || closed_)
+		return;
+
+	std::ostringstream ping;
+
+	ping << "PING :rp" << now;
+	queue(ping.str());
+
+	probe_sent_ = last_probe_ = now;
+	startWrite();
+}
+
+/**
+ * Queue a line without starting to write.
+ *
+ * @param line Line without the line terminator
+ */
+void UnrealReplayClient::queue(const std::string& line)
+{
+	sendq_.append(line);
+	sendq_.append("\r\n");
+}
+
+/**
+ * Close the connection at the end of the run.
+ */
+void UnrealReplayClient::quit()
+{
+	if (!closed_)
+		finish();
+}
+
+/**
+ * Send a captured line, followed by a latency probe if one is due.
+ *
+ * @param line Line without the line terminator
+ */
+void UnrealReplayClient::send(const std::string& line)
+{
+	if (closed_ || closing_)
+		return;
+
+	queue(line);
+	replay_.counters().lines_out++;
+
+	uint64_t interval = replay_.settings().probe_interval * 1000ULL;
+	uint64_t now = monotonic();
+
+	if (interval > 0 && now - last_probe_ >= interval)
+		probe(now);
+
+	startWrite();
+}
+
+/**
+ * Wait for the next line.
+ */
+void UnrealReplayClient::startRead()
+{
+	boost::asio::async_read_until(socket_, inbuf_, '\n',
+		boost::bind(&UnrealReplayClient::handleRead,
+			this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+}
+
+/**
+ * Write the queued lines, unless a write is in progress.
+ */
+void UnrealReplayClient::startWrite()
+{
+	if (writing_ || sendq_.empty() || closed_ || !connected_)
+		return;
+
+	write_buffer_.swap(sendq_);
+	writing_ = true;
+
+	boost::asio::async_write(socket_,
+		boost::asio::buffer(write_buffer_.c_str(), write_buffer_.length()),
+		boost::bind(&UnrealReplayClient::handleWrite,
+			this,
+			boost::asio::placeholders::error,
+			boost::asio::placeholders::bytes_transferred));
+}
+
+/**
+ * UnrealReplay constructor.
+ *
+ * @param settings Settings
+ */
+UnrealReplay::UnrealReplay(const UnrealReplaySettings& settings)
+	: settings_(settings), timer_(io_), next_(0), connections_(0),
+	  phase_(Replaying), started_(0), drain_started_(0), finished_(0),
+	  last_progress_(0)
+{ }
+
+/**
+ * UnrealReplay destructor.
+ */
+UnrealReplay::~UnrealReplay()
+{
+	for (std::map<uint32_t, UnrealReplayClient*>::iterator ci =
+			clients_.begin(); ci != clients_.end(); ++ci)
+		delete ci->second;
+}
+
+/**
+ * Returns the counters of the run.
+ *
+ * @return Counters
+ */
+UnrealReplay::Counters& UnrealReplay::counters()
+{
+	return counters_;
+}
+
+/**
+ * Send a record.
+ *
+ * @param rec Record
+ */
+void UnrealReplay::dispatch(const UnrealReplayRecord& rec)
+{
+	std::map<uint32_t, UnrealReplayClient*>::iterator ci =
+		clients_.find(rec.connection);
+
+	if (rec.type == UnrealTrafficCapture::Open)
+	{
+		if (ci != clients_.end())
+			return;
+
+		UnrealReplayClient* client = new UnrealReplayClient(*this);
+
+		clients_[rec.connection] = client;
+		client->connect(endpoint_);
+		counters_.opened++;
+	}
+	else if (ci == clients_.end())
+		return;
+	else if (rec.type == UnrealTrafficCapture::Line)
+		ci->second->send(rec.text);
+	else if (rec.type == UnrealTrafficCapture::Close)
+		ci->second->close();
+}
+
+/**
+ * Called when a connection has failed or been closed unexpectedly.
+ */
+void UnrealReplay::failed()
+{
+	counters_.failures++;
+}
+
+/**
+ * Returns whether all connections are idle.
+ *
+ * @return True if idle
+ */
+bool UnrealReplay::idle() const
+{
+	for (std::map<uint32_t, UnrealReplayClient*>::const_iterator ci =
+			clients_.begin(); ci != clients_.end(); ++ci)
+		if (!ci->second->isIdle())
+			return false;
+
+	return true;
+}
+
+/**
+ * Returns the I/O service.
+ *
+ * @return I/O service
+ */
+boost::asio::io_service& UnrealReplay::io()
+{
+	return io_;
+}
+
+/**
+ * Read the capture file.
+ *
+ * @return False if the file can't be read or is not a capture
+ */
+bool UnrealReplay::load()
+{
+	std::FILE* file = std::fopen(settings_.file.c_str(), "rb");
+
+	if (!file)
+	{
+		std::cerr << "Can't open " << settings_.file << ": "
+				  << std::strerror(errno) << std::endl;
+		return false;
+	}
+
+	UnrealTrafficCapture::FileHeader hdr;
+
+	if (std::fread(&hdr, sizeof(hdr), 1, file) != 1
+			|| std::memcmp(hdr.magic, "UCAP", 4) != 0
+			|| hdr.version != UnrealTrafficCapture::Version)
+	{
+		std::cerr << settings_.file << " is not a traffic capture of a "
+				  << "supported version." << std::endl;
+		std::fclose(file);
+		return false;
+	}
+
+	UnrealTrafficCapture::Record raw;
+	std::vector<char> text;
+	uint32_t last_connection = 0;
+
+	while (std::fread(&raw, sizeof(raw), 1, file) == 1)
+	{
+		UnrealReplayRecord rec;
+
+		text.resize(raw.length);
+
+		if (raw.length > 0 && std::fread(&text[0], raw.length, 1, file) != 1)
+		{
+			std::cerr << settings_.file << ": truncated record, "
+					  << "ignoring the rest." << std::endl;
+			break;
+		}
+
+		rec.time = raw.time;
+		rec.connection = raw.connection;
+		rec.type = raw.type;
+		rec.text.assign(text.begin(), text.end());
+
+		if (rec.type == UnrealTrafficCapture::Open
+				&& rec.connection > last_connection)
+		{
+			last_connection = rec.connection;
+			connections_++;
+		}
+
+		records_.push_back(rec);
+	}
+
+	std::fclose(file);
+
+	/* captures are written in time order; merged ones may not be */
+	std::stable_sort(records_.begin(), records_.end(), earlier);
+
+	return true;
+}
+
+/**
+ * Print the capture to stdout, one record per line.
+ */
+void UnrealReplay::print()
+{
+	for (size_t i = 0; i < records_.size(); ++i)
+	{
+		const UnrealReplayRecord& rec = records_[i];
+
+		std::printf("%llu.%06llu %u %c %s\n",
+			static_cast<unsigned long long>(rec.time / 1000000),
+			static_cast<unsigned long long>(rec.time % 1000000),
+			rec.connection, rec.type, rec.text.c_str());
+	}
+}
+
+/**
+ * Print a progress line for the last interval to stderr.
+ *
+ * @param now Current time
+ */
+void UnrealReplay::printProgress(uint64_t now)
+{
+	double secs = (now - last_progress_) / 1000000.0;
+
+	std::fprintf(stderr, "[%s] records %d/%d, lines/s %.0f, in %.1f MB/s, "
+		"latency p50 %dus p99 %dus\n",
+		phase_ == Replaying ? "replaying" : "draining",
+		static_cast<int>(next_),
+		static_cast<int>(records_.size()),
+		(counters_.lines_out - last_counters_.lines_out) / secs,
+		(counters_.bytes_in - last_counters_.bytes_in) / secs / 1048576.0,
+		static_cast<int>(latency_.percentile(0.5)),
+		static_cast<int>(latency_.percentile(0.99)));
+
+	last_progress_ = now;
+	last_counters_ = counters_;
+}
+
+/**
+ * Print the results of the run to stdout.
+ *
+ * @param seconds Length of the replay
+ */
+void UnrealReplay::printSummary(double seconds)
+{
+	const UnrealHistogram* hists[] = { &latency_, &registration_,
+		&schedule_ };
+	const char* hist_names[] = { "lines", "registration", "schedule" };
+	double captured = records_.empty()
+		? 0 : records_.back().time / 1000000.0;
+
+	if (settings_.json)
+	{
+		std::printf("{\"connections\":%d,\"opened\":%d,\"registered\":%d,"
+			"\"failures\":%d,\"closed_by_server\":%d,\"speed\":%.1f,"
+			"\"captured_seconds\":%.3f,\"seconds\":%.3f,"
+			"\"lines_out_per_sec\":%.1f,\"bytes_out_per_sec\":%.1f,"
+			"\"lines_in_per_sec\":%.1f,\"bytes_in_per_sec\":%.1f,"
+			"\"latency_us\":{",
+			static_cast<int>(connections_),
+			static_cast<int>(counters_.opened),
+			static_cast<int>(counters_.registered),
+			static_cast<int>(counters_.failures),
+			static_cast<int>(counters_.closed_by_server),
+			settings_.speed, captured, seconds,
+			counters_.lines_out / seconds, counters_.bytes_out / seconds,
+			counters_.lines_in / seconds, counters_.bytes_in / seconds);
+
+		for (int i = 0; i < 3; ++i)
+			std::printf("%s\"%s\":{\"count\":%llu,\"p50\":%llu,"
+				"\"p90\":%llu,\"p99\":%llu,\"max\":%llu}", i ? "," : "",
+				hist_names[i],
+				static_cast<unsigned long long>(hists[i]->count()),
+				static_cast<unsigned long long>(hists[i]->percentile(0.5)),
+				static_cast<unsigned long long>(hists[i]->percentile(0.9)),
+				static_cast<unsigned long long>(hists[i]->percentile(0.99)),
+				static_cast<unsigned long long>(hists[i]->max()));
+
+		std::printf("}}\n");
+		return;
+	}
+
+	std::printf("Connections:  %d opened, %d registered, %d failed, "
+		"%d closed by the server\n",
+		static_cast<int>(counters_.opened),
+		static_cast<int>(counters_.registered),
+		static_cast<int>(counters_.failures),
+		static_cast<int>(counters_.closed_by_server));
+
+	if (settings_.speed > 0)
+		std::printf("Duration:     %.1fs for %.1fs captured at %.1fx\n",
+			seconds, captured, settings_.speed);
+	else
+		std::printf("Duration:     %.1fs for %.1fs captured at max speed\n",
+			seconds, captured);
+
+	std::printf("Sent:         %.0f lines/s, %.2f MB/s\n",
+		counters_.lines_out / seconds,
+		counters_.bytes_out / seconds / 1048576.0);
+	std::printf("Received:     %.0f lines/s, %.2f MB/s\n",
+		counters_.lines_in / seconds,
+		counters_.bytes_in / seconds / 1048576.0);
+
+	for (int i = 0; i < 3; ++i)
+		std::printf("Latency %-13s p50 %lluus, p90 %lluus, p99 %lluus, "
+			"max %lluus (%llu samples)\n",
+			(std::string(hist_names[i]) + ":").c_str(),
+			static_cast<unsigned long long>(hists[i]->percentile(0.5)),
+			static_cast<unsigned long long>(hists[i]->percentile(0.9)),
+			static_cast<unsigned long long>(hists[i]->percentile(0.99)),
+			static_cast<unsigned long long>(hists[i]->max()),
+			static_cast<unsigned long long>(hists[i]->count()));
+}
+
+/**
+ * Record the answer to a latency probe.
+ *
+ * @param latency Time from sending the probe until the PONG, in
+ * microseconds
+ */
+void UnrealReplay::probed(uint64_t latency)
+{
+	latency_.add(latency);
+}
+
+/**
+ * Called when a connection has registered.
+ *
+ * @param latency Time from connecting until 001, in microseconds
+ */
+void UnrealReplay::registered(uint64_t latency)
+{
+	registration_.add(latency);
+	counters_.registered++;
+}
+
+/**
+ * Run the replay.
+ *
+ * @return Exit code
+ */
+int UnrealReplay::run()
+{
+	ErrorCode ec;
+	tcp::resolver resolver(io_);
+	std::ostringstream port;
+
+	port << settings_.port;
+
+	tcp::resolver::iterator it = resolver.resolve(
+		tcp::resolver::query(settings_.host, port.str()), ec);
+
+	if (ec)
+	{
+		std::cerr << "Can't resolve " << settings_.host << ": "
+				  << ec.message() << std::endl;
+		return 1;
+	}
+
+	endpoint_ = *it;
+	started_ = last_progress_ = monotonic();
+
+	std::fprintf(stderr, "Replaying %d records of %d connections\n",
+		static_cast<int>(records_.size()), static_cast<int>(connections_));
+
+	tick(ErrorCode());
+
+	io_.run();
+
+	if (phase_ != Done)
+		return 1;
+
+	printSummary((finished_ - started_) / 1000000.0);
+
+	return 0;
+}
+
+/**
+ * Returns the settings.
+ *
+ * @return Settings
+ */
+const UnrealReplaySettings& UnrealReplay::settings() const
+{
+	return settings_;
+}
+
+/**
+ * Replay tick: sends the records which are due, waits for the connections
+ * to become idle at the end and closes them.
+ *
+ * @param ec Error code
+ */
+void UnrealReplay::tick(const ErrorCode& ec)
+{
+	if (ec)
+		return;
+
+	uint64_t now = monotonic();
+
+	if (phase_ == Replaying)
+	{
+		size_t sent = 0;
+
+		while (next_ < records_.size())
+		{
+			const UnrealReplayRecord& rec = records_[next_];
+
+			if (settings_.speed > 0)
+			{
+				uint64_t due = started_
+					+ static_cast<uint64_t>(rec.time / settings_.speed);
+
+				if (due > now)
+					break;
+
+				schedule_.add(now - due);
+			}
+			else if (sent == max_batch)
+				break;
+
+			dispatch(rec);
+			++next_;
+			++sent;
+		}
+
+		if (next_ == records_.size())
+		{
+			phase_ = Draining;
+			drain_started_ = now;
+
+			for (std::map<uint32_t, UnrealReplayClient*>::iterator ci =
+					clients_.begin(); ci != clients_.end(); ++ci)
+				ci->second->drain();
+		}
+	}
+
+	if (phase_ == Draining && (idle() || now - drain_started_
+			>= drain_timeout))
+	{
+		phase_ = Done;
+		finished_ = now;
+
+		for (std::map<uint32_t, UnrealReplayClient*>::iterator ci =
+				clients_.begin(); ci != clients_.end(); ++ci)
+			ci->second->quit();
+
+		return;
+	}
+
+	if (now - last_progress_ >= 1000000)
+		printProgress(now);
+
+	timer_.expires_from_now(boost::posix_time::milliseconds(tick_interval));
+	timer_.async_wait(boost::bind(&UnrealReplay::tick, this,
+		boost::asio::placeholders::error));
+}
+
+/**
+ * Raise the limit of open file descriptors as far as permitted.
+ */
+static void raiseFileLimit()
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+/**
+ * Print the command line help.
+ *
+ * @param name Program name
+ */
+static void usage(const char* name)
+{
+	std::cerr
+		<< "Usage: " << name << " [options] <capture file>\n"
+		<< "  --host=ADDR          server address (127.0.0.1)\n"
+		<< "  --port=PORT          server port (6667)\n"
+		<< "  --speed=N|max        time scale of the replay (1)\n"
+		<< "  --probe-interval=MS  time between latency probes of a "
+			"connection; 0 probes at the end only (1000)\n"
+		<< "  --json               print the summary as JSON\n"
+		<< "  --print              print the capture instead of replaying "
+			"it\n";
+}
+
+int main(int argc, char** argv)
+{
+	UnrealReplaySettings settings;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		std::string::size_type eq = arg.find('=');
+		std::string key = arg.substr(0, eq);
+		std::string value = (eq == std::string::npos
+			? std::string() : arg.substr(eq + 1));
+
+		if (key.compare(0, 2, "--") != 0 && settings.file.empty())
+			settings.file = arg;
+		else if (key == "--host")
+			settings.host = value;
+		else if (key == "--port")
+			settings.port = static_cast<uint16_t>(std::atoi(value.c_str()));
+		else if (key == "--speed")
+			settings.speed = (value == "max" ? 0 : std::atof(value.c_str()));
+		else if (key == "--probe-interval")
+			settings.probe_interval = std::strtoul(value.c_str(), 0, 10);
+		else if (key == "--json")
+			settings.json = true;
+		else if (key == "--print")
+			settings.print = true;
+		else
+		{
+			usage(argv[0]);
+			return (key == "--help" ? 0 : 1);
+		}
+	}
+
+	if (settings.file.empty() || settings.speed < 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	UnrealReplay replay(settings);
+
+	if (!replay.load())
+		return 1;
+
+	if (settings.print)
+	{
+		replay.print();
+		return 0;
+	}
+
+	raiseFileLimit();
+
+	return replay.run();
+}